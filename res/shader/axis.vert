@@ -1,6 +1,10 @@
 #version 330 core
+layout(std140) uniform;
 
-uniform mat4 mvp;
+uniform uni_axis_data {
+// rows are stored contiguously, like nm::mat4
+    layout(row_major) mat4 mvp;
+};
 
 layout (location = 0) in vec3 in_pos;
 layout (location = 1) in vec3 in_col;
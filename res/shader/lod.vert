@@ -8,6 +8,8 @@ uniform vec3 uni_camera_pos;
 // GL doesnt allow unsized array when accessed from non-constant
 uniform float uni_inv_lvl_size[10];
 uniform ivec2 uni_lvl_off[10];
+// finest level whose texels are complete, finer levels fall back to it
+uniform uint uni_first_lvl;
 
 // defines
 uniform uint DEF_CLIPMAP_SIZE;
@@ -31,8 +33,29 @@ uniform uni_instance_data {
     per_instance_data instance[256];
 };
 
+// bilinear interpolation of the texels of a level at a grid position
+vec3 sample_level(in ivec2 grid_pos, in uint level)
+{
+    vec2 tex_pos = vec2(grid_pos) / float(1 << level);
+    vec2 i = floor(tex_pos);
+    vec2 f = tex_pos - i;
+
+    // .5f offset to sample mid-texel, take fract to increase precision
+    vec2 texcoord = fract(i * DEF_TEXTURE_SCALE) + .5f * DEF_TEXTURE_SCALE;
+    float flevel = float(level);
+    vec3 a = texture(uni_heightmap, vec3(texcoord, flevel)).rgb;
+    vec3 b = texture(uni_heightmap, vec3(texcoord + vec2(DEF_TEXTURE_SCALE, 0.f), flevel)).rgb;
+    vec3 c = texture(uni_heightmap, vec3(texcoord + vec2(0.f, DEF_TEXTURE_SCALE), flevel)).rgb;
+    vec3 d = texture(uni_heightmap, vec3(texcoord + vec2(DEF_TEXTURE_SCALE), flevel)).rgb;
+
+    return mix(mix(a, b, f.x), mix(c, d, f.x), f.y);
+}
+
 #define LOCATION_VERTEX 0
+#define LOCATION_INSTANCE 1
 layout(location = LOCATION_VERTEX) in uvec2 in_vertex;
+// index of the instance, including the first instance of the draw
+layout(location = LOCATION_INSTANCE) in uint in_instance;
 
 out float val_height;
 out vec2 val_lod;
@@ -43,7 +66,7 @@ out uint val_level;
 
 void main()
 {
-    val_level = instance[gl_InstanceID].level;
+    val_level = instance[in_instance].level;
     float flevel = float(val_level);
 
     // coverts a 'local' grid coordinate to a world coordinate
@@ -53,14 +76,14 @@ void main()
 
     // position of this mesh in world coordinates
     vec2 mesh_pos2 =
-    (instance[gl_InstanceID].offset + uni_lvl_off[val_level]) * DEF_CLIPMAP_SCALE;
+    (instance[in_instance].offset + uni_lvl_off[val_level]) * DEF_CLIPMAP_SCALE;
 
     // position of this vertex in world coordinates
     vec2 pos2 = mesh_pos2 + local_offset;
 
     // position in grid
     ivec2 grid_pos =
-    uni_lvl_off[val_level] + instance[gl_InstanceID].offset;
+    uni_lvl_off[val_level] + instance[in_instance].offset;
     // scale down to 2^level, take fract to increase precision
     // which is valid since we use GL_REPEAT
     vec2 off = fract((grid_pos / float(1 << val_level)) * DEF_TEXTURE_SCALE);
@@ -72,7 +95,7 @@ void main()
     // note: this is always positive
     uvec2 modif =
     uvec2(uni_lvl_off[val_level] - uni_lvl_off[val_level + 1u] +
-    instance[gl_InstanceID].offset);
+    instance[in_instance].offset);
 
     // the four sample points, aligned with the grid of the next level
     // w.r.t. the current level's mesh
@@ -106,6 +129,14 @@ void main()
     // high-resolution: x is height, yz is gradient
     vec3 tex_data_high = texture(uni_heightmap, vec3(texcoord, flevel)).rgb;
 
+    // the texels of this level are not generated yet, use the first level
+    // that is complete for both
+    if (val_level < uni_first_lvl) {
+        ivec2 vertex_pos = grid_pos + ivec2(in_vertex << val_level);
+        tex_data_high = sample_level(vertex_pos, uni_first_lvl);
+        tex_data_low = tex_data_high;
+    }
+
     // find blending factors for heightmap. the detail level must not have
     // any discontinuities or it shows as 'artifacts'.
     vec2 dist = abs(pos2 - uni_camera_pos.xz) * uni_inv_lvl_size[val_level];
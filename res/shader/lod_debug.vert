@@ -31,8 +31,11 @@ uniform uni_instance_data {
 };
 
 #define LOCATION_VERTEX 0
+#define LOCATION_INSTANCE 1
 
 layout(location = LOCATION_VERTEX) in uvec2 in_vertex;
+// index of the instance, including the first instance of the draw
+layout(location = LOCATION_INSTANCE) in uint in_instance;
 
 flat out uint val_level;
 flat out uint val_id;
@@ -40,11 +43,11 @@ flat out uint val_id;
 void main()
 {
     // get world coordinate position of this vertex, see lod.vert for details
-    uint level = instance[gl_InstanceID].level;
+    uint level = instance[in_instance].level;
     float scale = DEF_CLIPMAP_SCALE * float(1 << level);
     vec2 local_offset = in_vertex * scale;
     vec2 mesh_pos2 =
-    (instance[gl_InstanceID].offset + uni_lvl_off[level]) * DEF_CLIPMAP_SCALE;
+    (instance[in_instance].offset + uni_lvl_off[level]) * DEF_CLIPMAP_SCALE;
     vec2 pos2 = mesh_pos2 + local_offset;
 
     // simple pattern
@@ -64,5 +67,5 @@ void main()
     gl_Position = uni_view_proj * vert;
 
     val_level = level;
-    val_id = instance[gl_InstanceID].id;
+    val_id = instance[in_instance].id;
 }
\ No newline at end of file
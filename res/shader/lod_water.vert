@@ -8,6 +8,8 @@ uniform vec3 uni_camera_pos;
 // GL doesn't allow unsized array when accessed from non-constant.
 uniform float uni_inv_lvl_size[10];
 uniform ivec2 uni_lvl_off[10];
+// finest level whose texels are complete, finer levels fall back to it
+uniform uint uni_first_lvl;
 
 // defines
 uniform uint DEF_CLIPMAP_SIZE;
@@ -30,9 +32,30 @@ uniform uni_instance_data {
     per_instance_data instance[256];
 };
 
+// bilinear interpolation of the texels of a level at a grid position
+vec3 sample_level(in ivec2 grid_pos, in uint level)
+{
+    vec2 tex_pos = vec2(grid_pos) / float(1 << level);
+    vec2 i = floor(tex_pos);
+    vec2 f = tex_pos - i;
+
+    // .5f offset to sample mid-texel, take fract to increase precision
+    vec2 texcoord = fract(i * DEF_TEXTURE_SCALE) + .5f * DEF_TEXTURE_SCALE;
+    float flevel = float(level);
+    vec3 a = texture(uni_heightmap, vec3(texcoord, flevel)).rgb;
+    vec3 b = texture(uni_heightmap, vec3(texcoord + vec2(DEF_TEXTURE_SCALE, 0.f), flevel)).rgb;
+    vec3 c = texture(uni_heightmap, vec3(texcoord + vec2(0.f, DEF_TEXTURE_SCALE), flevel)).rgb;
+    vec3 d = texture(uni_heightmap, vec3(texcoord + vec2(DEF_TEXTURE_SCALE), flevel)).rgb;
+
+    return mix(mix(a, b, f.x), mix(c, d, f.x), f.y);
+}
+
 #define LOCATION_VERTEX 0
+#define LOCATION_INSTANCE 1
 
 layout(location = LOCATION_VERTEX) in uvec2 in_vertex;
+// index of the instance, including the first instance of the draw
+layout(location = LOCATION_INSTANCE) in uint in_instance;
 
 out float val_height;
 out float val_fog;
@@ -41,20 +64,20 @@ void main()
 {
     // obtain the terrain height to determine the water color. see lod.vert
     // for details
-    uint level = instance[gl_InstanceID].level;
+    uint level = instance[in_instance].level;
     float flevel = float(level);
     float scale = DEF_CLIPMAP_SCALE * float(1 << level);
     vec2 local_offset = in_vertex * scale;
     vec2 mesh_pos2 =
-    (instance[gl_InstanceID].offset + uni_lvl_off[level]) * DEF_CLIPMAP_SCALE;
+    (instance[in_instance].offset + uni_lvl_off[level]) * DEF_CLIPMAP_SCALE;
     vec2 pos2 = mesh_pos2 + local_offset;
     ivec2 grid_pos =
-    uni_lvl_off[level] + instance[gl_InstanceID].offset;
+    uni_lvl_off[level] + instance[in_instance].offset;
     vec2 off = fract((grid_pos / float(1 << level)) * DEF_TEXTURE_SCALE);
     vec2 texcoord = off + (in_vertex + .5f) * DEF_TEXTURE_SCALE;
     uvec2 modif =
     uvec2(uni_lvl_off[level] - uni_lvl_off[level + 1u] +
-    instance[gl_InstanceID].offset);
+    instance[in_instance].offset);
     uvec2 v0 = (modif + ((in_vertex + uvec2(0, 0)) << level)) >> (level + 1u);
     uvec2 v1 = (modif + ((in_vertex + uvec2(0, 1)) << level)) >> (level + 1u);
     uvec2 v2 = (modif + ((in_vertex + uvec2(1, 0)) << level)) >> (level + 1u);
@@ -72,6 +95,11 @@ void main()
     tex_data_low += texture(uni_heightmap, vec3(texcoord_v3, flevel + 1.f)).rgb;
     tex_data_low *= .25f;
     vec3 tex_data_high = texture(uni_heightmap, vec3(texcoord, flevel)).rgb;
+    if (level < uni_first_lvl) {
+        ivec2 vertex_pos = grid_pos + ivec2(in_vertex << level);
+        tex_data_high = sample_level(vertex_pos, uni_first_lvl);
+        tex_data_low = tex_data_high;
+    }
     vec2 dist = abs(pos2 - uni_camera_pos.xz) * uni_inv_lvl_size[level];
     vec2 a = clamp((dist - .325f) * 8.f, 0.f, 1.f);
     float lod_factor = max(a.x, a.y);
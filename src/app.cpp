@@ -4,6 +4,7 @@
 #include "gui.h"
 #include "imgui.h"
 #include "imgui_internal.h"
+#include "raycast.h"
 #include "stb_wrapper.h"
 #include "terrain.h"
 #include "timer.h"
@@ -17,6 +18,8 @@
 
 #include <chrono>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
 
 const int SCREEN_WIDTH  = 800;
@@ -29,6 +32,8 @@ camera camera{};
 static bool is_demo;
 static bool is_debug;
 static bool is_wireframe;
+static bool is_truncating_octaves;
+static bool is_regenerate_requested;
 static operation_draw curr_draw_op = DEFAULT;
 static operation_edit curr_edit_op = NONE;
 
@@ -39,16 +44,120 @@ int32_t last_mouse_y;
 
 const std::filesystem::path TERRAIN3_RESOURCE_DIR = RESOURCE_DIR;
 
+nm_ret load_compute_program(nm::shader_program* program, const char* name)
+{
+    nm::res_t comp_src;
+    const std::filesystem::path comp_path = TERRAIN3_RESOURCE_DIR / std::filesystem::path(name);
+    nm_ret ret = nm::read_file(&comp_src.text, &comp_src.len, comp_path.u8string().c_str());
+    if (ret != NM_SUCCESS) return NM_FAIL;
+
+    nm::shader comp_shader;
+    ret = comp_shader.init(comp_src.text, comp_src.len, GL_COMPUTE_SHADER);
+    if (ret != NM_SUCCESS) {
+        nm::log(nm::LOG_ERROR, "compute shader %s failed\n", name);
+        return NM_FAIL;
+    }
+
+    free(comp_src.text);
+    ret = program->init(nullptr, nullptr, nullptr, &comp_shader);
+    if (ret != NM_SUCCESS) return NM_FAIL;
+
+    comp_shader.cleanup();
+
+    return NM_SUCCESS;
+}
+
 void update_state(window*);
 
 /// Time delta in seconds.
 void update_camera_pos(float dt, terrain* terrain);
 
+/// Returns the ray from the camera through the mouse cursor.
+raycast_ray get_mouse_ray(window* w, const nm::mat4& vp);
+
 /// Application entry point.
-nm_ret run()
+nm_ret run(int argc, char* argv[])
 {
     nm::set_log_level(nm::LOG_TRACE);
 
+    heightmap_config config;
+    config.backend              = HEIGHTMAP_BACKEND_GPU;
+    config.source               = HEIGHTMAP_SOURCE_NOISE;
+    config.dem.path             = nullptr;
+    config.dem.format           = DEM_FORMAT_U16;
+    config.dem.width            = 0;
+    config.dem.height           = 0;
+    config.dem.spacing          = DEM_DEFAULT_SPACING;
+    config.dem.height_scale     = DEM_DEFAULT_HEIGHT_SCALE;
+    config.dem.height_offset    = 0.f;
+    config.lattice              = NOISE_LATTICE_PACKED;
+    config.is_gathering_noise   = true;
+    config.texel_budget         = HEIGHTMAP_TEXEL_BUDGET;
+    config.is_pipelined         = false;
+    config.is_reusing_levels    = true;
+    config.cache_path           = nullptr;
+    config.cache_size           = TILE_CACHE_DEFAULT_SIZE;
+    config.pack_path            = nullptr;
+    config.prefetch_frame_count = HEIGHTMAP_PREFETCH_FRAME_COUNT;
+    config.guard_band           = HEIGHTMAP_GUARD_BAND;
+    bool is_gpu_culling         = false;
+    bool is_coherent            = false;
+    bool is_checking_backends   = false;
+    bool is_dem_scale_set       = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--cpu") == 0) {
+            config.backend = HEIGHTMAP_BACKEND_CPU;
+        } else if (strcmp(argv[i], "--hash") == 0) {
+            config.lattice = NOISE_LATTICE_HASH;
+        } else if (strcmp(argv[i], "--table") == 0) {
+            config.lattice = NOISE_LATTICE_TABLE;
+        } else if (strcmp(argv[i], "--no-gather") == 0) {
+            config.is_gathering_noise = false;
+        } else if (strcmp(argv[i], "--no-budget") == 0) {
+            config.texel_budget = 0;
+        } else if (strcmp(argv[i], "--pipelined") == 0) {
+            config.is_pipelined = true;
+        } else if (strcmp(argv[i], "--no-reuse") == 0) {
+            config.is_reusing_levels = false;
+        } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+            // the cache stores texels that are generated on the cpu
+            config.cache_path = argv[++i];
+            config.backend    = HEIGHTMAP_BACKEND_CPU;
+        } else if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc) {
+            config.cache_size = size_t(strtoull(argv[++i], nullptr, 10)) << 20;
+        } else if (strcmp(argv[i], "--pack") == 0 && i + 1 < argc) {
+            config.pack_path = argv[++i];
+        } else if (strcmp(argv[i], "--no-prefetch") == 0) {
+            config.prefetch_frame_count = 0;
+        } else if (strcmp(argv[i], "--guard-band") == 0 && i + 1 < argc) {
+            config.guard_band = uint32_t(strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--dem") == 0 && i + 3 < argc) {
+            // the elevation model is resampled on the cpu
+            config.source     = HEIGHTMAP_SOURCE_DEM;
+            config.backend    = HEIGHTMAP_BACKEND_CPU;
+            config.dem.path   = argv[++i];
+            config.dem.width  = uint32_t(strtoul(argv[++i], nullptr, 10));
+            config.dem.height = uint32_t(strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--dem-float") == 0) {
+            config.dem.format = DEM_FORMAT_F32;
+        } else if (strcmp(argv[i], "--dem-spacing") == 0 && i + 1 < argc) {
+            config.dem.spacing = strtof(argv[++i], nullptr);
+        } else if (strcmp(argv[i], "--dem-scale") == 0 && i + 1 < argc) {
+            config.dem.height_scale = strtof(argv[++i], nullptr);
+            is_dem_scale_set        = true;
+        } else if (strcmp(argv[i], "--gpu-cull") == 0) {
+            is_gpu_culling = true;
+        } else if (strcmp(argv[i], "--coherent") == 0) {
+            is_coherent = true;
+        } else if (strcmp(argv[i], "--check-backends") == 0) {
+            is_checking_backends = true;
+        } else {
+            nm::log(nm::LOG_WARN, "unknown argument \"%s\"\n", argv[i]);
+        }
+    }
+    // float samples are in meters unless scaled explicitly, in any order
+    if (config.dem.format == DEM_FORMAT_F32 && !is_dem_scale_set) config.dem.height_scale = 1.f;
+
     nm_ret ret;
     window* window;
     ret = init(&window, SCREEN_WIDTH, SCREEN_HEIGHT, APP_TITLE);
@@ -68,12 +177,30 @@ nm_ret run()
     float aspect         = float(frame_size.x) / float(frame_size.y);
     camera.init(aspect, nm::to_rad(70.f), 1.f, 1e5f);
 
+    // per-frame uniform data of the axes and the terrain
+    ubo_ring ring;
+    if (init(&ring) != NM_SUCCESS) return -1;
+
     // initialize axes to draw them later
     if (init_axis() != NM_SUCCESS) return -1;
 
     // create terrain
     terrain terrain;
-    if (init(&terrain) == NM_FAIL) return -1;
+    if (init(&terrain, &config, &ring) == NM_FAIL) return -1;
+    terrain.geometry.is_gpu_culling = is_gpu_culling;
+    terrain.geometry.is_coherent    = is_coherent;
+
+    // the elevation model is not generated by both backends
+    if (is_checking_backends && config.source != HEIGHTMAP_SOURCE_NOISE) {
+        nm::log(nm::LOG_WARN, "only the noise can be checked\n");
+        is_checking_backends = false;
+    }
+    // the tiles of a pack are quantized coarser than the tolerance
+    if (is_checking_backends && config.pack_path) {
+        nm::log(nm::LOG_WARN, "the backends cannot be checked with a tile pack\n");
+        is_checking_backends = false;
+    }
+    nm_ret exit_code = NM_SUCCESS;
 
     std::chrono::duration<double> update_time(0.0);
     std::chrono::duration<double> render_time(0.0);
@@ -98,6 +225,10 @@ nm_ret run()
         if (!is_active(window)) continue;
 
         t0 = std::chrono::steady_clock::now();
+        begin_frame(&ring);
+
+        // both the interactive and the demo camera move the target
+        nm::fvec3 old_target = camera.target;
         update_state(window);
 
         // update time with actual time
@@ -110,8 +241,33 @@ nm_ret run()
             if (is_demo) update_camera_pos(dt, &terrain);
         }
 
+        if (is_truncating_octaves != terrain.heightmap.is_truncating_octaves) {
+            set_octave_truncation(&terrain.heightmap, is_truncating_octaves);
+        }
+        if (is_regenerate_requested) {
+            regenerate(&terrain.heightmap);
+            is_regenerate_requested = false;
+        }
+
         // update terrain with (potentionally) new camera pos
-        update(&terrain, camera.target);
+        update(&terrain, camera.target, camera.target - old_target);
+
+        // once all levels are complete, compare them with the cpu and quit
+        if (is_checking_backends &&
+            get_render_slot(&terrain.heightmap)->first_complete_level == 0) {
+            float height_error, slope_error;
+            uint32_t failure_count = check_texels(&terrain.heightmap, &height_error, &slope_error);
+            nm::log(
+                failure_count == 0 ? nm::LOG_INFO : nm::LOG_ERROR,
+                "texels that differ from the cpu: %u, largest difference: height %.2e m, "
+                "slope %.2e\n",
+                failure_count,
+                height_error,
+                slope_error);
+            exit_code = failure_count == 0 ? NM_SUCCESS : NM_FAIL;
+            end_frame(&ring);
+            break;
+        }
         t1 = std::chrono::steady_clock::now();
         update_time += t1 - t0;
 
@@ -125,12 +281,10 @@ nm_ret run()
         nm::mat4 vp = p * v;
 
         if (is_debug) {
-            // origin
-            nm::mat4 m = nm::mat4::scaling(10.f);
-            render_axis(vp * m);
-            // camera target
-            m = nm::mat4::translation(camera.target);
-            render_axis(vp * m);
+            // origin and camera target
+            nm::mat4 mvps[2] = {
+                vp * nm::mat4::scaling(10.f), vp * nm::mat4::translation(camera.target)};
+            render_axes(&ring, mvps, 2);
         }
 
         render(&terrain, vp, camera.target, curr_draw_op, is_wireframe);
@@ -138,11 +292,31 @@ nm_ret run()
         if (is_debug) {
             display_stats(update_time, render_time);
             display_pos(camera.target);
+            display_heightmap_stats(&terrain.heightmap.stats);
+            display_geometry_stats(&terrain.geometry.stats);
+            display_ring_stats(&ring.stats);
+
+            // terrain under the mouse cursor, rays are traced against the noise
+            raycast_terrain pick_terrain;
+            pick_terrain.noise   = terrain.heightmap.noise;
+            pick_terrain.lattice = terrain.heightmap.lattice;
+            pick_terrain.bounds  = &terrain.heightmap.bounds;
+            raycast_ray ray      = get_mouse_ray(window, vp);
+            raycast_hit hit;
+            hit.is_hit     = false;
+            hit.step_count = 0;
+            if (terrain.heightmap.source == HEIGHTMAP_SOURCE_NOISE) {
+                raycast(&pick_terrain, &ray, &hit);
+            }
+            display_pick(&hit);
         }
 
         t1 = std::chrono::steady_clock::now();
         render_time += t1 - t0;
 
+        // all commands that read the uniform data of the frame are issued
+        end_frame(&ring);
+
         // switch the front and back buffers to display the updated scene
         swap_buffers(window);
         reset_events(window);
@@ -150,10 +324,11 @@ nm_ret run()
 
     cleanup(&terrain);
     cleanup_axis();
+    cleanup(&ring);
     gui_cleanup();
     cleanup(window);
 
-    return 0;
+    return exit_code;
 }
 
 void update_state(window* w)
@@ -187,6 +362,14 @@ void update_state(window* w)
         is_debug = !is_debug;
     }
 
+    if (was_f5_pressed(w)) {
+        is_truncating_octaves = !is_truncating_octaves;
+    }
+
+    if (was_f6_pressed(w)) {
+        is_regenerate_requested = true;
+    }
+
     if (was_enter_pressed(w)) {
         if (!is_demo) {
             // enter demo mode, reset camera
@@ -248,6 +431,26 @@ void update_state(window* w)
     camera.add_zoom(float(scroll_delta.y));
 }
 
+raycast_ray get_mouse_ray(window* w, const nm::mat4& vp)
+{
+    // mouse position in normalized device coordinates, y points up
+    nm::uvec2 size  = framebuffer_size(w);
+    nm::dvec2 mouse = mouse_pos(w);
+    float x         = 2.f * float(mouse.x) / float(size.x) - 1.f;
+    float y         = 1.f - 2.f * float(mouse.y) / float(size.y);
+
+    // unproject the point on the far plane
+    nm::fvec4 clip = nm::invert(vp) * nm::fvec4(x, y, 1.f, 1.f);
+    nm::fvec3 end  = nm::fvec3(clip.x, clip.y, clip.z) / clip.w;
+
+    raycast_ray ray;
+    ray.origin = camera.get_camera_position();
+    ray.dir    = nm::normalize(end - ray.origin);
+    ray.max_t  = nm::length(end - ray.origin);
+
+    return ray;
+}
+
 void update_camera_pos(float dt, terrain* terrain)
 {
     // required to ensure only updating with a fixed timestep
@@ -1,10 +1,37 @@
 #ifndef TERRAIN3_APP_H
 #define TERRAIN3_APP_H
 
+#include "nmutil/gl.h"
+
 #include <filesystem>
 
 extern const std::filesystem::path TERRAIN3_RESOURCE_DIR;
 
-int run();
+/// Reads and compiles a compute shader from the resource directory.
+nm_ret load_compute_program(nm::shader_program* program, const char* name);
+
+/// Pass "--cpu" to generate the heightmap on the CPU. The packed noise lattice
+/// is used by default, pass "--hash" or "--table" to use the hash or the
+/// unpacked table lattice instead. Pass "--no-gather" to read the unpacked
+/// table with four texel fetches instead of a single gather. Pass "--no-budget"
+/// to generate all levels that moved in a single frame. Pass "--pipelined" to
+/// render from the texels of the previous generation while generating. Pass
+/// "--no-reuse" to generate the texels that coarser levels already have. Pass
+/// "--cache <file>" to keep the generated texels in a tile cache on disk, which
+/// implies "--cpu", and "--cache-size <MiB>" to change its size cap, and
+/// "--pack <file>" to fill it from the tiles that terrain3_bake baked. Pass
+/// "--no-prefetch" to only generate texels once the levels need them. Pass
+/// "--guard-band <texels>" to change the number of texels kept around each
+/// rendered level. Pass "--dem <file> <width> <height>" to render the raw
+/// 16-bit samples of a digital elevation model instead of the noise, which
+/// implies "--cpu", with "--dem-float" for 32-bit float samples in meters,
+/// "--dem-spacing <m>" for the distance between the samples and
+/// "--dem-scale <m>" for the height of a single step of a sample. Pass
+/// "--gpu-cull" to cull the blocks on the GPU and draw them indirectly. Pass
+/// "--coherent" to reuse the draw list of the blocks while the view and the
+/// levels do not move. Pass "--check-backends" to compare the texels of all
+/// levels with the CPU once they are generated, and quit with a failure if
+/// they differ by more than the tolerance.
+int run(int argc, char* argv[]);
 
 #endif //TERRAIN3_APP_H
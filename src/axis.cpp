@@ -1,6 +1,8 @@
 #include "axis.h"
 #include "nmutil/gl.h"
 #include "nmutil/io.h"
+#include <cassert>
+#include <cstring>
 #include <filesystem>
 #include "app.h"
 
@@ -75,12 +77,31 @@ nm_ret init_axis()
     return NM_SUCCESS;
 }
 
-void render_axis(nm::mat4 mvp)
+void render_axes(ubo_ring* ring, const nm::mat4* mvps, uint32_t count)
 {
+    assert(count <= AXIS_MAX_COUNT);
+
+    // every draw has its own matrix in the uniform data of the frame, the
+    // ring is unmapped once all are written
+    size_t offsets[AXIS_MAX_COUNT];
+    uint32_t allocated_count = 0;
+    for (; allocated_count < count; allocated_count++) {
+        const nm::mat4& mvp = mvps[allocated_count];
+        void* data          = map_range(ring, sizeof(mvp.data), &offsets[allocated_count]);
+        if (!data) break;
+        memcpy(data, mvp.data, sizeof(mvp.data));
+    }
+    if (allocated_count == 0) return;
+    unmap_ranges(ring);
+
     program.use();
     glBindVertexArray(lines_vao);
-    program.set_mat4("mvp", mvp);
-    GL_CHECK(glDrawArrays(GL_LINES, 0, 12));
+    for (uint32_t i = 0; i < allocated_count; i++) {
+        GL_CHECK(glBindBufferRange(
+            GL_UNIFORM_BUFFER, 0, ring->buffer, offsets[i], sizeof(mvps[i].data)));
+        GL_CHECK(glDrawArrays(GL_LINES, 0, 12));
+    }
+    GL_CHECK(glBindBufferBase(GL_UNIFORM_BUFFER, 0, 0));
     glBindVertexArray(0);
     program.unuse();
 }
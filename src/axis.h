@@ -3,12 +3,17 @@
 
 #include "nmutil/defs.h"
 #include "nmutil/matrix.h"
+#include "ubo_ring.h"
 
 /// Only call this once.
 nm_ret init_axis();
 
-/// Only call this after init_axis().
-void render_axis(nm::mat4 mvp);
+/// Maximum number of axes drawn by a single render_axes call.
+#define AXIS_MAX_COUNT 4u
+
+/// Only call this after init_axis(). Draws an axis for each of the count
+/// matrices, which are allocated from ring before any of them is drawn.
+void render_axes(ubo_ring* ring, const nm::mat4* mvps, uint32_t count);
 
 /// Only call this once, after init_axis().
 void cleanup_axis();
@@ -0,0 +1,561 @@
+/// Headless bake of the heightmap tiles of a world rectangle into a tile pack,
+/// which the runtime reads instead of evaluating the noise (see "--pack"). Does
+/// not need a window or an OpenGL context.
+///
+/// Usage: terrain3_bake <file> [options]
+///
+/// Pass "--rect <x0> <y0> <x1> <y1>" to bake the rectangle between these world
+/// coordinates in meters, and "--levels <count>" to bake the finest count
+/// levels. Pass "--hash" or "--table" for the lattices of the same name. Pass
+/// "--threads <count>" to limit the number of threads. Pass "--shard <i> <n>" to
+/// only bake the i-th of n equal ranges of the tiles, and "--merge <n>" to
+/// combine the files <file>.0 to <file>.<n-1> of such shards into the file.
+/// Pass "--processes <n>" to do both, with n processes of the bake on this
+/// machine. Pass "--scaling" to measure the throughput from one thread to all
+/// hardware threads first.
+
+#include "noise_batch.h"
+#include "terrain_defs.h"
+#include "tile_pack.h"
+#include "worker_pool.h"
+
+#include "nmutil/log.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Default distance in meters from the origin to the edges of the rectangle.
+#define BAKE_DEFAULT_EXTENT 256.f
+
+/// Number of tiles that are generated and encoded before they are written.
+#define BAKE_BATCH_TILE_COUNT 4096u
+
+/// Number of tiles of each measurement of the scaling.
+#define BAKE_SCALING_TILE_COUNT 16384u
+
+struct bake_config {
+    const char* path;
+    /// World-space rectangle in meters.
+    nm::fvec2 min;
+    nm::fvec2 max;
+    uint32_t level_count;
+    noise_lattice lattice;
+    /// Zero for all hardware threads.
+    uint32_t thread_count;
+    uint32_t shard_index;
+    uint32_t shard_count;
+    /// If not zero, the number of shards to merge.
+    uint32_t merge_count;
+    /// If not zero, the number of processes to bake the shards with.
+    uint32_t process_count;
+    bool is_measuring_scaling;
+};
+
+/// A tile of the pack, in tile coordinates of its level.
+struct bake_tile {
+    uint32_t level_index;
+    int32_t x;
+    int32_t y;
+};
+
+struct bake_work {
+    noise_isa isa;
+    noise_lattice lattice;
+    const uint8_t* noise;
+    const tile_pack_level* levels;
+    const bake_tile* tiles;
+    /// TILE_PACK_MAX_TILE_BYTES for each tile, and the number of bytes the
+    /// tile was encoded into.
+    uint8_t* data;
+    uint32_t* sizes;
+};
+
+/// Returns the level table of the tiles that overlap the rectangle. The tiles
+/// start at world texel coordinates that are a multiple of the tile size, like
+/// the tiles of the tile cache.
+static std::vector<tile_pack_level> get_levels(const bake_config* config)
+{
+    std::vector<tile_pack_level> levels(config->level_count);
+    for (uint32_t i = 0; i < config->level_count; i++) {
+        float extent = CLIPMAP_SCALE * float((1u << i) * TILE_PACK_TILE_SIZE);
+        int32_t x0   = int32_t(floorf(config->min.x / extent));
+        int32_t y0   = int32_t(floorf(config->min.y / extent));
+        int32_t x1   = int32_t(ceilf(config->max.x / extent));
+        int32_t y1   = int32_t(ceilf(config->max.y / extent));
+
+        tile_pack_level* level = &levels[i];
+        memset(level, 0, sizeof(*level));
+        level->level         = i;
+        level->octaves       = NOISE_OCTAVES;
+        level->x             = x0;
+        level->y             = y0;
+        level->width         = uint32_t(x1 > x0 ? x1 - x0 : 1);
+        level->height        = uint32_t(y1 > y0 ? y1 - y0 : 1);
+        level->height_step   = TILE_PACK_HEIGHT_STEP;
+        level->gradient_step = TILE_PACK_GRADIENT_STEP;
+    }
+
+    return levels;
+}
+
+/// Returns the tiles of all levels, from the finest to the coarsest level and
+/// row-major within a level, such that a range of tiles is a shard.
+static std::vector<bake_tile> get_tiles(const std::vector<tile_pack_level>& levels)
+{
+    std::vector<bake_tile> tiles;
+    for (uint32_t i = 0; i < uint32_t(levels.size()); i++) {
+        for (uint32_t y = 0; y < levels[i].height; y++) {
+            for (uint32_t x = 0; x < levels[i].width; x++) {
+                tiles.push_back({i, levels[i].x + int32_t(x), levels[i].y + int32_t(y)});
+            }
+        }
+    }
+
+    return tiles;
+}
+
+/// Generates and encodes the texels of a tile, mirroring generate_tile in
+/// heightmap.cpp.
+static void bake_tile_fn(void* user, uint32_t index)
+{
+    bake_work* work              = (bake_work*)user;
+    const bake_tile* tile        = &work->tiles[index];
+    const tile_pack_level* level = &work->levels[tile->level_index];
+
+    const int32_t t = int32_t(TILE_PACK_TILE_SIZE);
+    float xs[TILE_PACK_TILE_TEXEL_COUNT];
+    float ys[TILE_PACK_TILE_TEXEL_COUNT];
+    float h[TILE_PACK_TILE_TEXEL_COUNT];
+    float dx[TILE_PACK_TILE_TEXEL_COUNT];
+    float dz[TILE_PACK_TILE_TEXEL_COUNT];
+
+    for (int32_t y = 0; y < t; y++) {
+        for (int32_t x = 0; x < t; x++) {
+            // get world-space position
+            int32_t grid_x = (tile->x * t + x) << level->level;
+            int32_t grid_y = (tile->y * t + y) << level->level;
+            nm::fvec2 pos  = CLIPMAP_SCALE * nm::fvec2(float(grid_x), float(grid_y));
+
+            // same scaling as get_height
+            nm::fvec2 p   = TERRAIN_SCA * pos;
+            xs[y * t + x] = p.x;
+            ys[y * t + x] = p.y;
+        }
+    }
+
+    terrain_noise_batch(
+        work->isa,
+        work->lattice,
+        level->octaves,
+        xs,
+        ys,
+        TILE_PACK_TILE_TEXEL_COUNT,
+        work->noise,
+        NOISE_SIZE,
+        h,
+        dx,
+        dz);
+
+    nm::fvec4 texels[TILE_PACK_TILE_TEXEL_COUNT];
+    for (uint32_t i = 0; i < TILE_PACK_TILE_TEXEL_COUNT; i++) {
+        float height   = TERRAIN_AMP * h[i];
+        nm::fvec2 grad = TERRAIN_AMP * TERRAIN_SCA * nm::fvec2(dx[i], dz[i]);
+        texels[i]      = nm::fvec4(height, grad.x, grad.y, 0.f);
+    }
+
+    work->sizes[index] = encode_tile(
+        texels,
+        level->height_step,
+        level->gradient_step,
+        work->data + size_t(index) * TILE_PACK_MAX_TILE_BYTES);
+}
+
+/// Bakes the tiles with the calling thread and the workers of the pool, or
+/// only with the calling thread if pool is null.
+static void bake_tiles(worker_pool* pool, bake_work* work, uint32_t tile_count)
+{
+    if (pool) {
+        parallel_for(pool, tile_count, bake_tile_fn, work);
+        return;
+    }
+
+    for (uint32_t i = 0; i < tile_count; i++) {
+        bake_tile_fn(work, i);
+    }
+}
+
+/// Measures the throughput of baking the first tiles with one thread up to all
+/// hardware threads, and the efficiency of each thread count relative to
+/// perfect scaling of the single thread.
+static void measure_scaling(
+    const std::vector<tile_pack_level>& levels,
+    const std::vector<bake_tile>& tiles,
+    const uint8_t* noise,
+    noise_lattice lattice)
+{
+    uint32_t tile_count = uint32_t(tiles.size());
+    if (tile_count > BAKE_SCALING_TILE_COUNT) tile_count = BAKE_SCALING_TILE_COUNT;
+
+    std::vector<uint8_t> data(size_t(tile_count) * TILE_PACK_MAX_TILE_BYTES);
+    std::vector<uint32_t> sizes(tile_count);
+    bake_work work;
+    work.isa     = detect_noise_isa();
+    work.lattice = lattice;
+    work.noise   = noise;
+    work.levels  = levels.data();
+    work.tiles   = tiles.data();
+    work.data    = data.data();
+    work.sizes   = sizes.data();
+
+    uint32_t max_thread_count = std::thread::hardware_concurrency();
+    if (max_thread_count == 0) max_thread_count = 1;
+
+    std::vector<uint32_t> thread_counts;
+    for (uint32_t n = 1; n < max_thread_count; n *= 2) {
+        thread_counts.push_back(n);
+    }
+    thread_counts.push_back(max_thread_count);
+
+    printf("scaling over %u tiles, %s\n", tile_count, get_noise_isa_name(work.isa));
+    printf("%-10s %14s %12s\n", "threads", "tiles/s", "efficiency");
+    double single_rate = 0.;
+    for (uint32_t thread_count : thread_counts) {
+        // the calling thread is one of the threads
+        worker_pool pool;
+        bool is_pooled = thread_count > 1;
+        if (is_pooled && init(&pool, thread_count - 1) != NM_SUCCESS) return;
+
+        auto start = std::chrono::steady_clock::now();
+        bake_tiles(is_pooled ? &pool : nullptr, &work, tile_count);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        if (is_pooled) cleanup(&pool);
+
+        double rate = double(tile_count) / elapsed.count();
+        if (thread_count == 1) single_rate = rate;
+        printf(
+            "%-10u %14.0f %11.1f%%\n",
+            thread_count,
+            rate,
+            100. * rate / (single_rate * double(thread_count)));
+    }
+}
+
+/// Bakes the tiles of the shard into the file.
+static nm_ret bake(const bake_config* config, const uint8_t* noise)
+{
+    std::vector<tile_pack_level> levels = get_levels(config);
+    std::vector<bake_tile> tiles        = get_tiles(levels);
+
+    if (config->is_measuring_scaling) measure_scaling(levels, tiles, noise, config->lattice);
+
+    // the shard is an equal share of the tiles
+    uint64_t count = tiles.size();
+    uint32_t first = uint32_t(count * config->shard_index / config->shard_count);
+    uint32_t last  = uint32_t(count * (config->shard_index + 1u) / config->shard_count);
+
+    tile_pack_writer writer;
+    uint64_t seed = get_noise_seed(noise, NOISE_SIZE, config->lattice);
+    if (init(&writer, config->path, levels.data(), config->level_count, seed) != NM_SUCCESS) {
+        nm::log(nm::LOG_ERROR, "failed to create tile pack %s\n", config->path);
+        return NM_FAIL;
+    }
+
+    worker_pool pool;
+    if (init(&pool, config->thread_count > 0 ? config->thread_count - 1u : 0u) != NM_SUCCESS) {
+        return NM_FAIL;
+    }
+
+    std::vector<uint8_t> data(size_t(BAKE_BATCH_TILE_COUNT) * TILE_PACK_MAX_TILE_BYTES);
+    std::vector<uint32_t> sizes(BAKE_BATCH_TILE_COUNT);
+    bake_work work;
+    work.isa     = detect_noise_isa();
+    work.lattice = config->lattice;
+    work.noise   = noise;
+    work.levels  = levels.data();
+    work.data    = data.data();
+    work.sizes   = sizes.data();
+
+    nm_ret ret           = NM_SUCCESS;
+    uint64_t byte_count  = 0;
+    double bake_seconds  = 0.;
+    double write_seconds = 0.;
+    for (uint32_t batch = first; batch < last && ret == NM_SUCCESS;) {
+        uint32_t batch_count = last - batch;
+        if (batch_count > BAKE_BATCH_TILE_COUNT) batch_count = BAKE_BATCH_TILE_COUNT;
+        work.tiles = tiles.data() + batch;
+
+        auto start = std::chrono::steady_clock::now();
+        bake_tiles(&pool, &work, batch_count);
+        auto baked = std::chrono::steady_clock::now();
+
+        for (uint32_t i = 0; i < batch_count && ret == NM_SUCCESS; i++) {
+            const bake_tile* tile = &work.tiles[i];
+            ret                   = write_tile(
+                &writer,
+                tile->level_index,
+                tile->x,
+                tile->y,
+                data.data() + size_t(i) * TILE_PACK_MAX_TILE_BYTES,
+                sizes[i]);
+            byte_count += sizes[i];
+        }
+        auto written = std::chrono::steady_clock::now();
+
+        bake_seconds += std::chrono::duration<double>(baked - start).count();
+        write_seconds += std::chrono::duration<double>(written - baked).count();
+        batch += batch_count;
+    }
+
+    cleanup(&pool);
+    if (finish(&writer) != NM_SUCCESS) ret = NM_FAIL;
+    if (ret != NM_SUCCESS) {
+        nm::log(nm::LOG_ERROR, "failed to write tile pack %s\n", config->path);
+        return NM_FAIL;
+    }
+
+    uint32_t tile_count = last - first;
+    double seconds      = bake_seconds + write_seconds;
+    printf(
+        "baked %u of %llu tiles of %u levels into %s, %.1f MiB, %.0f bytes per tile\n",
+        tile_count,
+        (unsigned long long)count,
+        config->level_count,
+        config->path,
+        double(byte_count) / double(1u << 20),
+        tile_count > 0 ? double(byte_count) / double(tile_count) : 0.);
+    printf(
+        "%.2f s, %.0f tiles/s, %.1f Mtexels/s, %.1f%% of the time writing\n",
+        seconds,
+        seconds > 0. ? double(tile_count) / seconds : 0.,
+        seconds > 0. ? double(tile_count) * TILE_PACK_TILE_TEXEL_COUNT / seconds * 1e-6 : 0.,
+        seconds > 0. ? 100. * write_seconds / seconds : 0.);
+
+    return NM_SUCCESS;
+}
+
+/// Returns the path of the i-th shard of the file.
+static std::string get_shard_path(const char* path, uint32_t index)
+{
+    return std::string(path) + "." + std::to_string(index);
+}
+
+/// Combines the shard files into the file, without decoding their tiles.
+static nm_ret merge(const char* path, uint32_t shard_count)
+{
+    std::vector<tile_pack> shards(shard_count);
+    uint32_t open_count = 0;
+    nm_ret ret          = NM_SUCCESS;
+    for (; open_count < shard_count && ret == NM_SUCCESS; open_count++) {
+        ret = init(&shards[open_count], get_shard_path(path, open_count).c_str());
+        if (ret != NM_SUCCESS) break;
+
+        // the shards must have been baked with the same arguments
+        const tile_pack* a = &shards[0];
+        const tile_pack* b = &shards[open_count];
+        size_t level_size = a->header->level_count * sizeof(tile_pack_level);
+        if (b->header->level_count != a->header->level_count ||
+            b->header->seed != a->header->seed || memcmp(b->levels, a->levels, level_size) != 0) {
+            nm::log(nm::LOG_ERROR, "shard %u differs from the first shard\n", open_count);
+            ret = NM_FAIL;
+        }
+    }
+
+    tile_pack_writer writer;
+    bool is_writing = false;
+    if (ret == NM_SUCCESS) {
+        const tile_pack_header* header = shards[0].header;
+        ret = init(&writer, path, shards[0].levels, header->level_count, header->seed);
+        is_writing = ret == NM_SUCCESS;
+    }
+
+    uint32_t tile_count = 0;
+    for (uint32_t i = 0; i < open_count && ret == NM_SUCCESS; i++) {
+        const tile_pack* shard = &shards[i];
+        for (uint32_t j = 0; j < shard->header->level_count && ret == NM_SUCCESS; j++) {
+            const tile_pack_level* level = &shard->levels[j];
+            for (uint32_t k = 0; k < level->width * level->height && ret == NM_SUCCESS; k++) {
+                const tile_pack_entry* entry = &shard->entries[level->first_entry + k];
+                if (entry->size == 0) continue;
+
+                const uint8_t* data = shard->file.base + entry->offset;
+                if (get_checksum(data, entry->size, 0) != entry->checksum) {
+                    nm::log(nm::LOG_ERROR, "tile of shard %u is corrupt\n", i);
+                    ret = NM_FAIL;
+                    break;
+                }
+
+                int32_t x = level->x + int32_t(k % level->width);
+                int32_t y = level->y + int32_t(k / level->width);
+                ret       = write_tile(&writer, j, x, y, data, entry->size);
+                tile_count++;
+            }
+        }
+    }
+
+    if (is_writing && finish(&writer) != NM_SUCCESS) ret = NM_FAIL;
+    for (uint32_t i = 0; i < open_count; i++) {
+        cleanup(&shards[i]);
+    }
+    if (ret != NM_SUCCESS) {
+        nm::log(nm::LOG_ERROR, "failed to merge the shards of %s\n", path);
+        return NM_FAIL;
+    }
+
+    printf("merged %u tiles of %u shards into %s\n", tile_count, shard_count, path);
+
+    return NM_SUCCESS;
+}
+
+/// Bakes the shards with a process each, with an equal share of the hardware
+/// threads, and merges them.
+static nm_ret bake_processes(const bake_config* config, const char* program)
+{
+    uint32_t thread_count = config->thread_count > 0 ? config->thread_count
+                                                     : std::thread::hardware_concurrency();
+    uint32_t process_thread_count = thread_count / config->process_count;
+    if (process_thread_count == 0) process_thread_count = 1;
+
+    const char* lattice = config->lattice == NOISE_LATTICE_HASH    ? " --hash"
+                          : config->lattice == NOISE_LATTICE_TABLE ? " --table"
+                                                                   : "";
+
+    std::vector<std::string> commands(config->process_count);
+    for (uint32_t i = 0; i < config->process_count; i++) {
+        char args[256];
+        snprintf(
+            args,
+            sizeof(args),
+            "\" --rect %.9g %.9g %.9g %.9g --levels %u --threads %u --shard %u %u%s",
+            config->min.x,
+            config->min.y,
+            config->max.x,
+            config->max.y,
+            config->level_count,
+            process_thread_count,
+            i,
+            config->process_count,
+            lattice);
+        std::string shard_path = get_shard_path(config->path, i);
+        commands[i]            = "\"" + std::string(program) + "\" \"" + shard_path + args;
+#ifdef _WIN32
+        // cmd removes the outer quotes of the command
+        commands[i] = "\"" + commands[i] + "\"";
+#endif
+    }
+
+    std::vector<int> results(config->process_count);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < config->process_count; i++) {
+        threads.emplace_back([&, i]() { results[i] = system(commands[i].c_str()); });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    for (uint32_t i = 0; i < config->process_count; i++) {
+        if (results[i] == 0) continue;
+        nm::log(nm::LOG_ERROR, "process of shard %u failed\n", i);
+        return NM_FAIL;
+    }
+
+    if (merge(config->path, config->process_count) != NM_SUCCESS) return NM_FAIL;
+    for (uint32_t i = 0; i < config->process_count; i++) {
+        remove(get_shard_path(config->path, i).c_str());
+    }
+
+    uint64_t tile_count = get_tiles(get_levels(config)).size();
+    printf(
+        "%u processes with %u threads each: %.2f s, %.0f tiles/s\n",
+        config->process_count,
+        process_thread_count,
+        elapsed.count(),
+        double(tile_count) / elapsed.count());
+
+    return NM_SUCCESS;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2 || argv[1][0] == '-') {
+        nm::log(nm::LOG_ERROR, "usage: %s <file> [options]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    bake_config config;
+    config.path                 = argv[1];
+    config.min                  = nm::fvec2(-BAKE_DEFAULT_EXTENT, -BAKE_DEFAULT_EXTENT);
+    config.max                  = nm::fvec2(BAKE_DEFAULT_EXTENT, BAKE_DEFAULT_EXTENT);
+    config.level_count          = CLIPMAP_LEVEL_COUNT;
+    config.lattice              = NOISE_LATTICE_PACKED;
+    config.thread_count         = 0;
+    config.shard_index          = 0;
+    config.shard_count          = 1;
+    config.merge_count          = 0;
+    config.process_count        = 0;
+    config.is_measuring_scaling = false;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--rect") == 0 && i + 4 < argc) {
+            config.min.x = strtof(argv[++i], nullptr);
+            config.min.y = strtof(argv[++i], nullptr);
+            config.max.x = strtof(argv[++i], nullptr);
+            config.max.y = strtof(argv[++i], nullptr);
+        } else if (strcmp(argv[i], "--levels") == 0 && i + 1 < argc) {
+            config.level_count = uint32_t(strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--hash") == 0) {
+            config.lattice = NOISE_LATTICE_HASH;
+        } else if (strcmp(argv[i], "--table") == 0) {
+            config.lattice = NOISE_LATTICE_TABLE;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            config.thread_count = uint32_t(strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--shard") == 0 && i + 2 < argc) {
+            config.shard_index = uint32_t(strtoul(argv[++i], nullptr, 10));
+            config.shard_count = uint32_t(strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--merge") == 0 && i + 1 < argc) {
+            config.merge_count = uint32_t(strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--processes") == 0 && i + 1 < argc) {
+            config.process_count = uint32_t(strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--scaling") == 0) {
+            config.is_measuring_scaling = true;
+        } else {
+            nm::log(nm::LOG_WARN, "unknown argument \"%s\"\n", argv[i]);
+        }
+    }
+
+    if (config.merge_count > 0) {
+        return merge(config.path, config.merge_count) == NM_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (config.level_count == 0 || config.level_count > CLIPMAP_LEVEL_COUNT ||
+        config.shard_count == 0 || config.shard_index >= config.shard_count ||
+        !(config.max.x > config.min.x) || !(config.max.y > config.min.y)) {
+        nm::log(nm::LOG_ERROR, "invalid levels, shard, or rectangle\n");
+        return EXIT_FAILURE;
+    }
+
+    uint8_t* noise = create_noise_table(NOISE_SIZE);
+    if (!noise) return EXIT_FAILURE;
+
+    nm_ret ret;
+    if (config.process_count > 0) {
+        if (config.is_measuring_scaling) {
+            std::vector<tile_pack_level> levels = get_levels(&config);
+            measure_scaling(levels, get_tiles(levels), noise, config.lattice);
+        }
+        ret = bake_processes(&config, argv[0]);
+    } else {
+        ret = bake(&config, noise);
+    }
+
+    destroy_noise_table(noise);
+
+    return ret == NM_SUCCESS ? EXIT_SUCCESS : EXIT_FAILURE;
+}
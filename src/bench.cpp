@@ -0,0 +1,1262 @@
+/// Headless benchmarks of the CPU side of the terrain, does not need a window
+/// or an OpenGL context. Run a release build for meaningful numbers.
+
+#include "cull.h"
+#include "height_bounds.h"
+#include "noise_batch.h"
+#include "raycast.h"
+#include "terrain_defs.h"
+#include "tile_pack.h"
+#include "update_planner.h"
+#include "worker_pool.h"
+
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+/// Number of times each measurement is repeated, the fastest run is reported.
+#define BENCH_REPEAT_COUNT 5
+
+/// Number of points of a single level.
+#define BENCH_LEVEL_POINT_COUNT (CLIPMAP_LEVEL_SIZE * CLIPMAP_LEVEL_SIZE)
+
+/// Points of a complete rewrite of the heightmap, in noise space. Mirrors the
+/// positions generate_band in heightmap.cpp evaluates. Ordered by level.
+struct bench_points {
+    std::vector<float> xs;
+    std::vector<float> ys;
+};
+
+static void init(bench_points* points)
+{
+    for (uint32_t level = 0; level < CLIPMAP_LEVEL_COUNT; level++) {
+        for (int32_t y = 0; y < int32_t(CLIPMAP_LEVEL_SIZE); y++) {
+            for (int32_t x = 0; x < int32_t(CLIPMAP_LEVEL_SIZE); x++) {
+                // center the level around the origin
+                int32_t grid_x = (x - int32_t(CLIPMAP_LEVEL_SIZE / 2u)) << level;
+                int32_t grid_y = (y - int32_t(CLIPMAP_LEVEL_SIZE / 2u)) << level;
+                points->xs.push_back(TERRAIN_SCA * CLIPMAP_SCALE * float(grid_x));
+                points->ys.push_back(TERRAIN_SCA * CLIPMAP_SCALE * float(grid_y));
+            }
+        }
+    }
+}
+
+/// Returns the throughput in million points per second. If is_truncating,
+/// each level uses the octave count at the Nyquist limit of its spacing.
+static double bench_noise(
+    const bench_points* points,
+    noise_isa isa,
+    noise_lattice lattice,
+    bool is_truncating,
+    const uint8_t* noise)
+{
+    size_t n = points->xs.size();
+    std::vector<float> h(n);
+    std::vector<float> dx(n);
+    std::vector<float> dz(n);
+
+    double best = 0.;
+    for (uint32_t i = 0; i < BENCH_REPEAT_COUNT; i++) {
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t level = 0; level < CLIPMAP_LEVEL_COUNT; level++) {
+            uint32_t octaves = NOISE_OCTAVES;
+            if (is_truncating) {
+                octaves = get_nyquist_octaves(TERRAIN_SCA * CLIPMAP_SCALE * float(1u << level));
+            }
+
+            size_t first = size_t(level) * BENCH_LEVEL_POINT_COUNT;
+            terrain_noise_batch(
+                isa,
+                lattice,
+                octaves,
+                points->xs.data() + first,
+                points->ys.data() + first,
+                BENCH_LEVEL_POINT_COUNT,
+                noise,
+                NOISE_SIZE,
+                h.data() + first,
+                dx.data() + first,
+                dz.data() + first);
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        double seconds = std::chrono::duration<double>(end - start).count();
+        double rate    = double(n) / seconds * 1e-6;
+        if (rate > best) best = rate;
+    }
+
+    return best;
+}
+
+/// Compares the lattices for every instruction set the CPU supports, on a
+/// single thread.
+static void bench_lattices(const uint8_t* noise)
+{
+    bench_points points;
+    init(&points);
+
+    printf("terrain_noise, %zu points, single thread [Mpts/s]\n", points.xs.size());
+    printf("%-8s %10s %10s %10s\n", "isa", "table", "packed", "hash");
+
+    noise_isa max_isa = detect_noise_isa();
+    for (int32_t i = NOISE_ISA_SCALAR; i <= int32_t(max_isa); i++) {
+        noise_isa isa = noise_isa(i);
+        double table  = bench_noise(&points, isa, NOISE_LATTICE_TABLE, false, noise);
+        double packed = bench_noise(&points, isa, NOISE_LATTICE_PACKED, false, noise);
+        double hash   = bench_noise(&points, isa, NOISE_LATTICE_HASH, false, noise);
+        printf("%-8s %10.2f %10.2f %10.2f\n", get_noise_isa_name(isa), table, packed, hash);
+    }
+}
+
+/// Returns the time in nanoseconds of reading the four corners of a lattice
+/// cell, at the cells that all octaves of terrain_noise visit for the points.
+static double bench_corner_access(
+    const bench_points* points, noise_lattice lattice, const uint8_t* noise)
+{
+    const uint32_t s        = NOISE_SIZE - 1u;
+    const uint32_t* corners = get_noise_corners(noise, NOISE_SIZE);
+
+    // the cells are computed up front, to only measure the loads
+    std::vector<uint32_t> cells;
+    for (size_t i = 0; i < points->xs.size(); i++) {
+        nm::fvec2 p(points->xs[i], points->ys[i]);
+        for (uint32_t j = 0; j < NOISE_OCTAVES; j++) {
+            uint32_t x = uint32_t(int32_t(floorf(p.x))) & s;
+            uint32_t y = uint32_t(int32_t(floorf(p.y))) & s;
+            cells.push_back(y << 16 | x);
+            p = mul(NOISE_OCTAVE_STEP, p);
+        }
+    }
+
+    double best  = DBL_MAX;
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < BENCH_REPEAT_COUNT; i++) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t j = 0; j < cells.size(); j++) {
+            uint32_t x = cells[j] & 0xffffu;
+            uint32_t y = cells[j] >> 16;
+            if (lattice == NOISE_LATTICE_PACKED) {
+                uint32_t w = corners[noise_corner_index(x, y, NOISE_SIZE)];
+                sum += (w & 0xffu) + ((w >> 8) & 0xffu) + ((w >> 16) & 0xffu) + (w >> 24);
+            } else {
+                uint32_t x1 = (x + 1u) & s;
+                uint32_t y1 = (y + 1u) & s;
+                sum += noise[y * NOISE_SIZE + x] + noise[y * NOISE_SIZE + x1] +
+                       noise[y1 * NOISE_SIZE + x] + noise[y1 * NOISE_SIZE + x1];
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        double seconds = std::chrono::duration<double>(end - start).count();
+        if (seconds < best) best = seconds;
+    }
+
+    // keep the loads from being optimized out
+    if (sum == 0) printf(" ");
+
+    return best * 1e9 / double(cells.size());
+}
+
+/// Compares the cost of reading the corners of a lattice cell from the byte
+/// table and from the packed corner table.
+static void bench_corners(const uint8_t* noise)
+{
+    bench_points points;
+    init(&points);
+
+    double table  = bench_corner_access(&points, NOISE_LATTICE_TABLE, noise);
+    double packed = bench_corner_access(&points, NOISE_LATTICE_PACKED, noise);
+    printf(
+        "\ncorner access, single thread: table %.3f ns/cell, packed %.3f ns/cell\n",
+        table,
+        packed);
+}
+
+/// Compares all octaves against per-level truncated octaves, with the widest
+/// instruction set.
+static void bench_truncation(const uint8_t* noise)
+{
+    bench_points points;
+    init(&points);
+
+    printf("\noctaves per level:");
+    for (uint32_t level = 0; level < CLIPMAP_LEVEL_COUNT; level++) {
+        printf(" %u", get_nyquist_octaves(TERRAIN_SCA * CLIPMAP_SCALE * float(1u << level)));
+    }
+    printf("\n");
+
+    noise_isa isa    = detect_noise_isa();
+    double full      = bench_noise(&points, isa, NOISE_LATTICE_TABLE, false, noise);
+    double truncated = bench_noise(&points, isa, NOISE_LATTICE_TABLE, true, noise);
+    printf(
+        "%s, all octaves: %.2f Mpts/s, truncated: %.2f Mpts/s (%.0f%% less time)\n",
+        get_noise_isa_name(isa),
+        full,
+        truncated,
+        100. * (1. - full / truncated));
+}
+
+/// Compares the texels of a complete rewrite that the CPU backend evaluates in
+/// batches, for every lattice and every instruction set the CPU supports, with
+/// the scalar terrain_noise that lod.comp mirrors. Returns false if any texel
+/// differs by more than the tolerance of the backends.
+static bool bench_backends(const uint8_t* noise)
+{
+    bench_points points;
+    init(&points);
+
+    size_t n = points.xs.size();
+    std::vector<float> h(n);
+    std::vector<float> dx(n);
+    std::vector<float> dz(n);
+
+    printf("\nbackend agreement, %zu texels, largest difference\n", n);
+    printf("%-8s %-8s %12s %12s %10s\n", "isa", "lattice", "height [m]", "slope", "failures");
+
+    const noise_lattice lattices[] = {
+        NOISE_LATTICE_TABLE, NOISE_LATTICE_PACKED, NOISE_LATTICE_HASH};
+    const char* const lattice_names[] = {"table", "packed", "hash"};
+
+    uint32_t total_failure_count = 0;
+    noise_isa max_isa            = detect_noise_isa();
+    for (int32_t i = NOISE_ISA_SCALAR; i <= int32_t(max_isa); i++) {
+        for (uint32_t j = 0; j < 3; j++) {
+            // the octaves of the levels without truncation, and with
+            uint32_t failure_count = 0;
+            float height_error     = 0.f;
+            float slope_error      = 0.f;
+            for (uint32_t k = 0; k < 2 * CLIPMAP_LEVEL_COUNT; k++) {
+                uint32_t level   = k % CLIPMAP_LEVEL_COUNT;
+                uint32_t octaves = NOISE_OCTAVES;
+                if (k >= CLIPMAP_LEVEL_COUNT) {
+                    octaves = get_nyquist_octaves(TERRAIN_SCA * CLIPMAP_SCALE * float(1u << level));
+                }
+
+                size_t first = size_t(level) * BENCH_LEVEL_POINT_COUNT;
+                terrain_noise_batch(
+                    noise_isa(i),
+                    lattices[j],
+                    octaves,
+                    points.xs.data() + first,
+                    points.ys.data() + first,
+                    BENCH_LEVEL_POINT_COUNT,
+                    noise,
+                    NOISE_SIZE,
+                    h.data(),
+                    dx.data(),
+                    dz.data());
+
+                terrain_noise_fn fn = get_terrain_noise_fn(octaves, lattices[j]);
+                for (size_t l = 0; l < BENCH_LEVEL_POINT_COUNT; l++) {
+                    nm::fvec2 p(points.xs[first + l], points.ys[first + l]);
+                    nm::fvec3 r = fn(p, noise, NOISE_SIZE);
+
+                    // scaled as the texels in generate_band
+                    float height = TERRAIN_AMP * fabsf(h[l] - r.x);
+                    float slope  = TERRAIN_AMP * TERRAIN_SCA *
+                                  fmaxf(fabsf(dx[l] - r.y), fabsf(dz[l] - r.z));
+                    height_error = fmaxf(height_error, height);
+                    slope_error  = fmaxf(slope_error, slope);
+                    if (!(height <= TERRAIN_HEIGHT_TOLERANCE && slope <= TERRAIN_SLOPE_TOLERANCE)) {
+                        failure_count++;
+                    }
+                }
+            }
+
+            printf(
+                "%-8s %-8s %12.2e %12.2e %10u\n",
+                get_noise_isa_name(noise_isa(i)),
+                lattice_names[j],
+                height_error,
+                slope_error,
+                failure_count);
+            total_failure_count += failure_count;
+        }
+    }
+
+    return total_failure_count == 0;
+}
+
+/// Number of random points the gradient of the terrain is measured at.
+#define BENCH_GRADIENT_POINT_COUNT (1u << 23u)
+
+/// Measures the largest gradient of the terrain with all octaves at random
+/// points, for the table and the hashed lattice. NOISE_GRADIENT_BOUND is only
+/// an estimate, returns false if a point exceeds it.
+static bool bench_gradient(const uint8_t* noise)
+{
+    std::mt19937 rng(2);
+    std::uniform_real_distribution<float> coord(-1000.f, 1000.f);
+
+    size_t n = BENCH_GRADIENT_POINT_COUNT;
+    std::vector<float> xs(n);
+    std::vector<float> ys(n);
+    for (size_t i = 0; i < n; i++) {
+        xs[i] = coord(rng);
+        ys[i] = coord(rng);
+    }
+
+    std::vector<float> h(n);
+    std::vector<float> dx(n);
+    std::vector<float> dz(n);
+
+    printf("\ngradient, %zu random points, bound %.1f\n", n, double(NOISE_GRADIENT_BOUND));
+    printf("%-8s %10s %10s\n", "lattice", "largest", "exceeding");
+
+    const noise_lattice lattices[]    = {NOISE_LATTICE_TABLE, NOISE_LATTICE_HASH};
+    const char* const lattice_names[] = {"table", "hash"};
+
+    uint32_t total_failure_count = 0;
+    for (uint32_t i = 0; i < 2; i++) {
+        terrain_noise_batch(
+            detect_noise_isa(),
+            lattices[i],
+            NOISE_OCTAVES,
+            xs.data(),
+            ys.data(),
+            n,
+            noise,
+            NOISE_SIZE,
+            h.data(),
+            dx.data(),
+            dz.data());
+
+        uint32_t failure_count = 0;
+        float largest          = 0.f;
+        for (size_t j = 0; j < n; j++) {
+            float gradient = sqrtf(dx[j] * dx[j] + dz[j] * dz[j]);
+            largest        = fmaxf(largest, gradient);
+            if (!(gradient <= NOISE_GRADIENT_BOUND)) failure_count++;
+        }
+
+        printf("%-8s %10.2f %10u\n", lattice_names[i], largest, failure_count);
+        total_failure_count += failure_count;
+    }
+
+    return total_failure_count == 0;
+}
+
+/// Encodes the texels of a complete rewrite of the heightmap as tiles of a tile
+/// pack, and compares decoding them with evaluating the noise they replace.
+/// Returns false if a tile fails to decode or a texel is off by more than half
+/// a step.
+static bool bench_tile_pack(const uint8_t* noise)
+{
+    bench_points points;
+    init(&points);
+
+    size_t n = points.xs.size();
+    std::vector<float> h(n);
+    std::vector<float> dx(n);
+    std::vector<float> dz(n);
+    noise_isa isa = detect_noise_isa();
+    terrain_noise_batch(
+        isa,
+        NOISE_LATTICE_PACKED,
+        NOISE_OCTAVES,
+        points.xs.data(),
+        points.ys.data(),
+        n,
+        noise,
+        NOISE_SIZE,
+        h.data(),
+        dx.data(),
+        dz.data());
+
+    // the complete tiles of each level, scaled as in generate_band
+    const uint32_t t          = TILE_PACK_TILE_SIZE;
+    const uint32_t tile_count = CLIPMAP_LEVEL_SIZE / t;
+    std::vector<nm::fvec4> tiles;
+    for (uint32_t level = 0; level < CLIPMAP_LEVEL_COUNT; level++) {
+        for (uint32_t ty = 0; ty < tile_count; ty++) {
+            for (uint32_t tx = 0; tx < tile_count; tx++) {
+                for (uint32_t y = 0; y < t; y++) {
+                    for (uint32_t x = 0; x < t; x++) {
+                        size_t i = level * BENCH_LEVEL_POINT_COUNT +
+                                   (ty * t + y) * CLIPMAP_LEVEL_SIZE + tx * t + x;
+                        nm::fvec2 grad = TERRAIN_AMP * TERRAIN_SCA * nm::fvec2(dx[i], dz[i]);
+                        tiles.push_back(nm::fvec4(TERRAIN_AMP * h[i], grad.x, grad.y, 0.f));
+                    }
+                }
+            }
+        }
+    }
+    size_t total_tile_count = tiles.size() / TILE_PACK_TILE_TEXEL_COUNT;
+
+    std::vector<uint8_t> data(total_tile_count * TILE_PACK_MAX_TILE_BYTES);
+    std::vector<uint32_t> offsets(total_tile_count + 1u, 0);
+    const size_t level_tile_count = size_t(tile_count) * size_t(tile_count);
+    for (size_t i = 0; i < total_tile_count; i++) {
+        offsets[i + 1] = offsets[i] + encode_tile(
+                                          tiles.data() + i * TILE_PACK_TILE_TEXEL_COUNT,
+                                          TILE_PACK_HEIGHT_STEP,
+                                          TILE_PACK_GRADIENT_STEP,
+                                          data.data() + offsets[i]);
+    }
+
+    std::vector<nm::fvec4> decoded(tiles.size());
+    uint32_t failure_count = 0;
+    double best            = 0.;
+    for (uint32_t r = 0; r < BENCH_REPEAT_COUNT; r++) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < total_tile_count; i++) {
+            nm_ret ret = decode_tile(
+                data.data() + offsets[i],
+                offsets[i + 1] - offsets[i],
+                TILE_PACK_HEIGHT_STEP,
+                TILE_PACK_GRADIENT_STEP,
+                decoded.data() + i * TILE_PACK_TILE_TEXEL_COUNT);
+            if (ret != NM_SUCCESS) failure_count++;
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        double seconds = std::chrono::duration<double>(end - start).count();
+        double rate    = double(tiles.size()) / seconds * 1e-6;
+        if (rate > best) best = rate;
+    }
+
+    // absolute errors of each level
+    float height_errors[CLIPMAP_LEVEL_COUNT]   = {};
+    float gradient_errors[CLIPMAP_LEVEL_COUNT] = {};
+    for (size_t i = 0; i < tiles.size(); i++) {
+        uint32_t level = uint32_t(i / (level_tile_count * TILE_PACK_TILE_TEXEL_COUNT));
+        float* height  = &height_errors[level];
+        float* grad    = &gradient_errors[level];
+        *height        = fmaxf(*height, fabsf(decoded[i].x - tiles[i].x));
+        *grad          = fmaxf(*grad, fabsf(decoded[i].y - tiles[i].y));
+        *grad          = fmaxf(*grad, fabsf(decoded[i].z - tiles[i].z));
+    }
+
+    double raw_size   = double(tiles.size() * sizeof(nm::fvec4));
+    double noise_rate = bench_noise(&points, isa, NOISE_LATTICE_PACKED, false, noise);
+    printf(
+        "\ntile pack, %zu tiles: %.2fx smaller than rgba32f, %.2f bits per texel, "
+        "%u failures\n",
+        total_tile_count,
+        raw_size / double(offsets.back()),
+        8. * double(offsets.back()) / double(tiles.size()),
+        failure_count);
+    printf(
+        "decode: %.2f Mtexels/s, %s noise: %.2f Mpts/s, single thread\n",
+        best,
+        get_noise_isa_name(isa),
+        noise_rate);
+
+    // half a step, with some slack for the rounding of the products
+    const float max_height_error   = .505f * TILE_PACK_HEIGHT_STEP;
+    const float max_gradient_error = .505f * TILE_PACK_GRADIENT_STEP;
+    bool is_passing                = failure_count == 0;
+    printf("%-6s %10s %16s %14s\n", "level", "bits/texel", "max height error", "max grad error");
+    for (uint32_t level = 0; level < CLIPMAP_LEVEL_COUNT; level++) {
+        size_t first = level * level_tile_count;
+        size_t size  = offsets[first + level_tile_count] - offsets[first];
+        printf(
+            "%-6u %10.2f %14.5f m %14.6f\n",
+            level,
+            8. * double(size) / double(level_tile_count * TILE_PACK_TILE_TEXEL_COUNT),
+            height_errors[level],
+            gradient_errors[level]);
+        is_passing = is_passing && height_errors[level] <= max_height_error &&
+                     gradient_errors[level] <= max_gradient_error;
+    }
+    if (!is_passing) printf("tile pack exceeds half a quantization step\n");
+
+    return is_passing;
+}
+
+/// Number of rays of the raycast benchmark.
+#define BENCH_RAY_COUNT 20000u
+
+/// Fills the height bounds from a complete rewrite of the heightmap, as the
+/// reduction in lod_bounds.comp would.
+static void init_bounds(height_bounds* bounds, const bench_points* points, const uint8_t* noise)
+{
+    size_t n = points->xs.size();
+    std::vector<float> h(n);
+    std::vector<float> dx(n);
+    std::vector<float> dz(n);
+    terrain_noise_batch(
+        detect_noise_isa(),
+        NOISE_LATTICE_TABLE,
+        NOISE_OCTAVES,
+        points->xs.data(),
+        points->ys.data(),
+        n,
+        noise,
+        NOISE_SIZE,
+        h.data(),
+        dx.data(),
+        dz.data());
+
+    for (uint32_t level = 0; level < CLIPMAP_LEVEL_COUNT; level++) {
+        const int32_t origin    = -int32_t(CLIPMAP_LEVEL_SIZE / 2u);
+        bounds->is_valid[level] = true;
+        bounds->origins[level]  = nm::ivec2(origin, origin);
+        bounds->margins[level]  = get_bounds_margin(level, NOISE_OCTAVES);
+
+        for (uint32_t cy = 0; cy < HEIGHT_BOUNDS_CELL_COUNT; cy++) {
+            for (uint32_t cx = 0; cx < HEIGHT_BOUNDS_CELL_COUNT; cx++) {
+                bounds->cells[level][cy][cx] = nm::fvec2(FLT_MAX, -FLT_MAX);
+            }
+        }
+
+        for (uint32_t y = 0; y < CLIPMAP_LEVEL_SIZE; y++) {
+            for (uint32_t x = 0; x < CLIPMAP_LEVEL_SIZE; x++) {
+                size_t i     = level * BENCH_LEVEL_POINT_COUNT + y * CLIPMAP_LEVEL_SIZE + x;
+                float height = TERRAIN_AMP * h[i];
+
+                // the first texel of a cell is also the last one of the
+                // previous cell
+                uint32_t cx = x / HEIGHT_BOUNDS_CELL_SIZE;
+                uint32_t cy = y / HEIGHT_BOUNDS_CELL_SIZE;
+                bool is_x   = cx > 0 && x % HEIGHT_BOUNDS_CELL_SIZE == 0;
+                bool is_y   = cy > 0 && y % HEIGHT_BOUNDS_CELL_SIZE == 0;
+                for (uint32_t j = 0; j < 4; j++) {
+                    if (((j & 1u) && !is_x) || ((j & 2u) && !is_y)) continue;
+
+                    nm::fvec2* c = &bounds->cells[level][cy - (j >> 1u)][cx - (j & 1u)];
+                    c->x         = nm::min(c->x, height);
+                    c->y         = nm::max(c->y, height);
+                }
+            }
+        }
+    }
+
+    refine_bounds(bounds);
+}
+
+/// Rays that start in [min_height, max_height) meters above the terrain and
+/// look slightly down, as when picking with the camera.
+static void init_rays(
+    std::vector<raycast_ray>* rays, float min_height, float max_height, const uint8_t* noise)
+{
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> pos(-200.f, 200.f);
+    std::uniform_real_distribution<float> height(min_height, max_height);
+    std::uniform_real_distribution<float> yaw(0.f, 6.2831853f);
+    std::uniform_real_distribution<float> pitch(.03f, .5f);
+
+    terrain_noise_fn fn = get_terrain_noise_fn(NOISE_OCTAVES, NOISE_LATTICE_TABLE);
+    for (uint32_t i = 0; i < BENCH_RAY_COUNT; i++) {
+        nm::fvec2 xz = nm::fvec2(pos(rng), pos(rng));
+        float ground = TERRAIN_AMP * fn(TERRAIN_SCA * xz, noise, NOISE_SIZE).x;
+        float a      = yaw(rng);
+        float b      = pitch(rng);
+
+        raycast_ray ray;
+        ray.origin = nm::fvec3(xz.x, ground + height(rng), xz.y);
+        ray.dir    = nm::fvec3(cosf(b) * cosf(a), -sinf(b), cosf(b) * sinf(a));
+        ray.max_t  = 10000.f;
+        rays->push_back(ray);
+    }
+}
+
+/// Returns the throughput in rays per second. If pool is not null, the rays
+/// are traced as a single batch.
+static double bench_rays(
+    const raycast_terrain* terrain,
+    worker_pool* pool,
+    const std::vector<raycast_ray>* rays,
+    std::vector<raycast_hit>* hits)
+{
+    double best = 0.;
+    for (uint32_t i = 0; i < BENCH_REPEAT_COUNT; i++) {
+        auto start = std::chrono::steady_clock::now();
+        if (pool) {
+            raycast_batch(terrain, pool, rays->data(), hits->data(), uint32_t(rays->size()));
+        } else {
+            for (size_t j = 0; j < rays->size(); j++) {
+                raycast(terrain, &(*rays)[j], &(*hits)[j]);
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        double seconds = std::chrono::duration<double>(end - start).count();
+        double rate    = double(rays->size()) / seconds;
+        if (rate > best) best = rate;
+    }
+
+    return best;
+}
+
+/// Compares tracing rays with and without the height bounds, on a single
+/// thread and on the worker pool. Also checks that skipping cells does not
+/// change the hits.
+static void bench_raycast(
+    const char* name,
+    const height_bounds* bounds,
+    worker_pool* pool,
+    float min_height,
+    float max_height,
+    const uint8_t* noise)
+{
+    std::vector<raycast_ray> rays;
+    init_rays(&rays, min_height, max_height, noise);
+
+    raycast_terrain terrain;
+    terrain.noise   = noise;
+    terrain.lattice = NOISE_LATTICE_TABLE;
+
+    printf(
+        "\nraycast, %zu rays from %.0f to %.0f m above the terrain (%s)\n",
+        rays.size(),
+        min_height,
+        max_height,
+        name);
+    printf(
+        "%-15s %14s %10s %8s %8s %13s\n",
+        "",
+        "single [ray/s]",
+        "pool",
+        "steps",
+        "hits",
+        "out of steps");
+
+    std::vector<raycast_hit> reference(rays.size());
+    std::vector<raycast_hit> hits(rays.size());
+    for (uint32_t i = 0; i < 2; i++) {
+        terrain.bounds                = i == 0 ? nullptr : bounds;
+        std::vector<raycast_hit>* out = i == 0 ? &reference : &hits;
+
+        double single = bench_rays(&terrain, nullptr, &rays, out);
+        double batch  = bench_rays(&terrain, pool, &rays, out);
+
+        // rays that run out of steps are reported as misses
+        uint64_t step_count      = 0;
+        uint32_t hit_count       = 0;
+        uint32_t exhausted_count = 0;
+        for (size_t j = 0; j < rays.size(); j++) {
+            step_count += (*out)[j].step_count;
+            if ((*out)[j].is_hit) hit_count++;
+            if ((*out)[j].step_count >= RAYCAST_MAX_STEPS) exhausted_count++;
+        }
+        printf(
+            "%-15s %14.0f %10.0f %8.1f %8u %13u\n",
+            i == 0 ? "sphere tracing" : "height bounds",
+            single,
+            batch,
+            double(step_count) / double(rays.size()),
+            hit_count,
+            exhausted_count);
+    }
+
+    // the hit distance can only differ by the last step before the hit, a
+    // ray that runs out of steps in only one of the modes differs
+    uint32_t mismatch_count  = 0;
+    uint32_t exhausted_count = 0;
+    for (size_t j = 0; j < rays.size(); j++) {
+        bool is_same = reference[j].is_hit == hits[j].is_hit;
+        if (is_same && hits[j].is_hit) {
+            is_same = fabsf(reference[j].t - hits[j].t) < 10.f * RAYCAST_EPSILON;
+        }
+        if (is_same) continue;
+
+        mismatch_count++;
+        if (reference[j].step_count >= RAYCAST_MAX_STEPS ||
+            hits[j].step_count >= RAYCAST_MAX_STEPS) {
+            exhausted_count++;
+        }
+    }
+    printf("hits that differ: %u, of which out of steps: %u\n", mismatch_count, exhausted_count);
+}
+
+/// Traces rays close to the terrain, where most steps are spent grazing it,
+/// and rays from higher up, where complete cells can be skipped.
+static void bench_raycasts(const uint8_t* noise)
+{
+    bench_points points;
+    init(&points);
+
+    height_bounds* bounds = new height_bounds;
+    init_bounds(bounds, &points, noise);
+
+    worker_pool pool;
+    if (init(&pool, 0) == NM_SUCCESS) {
+        bench_raycast("low", bounds, &pool, 2.f, 20.f, noise);
+        bench_raycast("high", bounds, &pool, 50.f, 300.f, noise);
+        cleanup(&pool);
+    }
+
+    delete bounds;
+}
+
+/// Number of times the placements are culled per measurement.
+#define BENCH_CULL_COUNT 2000u
+
+/// Places all blocks of all levels around a camera at the origin, with the
+/// placements of geometry.cpp and the ranges of the blocks of setup_mesh.
+static void init_placements(cull_placements* placements, nm::ivec2* level_offsets)
+{
+    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
+        level_offsets[i] = nm::ivec2(-int32_t((CLIPMAP_SIZE - 1u) << (i + 1u)));
+    }
+
+    const uint32_t m                   = CLIPMAP_SIZE - 1u;
+    const uint32_t l                   = CLIPMAP_LEVEL_SIZE - 1u;
+    nm::uvec2 ranges[CULL_BLOCK_COUNT] = {
+        nm::uvec2(2u, 2u),
+        nm::uvec2(m, m),
+        nm::uvec2(2u, m),
+        nm::uvec2(m, 2u),
+        nm::uvec2(0u, l),
+        nm::uvec2(0u, l),
+        nm::uvec2(l, 0u),
+        nm::uvec2(l, 0u),
+        nm::uvec2(2u * CLIPMAP_SIZE),
+        nm::uvec2(2u * CLIPMAP_SIZE),
+        nm::uvec2(2u * CLIPMAP_SIZE),
+        nm::uvec2(2u * CLIPMAP_SIZE)};
+
+    uint32_t first[CULL_BLOCK_COUNT + 1];
+    uint32_t ids[CULL_MAX_PLACEMENT_COUNT];
+    init(placements);
+    add_clipmap_placements(placements, ranges, first, ids);
+}
+
+/// Frustum of a camera at eye that looks along angle around the y axis. The
+/// camera looks down if slope is negative.
+static void init_frustum(nm::frustum* frustum, nm::fvec3 eye, float angle, float slope)
+{
+    nm::mat4 proj = nm::mat4::perspective(
+        nm::to_rad(70.f), 16.f / 9.f, 1.f, 1e5f, nm::coord::right_handed);
+    nm::fvec3 look = eye + nm::fvec3(cosf(angle), slope, sinf(angle));
+    nm::mat4 view  = nm::mat4::look_at(eye, look, nm::fvec3(0.f, 1.f, 0.f));
+    construct_frustum(frustum, proj * view);
+}
+
+/// Frusta of cameras at the given height above the origin, each turned by a
+/// different angle. The cameras look down if slope is negative.
+static void init_frusta(nm::frustum* frusta, uint32_t count, float height, float slope)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        float angle = nm::to_rad(360.f / float(count) * float(i));
+        init_frustum(&frusta[i], nm::fvec3(0.f, height, 0.f), angle, slope);
+    }
+}
+
+/// Tests the box of every placement with nm::intersect, as geometry.cpp did
+/// before the placements were culled at once. Sets bit f of visible[i] if
+/// placement i intersects frustum f.
+static void cull_scalar(
+    const cull_placements* placements, const cull_input* input, uint8_t* visible)
+{
+    for (uint32_t i = 0; i < placements->count; i++) {
+        nm::ivec2 offset = input->level_offsets[placements->levels[i]];
+        nm::fvec3 pos    = nm::fvec3(
+            float(offset.x + placements->offsets_x[i]) * CLIPMAP_SCALE,
+            0.f,
+            float(offset.y + placements->offsets_z[i]) * CLIPMAP_SCALE);
+        nm::fvec3 extent =
+            nm::fvec3(placements->extents_x[i], TERRAIN_AMP * 2.f, placements->extents_z[i]);
+
+        nm::aabb bb;
+        bb.min = pos - nm::fvec3(.02f);
+        bb.max = pos + extent + nm::fvec3(.02f);
+
+        // fitted as get_block_heights in cull.cpp, with all octaves
+        uint32_t source = placements->levels[i];
+        float padding   = get_texel_spacing(source + 1u);
+        nm::fvec2 rect_min(pos.x - padding, pos.z - padding);
+        nm::fvec2 rect_max(pos.x + extent.x + padding, pos.z + extent.z + padding);
+        nm::fvec2 range;
+        nm::aabb fitted_bb = bb;
+        if (get_rect_bounds(input->bounds, source, rect_min, rect_max, &range)) {
+            float water_height = TERRAIN_WATER_LVL * TERRAIN_AMP;
+            fitted_bb.min.y    = nm::min(range.x, water_height) - .02f;
+            fitted_bb.max.y    = nm::max(range.y, water_height) + .02f;
+        }
+
+        visible[i] = 0u;
+        for (uint32_t f = 0; f < input->frustum_count; f++) {
+            nm::frustum frustum = input->frusta[f];
+            if (intersect(&frustum, &bb) && intersect(&frustum, &fitted_bb)) {
+                visible[i] |= uint8_t(1u << f);
+            }
+        }
+    }
+}
+
+/// Returns the time in nanoseconds of culling the placements, one at a time if
+/// is_single and at once otherwise. The visibility is written to visible.
+static double bench_cull(
+    const cull_placements* placements,
+    const cull_input* input,
+    bool is_single,
+    cull_result* result,
+    uint8_t* visible)
+{
+    double best = DBL_MAX;
+    for (uint32_t i = 0; i < BENCH_REPEAT_COUNT; i++) {
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t j = 0; j < BENCH_CULL_COUNT; j++) {
+            if (is_single) {
+                cull_scalar(placements, input, visible);
+            } else {
+                cull(placements, input, result);
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        double time = std::chrono::duration<double, std::nano>(end - start).count();
+        best        = nm::min(best, time / double(BENCH_CULL_COUNT));
+    }
+
+    if (!is_single) memcpy(visible, result->visible, placements->count);
+    return best;
+}
+
+/// Compares testing the placements one at a time with culling them at once,
+/// for an increasing number of frusta that look down on the terrain, for a
+/// frustum that looks steeply down from above it, and for frusta that look up
+/// from above it, which only see the sky. Also counts the placements that
+/// only one of both finds visible. Culling at once is tighter where a ring
+/// lies outside of a frustum that the box of one of its blocks intersects:
+/// the box of a trim covers the hole of its ring.
+static void bench_culling(const uint8_t* noise)
+{
+    bench_points points;
+    init(&points);
+
+    height_bounds* bounds = new height_bounds;
+    init_bounds(bounds, &points, noise);
+
+    cull_placements* placements = new cull_placements;
+    nm::ivec2 level_offsets[CLIPMAP_LEVEL_COUNT];
+    init_placements(placements, level_offsets);
+
+    uint32_t level_octaves[CLIPMAP_LEVEL_COUNT];
+    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) level_octaves[i] = NOISE_OCTAVES;
+
+    nm::frustum frusta[CULL_MAX_FRUSTUM_COUNT];
+    cull_input input;
+    input.frusta               = frusta;
+    input.level_offsets        = level_offsets;
+    input.bounds               = bounds;
+    input.level_octaves        = level_octaves;
+    input.first_complete_level = 0;
+    input.level_mask           = CULL_ALL_LEVELS;
+    input.is_frustum_changed   = true;
+
+    printf("\nculling %u placements\n", placements->count);
+    printf(
+        "%-16s %12s %12s %9s %8s %8s\n",
+        "",
+        "single [ns]",
+        "batch [ns]",
+        "rejected",
+        "tighter",
+        "looser");
+
+    cull_result* result = new cull_result;
+    uint8_t single_visible[CULL_MAX_PLACEMENT_COUNT];
+    uint8_t batch_visible[CULL_MAX_PLACEMENT_COUNT];
+    for (uint32_t i = 0; i < 6; i++) {
+        // the last rows look steeply down and up
+        bool is_steep       = i == 4;
+        bool is_sky         = i == 5;
+        input.frustum_count = is_steep ? 1u : (is_sky ? CULL_MAX_FRUSTUM_COUNT : 1u << i);
+        if (is_steep) {
+            init_frusta(frusta, input.frustum_count, TERRAIN_AMP * 3.f, -1.f);
+        } else if (is_sky) {
+            init_frusta(frusta, input.frustum_count, TERRAIN_AMP * 3.f, 1.f);
+        } else {
+            init_frusta(frusta, input.frustum_count, TERRAIN_AMP * 1.5f, -.3f);
+        }
+
+        double single = bench_cull(placements, &input, true, result, single_visible);
+        double batch  = bench_cull(placements, &input, false, result, batch_visible);
+
+        uint32_t tighter_count = 0;
+        uint32_t looser_count  = 0;
+        for (uint32_t j = 0; j < placements->count; j++) {
+            if (single_visible[j] & ~batch_visible[j]) tighter_count++;
+            if (batch_visible[j] & ~single_visible[j]) looser_count++;
+        }
+
+        char name[32];
+        const char* suffix = is_steep ? ", steep" : (is_sky ? ", sky" : "");
+        snprintf(name, sizeof(name), "%u frusta%s", input.frustum_count, suffix);
+        printf(
+            "%-16s %12.0f %12.0f %9u %8u %8u\n",
+            name,
+            single,
+            batch,
+            result->rejected_level_count,
+            tighter_count,
+            looser_count);
+    }
+
+    delete result;
+    delete placements;
+    delete bounds;
+}
+
+/// Number of frames of the flight that partial culling is checked with.
+#define BENCH_CULL_FRAME_COUNT 3000u
+
+/// Sets the offsets of the levels around a camera at pos, as get_offset_level
+/// in geometry.cpp.
+static void set_level_offsets(nm::ivec2* level_offsets, nm::fvec2 pos)
+{
+    nm::ivec2 scaled_pos(pos / nm::fvec2(CLIPMAP_SCALE));
+    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
+        int32_t res      = int32_t(1u << (i + 1u));
+        nm::ivec2 offset = nm::ivec2(nm::idiv(scaled_pos.x, res), nm::idiv(scaled_pos.y, res));
+        level_offsets[i] = offset * res - int32_t((CLIPMAP_SIZE - 1u) << (i + 1u));
+    }
+}
+
+/// Flies a camera in a circle around the origin, which turns and looks up and
+/// down, and culls with the result of the previous frame as geometry.cpp does:
+/// only the levels that moved are in level_mask. Each third frame the camera
+/// moves, each third frame it only turns, and each third frame only the
+/// levels catch up with it, as they lag behind the camera when the heightmap
+/// is updated over multiple frames. Checks that the results match culling all
+/// levels from scratch, and reports the levels that were culled again. Returns
+/// false if a placement differs.
+static bool bench_partial_cull(const uint8_t* noise)
+{
+    bench_points points;
+    init(&points);
+
+    height_bounds* bounds = new height_bounds;
+    init_bounds(bounds, &points, noise);
+
+    cull_placements* placements = new cull_placements;
+    nm::ivec2 level_offsets[CLIPMAP_LEVEL_COUNT];
+    init_placements(placements, level_offsets);
+
+    uint32_t level_octaves[CLIPMAP_LEVEL_COUNT];
+    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) level_octaves[i] = NOISE_OCTAVES;
+
+    nm::frustum frustum;
+    cull_input input;
+    input.frusta               = &frustum;
+    input.frustum_count        = 1u;
+    input.level_offsets        = level_offsets;
+    input.bounds               = bounds;
+    input.level_octaves        = level_octaves;
+    input.first_complete_level = 0;
+
+    cull_result* partial = new cull_result;
+    cull_result* full    = new cull_result;
+
+    nm::frustum prev_frustum;
+    nm::ivec2 prev_offsets[CLIPMAP_LEVEL_COUNT];
+    nm::fvec2 camera_pos    = nm::fvec2(150.f, 0.f);
+    float angle             = 0.f;
+    uint32_t culled_count   = 0;
+    uint32_t mismatch_count = 0;
+    for (uint32_t frame = 0; frame < BENCH_CULL_FRAME_COUNT; frame++) {
+        uint32_t phase = frame % 3u;
+        if (phase == 0u) {
+            float t    = float(frame) * .002f;
+            camera_pos = nm::fvec2(150.f * cosf(t), 150.f * sinf(t));
+        }
+        if (phase != 2u) angle += nm::to_rad(1.5f);
+
+        float height = TERRAIN_AMP * (2.f + sinf(angle * .37f));
+        float slope  = -.8f + .7f * sinf(angle * .61f);
+        init_frustum(&frustum, nm::fvec3(camera_pos.x, height, camera_pos.y), angle, slope);
+        if (phase == 2u || frame == 0u) set_level_offsets(level_offsets, camera_pos);
+
+        input.level_mask         = frame == 0u ? CULL_ALL_LEVELS : 0u;
+        input.is_frustum_changed = frame == 0u || memcmp(&frustum, &prev_frustum, sizeof(frustum));
+        for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT && frame > 0u; i++) {
+            if (level_offsets[i] != prev_offsets[i]) input.level_mask |= 1u << i;
+        }
+        prev_frustum = frustum;
+        memcpy(prev_offsets, level_offsets, sizeof(prev_offsets));
+        cull(placements, &input, partial);
+
+        input.level_mask         = CULL_ALL_LEVELS;
+        input.is_frustum_changed = true;
+        cull(placements, &input, full);
+
+        for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
+            if (partial->culled_level_mask & (1u << i)) culled_count++;
+        }
+        for (uint32_t j = 0; j < placements->count; j++) {
+            if (partial->visible[j] != full->visible[j] ||
+                partial->coarse_visible[j] != full->coarse_visible[j]) {
+                mismatch_count++;
+            }
+        }
+    }
+
+    printf(
+        "\npartial culling, %u frames: %.1f of %u levels culled per frame, "
+        "placements that differ: %u\n",
+        BENCH_CULL_FRAME_COUNT,
+        double(culled_count) / double(BENCH_CULL_FRAME_COUNT),
+        CLIPMAP_LEVEL_COUNT,
+        mismatch_count);
+
+    delete full;
+    delete partial;
+    delete placements;
+    delete bounds;
+
+    return mismatch_count == 0;
+}
+
+/// Number of random moves that the update planner is checked with.
+#define BENCH_PLANNER_MOVE_COUNT 2000
+
+/// Number of frames of each simulated flight.
+#define BENCH_PLANNER_FRAME_COUNT 1000
+
+/// Returns the number of texels of the regions.
+static uint64_t get_texel_count(const update_info* infos, uint32_t info_count)
+{
+    uint64_t texel_count = 0;
+    for (uint32_t i = 0; i < info_count; i++) {
+        texel_count += uint64_t(infos[i].size.x) * uint64_t(infos[i].size.y);
+    }
+
+    return texel_count;
+}
+
+/// A move of a window that the update planner is checked with, by delta plus
+/// windows times the size of the window.
+struct bench_planner_case {
+    const char* name;
+    nm::ivec2 old_start;
+    nm::ivec2 delta;
+    nm::ivec2 windows;
+    bool is_old_valid;
+};
+
+/// Checks the update planner against the brute-force texel sets for moves that
+/// hit the edge cases, for a window of a level and a window with a guard band.
+/// Also checks that the regions plan exactly the texels that the new window
+/// lacks. Returns false if any move fails.
+static bool bench_planner_cases()
+{
+    const int32_t size = int32_t(CLIPMAP_LEVEL_SIZE);
+
+    const bench_planner_case cases[] = {
+        {"zero move", nm::ivec2(0, 0), nm::ivec2(0, 0), nm::ivec2(0, 0), true},
+        {"zero move, wrapped", nm::ivec2(250, -3), nm::ivec2(0, 0), nm::ivec2(0, 0), true},
+        {"wrap-around x", nm::ivec2(-2, 7), nm::ivec2(5, 0), nm::ivec2(0, 0), true},
+        {"wrap-around y", nm::ivec2(7, -2 * size - 2), nm::ivec2(0, -6), nm::ivec2(0, 0), true},
+        {"diagonal", nm::ivec2(100, -100), nm::ivec2(3, 3), nm::ivec2(0, 0), true},
+        {"diagonal, negative", nm::ivec2(-1, -1), nm::ivec2(-7, -7), nm::ivec2(0, 0), true},
+        {"anti-diagonal", nm::ivec2(size - 1, 1), nm::ivec2(5, -9), nm::ivec2(0, 0), true},
+        {"exactly a window", nm::ivec2(3, 4), nm::ivec2(0, 0), nm::ivec2(1, 0), true},
+        {"larger than window", nm::ivec2(-5, 9), nm::ivec2(1, 2), nm::ivec2(1, 0), true},
+        {"larger, diagonal", nm::ivec2(17, -17), nm::ivec2(0, 0), nm::ivec2(-2, 3), true},
+        {"invalid old window", nm::ivec2(0, 0), nm::ivec2(1, 1), nm::ivec2(0, 0), false},
+    };
+
+    printf("\nupdate planner, fixed moves\n");
+    printf("%-22s %10s %8s %10s %10s\n", "", "texture", "regions", "texels", "result");
+
+    uint32_t failure_count = 0;
+    for (const bench_planner_case& c : cases) {
+        // the window of a level, and the window with a guard band around it
+        for (int32_t guard_band = 0; guard_band <= 4; guard_band += 4) {
+            int32_t texture_size = size + 2 * guard_band;
+            nm::ivec2 delta      = c.delta + c.windows * texture_size;
+            nm::ivec2 start      = c.old_start + delta;
+
+            update_info infos[PLANNER_MAX_REGION_COUNT];
+            uint32_t info_count = 0;
+            plan_update_regions(
+                c.old_start, c.is_old_valid, start, texture_size, 0, infos, &info_count);
+
+            // the new window lacks the texels outside of the overlap with the
+            // old one
+            int32_t kept_x          = nm::max(texture_size - abs(delta.x), 0);
+            int32_t kept_y          = nm::max(texture_size - abs(delta.y), 0);
+            uint64_t expected_count = uint64_t(texture_size) * uint64_t(texture_size);
+            if (c.is_old_valid) expected_count -= uint64_t(kept_x) * uint64_t(kept_y);
+
+            uint64_t texel_count = get_texel_count(infos, info_count);
+            bool is_passing      = texel_count == expected_count;
+            is_passing           = is_passing && check_update_regions(
+                                                     c.old_start,
+                                                     c.is_old_valid,
+                                                     start,
+                                                     texture_size,
+                                                     infos,
+                                                     info_count);
+            if (!is_passing) failure_count++;
+
+            printf(
+                "%-22s %10d %8u %10llu %10s\n",
+                c.name,
+                texture_size,
+                info_count,
+                (unsigned long long)texel_count,
+                is_passing ? "ok" : "FAILED");
+        }
+    }
+
+    return failure_count == 0;
+}
+
+/// Checks the update planner against the brute-force texel sets for random
+/// moves, and compares the texels it plans on diagonal flights with updating
+/// the new columns and the new rows separately, which generates the corner in
+/// between twice. Returns false if any random move fails.
+static bool bench_planner()
+{
+    const int32_t size = int32_t(CLIPMAP_LEVEL_SIZE);
+
+    std::mt19937 rng(3);
+    std::uniform_int_distribution<int32_t> start_dist(-100000, 100000);
+    std::uniform_int_distribution<int32_t> move_dist(-size - 8, size + 8);
+    std::uniform_int_distribution<int32_t> small_dist(-4, 4);
+
+    uint32_t failure_count = 0;
+    for (uint32_t i = 0; i < BENCH_PLANNER_MOVE_COUNT; i++) {
+        // mostly small moves, also some that are larger than a window
+        nm::ivec2 old_start(start_dist(rng), start_dist(rng));
+        nm::ivec2 delta = i % 2 == 0 ? nm::ivec2(small_dist(rng), small_dist(rng))
+                                     : nm::ivec2(move_dist(rng), move_dist(rng));
+        bool is_old_valid = i % 16 != 0;
+        // the window of a level, or the window with a guard band around it
+        int32_t texture_size = size + 2 * int32_t(i % 3) * 4;
+        nm::ivec2 start      = old_start + delta;
+
+        update_info infos[PLANNER_MAX_REGION_COUNT];
+        uint32_t info_count = 0;
+        plan_update_regions(old_start, is_old_valid, start, texture_size, 0, infos, &info_count);
+        if (!check_update_regions(
+                old_start, is_old_valid, start, texture_size, infos, info_count)) {
+            failure_count++;
+        }
+    }
+    printf(
+        "\nupdate planner, random moves: %u, failures: %u\n",
+        BENCH_PLANNER_MOVE_COUNT,
+        failure_count);
+
+    printf("%-22s %14s %14s %8s\n", "diagonal flight", "separate", "planned", "saved");
+    const int32_t speeds[] = {1, 4, 16, 64};
+    for (int32_t speed : speeds) {
+        uint64_t separate_count = 0;
+        uint64_t planned_count  = 0;
+        for (uint32_t level = 0; level < CLIPMAP_LEVEL_COUNT; level++) {
+            for (int32_t frame = 0; frame < BENCH_PLANNER_FRAME_COUNT; frame++) {
+                // moves diagonally by speed grid positions per frame
+                nm::ivec2 old_start((frame * speed) >> level, (frame * speed) >> level);
+                nm::ivec2 start(((frame + 1) * speed) >> level, ((frame + 1) * speed) >> level);
+                if (start.x == old_start.x) continue;
+
+                update_info infos[PLANNER_MAX_REGION_COUNT];
+                uint32_t info_count = 0;
+                plan_update_regions(old_start, true, start, size, level, infos, &info_count);
+                planned_count += get_texel_count(infos, info_count);
+
+                int32_t delta = nm::min(start.x - old_start.x, size);
+                separate_count += delta < size ? 2u * uint64_t(delta) * uint64_t(size)
+                                               : uint64_t(size) * uint64_t(size);
+            }
+        }
+
+        char name[32];
+        snprintf(name, sizeof(name), "%d texels/frame", speed);
+        printf(
+            "%-22s %14llu %14llu %7.2f%%\n",
+            name,
+            (unsigned long long)separate_count,
+            (unsigned long long)planned_count,
+            100. * (1. - double(planned_count) / double(separate_count)));
+    }
+
+    return failure_count == 0;
+}
+
+/// Returns the number of texels that a camera generates for all levels when it
+/// moves along the given positions in grid units, with a guard band of
+/// guard_band texels around each level.
+static uint64_t get_flight_texel_count(const std::vector<int32_t>& positions, int32_t guard_band)
+{
+    const int32_t texture_size = int32_t(CLIPMAP_LEVEL_SIZE) + 2 * guard_band;
+
+    uint64_t texel_count = 0;
+    for (uint32_t level = 0; level < CLIPMAP_LEVEL_COUNT; level++) {
+        nm::ivec2 old_start;
+        bool is_old_valid = false;
+        for (int32_t position : positions) {
+            // moves diagonally, the first position loads the complete level
+            nm::ivec2 render_start(position >> level, position >> level);
+            nm::ivec2 start = get_resident_start(old_start, is_old_valid, render_start, guard_band);
+            if (is_old_valid && start == old_start) continue;
+
+            update_info infos[PLANNER_MAX_REGION_COUNT];
+            uint32_t info_count = 0;
+            plan_update_regions(
+                old_start, is_old_valid, start, texture_size, level, infos, &info_count);
+            if (is_old_valid) texel_count += get_texel_count(infos, info_count);
+
+            old_start    = start;
+            is_old_valid = true;
+        }
+    }
+
+    return texel_count;
+}
+
+/// Compares the texels that cameras generate with guard bands of different
+/// sizes, for a camera that moves back and forth over a few texels and for one
+/// that flies in a straight line.
+static void bench_guard_band()
+{
+    std::vector<int32_t> oscillating;
+    std::vector<int32_t> straight;
+    for (int32_t frame = 0; frame < BENCH_PLANNER_FRAME_COUNT; frame++) {
+        // back and forth over three texels of the finest level, drifting by a
+        // texel every 64 frames
+        int32_t phase = frame % 6;
+        oscillating.push_back(frame / 64 + (phase < 3 ? phase : 6 - phase));
+        straight.push_back(frame * 4);
+    }
+
+    printf("\n%-22s %14s %14s\n", "guard band", "oscillating", "straight");
+    const int32_t guard_bands[] = {0, 2, 4, 8, 16};
+    for (int32_t guard_band : guard_bands) {
+        char name[32];
+        snprintf(name, sizeof(name), "%d texels", guard_band);
+        printf(
+            "%-22s %14llu %14llu\n",
+            name,
+            (unsigned long long)get_flight_texel_count(oscillating, guard_band),
+            (unsigned long long)get_flight_texel_count(straight, guard_band));
+    }
+}
+
+int main()
+{
+    uint8_t* noise = create_noise_table(NOISE_SIZE);
+    if (!noise) return EXIT_FAILURE;
+
+    // the checks of the benchmarks decide the exit code
+    bool is_passing = true;
+
+    bench_lattices(noise);
+    bench_corners(noise);
+    bench_truncation(noise);
+    is_passing = bench_backends(noise) && is_passing;
+    is_passing = bench_gradient(noise) && is_passing;
+    is_passing = bench_tile_pack(noise) && is_passing;
+    bench_raycasts(noise);
+    bench_culling(noise);
+    is_passing = bench_partial_cull(noise) && is_passing;
+    is_passing = bench_planner_cases() && is_passing;
+    is_passing = bench_planner() && is_passing;
+    bench_guard_band();
+
+    destroy_noise_table(noise);
+
+    if (!is_passing) printf("\nsome checks failed\n");
+    return is_passing ? EXIT_SUCCESS : EXIT_FAILURE;
+}
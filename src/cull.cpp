@@ -0,0 +1,513 @@
+#include "cull.h"
+
+#include <cassert>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+/// Margin around every box, to deal with precision issues.
+#define CULL_BOX_MARGIN .02f
+
+void init(cull_placements* placements)
+{
+    // the placements past the count are tested along with the last ones
+    memset(placements, 0, sizeof(cull_placements));
+    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
+        placements->ring_min[i] = nm::fvec2(FLT_MAX);
+        placements->ring_max[i] = nm::fvec2(-FLT_MAX);
+    }
+}
+
+uint32_t add_placement(
+    cull_placements* placements, nm::ivec2 offset, nm::uvec2 range, uint32_t level)
+{
+    assert(placements->count < CULL_MAX_PLACEMENT_COUNT);
+    uint32_t i = placements->count++;
+
+    placements->offsets_x[i] = offset.x;
+    placements->offsets_z[i] = offset.y;
+    placements->extents_x[i] = float(range.x) * get_texel_spacing(level);
+    placements->extents_z[i] = float(range.y) * get_texel_spacing(level);
+    placements->levels[i]    = level;
+
+    nm::fvec2 start  = nm::fvec2(offset);
+    nm::fvec2 end    = start + nm::fvec2(range) * float(1u << level);
+    nm::fvec2* ring0 = &placements->ring_min[level];
+    nm::fvec2* ring1 = &placements->ring_max[level];
+    *ring0           = nm::fvec2(nm::min(ring0->x, start.x), nm::min(ring0->y, start.y));
+    *ring1           = nm::fvec2(nm::max(ring1->x, end.x), nm::max(ring1->y, end.y));
+
+    return i;
+}
+
+/// Placements that add_clipmap_placements lists, and their ids.
+struct placement_list {
+    cull_placements* placements;
+    uint32_t* ids;
+};
+
+/// Lists a placement of a block of the type that was begun last.
+static void place_block(
+    placement_list* list, nm::ivec2 offset, nm::uvec2 range, uint32_t level, uint32_t id)
+{
+    uint32_t i   = add_placement(list->placements, offset, range, level);
+    list->ids[i] = id;
+}
+
+/// The singular 3x3 quadlet.
+static void place_quadlet(placement_list* list, nm::uvec2 range)
+{
+    place_block(list, nm::ivec2(2, 2) * (CLIPMAP_SIZE - 1), range, 0, 0);
+}
+
+/// These are the basic MxM tesselated quads.
+static void place_quads(placement_list* list, nm::uvec2 range)
+{
+    // from level 1 and out, the four center blocks are already filled with the
+    // lower clipmap level, so skip these.
+    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
+        for (uint32_t z = 0; z < 4; z++) {
+            for (uint32_t x = 0; x < 4; x++) {
+                if (i > 0 && z != 0 && z != 3 && x != 0 && x != 3) {
+                    // already occupied, skip. (except for level 0)
+                    continue;
+                }
+
+                nm::ivec2 offset = nm::ivec2(x, z) * ((CLIPMAP_SIZE - 1) << i);
+
+                // skip 2 texels horizontally and vertically at the middle to
+                // get a symmetric structure. these regions are filled with
+                // horizontal and vertical fixup regions
+                if (x >= 2) offset.x += 2 << i;
+                if (z >= 2) offset.y += 2 << i;
+
+                place_block(list, offset, range, i, 1);
+            }
+        }
+    }
+}
+
+static void place_fixups_z(placement_list* list, nm::uvec2 range)
+{
+    // Vertical
+
+    // +(CLIPMAP_SIZE - 1) offset in z from the -z one at level 0
+    place_block(list, nm::ivec2(2 * (CLIPMAP_SIZE - 1), (CLIPMAP_SIZE - 1)), range, 0, 2);
+
+    // -(CLIPMAP_SIZE - 1) offset in z from the +z one at level 0
+    place_block(
+        list, nm::ivec2(2 * (CLIPMAP_SIZE - 1), 2 * (CLIPMAP_SIZE - 1) + 2), range, 0, 2);
+
+    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
+        // Top region
+        place_block(list, nm::ivec2(2 * (CLIPMAP_SIZE - 1), 0) * (1 << i), range, i, 3);
+
+        // Bottom region
+        nm::ivec2 offset = nm::ivec2(2 * (CLIPMAP_SIZE - 1), 3 * (CLIPMAP_SIZE - 1) + 2);
+        place_block(list, offset * (1 << i), range, i, 3);
+    }
+}
+
+static void place_fixups_x(placement_list* list, nm::uvec2 range)
+{
+    // Horizontal
+
+    // for the first level, we draw two more horizontal fixups
+
+    // +(CLIPMAP_SIZE - 1) offset in x from the -x one at level 0
+    place_block(list, nm::ivec2((CLIPMAP_SIZE - 1), 2 * (CLIPMAP_SIZE - 1)), range, 0, 2);
+
+    // -(CLIPMAP_SIZE - 1) offset in x from the +x one at level 0
+    place_block(
+        list, nm::ivec2(2 * (CLIPMAP_SIZE - 1) + 2, 2 * (CLIPMAP_SIZE - 1)), range, 0, 2);
+
+    // for each level, follow the same process and draw two fixups
+    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
+        // Left side horizontal fixup region.
+        // Texel coordinates are derived by just dividing the world space offset with texture
+        // size. The 0.5 texel offset required to sample exactly at the texel center is done in
+        // vertex shader.
+        place_block(list, nm::ivec2(0, 2 * (CLIPMAP_SIZE - 1)) * (1 << i), range, i, 3);
+
+        // Right side horizontal fixup region
+        nm::ivec2 offset = nm::ivec2(3 * (CLIPMAP_SIZE - 1) + 2, 2 * (CLIPMAP_SIZE - 1));
+        place_block(list, offset * (1 << i), range, i, 3);
+    }
+}
+
+static void place_degenerates(
+    placement_list* list,
+    nm::uvec2 range,
+    const nm::ivec2& offset,
+    const nm::ivec2& ring_offset,
+    uint32_t id)
+{
+    // no need to connect the last clipmap level to next level (there is none)
+    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT - 1; i++) {
+        // due to horizontal and vertical fixup region,
+        // additional offset is (2 extra texels) is required.
+        nm::ivec2 level_offset = offset * (1 << i) + ring_offset * (1 << i);
+        place_block(list, level_offset, range, i, id);
+    }
+}
+
+/// Each level is placed with all four trims, the draw list picks one.
+static void place_trims(placement_list* list, nm::uvec2 range)
+{
+    // from level 1 and out, we only need a single L-shaped trim region
+    for (uint32_t i = 1; i < CLIPMAP_LEVEL_COUNT; i++) {
+        place_block(list, nm::ivec2((CLIPMAP_SIZE - 1) << i), range, i, 7);
+    }
+}
+
+void add_clipmap_placements(
+    cull_placements* placements,
+    const nm::uvec2 ranges[CULL_BLOCK_COUNT],
+    uint32_t first[CULL_BLOCK_COUNT + 1],
+    uint32_t ids[CULL_MAX_PLACEMENT_COUNT])
+{
+    placement_list list;
+    list.placements = placements;
+    list.ids        = ids;
+
+    // 3x3 block
+    first[0] = placements->count;
+    place_quadlet(&list, ranges[0]);
+
+    // main blocks
+    first[1] = placements->count;
+    place_quads(&list, ranges[1]);
+
+    // z direction ring fixups
+    first[2] = placements->count;
+    place_fixups_z(&list, ranges[2]);
+
+    // x direction ring fixups
+    first[3] = placements->count;
+    place_fixups_x(&list, ranges[3]);
+
+    // -x degenerates
+    first[4] = placements->count;
+    place_degenerates(&list, ranges[4], nm::ivec2(0), nm::ivec2(0), 4);
+
+    // +x degenerates
+    first[5] = placements->count;
+    place_degenerates(
+        &list, ranges[5], nm::ivec2(4 * (CLIPMAP_SIZE - 1), 0), nm::ivec2(2, 0), 5);
+
+    // -z degenerates
+    first[6] = placements->count;
+    place_degenerates(&list, ranges[6], nm::ivec2(0), nm::ivec2(0), 6);
+
+    // +z degenerates
+    first[7] = placements->count;
+    place_degenerates(
+        &list, ranges[7], nm::ivec2(0, 4 * (CLIPMAP_SIZE - 1)), nm::ivec2(0, 2), 7);
+
+    // the four trims
+    for (uint32_t i = 8; i < CULL_BLOCK_COUNT; i++) {
+        first[i] = placements->count;
+        place_trims(&list, ranges[i]);
+    }
+
+    first[CULL_BLOCK_COUNT] = placements->count;
+}
+
+/// Finds the range of heights that a block of the given level can be rendered
+/// at. Returns false if the height bounds do not cover the block.
+static bool get_block_heights(
+    const cull_input* input, nm::fvec2 pos, nm::fvec2 extent, uint32_t level, nm::fvec2* heights)
+{
+    // blocks of incomplete levels are rendered with the texels of the first
+    // complete level
+    uint32_t source = nm::max(level, input->first_complete_level);
+
+    // the vertex shader blends with the texels of the next level, which can
+    // lie up to a texel of that level outside of the block
+    float padding      = get_texel_spacing(source + 1u);
+    nm::fvec2 rect_min = pos - nm::fvec2(padding);
+    nm::fvec2 rect_max = pos + extent + nm::fvec2(padding);
+
+    nm::fvec2 range;
+    if (!get_rect_bounds(input->bounds, source, rect_min, rect_max, &range)) return false;
+
+    // the bounds cover the terrain with all octaves, the texels of both levels
+    // can lack the octaves that the next level truncates
+    uint32_t next_level = nm::min(source + 1u, CLIPMAP_LEVEL_COUNT - 1u);
+    float truncation    = TERRAIN_AMP * get_truncation_bound(input->level_octaves[next_level]);
+
+    // the water is drawn with the same blocks
+    float water_height = TERRAIN_WATER_LVL * TERRAIN_AMP;
+    heights->x         = nm::min(range.x - truncation, water_height);
+    heights->y         = nm::max(range.y + truncation, water_height);
+
+    return true;
+}
+
+/// Classifies a single box against all frusta. Per plane, the corner that is
+/// the furthest inside (p-vertex) decides whether the box is outside, the
+/// corner that is the furthest outside (n-vertex) whether it is inside.
+static cull_class classify_box(const cull_input* input, nm::fvec3 box_min, nm::fvec3 box_max)
+{
+    cull_class c = {0u, 0u};
+    for (uint32_t f = 0; f < input->frustum_count; f++) {
+        bool is_outside = false;
+        bool is_inside  = true;
+        for (uint32_t i = 0; i < 6; i++) {
+            nm::fvec4 plane = input->frusta[f].planes[i];
+            nm::fvec3 p, n;
+            p.x = plane.x > 0.f ? box_min.x : box_max.x;
+            p.y = plane.y > 0.f ? box_min.y : box_max.y;
+            p.z = plane.z > 0.f ? box_min.z : box_max.z;
+            n.x = plane.x > 0.f ? box_max.x : box_min.x;
+            n.y = plane.y > 0.f ? box_max.y : box_min.y;
+            n.z = plane.z > 0.f ? box_max.z : box_min.z;
+            if (dot(plane, nm::fvec4(p.x, p.y, p.z, 1.f)) > 0.f) is_outside = true;
+            if (dot(plane, nm::fvec4(n.x, n.y, n.z, 1.f)) > 0.f) is_inside = false;
+        }
+        if (!is_outside) c.intersecting |= 1u << f;
+        if (is_inside) c.contained |= 1u << f;
+    }
+
+    return c;
+}
+
+/// Returns the world-space rectangle around all placements of the level.
+static void get_ring_rect(
+    const cull_placements* placements,
+    const cull_input* input,
+    uint32_t level,
+    nm::fvec2* min,
+    nm::fvec2* max)
+{
+    nm::fvec2 offset = nm::fvec2(input->level_offsets[level]);
+    *min             = (offset + placements->ring_min[level]) * CLIPMAP_SCALE;
+    *max             = (offset + placements->ring_max[level]) * CLIPMAP_SCALE;
+}
+
+/// Classifies the ring of a level, spanning the complete height range. The
+/// rectangle of the next finer level is cut out of the ring, such that the
+/// ring of a camera that stands in it can still lie outside of its frustum.
+/// The annulus is split into four boxes: the strips at -z and +z with the full
+/// width, and the strips at -x and +x in between them. The ring intersects a
+/// frustum that any box intersects, and is contained in a frustum that
+/// contains all boxes.
+static cull_class classify_ring(
+    const cull_placements* placements, const cull_input* input, uint32_t level)
+{
+    cull_class c = {0u, 0u};
+    if (placements->ring_min[level].x > placements->ring_max[level].x) return c;
+
+    // noise will be in [0, <2]
+    const float min_y = -CULL_BOX_MARGIN;
+    const float max_y = TERRAIN_AMP * 2.f + CULL_BOX_MARGIN;
+
+    nm::fvec2 outer_min, outer_max;
+    get_ring_rect(placements, input, level, &outer_min, &outer_max);
+    outer_min -= nm::fvec2(CULL_BOX_MARGIN);
+    outer_max += nm::fvec2(CULL_BOX_MARGIN);
+
+    // the finest level has no hole
+    if (level == 0 || placements->ring_min[level - 1].x > placements->ring_max[level - 1].x) {
+        return classify_box(
+            input,
+            nm::fvec3(outer_min.x, min_y, outer_min.y),
+            nm::fvec3(outer_max.x, max_y, outer_max.y));
+    }
+
+    // the strips overlap the hole by the margin
+    nm::fvec2 hole_min, hole_max;
+    get_ring_rect(placements, input, level - 1u, &hole_min, &hole_max);
+    hole_min += nm::fvec2(CULL_BOX_MARGIN);
+    hole_max -= nm::fvec2(CULL_BOX_MARGIN);
+
+    const nm::fvec2 box_mins[4] = {
+        nm::fvec2(outer_min.x, outer_min.y),
+        nm::fvec2(outer_min.x, hole_max.y),
+        nm::fvec2(outer_min.x, hole_min.y),
+        nm::fvec2(hole_max.x, hole_min.y)};
+    const nm::fvec2 box_maxs[4] = {
+        nm::fvec2(outer_max.x, hole_min.y),
+        nm::fvec2(outer_max.x, outer_max.y),
+        nm::fvec2(hole_min.x, hole_max.y),
+        nm::fvec2(outer_max.x, hole_max.y)};
+
+    c.contained = (1u << input->frustum_count) - 1u;
+    for (uint32_t i = 0; i < 4; i++) {
+        cull_class box = classify_box(
+            input,
+            nm::fvec3(box_mins[i].x, min_y, box_mins[i].y),
+            nm::fvec3(box_maxs[i].x, max_y, box_maxs[i].y));
+        c.intersecting |= box.intersecting;
+        c.contained &= box.contained;
+    }
+
+    return c;
+}
+
+/// Returns a bit for each of the four boxes starting at i that lie completely
+/// outside of the plane. Only the p-vertex of each box is tested, which is the
+/// same corner of every box.
+static inline uint32_t get_outside_bits(const cull_result* result, uint32_t i, nm::fvec4 plane)
+{
+    const float* xs = plane.x > 0.f ? result->min_x : result->max_x;
+    const float* ys = plane.y > 0.f ? result->min_y : result->max_y;
+    const float* zs = plane.z > 0.f ? result->min_z : result->max_z;
+
+#if defined(__x86_64__) || defined(_M_X64)
+    __m128 d = _mm_set1_ps(plane.w);
+    d        = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(plane.x), _mm_load_ps(xs + i)));
+    d        = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(plane.y), _mm_load_ps(ys + i)));
+    d        = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(plane.z), _mm_load_ps(zs + i)));
+    return uint32_t(_mm_movemask_ps(_mm_cmpgt_ps(d, _mm_setzero_ps())));
+#else
+    uint32_t bits = 0u;
+    for (uint32_t j = 0; j < 4; j++) {
+        float d = plane.w + plane.x * xs[i + j] + plane.y * ys[i + j] + plane.z * zs[i + j];
+        if (d > 0.f) bits |= 1u << j;
+    }
+    return bits;
+#endif
+}
+
+/// Tests the four boxes starting at i against the frusta in mask. Sets bit f of
+/// bits[j] if box i + j intersects frustum f.
+static void test_boxes(
+    const cull_input* input,
+    const cull_result* result,
+    uint32_t i,
+    uint32_t mask,
+    uint32_t bits[4])
+{
+    for (uint32_t j = 0; j < 4; j++) bits[j] = 0u;
+
+    for (uint32_t f = 0; f < input->frustum_count; f++) {
+        if (!(mask & (1u << f))) continue;
+
+        uint32_t outside = 0u;
+        for (uint32_t k = 0; k < 6 && outside != 0xfu; k++) {
+            outside |= get_outside_bits(result, i, input->frusta[f].planes[k]);
+        }
+        for (uint32_t j = 0; j < 4; j++) {
+            if (!(outside & (1u << j))) bits[j] |= 1u << f;
+        }
+    }
+}
+
+/// Returns true if the level of the placement is culled by this call.
+static inline bool is_culled(
+    const cull_placements* placements, const cull_result* result, uint32_t i)
+{
+    return result->culled_level_mask & (1u << placements->levels[i]);
+}
+
+void cull(const cull_placements* placements, const cull_input* input, cull_result* result)
+{
+    assert(input->frustum_count <= CULL_MAX_FRUSTUM_COUNT);
+
+    // noise will be in [0, <2]
+    const float coarse_min_y = -CULL_BOX_MARGIN;
+    const float coarse_max_y = TERRAIN_AMP * 2.f + CULL_BOX_MARGIN;
+
+    // reject complete rings first, blocks of a ring that is contained in a
+    // frustum are not tested against it. a ring changes with the frusta and
+    // with the offsets of its level and the next finer level
+    cull_class* rings            = result->rings;
+    result->rejected_level_count = 0;
+    result->culled_level_mask    = input->level_mask;
+    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
+        cull_class ring = classify_ring(placements, input, i);
+        bool is_cut     = (ring.intersecting & ~ring.contained) != 0u;
+        bool is_changed = ring.intersecting != rings[i].intersecting ||
+                          ring.contained != rings[i].contained;
+        if (is_changed || (is_cut && input->is_frustum_changed)) {
+            result->culled_level_mask |= 1u << i;
+        }
+
+        rings[i] = ring;
+        if (!ring.intersecting) result->rejected_level_count++;
+    }
+
+    // boxes that span the complete height range
+    const uint32_t count = (placements->count + 3u) & ~3u;
+    for (uint32_t i = 0; i < count; i++) {
+        nm::ivec2 offset = input->level_offsets[placements->levels[i]];
+        float x          = float(offset.x + placements->offsets_x[i]) * CLIPMAP_SCALE;
+        float z          = float(offset.y + placements->offsets_z[i]) * CLIPMAP_SCALE;
+        result->min_x[i] = x - CULL_BOX_MARGIN;
+        result->min_y[i] = coarse_min_y;
+        result->min_z[i] = z - CULL_BOX_MARGIN;
+        result->max_x[i] = x + placements->extents_x[i] + CULL_BOX_MARGIN;
+        result->max_y[i] = coarse_max_y;
+        result->max_z[i] = z + placements->extents_z[i] + CULL_BOX_MARGIN;
+    }
+
+    for (uint32_t i = 0; i < count; i += 4) {
+        uint32_t mask = 0u;
+        for (uint32_t j = 0; j < 4; j++) {
+            if (!is_culled(placements, result, i + j)) continue;
+
+            const cull_class& ring = rings[placements->levels[i + j]];
+            mask |= ring.intersecting & ~ring.contained;
+        }
+
+        uint32_t bits[4];
+        test_boxes(input, result, i, mask, bits);
+        for (uint32_t j = 0; j < 4; j++) {
+            if (!is_culled(placements, result, i + j)) continue;
+
+            const cull_class& ring        = rings[placements->levels[i + j]];
+            uint32_t visible              = ring.contained | (ring.intersecting & bits[j]);
+            result->coarse_visible[i + j] = uint8_t(visible);
+        }
+    }
+
+    // fit the boxes of the blocks that are visible at all
+    bool is_any_fitted = false;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!is_culled(placements, result, i)) continue;
+
+        result->is_fitted[i] = false;
+        result->visible[i]   = result->coarse_visible[i];
+        if (!input->bounds || i >= placements->count || !result->coarse_visible[i]) continue;
+
+        nm::ivec2 offset = input->level_offsets[placements->levels[i]];
+        nm::fvec2 pos    = nm::fvec2(
+            float(offset.x + placements->offsets_x[i]) * CLIPMAP_SCALE,
+            float(offset.y + placements->offsets_z[i]) * CLIPMAP_SCALE);
+        nm::fvec2 extent = nm::fvec2(placements->extents_x[i], placements->extents_z[i]);
+        nm::fvec2 heights;
+        if (!get_block_heights(input, pos, extent, placements->levels[i], &heights)) continue;
+
+        result->is_fitted[i] = true;
+        result->min_y[i]     = heights.x - CULL_BOX_MARGIN;
+        result->max_y[i]     = heights.y + CULL_BOX_MARGIN;
+        is_any_fitted        = true;
+    }
+    if (!is_any_fitted) return;
+
+    // a fitted box holds the water height, such that it intersects every
+    // frustum that contains the ring of its level
+    for (uint32_t i = 0; i < count; i += 4) {
+        uint32_t mask = 0u;
+        for (uint32_t j = 0; j < 4; j++) {
+            if (!is_culled(placements, result, i + j) || !result->is_fitted[i + j]) continue;
+
+            const cull_class& ring = rings[placements->levels[i + j]];
+            mask |= result->coarse_visible[i + j] & ~ring.contained;
+        }
+        if (!mask) continue;
+
+        uint32_t bits[4];
+        test_boxes(input, result, i, mask, bits);
+        for (uint32_t j = 0; j < 4; j++) {
+            if (!is_culled(placements, result, i + j) || !result->is_fitted[i + j]) continue;
+
+            const cull_class& ring = rings[placements->levels[i + j]];
+            uint32_t visible       = ring.contained | bits[j];
+            result->visible[i + j] = uint8_t(result->coarse_visible[i + j] & visible);
+        }
+    }
+}
@@ -0,0 +1,129 @@
+#ifndef TERRAIN3_CULL_H
+#define TERRAIN3_CULL_H
+
+#include "height_bounds.h"
+#include "nmutil/intersect.h"
+#include "terrain_defs.h"
+
+#include <cstdint>
+
+/// This file and its implementation cull the blocks of the clipmap against
+/// several frusta at once. Relative to the offset of its level, every block is
+/// always placed at the same spot, so the placements are listed once. Each
+/// update, the boxes of all placements are laid out as structure of arrays and
+/// tested four at a time against a plane. Levels whose ring of blocks lies
+/// outside of all frusta are rejected before any of their blocks is tested.
+/// The ring of a level is the annulus between its outer edge and the outer
+/// edge of the next finer level, whose blocks fill its hole.
+
+/// Maximum number of placements, a multiple of four.
+#define CULL_MAX_PLACEMENT_COUNT 256u
+
+/// Maximum number of frusta culled against at once, one bit of a mask each.
+#define CULL_MAX_FRUSTUM_COUNT 8u
+
+/// Number of types of blocks that add_clipmap_placements lists.
+#define CULL_BLOCK_COUNT 12u
+
+/// Level mask that culls the placements of all levels.
+#define CULL_ALL_LEVELS ((1u << CLIPMAP_LEVEL_COUNT) - 1u)
+
+struct cull_placements {
+    uint32_t count;
+    /// Grid-space offset of each placement relative to the offset of its
+    /// level: (-x,-z)-most point.
+    int32_t offsets_x[CULL_MAX_PLACEMENT_COUNT];
+    int32_t offsets_z[CULL_MAX_PLACEMENT_COUNT];
+    /// World-space extent of each placement in the x/z-plane.
+    float extents_x[CULL_MAX_PLACEMENT_COUNT];
+    float extents_z[CULL_MAX_PLACEMENT_COUNT];
+    uint32_t levels[CULL_MAX_PLACEMENT_COUNT];
+    /// Grid-space rectangle around all placements of each level, relative to
+    /// the offset of the level. Empty if the level has none.
+    nm::fvec2 ring_min[CLIPMAP_LEVEL_COUNT];
+    nm::fvec2 ring_max[CLIPMAP_LEVEL_COUNT];
+};
+
+struct cull_input {
+    const nm::frustum* frusta;
+    /// At most CULL_MAX_FRUSTUM_COUNT.
+    uint32_t frustum_count;
+    /// (-x,-z)-most point of each level in grid coordinates.
+    const nm::ivec2* level_offsets;
+    /// Optional, used to fit the boxes of the placements to the terrain.
+    const height_bounds* bounds;
+    /// Number of octaves of each level of the heightmap, if bounds is set.
+    const uint32_t* level_octaves;
+    /// Finest level of the heightmap with complete texels.
+    uint32_t first_complete_level;
+    /// Bit for each level whose placements moved or whose boxes changed since
+    /// the previous call with the same result, CULL_ALL_LEVELS for the first.
+    uint32_t level_mask;
+    /// Whether the frusta differ from those of the previous call.
+    bool is_frustum_changed;
+};
+
+/// Frustum bits of a box that lies outside of none of the frustum planes
+/// (intersecting) and that lies inside all of them (contained).
+struct cull_class {
+    uint32_t intersecting;
+    uint32_t contained;
+};
+
+struct cull_result {
+    /// Bit i is set if the placement intersects frustum i.
+    uint8_t visible[CULL_MAX_PLACEMENT_COUNT];
+    /// Bit i is set if the placement intersects frustum i with a box that
+    /// spans the complete height range of the terrain.
+    uint8_t coarse_visible[CULL_MAX_PLACEMENT_COUNT];
+    /// Whether the box of the placement was fitted to the height bounds.
+    bool is_fitted[CULL_MAX_PLACEMENT_COUNT];
+    /// Class of the ring of each level.
+    cull_class rings[CLIPMAP_LEVEL_COUNT];
+    /// Number of levels whose ring lies outside of all frusta.
+    uint32_t rejected_level_count;
+    /// Bit for each level whose placements the last call culled again, see
+    /// cull. The results of the other placements were kept.
+    uint32_t culled_level_mask;
+
+    /// Boxes of the placements, as tested last.
+    alignas(16) float min_x[CULL_MAX_PLACEMENT_COUNT];
+    alignas(16) float min_y[CULL_MAX_PLACEMENT_COUNT];
+    alignas(16) float min_z[CULL_MAX_PLACEMENT_COUNT];
+    alignas(16) float max_x[CULL_MAX_PLACEMENT_COUNT];
+    alignas(16) float max_y[CULL_MAX_PLACEMENT_COUNT];
+    alignas(16) float max_z[CULL_MAX_PLACEMENT_COUNT];
+};
+
+void init(cull_placements* placements);
+
+/// Adds a placement of a block that covers range grid cells of the level,
+/// returns its index.
+uint32_t add_placement(
+    cull_placements* placements, nm::ivec2 offset, nm::uvec2 range, uint32_t level);
+
+/// Adds the placements of all types of blocks of the clipmap, one type after
+/// the other: the quadlet, the regular blocks, the fixups in z and in x, the
+/// degenerates at -x, +x, -z and +z, and the trims at -z+x, -z-x, +z+x and
+/// +z-x. ranges[i] is the range in grid cells of a block of type i. Sets
+/// first[i] to the index of the first placement of type i and first[i + 1] to
+/// the count, and ids[j] to the id of placement j, see instance_data::id.
+void add_clipmap_placements(
+    cull_placements* placements,
+    const nm::uvec2 ranges[CULL_BLOCK_COUNT],
+    uint32_t first[CULL_BLOCK_COUNT + 1],
+    uint32_t ids[CULL_MAX_PLACEMENT_COUNT]);
+
+/// Finds the frusta that each placement intersects. Matches testing the box of
+/// each placement with nm::intersect, except that a placement whose ring or
+/// whose box spanning the complete height range lies outside of a frustum is
+/// never visible in it, even if its fitted box is not.
+///
+/// The rings of all levels are classified on every call, and result keeps the
+/// results of the previous call. The placements of a level are only culled
+/// again if they are in level_mask, if the class of their ring changed, or if
+/// the frusta changed and cut through their ring. The placements of a ring
+/// that stays outside of or contained in each frustum keep their results.
+void cull(const cull_placements* placements, const cull_input* input, cull_result* result);
+
+#endif // TERRAIN3_CULL_H
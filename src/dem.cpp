@@ -0,0 +1,186 @@
+#include "dem.h"
+
+#include "nmutil/log.h"
+#include "nmutil/math.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+
+/// Fills mip with the 2x2 box filter of the previous mip. A mip with an odd
+/// number of samples in a row repeats its last sample.
+static void build_mip(const dem* d, uint32_t mip)
+{
+    const dem_mip* dst = &d->mips[mip];
+
+    for (int32_t y = 0; y < dst->height; y++) {
+        float* row = dst->samples + size_t(y) * size_t(dst->width);
+        for (int32_t x = 0; x < dst->width; x++) {
+            float h00 = get_dem_sample(d, mip - 1u, 2 * x, 2 * y);
+            float h10 = get_dem_sample(d, mip - 1u, 2 * x + 1, 2 * y);
+            float h01 = get_dem_sample(d, mip - 1u, 2 * x, 2 * y + 1);
+            float h11 = get_dem_sample(d, mip - 1u, 2 * x + 1, 2 * y + 1);
+            row[x]    = .25f * (h00 + h10 + h01 + h11);
+        }
+    }
+}
+
+/// Returns the largest rise over run between two neighboring samples of mip 0.
+static float get_max_slope(const dem* d)
+{
+    const dem_mip* m = &d->mips[0];
+
+    float max_rise = 0.f;
+    for (int32_t y = 0; y < m->height; y++) {
+        for (int32_t x = 0; x < m->width; x++) {
+            float h  = get_dem_sample(d, 0, x, y);
+            float dx = fabsf(get_dem_sample(d, 0, x + 1, y) - h);
+            float dy = fabsf(get_dem_sample(d, 0, x, y + 1) - h);
+            max_rise = fmaxf(max_rise, fmaxf(dx, dy));
+        }
+    }
+
+    return max_rise * m->inv_spacing;
+}
+
+nm_ret init(dem* d, const dem_config* config)
+{
+    if (config->width == 0 || config->height == 0 || !(config->spacing > 0.f)) {
+        nm::log(nm::LOG_ERROR, "invalid dimensions of dem %s\n", config->path);
+        return NM_FAIL;
+    }
+
+    // the levels read a few rows at a time from all over the file
+    if (init(&d->file, config->path, true) != NM_SUCCESS) {
+        nm::log(nm::LOG_ERROR, "failed to map dem %s\n", config->path);
+        return NM_FAIL;
+    }
+
+    size_t sample_size = config->format == DEM_FORMAT_U16 ? sizeof(uint16_t) : sizeof(float);
+    size_t data_size   = size_t(config->width) * size_t(config->height) * sample_size;
+    if (d->file.size < data_size) {
+        nm::log(
+            nm::LOG_ERROR,
+            "dem %s has %zu bytes, %ux%u samples need %zu\n",
+            config->path,
+            d->file.size,
+            config->width,
+            config->height,
+            data_size);
+        cleanup(&d->file);
+        return NM_FAIL;
+    }
+
+    d->format        = config->format;
+    d->height_scale  = config->height_scale;
+    d->height_offset = config->height_offset;
+
+    dem_mip* base     = &d->mips[0];
+    base->samples     = nullptr;
+    base->width       = int32_t(config->width);
+    base->height      = int32_t(config->height);
+    base->spacing     = config->spacing;
+    base->inv_spacing = 1.f / config->spacing;
+    base->origin      = -.5f * base->spacing *
+                   nm::fvec2(float(base->width - 1), float(base->height - 1));
+
+    auto start = std::chrono::steady_clock::now();
+
+    // each sample of a mip lies at the center of the four samples it averages,
+    // down to a single sample
+    d->mip_count = 1;
+    while (d->mip_count < DEM_MAX_MIP_COUNT) {
+        const dem_mip* src = &d->mips[d->mip_count - 1u];
+        if (src->width == 1 && src->height == 1) break;
+
+        dem_mip* dst     = &d->mips[d->mip_count];
+        dst->width       = (src->width + 1) / 2;
+        dst->height      = (src->height + 1) / 2;
+        dst->spacing     = 2.f * src->spacing;
+        dst->inv_spacing = .5f * src->inv_spacing;
+        dst->origin      = src->origin + nm::fvec2(.5f * src->spacing);
+        dst->samples = (float*)malloc(size_t(dst->width) * size_t(dst->height) * sizeof(float));
+        if (!dst->samples) {
+            nm::log(nm::LOG_ERROR, "failed to allocate mip %u of dem\n", d->mip_count);
+            cleanup(d);
+            return NM_FAIL;
+        }
+        d->mip_count++;
+
+        build_mip(d, d->mip_count - 1u);
+    }
+
+    d->max_slope = get_max_slope(d);
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    nm::log(
+        nm::LOG_INFO,
+        "mapped dem %s with %ux%u samples, %.2f m apart, built %u mips in %.2f s, "
+        "max slope %.2f\n",
+        config->path,
+        config->width,
+        config->height,
+        config->spacing,
+        d->mip_count,
+        elapsed.count(),
+        d->max_slope);
+
+    return NM_SUCCESS;
+}
+
+void cleanup(dem* d)
+{
+    for (uint32_t i = 1; i < d->mip_count; i++) {
+        free(d->mips[i].samples);
+    }
+    cleanup(&d->file);
+}
+
+uint32_t get_dem_mip(const dem* d, float spacing)
+{
+    float mip = roundf(log2f(spacing * d->mips[0].inv_spacing));
+    if (!(mip > 0.f)) return 0;
+
+    return nm::min(uint32_t(mip), d->mip_count - 1u);
+}
+
+float sample_dem(const dem* d, uint32_t mip, nm::fvec2 pos)
+{
+    const dem_mip* m = &d->mips[mip];
+
+    // position in samples
+    float x  = (pos.x - m->origin.x) * m->inv_spacing;
+    float y  = (pos.y - m->origin.y) * m->inv_spacing;
+    float fx = floorf(x);
+    float fy = floorf(y);
+    float tx = x - fx;
+    float ty = y - fy;
+
+    int32_t x0 = int32_t(fx);
+    int32_t y0 = int32_t(fy);
+    float h00  = get_dem_sample(d, mip, x0, y0);
+    float h10  = get_dem_sample(d, mip, x0 + 1, y0);
+    float h01  = get_dem_sample(d, mip, x0, y0 + 1);
+    float h11  = get_dem_sample(d, mip, x0 + 1, y0 + 1);
+
+    float h0 = h00 + (h10 - h00) * tx;
+    float h1 = h01 + (h11 - h01) * tx;
+
+    return h0 + (h1 - h0) * ty;
+}
+
+nm::fvec3 sample_dem_gradient(const dem* d, uint32_t mip, nm::fvec2 pos)
+{
+    float s = d->mips[mip].spacing;
+    float h = sample_dem(d, mip, pos);
+
+    nm::fvec2 ox = nm::fvec2(s, 0.f);
+    nm::fvec2 oy = nm::fvec2(0.f, s);
+    float dx     = sample_dem(d, mip, pos + ox) - sample_dem(d, mip, pos - ox);
+    float dy     = sample_dem(d, mip, pos + oy) - sample_dem(d, mip, pos - oy);
+
+    float inv_distance = .5f * d->mips[mip].inv_spacing;
+
+    return nm::fvec3(h, dx * inv_distance, dy * inv_distance);
+}
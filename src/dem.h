@@ -0,0 +1,117 @@
+#ifndef TERRAIN3_DEM_H
+#define TERRAIN3_DEM_H
+
+#include "mapped_file.h"
+#include "nmutil/defs.h"
+#include "nmutil/vector.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/// This file and its implementation encapsulate a digital elevation model, a
+/// heightfield of survey data in a raw file of row-major samples without a
+/// header. The file is memory-mapped read-only, such that sampling a position
+/// only reads the pages around it and files larger than the memory can be
+/// used. The heightfield is centered on the world origin, positions beyond its
+/// edges take the height of the nearest edge.
+///
+/// Coarse levels of the clipmap space their texels many samples apart, such
+/// that sampling the file directly aliases. A pyramid of box-filtered mips is
+/// built at init, each mip halving the resolution of the previous one, and a
+/// level samples the mip whose spacing matches its own texel spacing. The mips
+/// are held in memory in meters, a third of the samples of the file in total.
+
+/// Type of the samples of the file, in the byte order of the machine.
+enum dem_format {
+    /// Unsigned 16-bit integers, which are scaled and offset into meters.
+    DEM_FORMAT_U16,
+    /// 32-bit floats, which are scaled and offset into meters as well.
+    DEM_FORMAT_F32
+};
+
+/// Default distance in meters between two samples.
+#define DEM_DEFAULT_SPACING 1.f
+
+/// Default height in meters of a single step of a 16-bit sample.
+#define DEM_DEFAULT_HEIGHT_SCALE .1f
+
+/// Maximum number of mips, including the file itself.
+#define DEM_MAX_MIP_COUNT 16u
+
+struct dem_config {
+    const char* path;
+    dem_format format;
+    /// Number of samples in each row and number of rows.
+    uint32_t width;
+    uint32_t height;
+    float spacing;
+    /// Height in meters of sample s is s * height_scale + height_offset.
+    float height_scale;
+    float height_offset;
+};
+
+/// A level of the pyramid, mip 0 is the file itself.
+struct dem_mip {
+    /// Heights in meters, null for mip 0.
+    float* samples;
+    int32_t width;
+    int32_t height;
+    float spacing;
+    float inv_spacing;
+    /// World-space position of the first sample.
+    nm::fvec2 origin;
+};
+
+struct dem {
+    mapped_file file;
+
+    dem_format format;
+    float height_scale;
+    float height_offset;
+    /// Largest rise over run between two neighboring samples of the file,
+    /// which bounds the slope of the interpolated surface of every mip. It
+    /// takes the place of the slope bound of the noise in the margins of the
+    /// height bounds.
+    float max_slope;
+
+    dem_mip mips[DEM_MAX_MIP_COUNT];
+    uint32_t mip_count;
+};
+
+/// Maps the file, which must hold at least width * height samples, and builds
+/// the mips from it.
+nm_ret init(dem* d, const dem_config* config);
+
+void cleanup(dem* d);
+
+/// Returns the mip whose samples are closest to spacing meters apart, on a
+/// logarithmic scale.
+uint32_t get_dem_mip(const dem* d, float spacing);
+
+/// Returns the height in meters of the sample at (x, y) of the mip, clamped to
+/// the edges.
+inline float get_dem_sample(const dem* d, uint32_t mip, int32_t x, int32_t y)
+{
+    const dem_mip* m = &d->mips[mip];
+    x                = x < 0 ? 0 : (x >= m->width ? m->width - 1 : x);
+    y                = y < 0 ? 0 : (y >= m->height ? m->height - 1 : y);
+
+    size_t i = size_t(y) * size_t(m->width) + size_t(x);
+    if (m->samples) return m->samples[i];
+
+    float s = d->format == DEM_FORMAT_U16 ? float(((const uint16_t*)d->file.base)[i])
+                                          : ((const float*)d->file.base)[i];
+
+    return s * d->height_scale + d->height_offset;
+}
+
+/// Returns the height in meters at a world-space position, bilinearly
+/// interpolated between the four samples of the mip around it.
+float sample_dem(const dem* d, uint32_t mip, nm::fvec2 pos);
+
+/// Returns the height at a world-space position and its gradient, from central
+/// differences of the interpolated heights of the mip a sample spacing of the
+/// mip apart.
+nm::fvec3 sample_dem_gradient(const dem* d, uint32_t mip, nm::fvec2 pos);
+
+#endif // TERRAIN3_DEM_H
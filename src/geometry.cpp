@@ -1,33 +1,150 @@
 #include "geometry.h"
+#include "app.h"
 #include "nmutil/util.h"
+#include <cassert>
+#include <cstring>
 
-void setup_uniform_buffer(geometry* g)
+/// The compute shader program that culls the blocks on the GPU.
+nm::shader_program cull_program;
+
+/// Creates the buffers of lod_cull.comp, its candidates are tightly packed such
+/// that all instances can be indexed by the vertex shaders.
+static nm_ret setup_cull_buffers(geometry* g)
+{
+    const size_t instance_size = MESH_MAX_INSTANCE_COUNT * sizeof(instance_data);
+    GL_CHECK(glGenBuffers(1, &g->candidate_buffer));
+    GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, g->candidate_buffer));
+    GL_CHECK(glBufferData(GL_SHADER_STORAGE_BUFFER, instance_size, NULL, GL_STREAM_DRAW));
+
+    GL_CHECK(glGenBuffers(1, &g->instance_buffer));
+    GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, g->instance_buffer));
+    GL_CHECK(glBufferData(GL_SHADER_STORAGE_BUFFER, instance_size, NULL, GL_DYNAMIC_COPY));
+
+    GL_CHECK(glGenBuffers(1, &g->bounds_buffer));
+    GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, g->bounds_buffer));
+    GL_CHECK(glBufferData(
+        GL_SHADER_STORAGE_BUFFER, sizeof(height_bounds::cells), NULL, GL_STREAM_DRAW));
+    GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+
+    GL_CHECK(glGenBuffers(1, &g->command_buffer));
+    GL_CHECK(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, g->command_buffer));
+    GL_CHECK(glBufferData(
+        GL_DRAW_INDIRECT_BUFFER, BLOCK_COUNT * sizeof(draw_command), NULL, GL_DYNAMIC_DRAW));
+    GL_CHECK(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0));
+
+    if (load_compute_program(&cull_program, "shader/lod_cull.comp") != NM_SUCCESS) {
+        return NM_FAIL;
+    }
+
+    cull_program.use();
+    cull_program.set_uint("DEF_CLIPMAP_LEVEL_SIZE", CLIPMAP_LEVEL_SIZE);
+    cull_program.set_uint("DEF_CLIPMAP_LEVEL_COUNT", CLIPMAP_LEVEL_COUNT);
+    cull_program.set_float("DEF_CLIPMAP_SCALE", CLIPMAP_SCALE);
+    cull_program.set_float("DEF_TERRAIN_AMP", TERRAIN_AMP);
+    cull_program.set_float("DEF_TERRAIN_WATER_LVL", TERRAIN_WATER_LVL);
+    cull_program.set_uint("DEF_HEIGHT_BOUNDS_CELL_SIZE", HEIGHT_BOUNDS_CELL_SIZE);
+    cull_program.set_uint("DEF_HEIGHT_BOUNDS_CELL_COUNT", HEIGHT_BOUNDS_CELL_COUNT);
+    cull_program.unuse();
+
+    return NM_SUCCESS;
+}
+
+// offset.x and offset.y are either 0 or 1 (width of trim)
+
+static inline bool trim_cond_pos_x_neg_z(const nm::ivec2& offset)
+{
+    return offset.x == 0 && offset.y == 1;
+}
+
+static inline bool trim_cond_neg_x_neg_z(const nm::ivec2& offset)
+{
+    return offset.x == 1 && offset.y == 1;
+}
+
+static inline bool trim_cond_pos_x_pos_z(const nm::ivec2& offset)
+{
+    return offset.x == 0 && offset.y == 0;
+}
+
+static inline bool trim_cond_neg_x_pos_z(const nm::ivec2& offset)
+{
+    return offset.x == 1 && offset.y == 0;
+}
+
+/// Sets the draw info of a type of block. cond is null for blocks that are not
+/// trims.
+static void set_block(geometry* g, uint32_t index, const block& block, trim_cond cond)
 {
-    GL_CHECK(glGenBuffers(1, &g->uniform_buffer));
-    GL_CHECK(glBindBuffer(GL_UNIFORM_BUFFER, g->uniform_buffer));
-
-    // per level we draw at most 12 regular blocks, 4 fixups, 1 trim,
-    // 4 degenerate strips. for level zero we may additionally draw a quadlet,
-    // 4 fixups and 4 regular blocks (at most since frustum culling)
-    // double the UBO size just in case we have very high levels for UBO buffer
-    // alignment
-    g->uniform_buffer_size =
-        2 * ((12 + 4 + 1 + 4) * CLIPMAP_LEVEL_COUNT + 1 + 4 + 4) * sizeof(instance_data);
-    GL_CHECK(glBufferData(GL_UNIFORM_BUFFER, g->uniform_buffer_size, NULL, GL_STREAM_DRAW));
-
-    GL_CHECK(glBindBuffer(GL_UNIFORM_BUFFER, 0));
+    draw_info* info             = &g->draw_infos[index];
+    info->index_buffer_offset   = block.offset;
+    info->index_count           = block.count;
+    info->range                 = block.range;
+    info->instance_count        = 0;
+    info->uniform_buffer_offset = 0;
+    g->block_conds[index]       = cond;
 }
 
-void init(geometry* g)
+/// Lists the placements of all types of blocks, in the order of the draw
+/// infos. The placements relative to the level offsets never change.
+static void setup_placements(geometry* g)
+{
+    static_assert(
+        CULL_MAX_PLACEMENT_COUNT == MESH_MAX_INSTANCE_COUNT,
+        "each placement can be an instance in the vertex shaders");
+    static_assert(CULL_BLOCK_COUNT == BLOCK_COUNT, "a draw info for each type of block");
+
+    const mesh& m = g->mesh;
+
+    // in the order of add_clipmap_placements
+    set_block(g, 0, m.quadlet, nullptr);
+    set_block(g, 1, m.quad, nullptr);
+    set_block(g, 2, m.fixup_z, nullptr);
+    set_block(g, 3, m.fixup_x, nullptr);
+    set_block(g, 4, m.degenerate_neg_x, nullptr);
+    set_block(g, 5, m.degenerate_pos_x, nullptr);
+    set_block(g, 6, m.degenerate_neg_z, nullptr);
+    set_block(g, 7, m.degenerate_pos_z, nullptr);
+    set_block(g, 8, m.trim_neg_z_pos_x, trim_cond_pos_x_neg_z);
+    set_block(g, 9, m.trim_neg_z_neg_x, trim_cond_neg_x_neg_z);
+    set_block(g, 10, m.trim_pos_z_pos_x, trim_cond_pos_x_pos_z);
+    set_block(g, 11, m.trim_pos_z_neg_x, trim_cond_neg_x_pos_z);
+
+    nm::uvec2 ranges[BLOCK_COUNT];
+    for (uint32_t i = 0; i < BLOCK_COUNT; i++) ranges[i] = g->draw_infos[i].range;
+
+    init(&g->placements);
+    add_clipmap_placements(&g->placements, ranges, g->block_first, g->placement_ids);
+}
+
+nm_ret init(geometry* g, ubo_ring* ring)
 {
     init_mesh(&g->mesh);
-    setup_uniform_buffer(g);
+    setup_placements(g);
+    g->draw_list_size       = 0;
+    g->ring                 = ring;
+    g->uniform_offset       = 0;
+    g->is_uploaded          = false;
+    g->bounds               = nullptr;
+    g->level_octaves        = nullptr;
+    g->first_complete_level = 0;
+    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) g->bounds_versions[i] = 0;
+    g->is_gpu_culling       = false;
+    g->is_coherent          = false;
+    g->is_draw_list_valid   = false;
+    g->stats.rebuilt_count  = 0;
+    g->stats.reused_count   = 0;
     nm::load_gl_constants(g->gl_ubo_alignment, g->gl_max_compute_work_group_count);
+
+    return setup_cull_buffers(g);
 }
 
 void cleanup(geometry* g)
 {
-    GL_CHECK(glDeleteBuffers(1, &g->uniform_buffer));
+    cull_program.cleanup();
+    GL_CHECK(glDeleteBuffers(1, &g->command_buffer));
+    GL_CHECK(glDeleteBuffers(1, &g->bounds_buffer));
+    GL_CHECK(glDeleteBuffers(1, &g->instance_buffer));
+    GL_CHECK(glDeleteBuffers(1, &g->candidate_buffer));
     cleanup_mesh(&g->mesh);
 }
 
@@ -69,452 +186,311 @@ static inline T* buffer_offset(T* buffer, size_t offset)
     return reinterpret_cast<T*>(reinterpret_cast<uint8_t*>(buffer) + offset);
 }
 
-/// Returns true if a block with the given range, level, and offset
-/// intersects the current frustum.
-bool intersects_frustum(geometry* g, nm::ivec2 offset, nm::uvec2 range, uint32_t level)
-{
-    // grid-space level offset
-    nm::fvec3 lvl_off = nm::fvec3(g->level_offsets[level].x, 0.f, g->level_offsets[level].y);
-
-    // world-space mesh offset
-    nm::fvec3 pos = (lvl_off + nm::fvec3(offset.x, 0.f, offset.y)) * CLIPMAP_SCALE;
-    // world-space mesh extent
-    nm::fvec3 extent =
-        nm::fvec3(float(range.x), 0.f, float(range.y)) * float(1u << level) * CLIPMAP_SCALE;
-    // noise will be in [0, <2]
-    extent.y = TERRAIN_AMP * 2.f;
-
-    // get two terrain points
-    nm::fvec3 start = pos;
-    nm::fvec3 end   = pos + extent;
-
-    // the aabb needs the actual minimum and maximum points
-    nm::aabb bb;
-    bb.min = nm::min(start, end);
-    bb.max = nm::max(start, end);
-
-    // add some margin to deal with precision issues
-    bb.min -= nm::fvec3(.02f);
-    bb.max += nm::fvec3(.02f);
-
-    return intersect(&g->frustum, &bb);
-}
-
 /// Sets the UBO offset of the passed-in draw info to the passed-in UBO
 /// offset. Updates the passed-in UBO offset based on the draw info.
-/// Returns a pointer to the next draw info.
-draw_info* update_draw_list(geometry* g, draw_info* info, size_t* uniform_buffer_offset)
+static void update_draw_list(geometry* g, draw_info* info, size_t* uniform_buffer_offset)
 {
     info->uniform_buffer_offset = *uniform_buffer_offset;
 
-    // have to ensure that the uniform buffer is always bound at aligned offsets
+    // have to ensure that the uniform buffer is always bound at aligned offsets,
+    // the instances of lod_cull.comp are bound at once
+    size_t alignment       = g->is_gpu_culling ? sizeof(instance_data) : g->gl_ubo_alignment;
     *uniform_buffer_offset = realign_offset(
-        *uniform_buffer_offset + info->instance_count * sizeof(instance_data), g->gl_ubo_alignment);
-
-    return ++info;
+        *uniform_buffer_offset + info->instance_count * sizeof(instance_data), alignment);
 }
 
-/// The singular 3x3 quadlet.
-draw_info get_draw_info_quadlet(geometry* g, instance_data* instances)
+/// Returns the offset of the level from the previous level, in texels of the
+/// level. Either 0 or 1 in both dimensions (width of trim).
+static nm::ivec2 get_trim_offset(const geometry* g, uint32_t level)
 {
-    draw_info info;
-    info.instance_count      = 0;
-    info.index_buffer_offset = g->mesh.quadlet.offset;
-    info.index_count         = g->mesh.quadlet.count;
+    nm::ivec2 offset_prev_level    = g->level_offsets[level - 1];
+    nm::ivec2 offset_current_level = g->level_offsets[level] + ((CLIPMAP_SIZE - 1) << level);
 
-    instance_data instance;
-
-    instance.level  = 0;
-    instance.offset = nm::ivec2(2, 2) * (CLIPMAP_SIZE - 1);
-    instance.id     = 0;
-
-    if (intersects_frustum(g, instance.offset, g->mesh.quadlet.range, 0)) {
-        *instances++ = instance;
-        info.instance_count++;
-    }
-
-    return info;
+    return (offset_prev_level - offset_current_level) / int32_t(1u << level);
 }
 
-/// These are the basic MxM tesselated quads.
-draw_info get_draw_info_quads(geometry* g, instance_data* instances)
+/// Returns true if the placement intersects the frustum in the last culling
+/// pass, and counts it in the statistics.
+static bool is_visible(geometry* g, uint32_t placement)
 {
-    draw_info info;
-    info.instance_count      = 0;
-    info.index_buffer_offset = g->mesh.quad.offset;
-    info.index_count         = g->mesh.quad.count;
-
-    instance_data instance;
-    instance.id = 1;
+    if (g->cull.is_fitted[placement]) g->stats.fitted_count++;
 
-    // from level 1 and out, the four center blocks are already filled with the
-    // lower clipmap level, so skip these.
-    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
-        for (uint32_t z = 0; z < 4; z++) {
-            for (uint32_t x = 0; x < 4; x++) {
-                if (i > 0 && z != 0 && z != 3 && x != 0 && x != 3) {
-                    // already occupied, skip. (except for level 0)
-                    continue;
-                }
-
-                instance.level  = i;
-                instance.offset = nm::ivec2(x, z) * ((CLIPMAP_SIZE - 1) << i);
-
-                // skip 2 texels horizontally and vertically at the middle to
-                // get a symmetric structure. these regions are filled with
-                // horizontal and vertical fixup regions
-                if (x >= 2) instance.offset.x += 2 << i;
-                if (z >= 2) instance.offset.y += 2 << i;
-
-                if (intersects_frustum(g, instance.offset, g->mesh.quad.range, i)) {
-                    *instances++ = instance;
-                    info.instance_count++;
-                }
-            }
-        }
+    if (g->cull.visible[placement] & 1u) {
+        g->stats.instance_count++;
+        return true;
     }
 
-    return info;
+    // culled only because of the height bounds
+    if (g->cull.coarse_visible[placement] & 1u) g->stats.bounds_culled_count++;
+    return false;
 }
 
-draw_info get_draw_info_fixup_z(geometry* g, instance_data* instances)
+/// Writes a draw command for each type of block with all of its candidates and
+/// dispatches lod_cull.comp, which compacts the visible candidates.
+static void cull_blocks(geometry* g)
 {
-    draw_info info;
-    instance_data instance;
-
-    // Vertical
-    info.index_buffer_offset = g->mesh.fixup_z.offset;
-    info.index_count         = g->mesh.fixup_z.count;
-    info.instance_count      = 0;
-
-    instance.level = 0;
-    instance.id    = 2;
-
-    // +(CLIPMAP_SIZE - 1) offset in z from the -z one at level 0
-    instance.offset = nm::ivec2(2 * (CLIPMAP_SIZE - 1), (CLIPMAP_SIZE - 1));
-
-    if (intersects_frustum(g, instance.offset, g->mesh.fixup_z.range, 0)) {
-        *instances++ = instance;
-        info.instance_count++;
+    draw_command commands[BLOCK_COUNT];
+    nm::uvec2 block_ranges[BLOCK_COUNT];
+    uint32_t candidate_count = 0;
+    for (uint32_t i = 0; i < BLOCK_COUNT; i++) {
+        const draw_info& di = g->draw_infos[i];
+        commands[i].index_count    = di.index_count;
+        commands[i].instance_count = di.instance_count;
+        commands[i].first_index    = uint32_t(di.index_buffer_offset / sizeof(GLushort));
+        commands[i].base_vertex    = 0;
+        commands[i].base_instance  = uint32_t(di.uniform_buffer_offset / sizeof(instance_data));
+        block_ranges[i]            = di.range;
+        candidate_count += di.instance_count;
     }
+    assert(candidate_count <= MESH_MAX_INSTANCE_COUNT);
 
-    // -(CLIPMAP_SIZE - 1) offset in z from the +z one at level 0
-    instance.offset = nm::ivec2(2 * (CLIPMAP_SIZE - 1), 2 * (CLIPMAP_SIZE - 1) + 2);
-
-    if (intersects_frustum(g, instance.offset, g->mesh.fixup_z.range, 0)) {
-        *instances++ = instance;
-        info.instance_count++;
-    }
+    GL_CHECK(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, g->command_buffer));
+    GL_CHECK(glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(commands), commands));
+    GL_CHECK(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0));
 
-    instance.id = 3;
+    GLuint is_valid[CLIPMAP_LEVEL_COUNT];
+    nm::ivec2 origins[CLIPMAP_LEVEL_COUNT];
+    float margins[CLIPMAP_LEVEL_COUNT];
+    float truncations[CLIPMAP_LEVEL_COUNT];
+    bool is_fitting = g->bounds != nullptr;
     for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
-        // Top region
-        instance.level = i;
-
-        instance.offset = nm::ivec2(2 * (CLIPMAP_SIZE - 1), 0) * (1 << i);
-
-        if (intersects_frustum(g, instance.offset, g->mesh.fixup_z.range, i)) {
-            *instances++ = instance;
-            info.instance_count++;
-        }
-
-        // Bottom region
-        instance.offset = nm::ivec2(2 * (CLIPMAP_SIZE - 1), 3 * (CLIPMAP_SIZE - 1) + 2) * (1 << i);
-
-        if (intersects_frustum(g, instance.offset, g->mesh.fixup_z.range, i)) {
-            *instances++ = instance;
-            info.instance_count++;
-        }
+        is_valid[i]    = is_fitting && g->bounds->is_valid[i];
+        origins[i]     = is_fitting ? g->bounds->origins[i] : nm::ivec2(0);
+        margins[i]     = is_fitting ? g->bounds->margins[i] : 0.f;
+        truncations[i] = is_fitting ? TERRAIN_AMP * get_truncation_bound(g->level_octaves[i]) : 0.f;
     }
 
-    return info;
-}
-
-draw_info get_draw_info_fixup_x(geometry* g, instance_data* instances)
-{
-    draw_info info;
-    instance_data instance;
-
-    // Horizontal
-    info.index_buffer_offset = g->mesh.fixup_x.offset;
-    info.index_count         = g->mesh.fixup_x.count;
-    info.instance_count      = 0;
-
-    // for the first level, we draw two more horizontal fixups
-    instance.level = 0;
-    instance.id    = 2;
-
-    // +(CLIPMAP_SIZE - 1) offset in x from the -x one at level 0
-    instance.offset = nm::ivec2((CLIPMAP_SIZE - 1), 2 * (CLIPMAP_SIZE - 1));
-
-    if (intersects_frustum(g, instance.offset, g->mesh.fixup_x.range, 0)) {
-        *instances++ = instance;
-        info.instance_count++;
+    if (is_fitting) {
+        GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, g->bounds_buffer));
+        GL_CHECK(glBufferSubData(
+            GL_SHADER_STORAGE_BUFFER, 0, sizeof(g->bounds->cells), g->bounds->cells));
+        GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
     }
 
-    // -(CLIPMAP_SIZE - 1) offset in x from the +x one at level 0
-    instance.offset = nm::ivec2(2 * (CLIPMAP_SIZE - 1) + 2, 2 * (CLIPMAP_SIZE - 1));
-
-    if (intersects_frustum(g, instance.offset, g->mesh.fixup_x.range, 0)) {
-        *instances++ = instance;
-        info.instance_count++;
+    cull_program.use();
+    GL_CHECK(glUniform4fv(
+        cull_program.get_uniform_loc("uni_planes"), 6, (const GLfloat*)g->frustum.planes));
+    cull_program.set_ivec2_array("uni_lvl_off", g->level_offsets, CLIPMAP_LEVEL_COUNT);
+    GL_CHECK(glUniform2uiv(
+        cull_program.get_uniform_loc("uni_block_range"),
+        BLOCK_COUNT,
+        (const GLuint*)block_ranges));
+    cull_program.set_uint("uni_first_lvl", g->first_complete_level);
+    cull_program.set_uint("uni_is_fitting", is_fitting);
+    GL_CHECK(glUniform1uiv(
+        cull_program.get_uniform_loc("uni_bounds_valid"), CLIPMAP_LEVEL_COUNT, is_valid));
+    cull_program.set_ivec2_array("uni_bounds_origin", origins, CLIPMAP_LEVEL_COUNT);
+    cull_program.set_float_array("uni_bounds_margin", margins, CLIPMAP_LEVEL_COUNT);
+    cull_program.set_float_array("uni_truncation", truncations, CLIPMAP_LEVEL_COUNT);
+
+    GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, g->candidate_buffer));
+    GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, g->instance_buffer));
+    GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, g->command_buffer));
+    GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, g->bounds_buffer));
+
+    GL_CHECK(glDispatchCompute(BLOCK_COUNT, 1, 1));
+
+    // the commands are read by the indirect draws, the instances as uniforms
+    GL_CHECK(glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_UNIFORM_BARRIER_BIT));
+
+    for (GLuint i = 0; i < 4; i++) {
+        GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, 0));
     }
-
-    // for each level, follow the same process and draw two fixups
-    instance.id = 3;
-    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
-        // Left side horizontal fixup region.
-        // Texel coordinates are derived by just dividing the world space offset with texture size.
-        // The 0.5 texel offset required to sample exactly at the texel center is done in vertex shader.
-        instance.level = i;
-
-        instance.offset = nm::ivec2(0, 2 * (CLIPMAP_SIZE - 1)) * (1 << i);
-
-        // only add the instance if it's visible
-        if (intersects_frustum(g, instance.offset, g->mesh.fixup_x.range, i)) {
-            *instances++ = instance;
-            info.instance_count++;
-        }
-
-        // ight side horizontal fixup region
-        instance.offset = nm::ivec2(3 * (CLIPMAP_SIZE - 1) + 2, 2 * (CLIPMAP_SIZE - 1)) * (1 << i);
-
-        // only add the instance if it's visible
-        if (intersects_frustum(g, instance.offset, g->mesh.fixup_x.range, i)) {
-            *instances++ = instance;
-            info.instance_count++;
-        }
-    }
-
-    return info;
+    cull_program.unuse();
 }
 
-draw_info get_draw_info_degenerate(
-    geometry* g,
-    instance_data* instances,
-    const block& block,
-    const nm::ivec2& offset,
-    const nm::ivec2& ring_offset,
-    int id)
+/// Returns a bit for each level whose blocks moved or whose boxes changed, see
+/// is_coherent, and sets is_frustum_changed if the frustum differs from the
+/// previous update. The previous draw list can be reused if neither changed.
+static uint32_t get_changed_levels(const geometry* g, bool* is_frustum_changed)
 {
-    draw_info info;
-    info.instance_count      = 0;
-    info.index_buffer_offset = block.offset;
-    info.index_count         = block.count;
-
-    instance_data instance;
-    instance.id = id;
-
-    // no need to connect the last clipmap level to next level (there is none)
-    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT - 1; i++) {
-        instance.level  = i;
-        instance.offset = offset * (1 << i);
-
-        // due to horizontal and vertical fixup region,
-        // additional offset is (2 extra texels) is required.
-        instance.offset += ring_offset * (1 << i);
-
-        if (intersects_frustum(g, instance.offset, block.range, i)) {
-            *instances++ = instance;
-            info.instance_count++;
-        }
+    *is_frustum_changed = true;
+    if (!g->is_coherent || !g->is_draw_list_valid) return CULL_ALL_LEVELS;
+
+    // these change the boxes or the visibility of all blocks
+    if (g->is_gpu_culling != g->prev_is_gpu_culling) return CULL_ALL_LEVELS;
+    if (g->first_complete_level != g->prev_first_complete_level) return CULL_ALL_LEVELS;
+    for (uint32_t i = 0; g->level_octaves && i < CLIPMAP_LEVEL_COUNT; i++) {
+        if (g->level_octaves[i] != g->prev_level_octaves[i]) return CULL_ALL_LEVELS;
     }
 
-    return info;
-}
+    *is_frustum_changed = memcmp(&g->frustum, &g->prev_frustum, sizeof(nm::frustum)) != 0;
 
-draw_info get_draw_info_degenerate_neg_x(geometry* g, instance_data* instances)
-{
-    return get_draw_info_degenerate(
-        g, instances, g->mesh.degenerate_neg_x, nm::ivec2(0), nm::ivec2(0), 4);
-}
-
-draw_info get_draw_info_degenerate_pos_x(geometry* g, instance_data* instances)
-{
-    return get_draw_info_degenerate(
-        g,
-        instances,
-        g->mesh.degenerate_pos_x,
-        nm::ivec2(4 * (CLIPMAP_SIZE - 1), 0),
-        nm::ivec2(2, 0),
-        5);
-}
+    uint32_t changed_levels = 0u;
+    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
+        if (g->level_offsets[i] != g->prev_level_offsets[i]) changed_levels |= 1u << i;
+        if (g->bounds_versions[i] == g->prev_bounds_versions[i]) continue;
 
-draw_info get_draw_info_degenerate_neg_z(geometry* g, instance_data* instances)
-{
-    return get_draw_info_degenerate(
-        g, instances, g->mesh.degenerate_neg_z, nm::ivec2(0), nm::ivec2(0), 6);
-}
+        // the blocks of incomplete levels are fitted to the first complete one
+        changed_levels |= 1u << i;
+        if (i == g->first_complete_level) changed_levels |= (1u << i) - 1u;
+    }
 
-draw_info get_draw_info_degenerate_pos_z(geometry* g, instance_data* instances)
-{
-    return get_draw_info_degenerate(
-        g,
-        instances,
-        g->mesh.degenerate_pos_z,
-        nm::ivec2(0, 4 * (CLIPMAP_SIZE - 1)),
-        nm::ivec2(0, 2),
-        7);
+    return changed_levels;
 }
 
-draw_info get_draw_info_trim(
-    geometry* g, instance_data* instances, const block& block, trim_cond cond)
+/// Remembers the inputs of the draw list, see is_coherent.
+static void store_draw_list_inputs(geometry* g)
 {
-    draw_info info;
-    info.index_buffer_offset = block.offset;
-    info.index_count         = block.count;
-    info.instance_count      = 0;
-
-    instance_data instance;
-    instance.id = 7;
-
-    // from level 1 and out, we only need a single L-shaped trim region
-    for (uint32_t i = 1; i < CLIPMAP_LEVEL_COUNT; i++) {
-        nm::ivec2 offset_prev_level    = g->level_offsets[i - 1];
-        nm::ivec2 offset_current_level = g->level_offsets[i] + ((CLIPMAP_SIZE - 1) << i);
-
-        // there are four different ways (top-right, bottom-right, top-left,
-        // bottom-left) to apply a trim region depending on how camera snapping
-        // is done in get_offset_level(). a function pointer is introduced here
-        // so we can check if a particular trim type should be used for this
-        // level. only one conditional will return true for a given level.
-
-        nm::ivec2 off = (offset_prev_level - offset_current_level) / int32_t(1u << i);
-        if (!cond(off)) continue;
-
-        instance.level  = i;
-        instance.offset = nm::ivec2((CLIPMAP_SIZE - 1) << i);
-
-        if (intersects_frustum(g, instance.offset, block.range, i)) {
-            *instances++ = instance;
-            info.instance_count++;
-        }
+    g->is_draw_list_valid        = true;
+    g->prev_frustum              = g->frustum;
+    g->prev_first_complete_level = g->first_complete_level;
+    g->prev_is_gpu_culling       = g->is_gpu_culling;
+    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
+        g->prev_level_offsets[i]   = g->level_offsets[i];
+        g->prev_level_octaves[i]   = g->level_octaves ? g->level_octaves[i] : 0u;
+        g->prev_bounds_versions[i] = g->bounds_versions[i];
     }
-
-    return info;
 }
 
-// offset.x and offset.y are either 0 or 1 (width of trim)
-
-static inline bool trim_cond_pos_x_neg_z(const nm::ivec2& offset)
+/// Copies the draw list to the uniform data of the frame, which the instances
+/// are drawn from.
+static void upload_draw_list(geometry* g)
 {
-    return offset.x == 0 && offset.y == 1;
-}
+    g->is_uploaded = false;
+    if (g->draw_list_size == 0) return;
 
-static inline bool trim_cond_neg_x_neg_z(const nm::ivec2& offset)
-{
-    return offset.x == 1 && offset.y == 1;
-}
+    void* data = map_range(g->ring, g->draw_list_size, &g->uniform_offset);
+    if (!data) return;
 
-static inline bool trim_cond_pos_x_pos_z(const nm::ivec2& offset)
-{
-    return offset.x == 0 && offset.y == 0;
-}
+    memcpy(data, g->draw_list, g->draw_list_size);
 
-static inline bool trim_cond_neg_x_pos_z(const nm::ivec2& offset)
-{
-    return offset.x == 1 && offset.y == 0;
+    unmap_ranges(g->ring);
+    g->is_uploaded = true;
 }
 
-draw_info get_draw_info_trim_pos_x_neg_z(geometry* g, instance_data* instances)
+/// Copies the draw list to the candidates of lod_cull.comp. Returns false if
+/// the buffer could not be mapped.
+static bool upload_candidates(geometry* g)
 {
-    return get_draw_info_trim(g, instances, g->mesh.trim_neg_z_pos_x, trim_cond_pos_x_neg_z);
-}
+    const size_t candidate_size = MESH_MAX_INSTANCE_COUNT * sizeof(instance_data);
+    assert(g->draw_list_size <= candidate_size);
 
-draw_info get_draw_info_trim_neg_x_neg_z(geometry* g, instance_data* instances)
-{
-    return get_draw_info_trim(g, instances, g->mesh.trim_neg_z_neg_x, trim_cond_neg_x_neg_z);
-}
+    GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, g->candidate_buffer));
+    void* data = glMapBufferRange(
+        GL_SHADER_STORAGE_BUFFER,
+        0,
+        candidate_size,
+        GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_WRITE_BIT);
+    GL_CHECK_ERRORS();
 
-draw_info get_draw_info_trim_pos_x_pos_z(geometry* g, instance_data* instances)
-{
-    return get_draw_info_trim(g, instances, g->mesh.trim_pos_z_pos_x, trim_cond_pos_x_pos_z);
-}
+    if (data) {
+        memcpy(data, g->draw_list, g->draw_list_size);
+        GL_CHECK(glUnmapBuffer(GL_SHADER_STORAGE_BUFFER));
+    }
+    GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
 
-draw_info get_draw_info_trim_neg_x_pos_z(geometry* g, instance_data* instances)
-{
-    return get_draw_info_trim(g, instances, g->mesh.trim_pos_z_neg_x, trim_cond_neg_x_pos_z);
+    return data != nullptr;
 }
 
 void update_draw_list(geometry* g)
 {
-    GL_CHECK(glBindBuffer(GL_UNIFORM_BUFFER, g->uniform_buffer));
-    instance_data* data = (instance_data*)glMapBufferRange(
-        GL_UNIFORM_BUFFER,
-        0,
-        g->uniform_buffer_size,
-        GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_WRITE_BIT);
-    GL_CHECK_ERRORS();
-
-    if (!data) {
-        nm::log(nm::LOG_ERROR, "failed to map uniform buffer\n");
+    bool is_frustum_changed;
+    uint32_t changed_levels = get_changed_levels(g, &is_frustum_changed);
+    if (!changed_levels && !is_frustum_changed) {
+        g->stats.culled_level_count = 0;
+        g->stats.reused_count++;
+
+        // the uniform data of previous frames is overwritten by later ones
+        if (!g->is_gpu_culling) upload_draw_list(g);
         return;
     }
 
+    g->stats.instance_count       = 0;
+    g->stats.fitted_count         = 0;
+    g->stats.bounds_culled_count  = 0;
+    g->stats.rejected_level_count = 0;
+    g->stats.culled_level_count   = 0;
+    g->stats.is_gpu_culled        = g->is_gpu_culling;
+
+    if (!g->is_gpu_culling) {
+        cull_input input;
+        input.frusta               = &g->frustum;
+        input.frustum_count        = 1;
+        input.level_offsets        = g->level_offsets;
+        input.bounds               = g->bounds;
+        input.level_octaves        = g->level_octaves;
+        input.first_complete_level = g->first_complete_level;
+        input.level_mask           = changed_levels;
+        input.is_frustum_changed   = is_frustum_changed;
+        cull(&g->placements, &input, &g->cull);
+
+        g->stats.rejected_level_count = g->cull.rejected_level_count;
+        for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
+            if (g->cull.culled_level_mask & (1u << i)) g->stats.culled_level_count++;
+        }
+    }
+
     // byte offset, multiples of uniform_buffer_align
     size_t uniform_buffer_offset = 0;
 
     // create a draw list. the number of draw calls is equal to the different
-    // types of blocks. the blocks are instanced as necessary in the
-    // get_draw_info* calls.
-
-    draw_info* info = g->draw_infos;
-
-    // 3x3 block
-    *info = get_draw_info_quadlet(g, buffer_offset(data, uniform_buffer_offset));
-    info  = update_draw_list(g, info, &uniform_buffer_offset);
-
-    // main blocks
-    *info = get_draw_info_quads(g, buffer_offset(data, uniform_buffer_offset));
-    info  = update_draw_list(g, info, &uniform_buffer_offset);
-
-    // z direction ring fixups
-    *info = get_draw_info_fixup_z(g, buffer_offset(data, uniform_buffer_offset));
-    info  = update_draw_list(g, info, &uniform_buffer_offset);
+    // types of blocks. each type of block is instanced at its visible
+    // placements.
+    for (uint32_t i = 0; i < BLOCK_COUNT; i++) {
+        draw_info* info          = &g->draw_infos[i];
+        instance_data* instances = buffer_offset(g->draw_list, uniform_buffer_offset);
+        info->instance_count     = 0;
 
-    // x direction ring fixups
-    *info = get_draw_info_fixup_x(g, buffer_offset(data, uniform_buffer_offset));
-    info  = update_draw_list(g, info, &uniform_buffer_offset);
+        for (uint32_t j = g->block_first[i]; j < g->block_first[i + 1]; j++) {
+            uint32_t level = g->placements.levels[j];
 
-    // -x degenerates
-    *info = get_draw_info_degenerate_neg_x(g, buffer_offset(data, uniform_buffer_offset));
-    info  = update_draw_list(g, info, &uniform_buffer_offset);
+            // there are four different ways (top-right, bottom-right, top-left,
+            // bottom-left) to apply a trim region depending on how camera
+            // snapping is done in get_offset_level(). only one condition will
+            // return true for a given level.
+            if (g->block_conds[i] && !g->block_conds[i](get_trim_offset(g, level))) continue;
 
-    // +x degenerates
-    *info = get_draw_info_degenerate_pos_x(g, buffer_offset(data, uniform_buffer_offset));
-    info  = update_draw_list(g, info, &uniform_buffer_offset);
+            if (!g->is_gpu_culling && !is_visible(g, j)) continue;
 
-    // -z degenerates
-    *info = get_draw_info_degenerate_neg_z(g, buffer_offset(data, uniform_buffer_offset));
-    info  = update_draw_list(g, info, &uniform_buffer_offset);
+            instance_data* instance = &instances[info->instance_count++];
+            instance->offset = nm::ivec2(g->placements.offsets_x[j], g->placements.offsets_z[j]);
+            instance->level  = level;
+            instance->id     = g->placement_ids[j];
+        }
 
-    // +z degenerates
-    *info = get_draw_info_degenerate_pos_z(g, buffer_offset(data, uniform_buffer_offset));
-    info  = update_draw_list(g, info, &uniform_buffer_offset);
+        update_draw_list(g, info, &uniform_buffer_offset);
+    }
+    g->draw_list_size = uniform_buffer_offset;
+
+    // without gpu culling, the instances are drawn from the uniform data.
+    // otherwise, lod_cull.comp reads them as candidates
+    if (!g->is_gpu_culling) {
+        upload_draw_list(g);
+    } else if (upload_candidates(g)) {
+        cull_blocks(g);
+    } else {
+        nm::log(nm::LOG_ERROR, "failed to map instance buffer\n");
+        g->is_draw_list_valid = false;
+        return;
+    }
 
-    // +x,-z trim
-    *info = get_draw_info_trim_pos_x_neg_z(g, buffer_offset(data, uniform_buffer_offset));
-    info  = update_draw_list(g, info, &uniform_buffer_offset);
+    store_draw_list_inputs(g);
+    g->stats.rebuilt_count++;
+}
 
-    // -x,-z trim
-    *info = get_draw_info_trim_neg_x_neg_z(g, buffer_offset(data, uniform_buffer_offset));
-    info  = update_draw_list(g, info, &uniform_buffer_offset);
+void render(geometry* g)
+{
+    if (g->is_gpu_culling) {
+        // the instances of all commands are bound at once, each command
+        // indexes them starting at its base instance
+        GL_CHECK(glBindBufferRange(
+            GL_UNIFORM_BUFFER,
+            0,
+            g->instance_buffer,
+            0,
+            MESH_MAX_INSTANCE_COUNT * sizeof(instance_data)));
+        GL_CHECK(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, g->command_buffer));
 
-    // +x,+z trim
-    *info = get_draw_info_trim_pos_x_pos_z(g, buffer_offset(data, uniform_buffer_offset));
-    info  = update_draw_list(g, info, &uniform_buffer_offset);
+        render_mesh_indirect(&g->mesh, BLOCK_COUNT);
 
-    // -x,+z trim
-    *info = get_draw_info_trim_neg_x_pos_z(g, buffer_offset(data, uniform_buffer_offset));
-    info  = update_draw_list(g, info, &uniform_buffer_offset);
+        GL_CHECK(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0));
+        GL_CHECK(glBindBufferBase(GL_UNIFORM_BUFFER, 0, 0));
+        return;
+    }
 
-    GL_CHECK(glUnmapBuffer(GL_UNIFORM_BUFFER));
-    GL_CHECK(glBindBuffer(GL_UNIFORM_BUFFER, 0));
-}
+    if (!g->is_uploaded) return;
 
-void render(geometry* g)
-{
-    GL_CHECK(glBindBuffer(GL_UNIFORM_BUFFER, g->uniform_buffer));
     for (uint32_t i = 0; i < BLOCK_COUNT; i++) {
         draw_info di = g->draw_infos[i];
         if (di.instance_count == 0) continue;
@@ -524,13 +500,12 @@ void render(geometry* g)
         GL_CHECK(glBindBufferRange(
             GL_UNIFORM_BUFFER,
             0,
-            g->uniform_buffer,
-            di.uniform_buffer_offset,
+            g->ring->buffer,
+            g->uniform_offset + di.uniform_buffer_offset,
             realign_offset(di.instance_count * sizeof(instance_data), g->gl_ubo_alignment)));
 
         // draw all instances
         render_mesh(&g->mesh, di);
     }
-    GL_CHECK(glBindBuffer(GL_UNIFORM_BUFFER, 0));
     GL_CHECK(glBindBufferBase(GL_UNIFORM_BUFFER, 0, 0));
 }
\ No newline at end of file
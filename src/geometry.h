@@ -1,9 +1,12 @@
 #ifndef TERRAIN3_GEOMETRY_H
 #define TERRAIN3_GEOMETRY_H
 
+#include "cull.h"
+#include "height_bounds.h"
 #include "mesh.h"
 #include "nmutil/intersect.h"
 #include "terrain_defs.h"
+#include "ubo_ring.h"
 #include <nmutil/gl.h>
 #include <nmutil/matrix.h>
 
@@ -13,30 +16,116 @@
 
 /// With instanced drawing we can draw each type of mesh with a single call.
 
+/// Statistics of the last draw list update.
+struct geometry_stats {
+    /// Number of instances that intersect the frustum.
+    uint32_t instance_count;
+    /// Number of instances whose box was fitted to the height bounds.
+    uint32_t fitted_count;
+    /// Number of instances that are culled, but would intersect the frustum
+    /// with a box that spans the complete height range of the terrain.
+    uint32_t bounds_culled_count;
+    /// Number of levels whose ring of blocks lies outside of the frustum.
+    uint32_t rejected_level_count;
+    /// Number of levels whose blocks were culled again, see is_coherent.
+    uint32_t culled_level_count;
+    /// Number of draw list updates that rebuilt the draw list and that reused
+    /// the previous one, since init.
+    uint32_t rebuilt_count;
+    uint32_t reused_count;
+    /// If true, the instances were culled on the GPU, which does not count
+    /// them.
+    bool is_gpu_culled;
+};
+
+/// Maximum number of instances in the draw list, including the padding that
+/// aligns the instances of each type of block. Per level we draw at most 12
+/// regular blocks, 4 fixups, 1 trim, 4 degenerate strips. For level zero we may
+/// additionally draw a quadlet, 4 fixups and 4 regular blocks (at most since
+/// frustum culling). Doubled just in case we have very high levels for UBO
+/// buffer alignment.
+#define GEOMETRY_MAX_INSTANCE_COUNT (2 * ((12 + 4 + 1 + 4) * CLIPMAP_LEVEL_COUNT + 1 + 4 + 4))
+
+/// Operates on a grid coordinate.
+typedef bool (*trim_cond)(const nm::ivec2& offset);
+
 struct geometry {
     /// Contains the static mesh which is used to represent the geometry.
     mesh mesh;
 
-    /// UBO maintains the positions and the levels for all meshes.
-    GLuint uniform_buffer;
-    size_t uniform_buffer_size;
+    /// The draw list maintains the positions and the levels for all meshes,
+    /// draw_list_size is its size in bytes. Without gpu culling, it is copied
+    /// to the ring every frame, also when it is reused, as the segment of a
+    /// frame is overwritten by a later frame. The copy is at most 7 kilobytes.
+    alignas(16) instance_data draw_list[GEOMETRY_MAX_INSTANCE_COUNT];
+    size_t draw_list_size;
+    ubo_ring* ring;
+    /// Start of the draw list in the ring, if it is uploaded in this frame.
+    size_t uniform_offset;
+    bool is_uploaded;
 
     /// As many draw calls as there are blocks.
     draw_info draw_infos[BLOCK_COUNT];
 
+    /// Every spot that a block can be drawn at, the placements of
+    /// draw_infos[i] are [block_first[i], block_first[i + 1]).
+    cull_placements placements;
+    uint32_t block_first[BLOCK_COUNT + 1];
+    /// See instance_data::id.
+    uint32_t placement_ids[CULL_MAX_PLACEMENT_COUNT];
+    /// Null, or picks the levels that the type of trim is drawn at.
+    trim_cond block_conds[BLOCK_COUNT];
+    /// Frustum culling of the placements in the last draw list update.
+    cull_result cull;
+
     /// (-x,-z)-most point of the level's mesh in grid coordinates.
     nm::ivec2 level_offsets[CLIPMAP_LEVEL_COUNT];
 
     nm::frustum frustum;
 
+    /// Optional, used to fit the boxes of the blocks to the terrain.
+    const height_bounds* bounds;
+    /// Number of octaves of each level of the heightmap, if bounds is set.
+    const uint32_t* level_octaves;
+    /// Finest level of the heightmap with complete texels, the blocks of finer
+    /// levels are rendered with the texels of this level.
+    uint32_t first_complete_level;
+    /// Change whenever the bounds of the level change.
+    uint32_t bounds_versions[CLIPMAP_LEVEL_COUNT];
+
+    /// If true, the draw list is reused as long as its inputs do not change.
+    /// Otherwise, only the blocks of the levels that moved or whose bounds
+    /// changed are culled again, along with the levels whose ring the frustum
+    /// cuts through if it changed, see cull.
+    bool is_coherent;
+    /// Inputs of the last draw list update, see is_coherent.
+    bool is_draw_list_valid;
+    nm::frustum prev_frustum;
+    nm::ivec2 prev_level_offsets[CLIPMAP_LEVEL_COUNT];
+    uint32_t prev_level_octaves[CLIPMAP_LEVEL_COUNT];
+    uint32_t prev_first_complete_level;
+    uint32_t prev_bounds_versions[CLIPMAP_LEVEL_COUNT];
+    bool prev_is_gpu_culling;
+
+    /// If true, lod_cull.comp culls the blocks and writes the draw commands,
+    /// and each program draws all types of blocks with a single indirect draw.
+    bool is_gpu_culling;
+    /// GPU culling: all instances of each type of block, the instances that
+    /// intersect the frustum, and a draw command for each type of block.
+    GLuint candidate_buffer;
+    GLuint instance_buffer;
+    GLuint command_buffer;
+    /// GPU culling: copy of the cells of the height bounds.
+    GLuint bounds_buffer;
+
+    geometry_stats stats;
+
     GLint gl_ubo_alignment;
     GLint gl_max_compute_work_group_count[3];
 };
 
-/// Operates on a grid coordinate.
-typedef bool (*trim_cond)(const nm::ivec2& offset);
-
-void init(geometry* g);
+/// The per-frame uniform data is allocated from ring.
+nm_ret init(geometry* g, ubo_ring* ring);
 
 void cleanup(geometry* g);
 
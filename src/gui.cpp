@@ -102,4 +102,191 @@ void display_pos(nm::fvec3 pos)
 
     display_text(displayed_text, 10.0f, 100.0f);
     end_frame_imgui();
+}
+
+void display_heightmap_stats(const heightmap_stats* stats)
+{
+    static char displayed_text[1024];
+
+    begin_frame_imgui();
+    int len = sprintf(
+        displayed_text,
+        "regions: %u\n"
+        "tiles: %u\n"
+        "launched: %u\n"
+        "useful: %u\n"
+        "deferred levels: %u\n"
+        "reused: %u, %.1f%% since start\n"
+        "octaves:",
+        stats->region_count,
+        stats->tile_count,
+        stats->launched_invocations,
+        stats->useful_invocations,
+        stats->deferred_level_count,
+        stats->reused_texels,
+        stats->updated_texel_sum > 0
+            ? 100. * double(stats->reused_texel_sum) / double(stats->updated_texel_sum)
+            : 0.);
+    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
+        len += sprintf(displayed_text + len, " %u", stats->level_octaves[i]);
+    }
+
+    // average generation time per texel, with all and with truncated octaves
+    double ns_per_texel[2] = {0., 0.};
+    for (uint32_t i = 0; i < 2; i++) {
+        if (stats->generate_texels[i] == 0) continue;
+        ns_per_texel[i] = stats->generate_seconds[i] * 1e9 / double(stats->generate_texels[i]);
+    }
+    len += sprintf(
+        displayed_text + len,
+        "\nall octaves: %.3f ns/texel\n"
+        "truncated: %.3f ns/texel\n",
+        ns_per_texel[0],
+        ns_per_texel[1]);
+    if (ns_per_texel[0] > 0. && ns_per_texel[1] > 0.) {
+        len += sprintf(
+            displayed_text + len,
+            "reduction: %.1f%%\n",
+            100. * (1. - ns_per_texel[1] / ns_per_texel[0]));
+    }
+
+    // average time to regenerate all levels, with all and with truncated octaves
+    double ms_per_regenerate[2] = {0., 0.};
+    for (uint32_t i = 0; i < 2; i++) {
+        if (stats->regenerate_count[i] == 0) continue;
+        ms_per_regenerate[i] = stats->regenerate_seconds[i] * 1e3 / stats->regenerate_count[i];
+    }
+    len += sprintf(
+        displayed_text + len,
+        "regenerate: %.3f ms, truncated: %.3f ms\n",
+        ms_per_regenerate[0],
+        ms_per_regenerate[1]);
+
+    // share of the tiles that were read from the tile cache
+    if (stats->cache_tile_capacity > 0) {
+        uint64_t lookup_sum = stats->cache_hit_sum + stats->cache_miss_sum;
+        len += sprintf(
+            displayed_text + len,
+            "cache: %u hits, %u misses, %.1f%% hits since start, %u of %u tiles\n",
+            stats->cache_hits,
+            stats->cache_misses,
+            lookup_sum > 0 ? 100. * double(stats->cache_hit_sum) / double(lookup_sum) : 0.,
+            stats->cache_tile_count,
+            stats->cache_tile_capacity);
+    }
+
+    // tiles that were baked offline instead of generated
+    if (stats->pack_tile_sum > 0) {
+        len += sprintf(
+            displayed_text + len,
+            "pack: %u tiles, %llu since start\n",
+            stats->pack_tiles,
+            (unsigned long long)stats->pack_tile_sum);
+    }
+
+    // share of the updated texels that were generated ahead of time
+    uint64_t written_sum = stats->updated_texel_sum + stats->prefetch_copied_texel_sum;
+    len += sprintf(
+        displayed_text + len,
+        "prefetch: %u ahead, %u copied, %.1f%% copied since start\n",
+        stats->prefetched_texels,
+        stats->prefetch_copied_texels,
+        written_sum > 0 ? 100. * double(stats->prefetch_copied_texel_sum) / double(written_sum)
+                        : 0.);
+
+    // texels that the rendered texels moved onto without generating them
+    len += sprintf(
+        displayed_text + len,
+        "guard band: %u avoided, %llu since start\n",
+        stats->avoided_texels,
+        (unsigned long long)stats->avoided_texel_sum);
+
+    // average GPU time per frame, compare the frame time with and without
+    // pipelining
+    if (stats->frame_count > 0) {
+        double inv_count = 1e3 / double(stats->frame_count);
+        sprintf(
+            displayed_text + len,
+            "generate: %.3f ms, render: %.3f ms, frame: %.3f ms\n",
+            stats->frame_generate_seconds * inv_count,
+            stats->frame_render_seconds * inv_count,
+            stats->frame_seconds * inv_count);
+    }
+
+    display_text(displayed_text, 10.0f, 160.0f);
+    end_frame_imgui();
+}
+
+void display_pick(const raycast_hit* hit)
+{
+    static char displayed_text[128];
+
+    begin_frame_imgui();
+    if (hit->is_hit) {
+        sprintf(
+            displayed_text,
+            "pick: %.2f %.2f %.2f\n"
+            "distance: %.2f\n"
+            "steps: %u\n",
+            hit->pos.x,
+            hit->pos.y,
+            hit->pos.z,
+            hit->t,
+            hit->step_count);
+    } else {
+        sprintf(displayed_text, "pick: none\nsteps: %u\n", hit->step_count);
+    }
+
+    display_text(displayed_text, 10.0f, 420.0f);
+    end_frame_imgui();
+}
+
+void display_geometry_stats(const geometry_stats* stats)
+{
+    static char displayed_text[256];
+
+    begin_frame_imgui();
+    int length;
+    if (stats->is_gpu_culled) {
+        length = sprintf(displayed_text, "culled on the gpu\n");
+    } else {
+        length = sprintf(
+            displayed_text,
+            "instances: %u\n"
+            "fitted: %u\n"
+            "culled by bounds: %u\n"
+            "rejected levels: %u\n"
+            "culled levels: %u\n",
+            stats->instance_count,
+            stats->fitted_count,
+            stats->bounds_culled_count,
+            stats->rejected_level_count,
+            stats->culled_level_count);
+    }
+    sprintf(
+        displayed_text + length,
+        "draw list rebuilt: %u\n"
+        "draw list reused: %u\n",
+        stats->rebuilt_count,
+        stats->reused_count);
+
+    display_text(displayed_text, 10.0f, 480.0f);
+    end_frame_imgui();
+}
+
+void display_ring_stats(const ubo_ring_stats* stats)
+{
+    static char displayed_text[256];
+
+    begin_frame_imgui();
+    sprintf(
+        displayed_text,
+        "uniform data: %zu bytes\n"
+        "uniform stalls: %u\n"
+        "uniform overflows: %u\n",
+        stats->allocated_size,
+        stats->stall_count,
+        stats->overflow_count);
+    display_text(displayed_text, 10.0f, 620.0f);
+    end_frame_imgui();
 }
\ No newline at end of file
@@ -1,6 +1,10 @@
 #ifndef TERRAIN3_GUI_H
 #define TERRAIN3_GUI_H
 
+#include "geometry.h"
+#include "heightmap.h"
+#include "raycast.h"
+#include "ubo_ring.h"
 #include "window.hpp"
 
 #include <nmutil/vector.h>
@@ -22,4 +26,12 @@ void display_stats(
 
 void display_pos(nm::fvec3 pos);
 
+void display_heightmap_stats(const heightmap_stats* stats);
+
+void display_pick(const raycast_hit* hit);
+
+void display_geometry_stats(const geometry_stats* stats);
+
+void display_ring_stats(const ubo_ring_stats* stats);
+
 #endif //TERRAIN3_GUI_H
@@ -0,0 +1,195 @@
+#ifndef TERRAIN3_HEIGHT_BOUNDS_H
+#define TERRAIN3_HEIGHT_BOUNDS_H
+
+#include "nmutil/math.h"
+#include "nmutil/vector.h"
+#include "noise.h"
+#include "terrain_defs.h"
+
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+
+/// This file describes the minimum and maximum heights of the resident
+/// clipmap levels. Each level is divided into square cells of texels, which
+/// start at the (-x,-y)-most texel of the level. A cell spans from its first
+/// texel to the first texel of the next cell, which both cells include, so
+/// the cells end at the last texel of the level. Together, the levels form a
+/// pyramid: every coarser level covers twice the area with cells of twice the
+/// size. As the terrain is static, the bounds of a cell stay valid after the
+/// level has moved on. The margins grow with the texel spacing, so the ranges
+/// of coarse cells are narrowed to the ranges of the finer cells that cover
+/// them, where there are any.
+
+/// Size of a cell in texels of its level, must match the local size in
+/// lod_bounds.comp.
+#define HEIGHT_BOUNDS_CELL_SIZE 16u
+
+/// Number of cells of a single level in one dimension.
+#define HEIGHT_BOUNDS_CELL_COUNT                                                                   \
+    ((CLIPMAP_LEVEL_SIZE + HEIGHT_BOUNDS_CELL_SIZE - 1u) / HEIGHT_BOUNDS_CELL_SIZE)
+
+struct height_bounds {
+    /// Whether the level has been reduced at least once.
+    bool is_valid[CLIPMAP_LEVEL_COUNT];
+    /// World texel coordinate of the (-x,-y)-most texel of each level, at the
+    /// time the level was reduced.
+    nm::ivec2 origins[CLIPMAP_LEVEL_COUNT];
+    /// Added to both ends of the range of every cell of the level. Covers the
+    /// surface in between the texels and octaves the level did not evaluate.
+    float margins[CLIPMAP_LEVEL_COUNT];
+    /// World-space minimum (x) and maximum (y) height of the texels of each
+    /// cell, including the texels it shares with the next cells, without the
+    /// margin.
+    nm::fvec2 cells[CLIPMAP_LEVEL_COUNT][HEIGHT_BOUNDS_CELL_COUNT][HEIGHT_BOUNDS_CELL_COUNT];
+    /// Height range with margin of each cell, intersected with the union of
+    /// the ranges of the cells of the next finer level that cover the cell.
+    /// Derived from the above by refine_bounds.
+    nm::fvec2 ranges[CLIPMAP_LEVEL_COUNT][HEIGHT_BOUNDS_CELL_COUNT][HEIGHT_BOUNDS_CELL_COUNT];
+};
+
+/// Distance in meters between two texels of a level.
+inline float get_texel_spacing(uint32_t level) { return CLIPMAP_SCALE * float(1u << level); }
+
+/// Upper bound on the slope of the terrain in world space.
+#define HEIGHT_BOUNDS_SLOPE (TERRAIN_AMP * TERRAIN_SCA * NOISE_GRADIENT_BOUND)
+
+/// Returns the margin of a level whose texels evaluated the given number of
+/// octaves. Every point of a cell is at most half a diagonal texel spacing away
+/// from a texel of the cell.
+inline float get_bounds_margin(uint32_t level, uint32_t octaves)
+{
+    float interpolation = HEIGHT_BOUNDS_SLOPE * .70710678f * get_texel_spacing(level);
+    return interpolation + TERRAIN_AMP * get_truncation_bound(octaves);
+}
+
+/// Computes the ranges from the cells, must be called after the cells,
+/// origins or margins changed. Goes from fine to coarse, such that a cell
+/// inherits the narrowed ranges of all finer levels.
+inline void refine_bounds(height_bounds* bounds)
+{
+    const int32_t size      = int32_t(CLIPMAP_LEVEL_SIZE);
+    const int32_t cell_size = int32_t(HEIGHT_BOUNDS_CELL_SIZE);
+    for (uint32_t level = 0; level < CLIPMAP_LEVEL_COUNT; level++) {
+        if (!bounds->is_valid[level]) continue;
+
+        nm::ivec2 origin = bounds->origins[level];
+        float margin     = bounds->margins[level];
+        bool is_finer    = level > 0 && bounds->is_valid[level - 1u];
+        nm::ivec2 finer  = is_finer ? bounds->origins[level - 1u] : nm::ivec2(0);
+
+        for (int32_t cy = 0; cy < int32_t(HEIGHT_BOUNDS_CELL_COUNT); cy++) {
+            for (int32_t cx = 0; cx < int32_t(HEIGHT_BOUNDS_CELL_COUNT); cx++) {
+                nm::fvec2 cell  = bounds->cells[level][cy][cx];
+                nm::fvec2 range = nm::fvec2(cell.x - margin, cell.y + margin);
+
+                // first and last texel of the finer level that the cell
+                // covers, relative to its origin, the last cell is cut off by
+                // the end of the level
+                int32_t x0 = 2 * (origin.x + cx * cell_size) - finer.x;
+                int32_t y0 = 2 * (origin.y + cy * cell_size) - finer.y;
+                int32_t x1 = 2 * (origin.x + nm::min((cx + 1) * cell_size, size - 1)) - finer.x;
+                int32_t y1 = 2 * (origin.y + nm::min((cy + 1) * cell_size, size - 1)) - finer.y;
+                if (is_finer && x0 >= 0 && y0 >= 0 && x1 < size && y1 < size) {
+                    // the finer cells that span the texels, x1 > x0 holds
+                    nm::fvec2 finer_range(FLT_MAX, -FLT_MAX);
+                    for (int32_t fy = y0 / cell_size; fy <= (y1 - 1) / cell_size; fy++) {
+                        for (int32_t fx = x0 / cell_size; fx <= (x1 - 1) / cell_size; fx++) {
+                            nm::fvec2 other = bounds->ranges[level - 1u][fy][fx];
+                            finer_range.x   = nm::min(finer_range.x, other.x);
+                            finer_range.y   = nm::max(finer_range.y, other.y);
+                        }
+                    }
+                    range.x = nm::max(range.x, finer_range.x);
+                    range.y = nm::min(range.y, finer_range.y);
+                }
+
+                bounds->ranges[level][cy][cx] = range;
+            }
+        }
+    }
+}
+
+/// Finds the cell of the level that contains a world-space position. Returns
+/// false if the level is not valid or does not contain the position. Otherwise,
+/// sets the world-space extent of the cell and its narrowed height range.
+inline bool get_cell_bounds(
+    const height_bounds* bounds,
+    uint32_t level,
+    nm::fvec2 pos,
+    nm::fvec2* cell_min,
+    nm::fvec2* cell_max,
+    nm::fvec2* range)
+{
+    if (!bounds->is_valid[level]) return false;
+
+    // position in texels relative to the origin of the level
+    float spacing    = get_texel_spacing(level);
+    nm::ivec2 origin = bounds->origins[level];
+    float x          = pos.x / spacing - float(origin.x);
+    float y          = pos.y / spacing - float(origin.y);
+    float last       = float(CLIPMAP_LEVEL_SIZE - 1u);
+    if (x < 0.f || y < 0.f || x >= last || y >= last) return false;
+
+    uint32_t cx = uint32_t(x) / HEIGHT_BOUNDS_CELL_SIZE;
+    uint32_t cy = uint32_t(y) / HEIGHT_BOUNDS_CELL_SIZE;
+
+    // the last cell is cut off by the last texel of the level
+    const int32_t size      = int32_t(CLIPMAP_LEVEL_SIZE);
+    const int32_t cell_size = int32_t(HEIGHT_BOUNDS_CELL_SIZE);
+    int32_t x0              = origin.x + int32_t(cx) * cell_size;
+    int32_t y0              = origin.y + int32_t(cy) * cell_size;
+    int32_t x1              = nm::min(x0 + cell_size, origin.x + size - 1);
+    int32_t y1              = nm::min(y0 + cell_size, origin.y + size - 1);
+
+    *cell_min = spacing * nm::fvec2(float(x0), float(y0));
+    *cell_max = spacing * nm::fvec2(float(x1), float(y1));
+    *range    = bounds->ranges[level][cy][cx];
+
+    return true;
+}
+
+/// Finds the height range with margin of a world-space rectangle, from the
+/// finest valid level that is at least first_level and contains all texels
+/// around the rectangle. Returns false if there is no such level.
+inline bool get_rect_bounds(
+    const height_bounds* bounds,
+    uint32_t first_level,
+    nm::fvec2 rect_min,
+    nm::fvec2 rect_max,
+    nm::fvec2* range)
+{
+    for (uint32_t level = first_level; level < CLIPMAP_LEVEL_COUNT; level++) {
+        if (!bounds->is_valid[level]) continue;
+
+        // texels relative to the origin of the level
+        float spacing    = get_texel_spacing(level);
+        nm::ivec2 origin = bounds->origins[level];
+        int32_t x0       = int32_t(floorf(rect_min.x / spacing)) - origin.x;
+        int32_t y0       = int32_t(floorf(rect_min.y / spacing)) - origin.y;
+        int32_t x1       = int32_t(ceilf(rect_max.x / spacing)) - origin.x;
+        int32_t y1       = int32_t(ceilf(rect_max.y / spacing)) - origin.y;
+
+        const int32_t size = int32_t(CLIPMAP_LEVEL_SIZE);
+        if (x0 < 0 || y0 < 0 || x1 >= size || y1 >= size) continue;
+
+        const int32_t cell_size = int32_t(HEIGHT_BOUNDS_CELL_SIZE);
+        nm::fvec2 cells(FLT_MAX, -FLT_MAX);
+        for (int32_t cy = y0 / cell_size; cy <= y1 / cell_size; cy++) {
+            for (int32_t cx = x0 / cell_size; cx <= x1 / cell_size; cx++) {
+                nm::fvec2 cell = bounds->cells[level][cy][cx];
+                cells.x        = nm::min(cells.x, cell.x);
+                cells.y        = nm::max(cells.y, cell.y);
+            }
+        }
+
+        float margin = bounds->margins[level];
+        *range       = nm::fvec2(cells.x - margin, cells.y + margin);
+
+        return true;
+    }
+
+    return false;
+}
+
+#endif // TERRAIN3_HEIGHT_BOUNDS_H
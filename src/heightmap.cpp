@@ -8,91 +8,228 @@
 #include "nmutil/io.h"
 #include "nmutil/util.h"
 #include "noise.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
 #include <filesystem>
+#include <vector>
 
 /// The compute shader program.
 nm::shader_program comp_program;
+/// The compute shader program that reduces the height bounds.
+nm::shader_program bounds_program;
+/// The compute shader program that copies texels from coarser levels.
+nm::shader_program reuse_program;
 
-nm_ret init(heightmap* hm)
+/// Number of slots in use, see heightmap::slots.
+static uint32_t get_slot_count(const heightmap* hm) { return hm->is_pipelined ? 2u : 1u; }
+
+/// Creates a texture with a layer of size^2 texels for each level.
+static void create_level_texture(nm::tex* texture, int32_t size)
 {
-    // create texture that represents the heightmap
-    hm->texture.init(GL_TEXTURE_2D_ARRAY);
-    hm->texture.use();
+    texture->init(GL_TEXTURE_2D_ARRAY);
+    texture->use();
 
     // R is height, G and B are terrain gradients, A is padding
     GL_CHECK(glTexStorage3D(
         GL_TEXTURE_2D_ARRAY,
         1,
         GL_RGBA32F,
-        CLIPMAP_LEVEL_SIZE,
-        CLIPMAP_LEVEL_SIZE,
+        size,
+        size,
         CLIPMAP_LEVEL_COUNT));
 
     GL_CHECK(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
     GL_CHECK(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
 
-    // the repeat is crucial here. this allows us to update small sections of
-    // the texture when moving the camera
+    // the repeat is crucial here. this allows us to update small sections
+    // of the texture when moving the camera
     GL_CHECK(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT));
     GL_CHECK(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT));
 
-    hm->texture.unuse();
+    texture->unuse();
+}
+
+nm_ret init(heightmap* hm, const heightmap_config* config, ubo_ring* ring)
+{
+    hm->ring         = ring;
+    hm->backend      = config->backend;
+    hm->source       = config->source;
+    hm->lattice      = config->lattice;
+    hm->is_pipelined = config->is_pipelined;
+
+    // the elevation model is resampled on the worker threads
+    if (hm->source == HEIGHTMAP_SOURCE_DEM && hm->backend != HEIGHTMAP_BACKEND_CPU) {
+        nm::log(nm::LOG_WARN, "the elevation model requires the cpu backend\n");
+        hm->backend = HEIGHTMAP_BACKEND_CPU;
+    }
+
+    hm->guard_band   = int32_t(nm::min(config->guard_band, HEIGHTMAP_MAX_GUARD_BAND));
+    hm->texture_size = int32_t(CLIPMAP_LEVEL_SIZE) + 2 * hm->guard_band;
+    if (hm->guard_band > 0) {
+        nm::log(nm::LOG_INFO, "keeping a guard band of %d texels\n", hm->guard_band);
+    }
+
+    // create the textures that represent the heightmap, the second one is
+    // only used when pipelining
+    for (uint32_t i = 0; i < get_slot_count(hm); i++) {
+        heightmap_slot* slot = &hm->slots[i];
+        create_level_texture(&slot->texture, hm->texture_size);
 
-    // uniform buffer for compute shader
-    GL_CHECK(glGenBuffers(1, &hm->uniform_buffer));
-    GL_CHECK(glBindBuffer(GL_UNIFORM_BUFFER, hm->uniform_buffer));
+        // nothing can be rendered from the slot until its first generation
+        slot->fence                = 0;
+        slot->first_complete_level = CLIPMAP_LEVEL_COUNT;
+        slot->region_count         = 0;
+    }
+    hm->write_index  = 0;
+    hm->render_index = hm->is_pipelined ? 1u : 0u;
+    if (hm->is_pipelined) nm::log(nm::LOG_INFO, "pipelining heightmap generation\n");
 
-    // allocate space
+    // uniform data for compute shader, allocated from the ring. the block is
+    // always bound at its full size
+    hm->uniform_offset      = 0;
     hm->uniform_buffer_size = sizeof(update_info) * MAX_UPDATE_COUNT;
-    GL_CHECK(glBufferData(GL_UNIFORM_BUFFER, hm->uniform_buffer_size, NULL, GL_STREAM_DRAW));
 
-    GL_CHECK(glBindBuffer(GL_UNIFORM_BUFFER, 0));
+    // storage buffer with the list of tiles for the compute shader
+    GL_CHECK(glGenBuffers(1, &hm->tile_buffer));
+    GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, hm->tile_buffer));
 
-    // compute shader
-    nm::res_t comp_src;
-    const std::filesystem::path comp_path =
-        TERRAIN3_RESOURCE_DIR / std::filesystem::path("shader/lod.comp");
-    nm_ret ret = nm::read_file(&comp_src.text, &comp_src.len, comp_path.u8string().c_str());
-    if (ret != NM_SUCCESS) return NM_FAIL;
+    hm->tile_buffer_size = sizeof(uint32_t) * MAX_TILE_COUNT;
+    GL_CHECK(glBufferData(GL_SHADER_STORAGE_BUFFER, hm->tile_buffer_size, NULL, GL_STREAM_DRAW));
 
-    nm::shader comp_shader;
-    ret = comp_shader.init(comp_src.text, comp_src.len, GL_COMPUTE_SHADER);
-    if (ret != NM_SUCCESS) {
-        nm::log(nm::LOG_ERROR, "compute shader failed\n");
-        return NM_FAIL;
-    }
+    // the reused texels need fewer tiles than the generated ones
+    GL_CHECK(glGenBuffers(1, &hm->reuse_tile_buffer));
+    GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, hm->reuse_tile_buffer));
+    GL_CHECK(glBufferData(GL_SHADER_STORAGE_BUFFER, hm->tile_buffer_size, NULL, GL_STREAM_DRAW));
 
-    free(comp_src.text);
-    ret = comp_program.init(nullptr, nullptr, nullptr, &comp_shader);
-    if (ret != NM_SUCCESS) return NM_FAIL;
+    GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
 
-    comp_shader.cleanup();
+    // compute shaders
+    if (load_compute_program(&comp_program, "shader/lod.comp") != NM_SUCCESS) return NM_FAIL;
+    if (load_compute_program(&bounds_program, "shader/lod_bounds.comp") != NM_SUCCESS) {
+        return NM_FAIL;
+    }
+    if (load_compute_program(&reuse_program, "shader/lod_reuse.comp") != NM_SUCCESS) {
+        return NM_FAIL;
+    }
 
     comp_program.use();
     // todo put binding point in variable/define
     comp_program.bind_uniform_block("uni_data", 0);
 
     comp_program.set_int("uni_noise", 1);
+    comp_program.set_int("uni_noise_corners", 2);
     comp_program.set_uint("DEF_CLIPMAP_LEVEL_SIZE", CLIPMAP_LEVEL_SIZE);
     comp_program.set_float("DEF_CLIPMAP_SCALE", CLIPMAP_SCALE);
     comp_program.set_float("DEF_TERRAIN_AMP", TERRAIN_AMP);
     comp_program.set_float("DEF_TERRAIN_SCA", TERRAIN_SCA);
     comp_program.set_uint("DEF_NOISE_SIZE", NOISE_SIZE);
+    comp_program.set_uint("DEF_NOISE_OCTAVES", NOISE_OCTAVES);
+    comp_program.set_float("DEF_NOISE_LACUNARITY", NOISE_LACUNARITY);
+    comp_program.set_float("DEF_NOISE_GAIN", NOISE_GAIN);
+    comp_program.set_uint("DEF_NOISE_LATTICE", hm->lattice);
+    comp_program.set_uint("DEF_NOISE_GATHER", config->is_gathering_noise ? 1u : 0u);
     comp_program.unuse();
 
-    // initialize noise
-    srand(2);
-    uint32_t noise_count = NOISE_SIZE * NOISE_SIZE;
-    hm->noise            = (uint8_t*)malloc(sizeof(uint8_t) * noise_count);
+    bounds_program.use();
+    bounds_program.set_uint("DEF_CLIPMAP_LEVEL_SIZE", CLIPMAP_LEVEL_SIZE);
+    bounds_program.set_uint("DEF_HEIGHT_BOUNDS_CELL_COUNT", HEIGHT_BOUNDS_CELL_COUNT);
+    bounds_program.set_int("uni_texture_size", hm->texture_size);
+    bounds_program.unuse();
+
+    reuse_program.use();
+    reuse_program.bind_uniform_block("uni_data", 0);
+    reuse_program.set_int("uni_texture_size", hm->texture_size);
+    reuse_program.unuse();
+
+    // storage buffer with the height bounds of all levels, and the buffers
+    // they are copied to for reading back
+    GL_CHECK(glGenBuffers(1, &hm->bounds_buffer));
+    GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, hm->bounds_buffer));
+    GL_CHECK(glBufferData(
+        GL_SHADER_STORAGE_BUFFER, sizeof(hm->bounds.cells), NULL, GL_DYNAMIC_COPY));
+    GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+
+    for (uint32_t i = 0; i < HEIGHTMAP_READBACK_COUNT; i++) {
+        GL_CHECK(glGenBuffers(1, &hm->readbacks[i].buffer));
+        GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, hm->readbacks[i].buffer));
+        GL_CHECK(glBufferData(
+            GL_COPY_WRITE_BUFFER, sizeof(hm->bounds.cells), NULL, GL_STREAM_READ));
+        hm->readbacks[i].fence = 0;
+    }
+    GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+    hm->readback_index = 0;
 
-    for (uint32_t i = 0u; i < noise_count; i++) {
-        hm->noise[i] = uint8_t(float(rand()) / float(RAND_MAX) * UINT8_MAX);
+    hm->bounds_dirty_mask = 0;
+    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
+        hm->bounds_valid[i]    = false;
+        hm->bounds.is_valid[i] = false;
+        hm->bounds_versions[i] = 0;
     }
 
-    // state: initialize level infos
+    // initialize noise, the table is also created for the hash lattice since
+    // the noise texture is always bound
+    hm->noise = create_noise_table(NOISE_SIZE);
+    if (!hm->noise) return NM_FAIL;
+
+    hm->isa = detect_noise_isa();
+    nm::log(nm::LOG_INFO, "evaluating cpu noise with %s\n", get_noise_isa_name(hm->isa));
+    nm::log(nm::LOG_INFO, "using %s noise lattice\n", get_noise_lattice_name(hm->lattice));
+
+    if (hm->source == HEIGHTMAP_SOURCE_DEM && init(&hm->elevation, &config->dem) != NM_SUCCESS) {
+        return NM_FAIL;
+    }
+
+    // state: initialize level infos, nothing is complete until the first
+    // update
     for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
         hm->level_infos[i].cleared = true;
     }
+    hm->texel_budget               = config->texel_budget;
+    hm->is_regenerate_pending      = false;
+    hm->stats.deferred_level_count = 0;
+
+    // the prefetched texels are staged in a texture of their own, as the
+    // texels that the levels scroll in replace texels that are still rendered
+    hm->prefetch_frame_count = config->prefetch_frame_count;
+    if (hm->prefetch_frame_count > 0) {
+        create_level_texture(&hm->prefetch_texture, hm->texture_size);
+        nm::log(nm::LOG_INFO, "prefetching %u updates ahead\n", hm->prefetch_frame_count);
+    }
+    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
+        hm->prefetch_infos[i].is_valid = false;
+    }
+    hm->velocity                        = nm::fvec2(0.f, 0.f);
+    hm->stats.prefetched_texels         = 0;
+    hm->stats.prefetch_copied_texels    = 0;
+    hm->stats.prefetched_texel_sum      = 0;
+    hm->stats.prefetch_copied_texel_sum = 0;
+    hm->stats.avoided_texels            = 0;
+    hm->stats.avoided_texel_sum         = 0;
+
+    hm->is_reusing_levels       = config->is_reusing_levels;
+    hm->stats.reused_texels     = 0;
+    hm->stats.reused_texel_sum  = 0;
+    hm->stats.updated_texel_sum = 0;
+    if (!hm->is_reusing_levels) nm::log(nm::LOG_INFO, "not reusing texels of coarser levels\n");
+
+    // the spacing between texels in noise space doubles every level
+    hm->is_truncating_octaves = false;
+    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
+        float spacing              = TERRAIN_SCA * CLIPMAP_SCALE * float(1u << i);
+        hm->nyquist_octaves[i]     = get_nyquist_octaves(spacing);
+        hm->stats.level_octaves[i] = NOISE_OCTAVES;
+    }
+    for (uint32_t i = 0; i < 2; i++) {
+        hm->stats.generate_seconds[i]   = 0.;
+        hm->stats.generate_texels[i]    = 0;
+        hm->stats.regenerate_seconds[i] = 0.;
+        hm->stats.regenerate_count[i]   = 0;
+    }
+    hm->stats.frame_generate_seconds = 0.;
+    hm->stats.frame_render_seconds   = 0.;
+    hm->stats.frame_seconds          = 0.;
+    hm->stats.frame_count            = 0;
 
     // create noise texture
     hm->noise_tex.init(GL_TEXTURE_2D);
@@ -104,58 +241,322 @@ nm_ret init(heightmap* hm)
     GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
     GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
 
-    GL_CHECK(glTexImage2D(
-        GL_TEXTURE_2D, 0, GL_R32F, NOISE_SIZE, NOISE_SIZE, 0, GL_RED, GL_UNSIGNED_BYTE, hm->noise));
-
-    GL_CHECK(glBindImageTexture(1, hm->noise_tex.id, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F));
+    // normalized bytes, the same values as the cpu divides by UINT8_MAX
+    GL_CHECK(glTexStorage2D(GL_TEXTURE_2D, 1, GL_R8, NOISE_SIZE, NOISE_SIZE));
+    GL_CHECK(glTexSubImage2D(
+        GL_TEXTURE_2D, 0, 0, 0, NOISE_SIZE, NOISE_SIZE, GL_RED, GL_UNSIGNED_BYTE, hm->noise));
 
     hm->noise_tex.unuse();
 
+    // create the packed corner texture, which is row-major unlike the table
+    std::vector<uint32_t> corners(NOISE_SIZE * NOISE_SIZE);
+    const uint32_t* packed = get_noise_corners(hm->noise, NOISE_SIZE);
+    for (uint32_t y = 0; y < NOISE_SIZE; y++) {
+        for (uint32_t x = 0; x < NOISE_SIZE; x++) {
+            corners[y * NOISE_SIZE + x] = packed[noise_corner_index(x, y, NOISE_SIZE)];
+        }
+    }
+
+    hm->noise_corners_tex.init(GL_TEXTURE_2D);
+    hm->noise_corners_tex.use();
+
+    GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+    GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+
+    // the bytes of each (little-endian) word are the red, green, blue, and
+    // alpha channels
+    GL_CHECK(glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, NOISE_SIZE, NOISE_SIZE));
+    GL_CHECK(glTexSubImage2D(
+        GL_TEXTURE_2D,
+        0,
+        0,
+        0,
+        NOISE_SIZE,
+        NOISE_SIZE,
+        GL_RGBA,
+        GL_UNSIGNED_BYTE,
+        corners.data()));
+
+    hm->noise_corners_tex.unuse();
+
+    if (hm->backend == HEIGHTMAP_BACKEND_GPU) {
+        for (uint32_t i = 0; i < HEIGHTMAP_TIMER_COUNT; i++) {
+            GL_CHECK(glGenQueries(1, &hm->timers[i].query));
+            hm->timers[i].is_pending = false;
+        }
+        hm->timer_index = 0;
+
+        for (uint32_t i = 0; i < HEIGHTMAP_FRAME_TIMER_COUNT; i++) {
+            GL_CHECK(glGenQueries(4, hm->frame_timers[i].queries));
+            hm->frame_timers[i].recorded_mask = 0;
+            hm->frame_timers[i].is_pending    = false;
+        }
+        hm->frame_timer_index = 0;
+    }
+
+    if (init(&hm->pool, 0) != NM_SUCCESS) return NM_FAIL;
+
+    if (hm->backend == HEIGHTMAP_BACKEND_CPU) {
+        // ring of pixel buffers to upload the texels from
+        GL_CHECK(glGenBuffers(HEIGHTMAP_PBO_COUNT, hm->pbos));
+        for (uint32_t i = 0; i < HEIGHTMAP_PBO_COUNT; i++) {
+            GL_CHECK(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, hm->pbos[i]));
+            GL_CHECK(glBufferData(
+                GL_PIXEL_UNPACK_BUFFER,
+                sizeof(nm::fvec4) * HEIGHTMAP_PBO_TEXEL_COUNT,
+                NULL,
+                GL_STREAM_DRAW));
+            hm->pbo_fences[i] = 0;
+        }
+        GL_CHECK(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+        hm->pbo_index = 0;
+
+        nm::log(nm::LOG_INFO, "generating heightmap on the cpu\n");
+    }
+
+    // the cache needs the texels on the cpu, and is keyed by the noise
+    hm->is_caching = false;
+    if (config->cache_path && hm->source == HEIGHTMAP_SOURCE_DEM) {
+        nm::log(nm::LOG_WARN, "the tile cache does not support the elevation model\n");
+    } else if (config->cache_path && hm->backend == HEIGHTMAP_BACKEND_CPU) {
+        uint64_t seed  = get_noise_seed(hm->noise, NOISE_SIZE, hm->lattice);
+        hm->is_caching = init(&hm->cache, config->cache_path, config->cache_size, seed) ==
+                         NM_SUCCESS;
+    } else if (config->cache_path) {
+        nm::log(nm::LOG_WARN, "the tile cache requires the cpu backend\n");
+    }
+
+    // baked tiles fill the cache, and must be of the same noise
+    hm->is_packed = false;
+    if (config->pack_path && !hm->is_caching) {
+        nm::log(nm::LOG_WARN, "the tile pack requires the tile cache\n");
+    } else if (config->pack_path && init(&hm->pack, config->pack_path) == NM_SUCCESS) {
+        hm->is_packed = hm->pack.header->seed == hm->cache.header->seed;
+        if (!hm->is_packed) {
+            nm::log(nm::LOG_WARN, "tile pack %s is of another noise\n", config->pack_path);
+            cleanup(&hm->pack);
+        }
+    }
+    // the checksum covers the steps and the checksums of all tiles
+    hm->pack_id = hm->is_packed ? hm->pack.header->index_checksum | 1u : 0;
+    hm->stats.cache_hits          = 0;
+    hm->stats.cache_misses        = 0;
+    hm->stats.cache_hit_sum       = 0;
+    hm->stats.cache_miss_sum      = 0;
+    hm->stats.cache_tile_count    = hm->is_caching ? get_cached_tile_count(&hm->cache) : 0;
+    hm->stats.cache_tile_capacity = hm->is_caching ? get_tile_capacity(&hm->cache) : 0;
+    hm->stats.pack_tiles          = 0;
+    hm->stats.pack_tile_sum       = 0;
+
+    // cached tiles hold all of their texels
+    if (hm->is_caching) hm->is_reusing_levels = false;
+
     return NM_SUCCESS;
 }
 
 void cleanup(heightmap* hm)
 {
-    GL_CHECK(glDeleteBuffers(1, &hm->uniform_buffer));
+    if (hm->backend == HEIGHTMAP_BACKEND_GPU) {
+        for (uint32_t i = 0; i < HEIGHTMAP_TIMER_COUNT; i++) {
+            GL_CHECK(glDeleteQueries(1, &hm->timers[i].query));
+        }
+        for (uint32_t i = 0; i < HEIGHTMAP_FRAME_TIMER_COUNT; i++) {
+            GL_CHECK(glDeleteQueries(4, hm->frame_timers[i].queries));
+        }
+    }
+
+    if (hm->backend == HEIGHTMAP_BACKEND_CPU) {
+        for (uint32_t i = 0; i < HEIGHTMAP_PBO_COUNT; i++) {
+            if (hm->pbo_fences[i]) GL_CHECK(glDeleteSync(hm->pbo_fences[i]));
+        }
+        GL_CHECK(glDeleteBuffers(HEIGHTMAP_PBO_COUNT, hm->pbos));
+    }
+    cleanup(&hm->pool);
+    if (hm->is_caching) cleanup(&hm->cache);
+    if (hm->is_packed) cleanup(&hm->pack);
+    if (hm->source == HEIGHTMAP_SOURCE_DEM) cleanup(&hm->elevation);
+
+    for (uint32_t i = 0; i < HEIGHTMAP_READBACK_COUNT; i++) {
+        if (hm->readbacks[i].fence) GL_CHECK(glDeleteSync(hm->readbacks[i].fence));
+        GL_CHECK(glDeleteBuffers(1, &hm->readbacks[i].buffer));
+    }
+    GL_CHECK(glDeleteBuffers(1, &hm->bounds_buffer));
+    bounds_program.cleanup();
+
+    reuse_program.cleanup();
+    GL_CHECK(glDeleteBuffers(1, &hm->reuse_tile_buffer));
+    GL_CHECK(glDeleteBuffers(1, &hm->tile_buffer));
     comp_program.cleanup(); // todo only do if not already done
-    free(hm->noise);
-    hm->texture.cleanup();
+    destroy_noise_table(hm->noise);
+    hm->noise_corners_tex.cleanup();
+    hm->noise_tex.cleanup();
+    for (uint32_t i = 0; i < get_slot_count(hm); i++) {
+        if (hm->slots[i].fence) GL_CHECK(glDeleteSync(hm->slots[i].fence));
+        hm->slots[i].texture.cleanup();
+    }
+    if (hm->prefetch_frame_count > 0) hm->prefetch_texture.cleanup();
 }
 
 nm::fvec3 get_height(heightmap* hm, nm::fvec2 pos)
 {
+    if (hm->source == HEIGHTMAP_SOURCE_DEM) return sample_dem_gradient(&hm->elevation, 0, pos);
+
     // returns in [0,1]
-    nm::fvec3 t    = terrain_noise(TERRAIN_SCA * pos, hm->noise, NOISE_SIZE);
+    nm::fvec3 t    = get_terrain_noise_fn(NOISE_OCTAVES, hm->lattice)(
+        TERRAIN_SCA * pos, hm->noise, NOISE_SIZE);
     float height   = TERRAIN_AMP * t.x;
     nm::fvec2 grad = TERRAIN_AMP * TERRAIN_SCA * nm::fvec2(t.y, t.z);
 
     return nm::fvec3(height, grad.x, grad.y);
 }
 
-/// Register that the following region must be updated:
-/// At texture position [tex_x,tex_y] compute a block of [size_x,size_y]
-/// that starts in (world) texture space [start_x,start_y].
-void register_update_region(
-    update_info* infos,
-    uint32_t* info_index,
-    int32_t tex_x,
-    int32_t tex_y,
-    int32_t size_x,
-    int32_t size_y,
-    int32_t start_x,
-    int32_t start_y,
-    int32_t level)
+/// Shared state of a single call to query_heights.
+struct query_work {
+    const heightmap* hm;
+    const nm::fvec2* positions;
+    nm::fvec3* results;
+    uint32_t count;
+    uint32_t octaves;
+};
+
+/// Evaluates a single chunk of a query as a single batch.
+static void query_chunk(void* user, uint32_t index)
 {
-    // do not create update info when nothing needs updating
-    if (size_x == 0 || size_y == 0) return;
+    const query_work* work = (const query_work*)user;
+
+    uint32_t first = index * HEIGHTMAP_QUERY_CHUNK_SIZE;
+    uint32_t count = nm::min(work->count - first, HEIGHTMAP_QUERY_CHUNK_SIZE);
+
+    if (work->hm->source == HEIGHTMAP_SOURCE_DEM) {
+        for (uint32_t i = first; i < first + count; i++) {
+            work->results[i] = sample_dem_gradient(&work->hm->elevation, 0, work->positions[i]);
+        }
+        return;
+    }
 
-    update_info info;
-    info.tex   = nm::ivec2(tex_x, tex_y);
-    info.size  = nm::ivec2(size_x, size_y);
-    info.start = nm::ivec2(start_x, start_y);
-    info.level = level;
+    float xs[HEIGHTMAP_QUERY_CHUNK_SIZE];
+    float ys[HEIGHTMAP_QUERY_CHUNK_SIZE];
+    float h[HEIGHTMAP_QUERY_CHUNK_SIZE];
+    float dx[HEIGHTMAP_QUERY_CHUNK_SIZE];
+    float dz[HEIGHTMAP_QUERY_CHUNK_SIZE];
 
-    infos[(*info_index)++] = info;
+    for (uint32_t i = 0; i < count; i++) {
+        nm::fvec2 p = TERRAIN_SCA * work->positions[first + i];
+        xs[i]       = p.x;
+        ys[i]       = p.y;
+    }
+
+    terrain_noise_batch(
+        work->hm->isa,
+        work->hm->lattice,
+        work->octaves,
+        xs,
+        ys,
+        count,
+        work->hm->noise,
+        NOISE_SIZE,
+        h,
+        dx,
+        dz);
+
+    // same scaling as get_height
+    for (uint32_t i = 0; i < count; i++) {
+        float height             = TERRAIN_AMP * h[i];
+        nm::fvec2 grad           = TERRAIN_AMP * TERRAIN_SCA * nm::fvec2(dx[i], dz[i]);
+        work->results[first + i] = nm::fvec3(height, grad.x, grad.y);
+    }
+}
+
+void query_heights(
+    heightmap* hm,
+    const nm::fvec2* positions,
+    nm::fvec3* results,
+    uint32_t count,
+    float lod_hint)
+{
+    query_work work;
+    work.hm        = hm;
+    work.positions = positions;
+    work.results   = results;
+    work.count     = count;
+    // the feature size is the spacing at which the octaves are sampled
+    work.octaves = lod_hint > 0.f ? get_nyquist_octaves(TERRAIN_SCA * lod_hint) : NOISE_OCTAVES;
+
+    uint32_t chunk_count = (count + HEIGHTMAP_QUERY_CHUNK_SIZE - 1u) / HEIGHTMAP_QUERY_CHUNK_SIZE;
+    parallel_for(&hm->pool, chunk_count, query_chunk, &work);
+}
+
+uint32_t check_texels(heightmap* hm, float* height_error, float* slope_error)
+{
+    assert(hm->source == HEIGHTMAP_SOURCE_NOISE);
+
+    *height_error = 0.f;
+    *slope_error  = 0.f;
+
+    // the texels are written with image stores or pixel transfers
+    heightmap_slot* slot = &hm->slots[hm->render_index];
+    const int32_t size   = hm->texture_size;
+    std::vector<nm::fvec4> texels(size_t(size) * size_t(size) * CLIPMAP_LEVEL_COUNT);
+    GL_CHECK(glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT));
+    slot->texture.use();
+    GL_CHECK(glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, GL_FLOAT, texels.data()));
+    slot->texture.unuse();
+
+    float xs[CLIPMAP_LEVEL_SIZE];
+    float ys[CLIPMAP_LEVEL_SIZE];
+    float h[CLIPMAP_LEVEL_SIZE];
+    float dx[CLIPMAP_LEVEL_SIZE];
+    float dz[CLIPMAP_LEVEL_SIZE];
+
+    uint32_t failure_count = 0;
+    for (uint32_t i = slot->first_complete_level; i < CLIPMAP_LEVEL_COUNT; i++) {
+        // the rendered texels of the level, see update_level
+        nm::ivec2 offset = slot->level_offsets[i];
+        nm::ivec2 start(offset.x >> i, offset.y >> i);
+        for (int32_t y = 0; y < int32_t(CLIPMAP_LEVEL_SIZE); y++) {
+            for (int32_t x = 0; x < int32_t(CLIPMAP_LEVEL_SIZE); x++) {
+                // same scaling as generate_band
+                nm::fvec2 pos = CLIPMAP_SCALE * nm::fvec2(
+                    float((start.x + x) << i), float((start.y + y) << i));
+                xs[x] = TERRAIN_SCA * pos.x;
+                ys[x] = TERRAIN_SCA * pos.y;
+            }
+
+            terrain_noise_batch(
+                hm->isa,
+                hm->lattice,
+                hm->stats.level_octaves[i],
+                xs,
+                ys,
+                CLIPMAP_LEVEL_SIZE,
+                hm->noise,
+                NOISE_SIZE,
+                h,
+                dx,
+                dz);
+
+            // world texel (x, y) is stored at local texel (x mod size, y mod size)
+            int32_t local_y = start.y + y - nm::idiv(start.y + y, size) * size;
+            for (int32_t x = 0; x < int32_t(CLIPMAP_LEVEL_SIZE); x++) {
+                int32_t local_x = start.x + x - nm::idiv(start.x + x, size) * size;
+                size_t j        = (size_t(i) * size_t(size) + size_t(local_y)) * size_t(size) +
+                           size_t(local_x);
+                nm::fvec4 texel = texels[j];
+
+                float height = fabsf(texel.x - TERRAIN_AMP * h[x]);
+                float slope  = fmaxf(
+                    fabsf(texel.y - TERRAIN_AMP * TERRAIN_SCA * dx[x]),
+                    fabsf(texel.z - TERRAIN_AMP * TERRAIN_SCA * dz[x]));
+                *height_error = fmaxf(*height_error, height);
+                *slope_error  = fmaxf(*slope_error, slope);
+                if (!(height <= TERRAIN_HEIGHT_TOLERANCE && slope <= TERRAIN_SLOPE_TOLERANCE)) {
+                    failure_count++;
+                }
+            }
+        }
+    }
+
+    return failure_count;
 }
 
 /// Find out what parts of this level's texture need to be updated.
@@ -164,419 +565,1457 @@ void update_level(
     heightmap* hm, nm::ivec2 offset, uint32_t level, update_info* u_infos, uint32_t* info_index)
 {
     level_info* info = &hm->level_infos[level];
-    // (-x,-z)-most world texture coordinate
-    int32_t start_x = offset.x >> level;
-    int32_t start_y = offset.y >> level;
+    // (-x,-z)-most world texture coordinate of the rendered texels
+    nm::ivec2 render_start(offset.x >> level, offset.y >> level);
+    info->render_x = render_start.x;
+    info->render_y = render_start.y;
+
+    // the loaded texels only move once the rendered texels leave them
+    nm::ivec2 old_start(info->x, info->y);
+    nm::ivec2 start = get_resident_start(old_start, !info->cleared, render_start, hm->guard_band);
 
     // nothing to do for this level, not moved and not cleared
-    if (start_x == info->x && start_y == info->y && !info->cleared) return;
-
-    // movement in texture coordinates
-    int32_t delta_x = start_x - info->x;
-    int32_t delta_y = start_y - info->y;
-
-    // old (local) texture origin
-    int32_t old_base_x = nm::idiv(info->x, CLIPMAP_LEVEL_SIZE) * CLIPMAP_LEVEL_SIZE;
-    int32_t old_base_y = nm::idiv(info->y, CLIPMAP_LEVEL_SIZE) * CLIPMAP_LEVEL_SIZE;
-    // new (local) texture origin
-    int32_t base_x = nm::idiv(start_x, CLIPMAP_LEVEL_SIZE) * CLIPMAP_LEVEL_SIZE;
-    int32_t base_y = nm::idiv(start_y, CLIPMAP_LEVEL_SIZE) * CLIPMAP_LEVEL_SIZE;
-
-    // check if we must compute the complete texture or just parts of it
-    if (abs(delta_x) >= int32_t(CLIPMAP_LEVEL_SIZE) ||
-        abs(delta_y) >= int32_t(CLIPMAP_LEVEL_SIZE) || info->cleared) {
-        // we have suddenly moved to a completely different place in the
-        // heightmap, or we need to recompute everything
-
-        //        /--------------------------|seam|-------------------------/
-        // world: wrapped  start+CLIP_LVL_SIZE    start    base+CLIP_LVL_SIZE
-        // local: 0        wrapped                wrapped  CLIP_LVL_SIZE
-        // (base and start might be the same)
-
-        int32_t wrapped_x = start_x - base_x;
-        int32_t wrapped_y = start_y - base_y;
-
-        register_update_region(
-            u_infos,
-            info_index,
-            0,
-            0,
-            wrapped_x,
-            wrapped_y,
-            base_x + CLIPMAP_LEVEL_SIZE,
-            base_y + CLIPMAP_LEVEL_SIZE,
-            level);
-
-        register_update_region(
-            u_infos,
-            info_index,
-            wrapped_x,
-            0,
-            CLIPMAP_LEVEL_SIZE - wrapped_x,
-            wrapped_y,
-            start_x,
-            base_y + CLIPMAP_LEVEL_SIZE,
-            level);
-
-        register_update_region(
-            u_infos,
-            info_index,
+    if (start.x == info->x && start.y == info->y && !info->cleared) return;
+
+    uint32_t first = *info_index;
+    plan_update_regions(
+        old_start, !info->cleared, start, hm->texture_size, level, u_infos, info_index);
+    assert(check_update_regions(
+        old_start,
+        !info->cleared,
+        start,
+        hm->texture_size,
+        u_infos + first,
+        *info_index - first));
+
+    info->x       = start.x;
+    info->y       = start.y;
+    info->cleared = false;
+}
+
+/// Texel (x, y) of level i + 1 lies on texel (2x, 2y) of level i. Returns the
+/// coarsest level that evaluates the same octaves as the given level, such that
+/// every texel of the level with even world texel coordinates can be copied
+/// from a texel of a coarser level. Returns the level itself if there is none.
+/// The elevation model samples a different mip for each level, so its levels
+/// share no texels.
+static uint32_t get_reuse_level(const heightmap* hm, uint32_t level)
+{
+    if (!hm->is_reusing_levels || hm->source == HEIGHTMAP_SOURCE_DEM) return level;
+
+    uint32_t source = level;
+    while (source + 1 < CLIPMAP_LEVEL_COUNT &&
+           hm->stats.level_octaves[source + 1] == hm->stats.level_octaves[level]) {
+        source++;
+    }
+
+    return source;
+}
+
+/// Returns the number of even integers in [start, start + size).
+static uint32_t get_even_count(int32_t start, int32_t size)
+{
+    return uint32_t(size + ((start & 1) == 0 ? 1 : 0)) / 2u;
+}
+
+/// Returns the number of texels of the region that are copied from a coarser
+/// level, rather than generated.
+static uint32_t get_reused_texel_count(const heightmap* hm, const update_info* info)
+{
+    if (get_reuse_level(hm, info->level) == info->level) return 0;
+
+    return get_even_count(info->start.x, info->size.x) *
+           get_even_count(info->start.y, info->size.y);
+}
+
+/// Returns the number of tiles of the given size needed to cover a region. With
+/// reuse, the tiles start at the even world texel coordinate at or before the
+/// start of the region.
+static nm::uvec2 get_tile_count(const update_info* info, uint32_t tile_size, bool is_reusing)
+{
+    nm::ivec2 size = info->size;
+    if (is_reusing) size += nm::ivec2(info->start.x & 1, info->start.y & 1);
+
+    return nm::uvec2(
+        (uint32_t(size.x) + tile_size - 1u) / tile_size,
+        (uint32_t(size.y) + tile_size - 1u) / tile_size);
+}
+
+/// Splits each region into tiles of HEIGHTMAP_TILE_SIZE^2 texels, such that
+/// only workgroups that overlap a region are dispatched. Regions with reused
+/// texels are split into tiles of HEIGHTMAP_REUSE_TILE_SIZE^2 texels, of which
+/// only the generated texels are dispatched. Returns the number of tiles
+/// written.
+uint32_t build_tile_list(
+    heightmap* hm, const update_info* infos, uint32_t info_count, uint32_t* tiles)
+{
+    uint32_t tile_count  = 0;
+    uint32_t texel_count = 0;
+    for (uint32_t i = 0; i < info_count; i++) {
+        uint32_t source  = get_reuse_level(hm, infos[i].level);
+        bool is_reusing  = source != infos[i].level;
+        uint32_t size    = is_reusing ? HEIGHTMAP_REUSE_TILE_SIZE : HEIGHTMAP_TILE_SIZE;
+        nm::uvec2 counts = get_tile_count(&infos[i], size, is_reusing);
+        for (uint32_t y = 0; y < counts.y; y++) {
+            for (uint32_t x = 0; x < counts.x; x++) {
+                tiles[tile_count++] = source << 24 | i << 16 | y << 8 | x;
+            }
+        }
+        texel_count += infos[i].size.x * infos[i].size.y - get_reused_texel_count(hm, &infos[i]);
+    }
+
+    hm->stats.region_count         = info_count;
+    hm->stats.tile_count           = tile_count;
+    hm->stats.launched_invocations = tile_count * HEIGHTMAP_TILE_SIZE * HEIGHTMAP_TILE_SIZE;
+    hm->stats.useful_invocations   = texel_count;
+
+    return tile_count;
+}
+
+/// A band of rows of a single region, which is generated by a single worker.
+struct cpu_job {
+    const update_info* info;
+    int32_t row_start;
+    int32_t row_end;
+    /// Destination of the first texel of the region.
+    nm::fvec4* texels;
+    /// If true, the texels with even world texel coordinates are left for
+    /// lod_reuse.comp.
+    bool is_reusing;
+};
+
+struct cpu_work {
+    heightmap* hm;
+    const cpu_job* jobs;
+};
+
+/// Number of rows that are generated by a single job.
+#define CPU_JOB_ROW_COUNT 8
+
+/// Generate the texels of a band of rows, mirroring lod.comp. Each row is
+/// evaluated as a single batch, without the reused texels.
+static void generate_band(void* user, uint32_t index)
+{
+    cpu_work* work          = (cpu_work*)user;
+    const cpu_job* job      = &work->jobs[index];
+    const update_info* info = job->info;
+
+    float xs[HEIGHTMAP_MAX_TEXTURE_SIZE];
+    float ys[HEIGHTMAP_MAX_TEXTURE_SIZE];
+    float h[HEIGHTMAP_MAX_TEXTURE_SIZE];
+    float dx[HEIGHTMAP_MAX_TEXTURE_SIZE];
+    float dz[HEIGHTMAP_MAX_TEXTURE_SIZE];
+
+    for (int32_t y = job->row_start; y < job->row_end; y++) {
+        // every other texel of an even row is reused
+        bool is_row_reusing = job->is_reusing && ((info->start.y + y) & 1) == 0;
+
+        uint32_t count = 0;
+        for (int32_t x = 0; x < info->size.x; x++) {
+            if (is_row_reusing && ((info->start.x + x) & 1) == 0) continue;
+
+            // get world-space position
+            int32_t grid_x = (info->start.x + x) << info->level;
+            int32_t grid_y = (info->start.y + y) << info->level;
+            nm::fvec2 pos  = CLIPMAP_SCALE * nm::fvec2(float(grid_x), float(grid_y));
+
+            // same scaling as get_height
+            nm::fvec2 p = TERRAIN_SCA * pos;
+            xs[count]   = p.x;
+            ys[count]   = p.y;
+            count++;
+        }
+
+        terrain_noise_batch(
+            work->hm->isa,
+            work->hm->lattice,
+            info->octaves,
+            xs,
+            ys,
+            count,
+            work->hm->noise,
+            NOISE_SIZE,
+            h,
+            dx,
+            dz);
+
+        nm::fvec4* texels = job->texels + y * info->size.x;
+        uint32_t j        = 0;
+        for (int32_t x = 0; x < info->size.x; x++) {
+            if (is_row_reusing && ((info->start.x + x) & 1) == 0) continue;
+
+            float height   = TERRAIN_AMP * h[j];
+            nm::fvec2 grad = TERRAIN_AMP * TERRAIN_SCA * nm::fvec2(dx[j], dz[j]);
+            texels[x]      = nm::fvec4(height, grad.x, grad.y, 0.f);
+            j++;
+        }
+    }
+}
+
+/// Resample the elevation model into the texels of a band of rows, from the mip
+/// that matches the texel spacing of the level, such that coarse levels do not
+/// alias.
+static void generate_dem_band(void* user, uint32_t index)
+{
+    cpu_work* work          = (cpu_work*)user;
+    const cpu_job* job      = &work->jobs[index];
+    const update_info* info = job->info;
+    const dem* elevation    = &work->hm->elevation;
+    uint32_t mip            = get_dem_mip(elevation, get_texel_spacing(info->level));
+
+    // the levels share no texels, see get_reuse_level
+    assert(!job->is_reusing);
+
+    for (int32_t y = job->row_start; y < job->row_end; y++) {
+        nm::fvec4* texels = job->texels + y * info->size.x;
+        for (int32_t x = 0; x < info->size.x; x++) {
+            // get world-space position
+            int32_t grid_x = (info->start.x + x) << info->level;
+            int32_t grid_y = (info->start.y + y) << info->level;
+            nm::fvec2 pos  = CLIPMAP_SCALE * nm::fvec2(float(grid_x), float(grid_y));
+
+            nm::fvec3 t = sample_dem_gradient(elevation, mip, pos);
+            texels[x]   = nm::fvec4(t.x, t.y, t.z, 0.f);
+        }
+    }
+}
+
+/// Generates the texels of the regions on the worker threads, one after the
+/// other in the given buffer.
+static void generate_regions(
+    heightmap* hm,
+    const update_info* infos,
+    uint32_t info_count,
+    nm::fvec4* texels,
+    std::vector<cpu_job>* jobs)
+{
+    // split the regions into bands of rows
+    jobs->clear();
+    size_t offset             = 0;
+    size_t texel_count        = 0;
+    size_t reused_texel_count = 0;
+    for (uint32_t i = 0; i < info_count; i++) {
+        bool is_reusing = get_reuse_level(hm, infos[i].level) != infos[i].level;
+        for (int32_t y = 0; y < infos[i].size.y; y += CPU_JOB_ROW_COUNT) {
+            cpu_job job;
+            job.info       = &infos[i];
+            job.row_start  = y;
+            job.row_end    = nm::min(y + CPU_JOB_ROW_COUNT, infos[i].size.y);
+            job.texels     = texels + offset;
+            job.is_reusing = is_reusing;
+            jobs->push_back(job);
+        }
+        offset += size_t(infos[i].size.x) * size_t(infos[i].size.y);
+        reused_texel_count += get_reused_texel_count(hm, &infos[i]);
+    }
+    texel_count = offset;
+
+    cpu_work work;
+    work.hm   = hm;
+    work.jobs = jobs->data();
+
+    auto start = std::chrono::steady_clock::now();
+    worker_fn fn = hm->source == HEIGHTMAP_SOURCE_DEM ? generate_dem_band : generate_band;
+    parallel_for(&hm->pool, uint32_t(jobs->size()), fn, &work);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    hm->stats.generate_seconds[hm->is_truncating_octaves] += elapsed.count();
+    hm->stats.generate_texels[hm->is_truncating_octaves] += texel_count - reused_texel_count;
+}
+
+/// Returns the key of the cached tile at tile coordinate (x, y) of the level.
+/// Tiles that the pack has are keyed by the pack, as their texels are
+/// quantized.
+static tile_cache_key get_tile_key(const heightmap* hm, uint32_t level, int32_t x, int32_t y)
+{
+    tile_cache_key key;
+    key.x       = x;
+    key.y       = y;
+    key.level   = level;
+    key.octaves = hm->stats.level_octaves[level];
+    key.pack    = 0;
+
+    tile_pack_tile tile;
+    if (hm->is_packed && find_tile(&hm->pack, level, x, y, &tile) &&
+        tile.level->octaves == key.octaves) {
+        key.pack = hm->pack_id;
+    }
+
+    return key;
+}
+
+/// Returns the first (xy) and last (zw) tile coordinate of the tiles that the
+/// region overlaps.
+static nm::ivec4 get_tile_range(const update_info* info)
+{
+    const int32_t t = int32_t(TILE_CACHE_TILE_SIZE);
+    return nm::ivec4(
+        nm::idiv(info->start.x, t),
+        nm::idiv(info->start.y, t),
+        nm::idiv(info->start.x + info->size.x - 1, t),
+        nm::idiv(info->start.y + info->size.y - 1, t));
+}
+
+/// Returns the number of texels that must be generated for the region, which
+/// is a complete tile for each tile that is not cached yet.
+static uint32_t get_uncached_texel_count(const heightmap* hm, const update_info* info)
+{
+    uint32_t texel_count = 0;
+    nm::ivec4 range      = get_tile_range(info);
+    for (int32_t y = range.y; y <= range.w; y++) {
+        for (int32_t x = range.x; x <= range.z; x++) {
+            tile_cache_key key = get_tile_key(hm, info->level, x, y);
+            if (peek_tile(&hm->cache, &key) != TILE_CACHE_NO_SLOT) continue;
+            texel_count += TILE_CACHE_TILE_SIZE * TILE_CACHE_TILE_SIZE;
+        }
+    }
+
+    return texel_count;
+}
+
+/// A tile that is missing from the cache, which is generated by a single
+/// worker.
+struct cache_job {
+    tile_cache_key key;
+    nm::fvec4* texels;
+    /// Set if the texels were decoded from the tile pack.
+    bool is_baked;
+};
+
+struct cache_work {
+    heightmap* hm;
+    cache_job* jobs;
+};
+
+static_assert(TILE_PACK_TILE_SIZE == TILE_CACHE_TILE_SIZE, "tiles of the pack fill cached tiles");
+
+/// Decodes the texels of a tile that is keyed by the tile pack. A tile whose
+/// checksum does not match is generated instead, which are exact texels under
+/// the key of the pack.
+static bool read_baked_tile(const heightmap* hm, const cache_job* job)
+{
+    tile_pack_tile tile;
+    if (job->key.pack == 0) return false;
+    if (!find_tile(&hm->pack, job->key.level, job->key.x, job->key.y, &tile)) return false;
+
+    return read_tile(&hm->pack, &tile, job->texels) == NM_SUCCESS;
+}
+
+/// Generate the texels of a complete tile into the cache, as a single batch.
+static void generate_tile(void* user, uint32_t index)
+{
+    cache_work* work = (cache_work*)user;
+    cache_job* job   = &work->jobs[index];
+
+    job->is_baked = read_baked_tile(work->hm, job);
+    if (job->is_baked) return;
+
+    const int32_t t = int32_t(TILE_CACHE_TILE_SIZE);
+    float xs[TILE_CACHE_TILE_SIZE * TILE_CACHE_TILE_SIZE];
+    float ys[TILE_CACHE_TILE_SIZE * TILE_CACHE_TILE_SIZE];
+    float h[TILE_CACHE_TILE_SIZE * TILE_CACHE_TILE_SIZE];
+    float dx[TILE_CACHE_TILE_SIZE * TILE_CACHE_TILE_SIZE];
+    float dz[TILE_CACHE_TILE_SIZE * TILE_CACHE_TILE_SIZE];
+
+    for (int32_t y = 0; y < t; y++) {
+        for (int32_t x = 0; x < t; x++) {
+            // get world-space position
+            int32_t grid_x = (job->key.x * t + x) << job->key.level;
+            int32_t grid_y = (job->key.y * t + y) << job->key.level;
+            nm::fvec2 pos  = CLIPMAP_SCALE * nm::fvec2(float(grid_x), float(grid_y));
+
+            // same scaling as get_height
+            nm::fvec2 p   = TERRAIN_SCA * pos;
+            xs[y * t + x] = p.x;
+            ys[y * t + x] = p.y;
+        }
+    }
+
+    terrain_noise_batch(
+        work->hm->isa,
+        work->hm->lattice,
+        job->key.octaves,
+        xs,
+        ys,
+        TILE_CACHE_TILE_SIZE * TILE_CACHE_TILE_SIZE,
+        work->hm->noise,
+        NOISE_SIZE,
+        h,
+        dx,
+        dz);
+
+    for (uint32_t i = 0; i < TILE_CACHE_TILE_SIZE * TILE_CACHE_TILE_SIZE; i++) {
+        float height   = TERRAIN_AMP * h[i];
+        nm::fvec2 grad = TERRAIN_AMP * TERRAIN_SCA * nm::fvec2(dx[i], dz[i]);
+        job->texels[i] = nm::fvec4(height, grad.x, grad.y, 0.f);
+    }
+}
+
+/// Looks up the tiles that the regions overlap, and generates the missing ones
+/// into the cache on the worker threads.
+static void fill_cache(heightmap* hm, const update_info* infos, uint32_t info_count)
+{
+    std::vector<cache_job> jobs;
+
+    uint64_t hit_count = hm->cache.hit_count;
+    for (uint32_t i = 0; i < info_count; i++) {
+        nm::ivec4 range = get_tile_range(&infos[i]);
+        for (int32_t y = range.y; y <= range.w; y++) {
+            for (int32_t x = range.x; x <= range.z; x++) {
+                cache_job job;
+                job.key = get_tile_key(hm, infos[i].level, x, y);
+                if (find_tile(&hm->cache, &job.key) != TILE_CACHE_NO_SLOT) continue;
+
+                job.texels = get_tile_texels(&hm->cache, insert_tile(&hm->cache, &job.key));
+                jobs.push_back(job);
+            }
+        }
+    }
+
+    hm->stats.cache_hits   = uint32_t(hm->cache.hit_count - hit_count);
+    hm->stats.cache_misses = uint32_t(jobs.size());
+    hm->stats.cache_hit_sum += hm->stats.cache_hits;
+    hm->stats.cache_miss_sum += hm->stats.cache_misses;
+    hm->stats.pack_tiles = 0;
+    if (jobs.empty()) return;
+
+    cache_work work;
+    work.hm   = hm;
+    work.jobs = jobs.data();
+
+    auto start = std::chrono::steady_clock::now();
+    parallel_for(&hm->pool, uint32_t(jobs.size()), generate_tile, &work);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    for (const cache_job& job : jobs) {
+        set_tile_valid(&hm->cache, peek_tile(&hm->cache, &job.key));
+        if (job.is_baked) hm->stats.pack_tiles++;
+    }
+    hm->stats.pack_tile_sum += hm->stats.pack_tiles;
+
+    size_t texel_count = jobs.size() * TILE_CACHE_TILE_SIZE * TILE_CACHE_TILE_SIZE;
+    hm->stats.generate_seconds[hm->is_truncating_octaves] += elapsed.count();
+    hm->stats.generate_texels[hm->is_truncating_octaves] += texel_count;
+}
+
+/// Copies the texels of the regions from their cached tiles, one after the
+/// other in the given buffer.
+static void copy_cached_regions(
+    heightmap* hm, const update_info* infos, uint32_t info_count, nm::fvec4* texels)
+{
+    const int32_t t = int32_t(TILE_CACHE_TILE_SIZE);
+    for (uint32_t i = 0; i < info_count; i++) {
+        const update_info* info = &infos[i];
+        nm::ivec4 range         = get_tile_range(info);
+        for (int32_t ty = range.y; ty <= range.w; ty++) {
+            for (int32_t tx = range.x; tx <= range.z; tx++) {
+                tile_cache_key key = get_tile_key(hm, info->level, tx, ty);
+                const nm::fvec4* tile =
+                    get_tile_texels(&hm->cache, peek_tile(&hm->cache, &key));
+
+                // overlap of the tile and the region in world texel coordinates
+                int32_t x0 = nm::max(info->start.x, tx * t);
+                int32_t y0 = nm::max(info->start.y, ty * t);
+                int32_t x1 = nm::min(info->start.x + info->size.x, tx * t + t);
+                int32_t y1 = nm::min(info->start.y + info->size.y, ty * t + t);
+                for (int32_t y = y0; y < y1; y++) {
+                    const nm::fvec4* row = tile + (y - ty * t) * t + (x0 - tx * t);
+                    std::copy(
+                        row,
+                        row + (x1 - x0),
+                        texels + (y - info->start.y) * info->size.x + (x0 - info->start.x));
+                }
+            }
+        }
+        texels += size_t(info->size.x) * size_t(info->size.y);
+    }
+}
+
+/// Generates the regions on the worker threads and uploads them to the
+/// texture. Regions are processed in chunks that fit in a single pixel buffer.
+void update_cpu(heightmap* hm, nm::tex* texture, const update_info* infos, uint32_t info_count)
+{
+    std::vector<cpu_job> jobs;
+
+    // all tiles are cached before any region is assembled
+    if (hm->is_caching) {
+        fill_cache(hm, infos, info_count);
+        hm->stats.cache_tile_count = get_cached_tile_count(&hm->cache);
+    }
+
+    texture->use();
+
+    uint32_t first = 0;
+    while (first < info_count) {
+        // gather regions until the buffer is full
+        uint32_t last      = first;
+        size_t texel_count = 0;
+        while (last < info_count) {
+            size_t region_texel_count = size_t(infos[last].size.x) * size_t(infos[last].size.y);
+            if (texel_count + region_texel_count > HEIGHTMAP_PBO_TEXEL_COUNT) break;
+            texel_count += region_texel_count;
+            last++;
+        }
+
+        // wait until the upload from this buffer, three frames ago, is done
+        uint32_t idx = hm->pbo_index;
+        if (hm->pbo_fences[idx]) {
+            GLenum status =
+                glClientWaitSync(hm->pbo_fences[idx], GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+            GL_CHECK_ERRORS();
+            // the gpu may still read the buffer, the fence is waited on again
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+                nm::log(nm::LOG_ERROR, "failed to wait for pixel buffer\n");
+                break;
+            }
+            GL_CHECK(glDeleteSync(hm->pbo_fences[idx]));
+            hm->pbo_fences[idx] = 0;
+        }
+
+        GL_CHECK(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, hm->pbos[idx]));
+        nm::fvec4* texels = (nm::fvec4*)glMapBufferRange(
+            GL_PIXEL_UNPACK_BUFFER,
             0,
-            wrapped_y,
-            wrapped_x,
-            CLIPMAP_LEVEL_SIZE - wrapped_y,
-            base_x + CLIPMAP_LEVEL_SIZE,
-            start_y,
-            level);
-
-        register_update_region(
-            u_infos,
-            info_index,
-            wrapped_x,
-            wrapped_y,
-            CLIPMAP_LEVEL_SIZE - wrapped_x,
-            CLIPMAP_LEVEL_SIZE - wrapped_y,
-            start_x,
-            start_y,
-            level);
-
-        info->cleared = false;
-    } else {
-        // incremental update: upload what we need
-        int32_t old_wrapped_x = info->x - old_base_x;
-        int32_t old_wrapped_y = info->y - old_base_y;
-        int32_t wrapped_x     = start_x - base_x;
-        int32_t wrapped_y     = start_y - base_y;
-
-        int32_t wrap_delta_x = wrapped_x - old_wrapped_x;
-        int32_t wrap_delta_y = wrapped_y - old_wrapped_y;
-
-        // there can be significant overlap between X-delta and Y-delta uploads
-        // if deltas are large. Avoiding this would add even more complexities
-        // and is therefore ignored here.
-
-        // Do this in two steps:
-
-        // First, update as we're moving in X, then move in Y.
-        if (wrap_delta_x >= 0 && delta_x >= 0) {
-            // One update region for X, simple case. Have to update both Y regions however.
-            register_update_region(
-                u_infos,
-                info_index,
-                old_wrapped_x,
-                0,
-                wrap_delta_x,
-                old_wrapped_y,
-                info->x + CLIPMAP_LEVEL_SIZE,
-                old_base_y + CLIPMAP_LEVEL_SIZE,
-                level);
-
-            register_update_region(
-                u_infos,
-                info_index,
-                old_wrapped_x,
-                old_wrapped_y,
-                wrap_delta_x,
-                CLIPMAP_LEVEL_SIZE - old_wrapped_y,
-                info->x + CLIPMAP_LEVEL_SIZE,
-                info->y,
-                level);
-        } else if (wrap_delta_x < 0 && delta_x < 0) {
-            // One update region for X, simple case. Have to update both Y regions however.
-            register_update_region(
-                u_infos,
-                info_index,
-                wrapped_x,
-                0,
-                -wrap_delta_x,
-                old_wrapped_y,
-                start_x,
-                old_base_y + CLIPMAP_LEVEL_SIZE,
-                level);
-
-            register_update_region(
-                u_infos,
-                info_index,
-                wrapped_x,
-                old_wrapped_y,
-                -wrap_delta_x,
-                CLIPMAP_LEVEL_SIZE - old_wrapped_y,
-                start_x,
-                info->y,
-                level);
-        } else if (wrap_delta_x < 0 && delta_x >= 0) {
-            // Two update regions in X, and also have to update both Y regions.
-            register_update_region(
-                u_infos,
-                info_index,
-                0,
-                0,
-                wrapped_x,
-                old_wrapped_y,
-                base_x + CLIPMAP_LEVEL_SIZE,
-                old_base_y + CLIPMAP_LEVEL_SIZE,
-                level);
-
-            register_update_region(
-                u_infos,
-                info_index,
-                old_wrapped_x,
-                0,
-                CLIPMAP_LEVEL_SIZE - old_wrapped_x,
-                old_wrapped_y,
-                base_x + old_wrapped_x,
-                old_base_y + CLIPMAP_LEVEL_SIZE,
-                level);
-
-            register_update_region(
-                u_infos,
-                info_index,
-                0,
-                old_wrapped_y,
-                wrapped_x,
-                CLIPMAP_LEVEL_SIZE - old_wrapped_y,
-                base_x + CLIPMAP_LEVEL_SIZE,
-                info->y,
-                level);
-
-            register_update_region(
-                u_infos,
-                info_index,
-                old_wrapped_x,
-                old_wrapped_y,
-                CLIPMAP_LEVEL_SIZE - old_wrapped_x,
-                CLIPMAP_LEVEL_SIZE - old_wrapped_y,
-                base_x + old_wrapped_x,
-                info->y,
-                level);
-        } else if (wrap_delta_x >= 0 && delta_x < 0) {
-            // Two update regions in X, and also have to update both Y regions.
-            register_update_region(
-                u_infos,
-                info_index,
-                0,
-                0,
-                old_wrapped_x,
-                old_wrapped_y,
-                base_x + CLIPMAP_LEVEL_SIZE,
-                old_base_y + CLIPMAP_LEVEL_SIZE,
-                level);
-
-            register_update_region(
-                u_infos,
-                info_index,
-                wrapped_x,
-                0,
-                CLIPMAP_LEVEL_SIZE - wrapped_x,
-                old_wrapped_y,
-                start_x,
-                old_base_y + CLIPMAP_LEVEL_SIZE,
-                level);
-
-            register_update_region(
-                u_infos,
-                info_index,
-                0,
-                old_wrapped_y,
-                old_wrapped_x,
-                CLIPMAP_LEVEL_SIZE - old_wrapped_y,
-                base_x + CLIPMAP_LEVEL_SIZE,
-                info->y,
-                level);
-
-            register_update_region(
-                u_infos,
-                info_index,
-                wrapped_x,
-                old_wrapped_y,
-                CLIPMAP_LEVEL_SIZE - wrapped_x,
-                CLIPMAP_LEVEL_SIZE - old_wrapped_y,
-                start_x,
-                info->y,
-                level);
-        }
-
-        // Second, update as we're moving in Y.
-        if (wrap_delta_y >= 0 && delta_y >= 0) {
-            register_update_region(
-                u_infos,
-                info_index,
-                0,
-                old_wrapped_y,
-                wrapped_x,
-                wrap_delta_y,
-                base_x + CLIPMAP_LEVEL_SIZE,
-                info->y + CLIPMAP_LEVEL_SIZE,
-                level);
-
-            register_update_region(
-                u_infos,
-                info_index,
-                wrapped_x,
-                old_wrapped_y,
-                CLIPMAP_LEVEL_SIZE - wrapped_x,
-                wrap_delta_y,
-                start_x,
-                info->y + CLIPMAP_LEVEL_SIZE,
-                level);
-        } else if (wrap_delta_y < 0 && delta_y < 0) {
-            register_update_region(
-                u_infos,
-                info_index,
-                0,
-                wrapped_y,
-                wrapped_x,
-                -wrap_delta_y,
-                base_x + CLIPMAP_LEVEL_SIZE,
-                start_y,
-                level);
-
-            register_update_region(
-                u_infos,
-                info_index,
-                wrapped_x,
-                wrapped_y,
-                CLIPMAP_LEVEL_SIZE - wrapped_x,
-                -wrap_delta_y,
-                start_x,
-                start_y,
-                level);
-        } else if (wrap_delta_y < 0 && delta_y >= 0) {
-            register_update_region(
-                u_infos,
-                info_index,
-                0,
-                0,
-                wrapped_x,
-                wrapped_y,
-                base_x + CLIPMAP_LEVEL_SIZE,
-                base_y + CLIPMAP_LEVEL_SIZE,
-                level);
-
-            register_update_region(
-                u_infos,
-                info_index,
-                0,
-                old_wrapped_y,
-                wrapped_x,
-                CLIPMAP_LEVEL_SIZE - old_wrapped_y,
-                base_x + CLIPMAP_LEVEL_SIZE,
-                base_y + old_wrapped_y,
-                level);
-
-            register_update_region(
-                u_infos,
-                info_index,
-                wrapped_x,
-                0,
-                CLIPMAP_LEVEL_SIZE - wrapped_x,
-                wrapped_y,
-                start_x,
-                base_y + CLIPMAP_LEVEL_SIZE,
-                level);
-
-            register_update_region(
-                u_infos,
-                info_index,
-                wrapped_x,
-                old_wrapped_y,
-                CLIPMAP_LEVEL_SIZE - wrapped_x,
-                CLIPMAP_LEVEL_SIZE - old_wrapped_y,
-                start_x,
-                base_y + old_wrapped_y,
-                level);
-        } else if (wrap_delta_y >= 0 && delta_y < 0) {
-            register_update_region(
-                u_infos,
-                info_index,
-                0,
-                0,
-                wrapped_x,
-                old_wrapped_y,
-                base_x + CLIPMAP_LEVEL_SIZE,
-                base_y + CLIPMAP_LEVEL_SIZE,
-                level);
-
-            register_update_region(
-                u_infos,
-                info_index,
-                0,
-                wrapped_y,
-                wrapped_x,
-                CLIPMAP_LEVEL_SIZE - wrapped_y,
-                base_x + CLIPMAP_LEVEL_SIZE,
-                start_y,
-                level);
-
-            register_update_region(
-                u_infos,
-                info_index,
-                wrapped_x,
+            sizeof(nm::fvec4) * texel_count,
+            GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_WRITE_BIT);
+        GL_CHECK_ERRORS();
+
+        if (!texels) {
+            nm::log(nm::LOG_ERROR, "failed to map pixel buffer\n");
+            GL_CHECK(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+            break;
+        }
+
+        if (hm->is_caching) {
+            copy_cached_regions(hm, infos + first, last - first, texels);
+        } else {
+            generate_regions(hm, infos + first, last - first, texels, &jobs);
+        }
+
+        GL_CHECK(glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER));
+
+        // copy from buffer to texture
+        size_t offset = 0;
+        for (uint32_t i = first; i < last; i++) {
+            GL_CHECK(glTexSubImage3D(
+                GL_TEXTURE_2D_ARRAY,
                 0,
-                CLIPMAP_LEVEL_SIZE - wrapped_x,
-                old_wrapped_y,
-                start_x,
-                base_y + CLIPMAP_LEVEL_SIZE,
-                level);
+                infos[i].tex.x,
+                infos[i].tex.y,
+                infos[i].level,
+                infos[i].size.x,
+                infos[i].size.y,
+                1,
+                GL_RGBA,
+                GL_FLOAT,
+                reinterpret_cast<const GLvoid*>(sizeof(nm::fvec4) * offset)));
+            offset += size_t(infos[i].size.x) * size_t(infos[i].size.y);
+        }
+
+        hm->pbo_fences[idx] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        GL_CHECK_ERRORS();
+        hm->pbo_index = (idx + 1) % HEIGHTMAP_PBO_COUNT;
+
+        first = last;
+    }
+
+    GL_CHECK(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+    texture->unuse();
+}
+
+/// Accumulates the results of the timer queries that are available, without
+/// waiting for the others.
+void collect_timers(heightmap* hm)
+{
+    for (uint32_t i = 0; i < HEIGHTMAP_TIMER_COUNT; i++) {
+        heightmap_timer* timer = &hm->timers[i];
+        if (!timer->is_pending) continue;
+
+        GLint is_available;
+        GL_CHECK(glGetQueryObjectiv(timer->query, GL_QUERY_RESULT_AVAILABLE, &is_available));
+        if (!is_available) continue;
+
+        GLuint64 nanoseconds;
+        GL_CHECK(glGetQueryObjectui64v(timer->query, GL_QUERY_RESULT, &nanoseconds));
+        hm->stats.generate_seconds[timer->is_truncated] += double(nanoseconds) * 1e-9;
+        hm->stats.generate_texels[timer->is_truncated] += timer->texel_count;
+        timer->is_pending = false;
+
+        if (!timer->is_regeneration) continue;
+        uint32_t idx = timer->is_truncated;
+        hm->stats.regenerate_seconds[idx] += double(nanoseconds) * 1e-9;
+        hm->stats.regenerate_count[idx]++;
+        nm::log(
+            nm::LOG_INFO,
+            "regenerated all levels %s in %.3f ms, %.3f ms on average over %u\n",
+            timer->is_truncated ? "with truncated octaves" : "with all octaves",
+            double(nanoseconds) * 1e-6,
+            hm->stats.regenerate_seconds[idx] * 1e3 / double(hm->stats.regenerate_count[idx]),
+            hm->stats.regenerate_count[idx]);
+    }
+}
 
-            register_update_region(
-                u_infos,
-                info_index,
-                wrapped_x,
-                wrapped_y,
-                CLIPMAP_LEVEL_SIZE - wrapped_x,
-                CLIPMAP_LEVEL_SIZE - wrapped_y,
-                start_x,
-                start_y,
-                level);
+/// Sets the update infos in the uniform data of the frame, which both lod.comp
+/// and lod_reuse.comp read. Returns false if there is no room for them.
+static bool upload_regions(heightmap* hm, const update_info* infos, uint32_t info_count)
+{
+    update_info* info = (update_info*)map_range(
+        hm->ring, hm->uniform_buffer_size, &hm->uniform_offset);
+    if (!info) return false;
+
+    memcpy(info, infos, sizeof(update_info) * info_count);
+
+    unmap_ranges(hm->ring);
+    return true;
+}
+
+/// Binds the update infos of the last upload_regions.
+static void bind_regions(const heightmap* hm)
+{
+    GL_CHECK(glBindBufferRange(
+        GL_UNIFORM_BUFFER, 0, hm->ring->buffer, hm->uniform_offset, hm->uniform_buffer_size));
+}
+
+/// Splits the reused texels of each region into tiles of
+/// HEIGHTMAP_GATHER_TILE_SIZE^2 texels. Returns the number of tiles written.
+static uint32_t build_reuse_tile_list(
+    const heightmap* hm, const update_info* infos, uint32_t info_count, uint32_t* tiles)
+{
+    uint32_t tile_count = 0;
+    for (uint32_t i = 0; i < info_count; i++) {
+        uint32_t source = get_reuse_level(hm, infos[i].level);
+        if (source == infos[i].level) continue;
+
+        nm::uvec2 counts = get_tile_count(&infos[i], HEIGHTMAP_GATHER_TILE_SIZE, true);
+        for (uint32_t y = 0; y < counts.y; y++) {
+            for (uint32_t x = 0; x < counts.x; x++) {
+                tiles[tile_count++] = source << 24 | i << 16 | y << 8 | x;
+            }
         }
     }
 
-    info->x = start_x;
-    info->y = start_y;
+    return tile_count;
 }
 
-void update(heightmap* hm, nm::ivec2 level_offsets[CLIPMAP_LEVEL_COUNT])
+/// Copies the reused texels of the regions from the coarser levels of the
+/// texture, once the generated texels of all regions have been written. The
+/// update infos must be in the uniform buffer and the levels must have been
+/// updated.
+static void reuse_texels(
+    heightmap* hm, const nm::tex* texture, const update_info* infos, uint32_t info_count)
 {
-    // map buffer to gpu
-    GL_CHECK(glBindBuffer(GL_UNIFORM_BUFFER, hm->uniform_buffer));
-    update_info* info = (update_info*)glMapBufferRange(
-        GL_UNIFORM_BUFFER,
+    if (hm->stats.reused_texels == 0) return;
+
+    GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, hm->reuse_tile_buffer));
+    uint32_t* tiles = (uint32_t*)glMapBufferRange(
+        GL_SHADER_STORAGE_BUFFER,
         0,
-        hm->uniform_buffer_size,
+        hm->tile_buffer_size,
         GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_WRITE_BIT);
     GL_CHECK_ERRORS();
 
-    // find out what needs to be updated for each level, set in buffer
-    uint32_t update_region_count = 0;
+    uint32_t tile_count = build_reuse_tile_list(hm, infos, info_count, tiles);
+
+    GL_CHECK(glUnmapBuffer(GL_SHADER_STORAGE_BUFFER));
+    GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+
+    if (tile_count == 0) return;
+
+    // world and local texel coordinate of the origin of each level, to find
+    // the texels of the coarser levels
+    nm::ivec2 starts[CLIPMAP_LEVEL_COUNT];
+    nm::ivec2 tex_origins[CLIPMAP_LEVEL_COUNT];
     for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
-        update_level(hm, level_offsets[i], i, info, &update_region_count);
+        const level_info* info = &hm->level_infos[i];
+        const int32_t size     = hm->texture_size;
+        starts[i]              = nm::ivec2(info->x, info->y);
+        tex_origins[i]         = nm::ivec2(
+            info->x - nm::idiv(info->x, size) * size, info->y - nm::idiv(info->y, size) * size);
     }
 
-    GL_CHECK(glUnmapBuffer(GL_UNIFORM_BUFFER));
+    // make sure the compute shader is done writing the texels
+    GL_CHECK(glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT));
+
+    reuse_program.use();
+    GL_CHECK(glBindImageTexture(0, texture->id, 0, GL_TRUE, 0, GL_READ_WRITE, GL_RGBA32F));
+    bind_regions(hm);
+    GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, hm->reuse_tile_buffer));
+
+    reuse_program.set_ivec2_array("uni_level_starts", starts, CLIPMAP_LEVEL_COUNT);
+    reuse_program.set_ivec2_array("uni_tex_origins", tex_origins, CLIPMAP_LEVEL_COUNT);
+
+    GL_CHECK(glDispatchCompute(tile_count, 1, 1));
+
+    reuse_program.unuse();
+    GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0));
+    GL_CHECK(glBindBufferBase(GL_UNIFORM_BUFFER, 0, 0));
+}
+
+/// Generates the regions into the texture with the lod.comp compute shader.
+/// is_regeneration is true if the regions cover all levels completely. The
+/// dispatches are only timed if is_timed.
+void update_gpu(
+    heightmap* hm,
+    nm::tex* texture,
+    const update_info* infos,
+    uint32_t update_region_count,
+    bool is_regeneration,
+    bool is_timed)
+{
+    // also when there is nothing to dispatch, to not hold back results
+    collect_timers(hm);
+
+    if (update_region_count == 0) {
+        hm->stats.region_count         = 0;
+        hm->stats.tile_count           = 0;
+        hm->stats.launched_invocations = 0;
+        hm->stats.useful_invocations   = 0;
+        return;
+    }
+    if (!upload_regions(hm, infos, update_region_count)) return;
+
+    // map buffer to gpu, set tile list in buffer
+    GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, hm->tile_buffer));
+    uint32_t* tiles = (uint32_t*)glMapBufferRange(
+        GL_SHADER_STORAGE_BUFFER,
+        0,
+        hm->tile_buffer_size,
+        GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_WRITE_BIT);
+    GL_CHECK_ERRORS();
+
+    uint32_t tile_count = build_tile_list(hm, infos, update_region_count, tiles);
+
+    GL_CHECK(glUnmapBuffer(GL_SHADER_STORAGE_BUFFER));
+    GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+
+    if (tile_count == 0) return;
 
     comp_program.use();
-    GL_CHECK(glBindImageTexture(0, hm->texture.id, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA32F));
+    GL_CHECK(glBindImageTexture(0, texture->id, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA32F));
 
-    GL_CHECK(glBindBufferBase(GL_UNIFORM_BUFFER, 0, hm->uniform_buffer));
+    bind_regions(hm);
+    // todo put binding point in variable/define
+    GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, hm->tile_buffer));
 
     hm->noise_tex.use(GL_TEXTURE1);
+    hm->noise_corners_tex.use(GL_TEXTURE2);
+
+    // time the dispatches, unless all queries are still in flight
+    heightmap_timer* timer = &hm->timers[hm->timer_index];
+    is_timed               = is_timed && !timer->is_pending;
+    if (is_timed) GL_CHECK(glBeginQuery(GL_TIME_ELAPSED, timer->query));
+
+    // one workgroup per tile, regardless of the size of the regions
+    GL_CHECK(glDispatchCompute(tile_count, 1, 1));
+    reuse_texels(hm, texture, infos, update_region_count);
+
+    if (is_timed) {
+        GL_CHECK(glEndQuery(GL_TIME_ELAPSED));
+        timer->is_pending      = true;
+        timer->is_truncated    = hm->is_truncating_octaves;
+        timer->is_regeneration = is_regeneration;
+        timer->texel_count     = hm->stats.useful_invocations;
+        hm->timer_index        = (hm->timer_index + 1) % HEIGHTMAP_TIMER_COUNT;
+    }
 
-    // ability to compute at most all possible update buffers in a single call
-    GL_CHECK(glDispatchCompute(CLIPMAP_LEVEL_SIZE, CLIPMAP_LEVEL_SIZE, update_region_count));
-
+    hm->noise_corners_tex.unuse(GL_TEXTURE2);
     hm->noise_tex.unuse(GL_TEXTURE1);
 
     comp_program.unuse();
-    GL_CHECK(glBindBuffer(GL_UNIFORM_BUFFER, 0));
+    GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0));
+    GL_CHECK(glBindBufferBase(GL_UNIFORM_BUFFER, 0, 0));
 }
 
-void use_texture(heightmap* hm)
+/// Reads back the copies of the height bounds whose fence has signaled,
+/// without waiting for the others.
+void collect_bounds(heightmap* hm)
+{
+    // bounds before each read back
+    nm::fvec2 prev_ranges[CLIPMAP_LEVEL_COUNT][HEIGHT_BOUNDS_CELL_COUNT][HEIGHT_BOUNDS_CELL_COUNT];
+    bool prev_is_valid[CLIPMAP_LEVEL_COUNT];
+    nm::ivec2 prev_origins[CLIPMAP_LEVEL_COUNT];
+
+    // oldest first, such that the newest bounds are kept
+    for (uint32_t i = 0; i < HEIGHTMAP_READBACK_COUNT; i++) {
+        heightmap_readback* readback =
+            &hm->readbacks[(hm->readback_index + i) % HEIGHTMAP_READBACK_COUNT];
+        if (!readback->fence) continue;
+
+        // fences signal in order, so the newer copies are not done either
+        GLenum status = glClientWaitSync(readback->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        GL_CHECK_ERRORS();
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break;
+
+        GL_CHECK(glBindBuffer(GL_COPY_READ_BUFFER, readback->buffer));
+        GL_CHECK(glGetBufferSubData(
+            GL_COPY_READ_BUFFER, 0, sizeof(hm->bounds.cells), hm->bounds.cells));
+        GL_CHECK(glBindBuffer(GL_COPY_READ_BUFFER, 0));
+
+        // the culling only reads the ranges and the origins
+        memcpy(prev_ranges, hm->bounds.ranges, sizeof(prev_ranges));
+        for (uint32_t j = 0; j < CLIPMAP_LEVEL_COUNT; j++) {
+            prev_is_valid[j]       = hm->bounds.is_valid[j];
+            prev_origins[j]        = hm->bounds.origins[j];
+            hm->bounds.is_valid[j] = readback->is_valid[j];
+            hm->bounds.origins[j]  = readback->origins[j];
+            hm->bounds.margins[j]  = readback->margins[j];
+        }
+        refine_bounds(&hm->bounds);
+
+        // most read backs only change the levels that were generated
+        for (uint32_t j = 0; j < CLIPMAP_LEVEL_COUNT; j++) {
+            if (!hm->bounds.is_valid[j] && !prev_is_valid[j]) continue;
+            if (hm->bounds.is_valid[j] == prev_is_valid[j] &&
+                hm->bounds.origins[j] == prev_origins[j] &&
+                memcmp(hm->bounds.ranges[j], prev_ranges[j], sizeof(prev_ranges[j])) == 0) {
+                continue;
+            }
+            hm->bounds_versions[j]++;
+        }
+
+        GL_CHECK(glDeleteSync(readback->fence));
+        readback->fence = 0;
+    }
+}
+
+/// Returns the margin of the height bounds of a level, see get_bounds_margin.
+static float get_level_margin(const heightmap* hm, uint32_t level)
 {
-    // make sure sync happens and that the compute shader is done
+    if (hm->source == HEIGHTMAP_SOURCE_NOISE) {
+        return get_bounds_margin(level, hm->stats.level_octaves[level]);
+    }
+
+    // the survey data has no octaves, only the surface in between the texels
+    return hm->elevation.max_slope * 1.4142136f * get_texel_spacing(level);
+}
+
+/// Reduces the height bounds of the levels that the last generation into the
+/// slot changed and starts reading them back. Levels stay dirty while all
+/// copies are in flight.
+void update_bounds(heightmap* hm, const heightmap_slot* slot)
+{
+    for (uint32_t i = 0; i < slot->region_count; i++) {
+        hm->bounds_dirty_mask |= 1u << slot->regions[i].level;
+    }
+
+    // the cells start at the rendered texels, which can move within the guard
+    // band without any region
+    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
+        const level_info* info = &hm->level_infos[i];
+        nm::ivec2 origin       = hm->bounds_origins[i];
+        if (hm->bounds_valid[i] && (origin.x != info->render_x || origin.y != info->render_y)) {
+            hm->bounds_dirty_mask |= 1u << i;
+        }
+    }
+
+    collect_bounds(hm);
+
+    heightmap_readback* readback = &hm->readbacks[hm->readback_index];
+    if (hm->bounds_dirty_mask == 0 || readback->fence) return;
+
+    // make sure the compute shader is done writing the texels
     GL_CHECK(glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT));
 
-    hm->texture.use(GL_TEXTURE0);
+    bounds_program.use();
+    GLuint texture = slot->texture.id;
+    GL_CHECK(glBindImageTexture(0, texture, 0, GL_TRUE, 0, GL_READ_ONLY, GL_RGBA32F));
+    GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, hm->bounds_buffer));
+
+    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
+        if (!(hm->bounds_dirty_mask & (1u << i))) continue;
+
+        // local texel coordinate of the rendered origin of the level
+        const level_info* info = &hm->level_infos[i];
+        const int32_t size     = hm->texture_size;
+        int32_t tex_x          = info->render_x - nm::idiv(info->render_x, size) * size;
+        int32_t tex_y          = info->render_y - nm::idiv(info->render_y, size) * size;
+
+        bounds_program.set_uint("uni_level", i);
+        bounds_program.set_ivec2("uni_tex_origin", nm::ivec2(tex_x, tex_y));
+
+        // one workgroup per cell
+        GL_CHECK(glDispatchCompute(HEIGHT_BOUNDS_CELL_COUNT, HEIGHT_BOUNDS_CELL_COUNT, 1));
+
+        hm->bounds_valid[i]   = true;
+        hm->bounds_origins[i] = nm::ivec2(info->render_x, info->render_y);
+        hm->bounds_margins[i] = get_level_margin(hm, i);
+    }
+    hm->bounds_dirty_mask = 0;
+
+    bounds_program.unuse();
+    GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0));
+
+    // copy the bounds, such that the reduction of later frames can continue
+    GL_CHECK(glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT));
+    GL_CHECK(glBindBuffer(GL_COPY_READ_BUFFER, hm->bounds_buffer));
+    GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, readback->buffer));
+    GL_CHECK(glCopyBufferSubData(
+        GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(hm->bounds.cells)));
+    GL_CHECK(glBindBuffer(GL_COPY_READ_BUFFER, 0));
+    GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+
+    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
+        readback->is_valid[i] = hm->bounds_valid[i];
+        readback->origins[i]  = hm->bounds_origins[i];
+        readback->margins[i]  = hm->bounds_margins[i];
+    }
+
+    readback->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    GL_CHECK_ERRORS();
+    hm->readback_index = (hm->readback_index + 1) % HEIGHTMAP_READBACK_COUNT;
+}
+
+/// Records a timestamp of the current frame timer, see heightmap_frame_timer.
+/// Timestamps are only recorded in order, the frame is not measured otherwise.
+static void record_timestamp(heightmap* hm, uint32_t index)
+{
+    if (hm->backend != HEIGHTMAP_BACKEND_GPU) return;
+
+    heightmap_frame_timer* timer = &hm->frame_timers[hm->frame_timer_index];
+    if (timer->is_pending) return;
+
+    if (timer->recorded_mask != (1u << index) - 1u) return;
+
+    GL_CHECK(glQueryCounter(timer->queries[index], GL_TIMESTAMP));
+    timer->recorded_mask |= 1u << index;
+
+    if (index == 3) {
+        timer->is_pending     = true;
+        hm->frame_timer_index = (hm->frame_timer_index + 1) % HEIGHTMAP_FRAME_TIMER_COUNT;
+    }
+}
+
+/// Accumulates the frame timers that are available, without waiting for the
+/// others.
+static void collect_frame_timers(heightmap* hm)
+{
+    if (hm->backend != HEIGHTMAP_BACKEND_GPU) return;
+
+    for (uint32_t i = 0; i < HEIGHTMAP_FRAME_TIMER_COUNT; i++) {
+        heightmap_frame_timer* timer = &hm->frame_timers[i];
+        if (!timer->is_pending) continue;
+
+        // the last timestamp is available after all others
+        GLint is_available;
+        GL_CHECK(glGetQueryObjectiv(timer->queries[3], GL_QUERY_RESULT_AVAILABLE, &is_available));
+        if (!is_available) continue;
+
+        double t[4];
+        for (uint32_t j = 0; j < 4; j++) {
+            GLuint64 nanoseconds;
+            GL_CHECK(glGetQueryObjectui64v(timer->queries[j], GL_QUERY_RESULT, &nanoseconds));
+            t[j] = double(nanoseconds) * 1e-9;
+        }
+
+        hm->stats.frame_generate_seconds += t[1] - t[0];
+        hm->stats.frame_render_seconds += t[3] - t[2];
+        hm->stats.frame_seconds += t[3] - t[0];
+        hm->stats.frame_count++;
+
+        timer->is_pending = false;
+    }
+
+    // start over, a frame without generation is not measured
+    heightmap_frame_timer* timer = &hm->frame_timers[hm->frame_timer_index];
+    if (!timer->is_pending) timer->recorded_mask = 0;
+}
+
+/// Pipelined mode: makes the slot that is being generated the one that is
+/// rendered, once its generation is done. Returns false if the generation is
+/// still in flight.
+static bool promote_slot(heightmap* hm)
+{
+    heightmap_slot* slot = &hm->slots[hm->write_index];
+    if (!slot->fence) return true;
+
+    // only wait if there is nothing else to render
+    bool is_waiting = get_render_slot(hm)->first_complete_level == CLIPMAP_LEVEL_COUNT;
+    GLenum status   = glClientWaitSync(
+        slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, is_waiting ? UINT64_MAX : 0);
+    GL_CHECK_ERRORS();
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) return false;
+
+    GL_CHECK(glDeleteSync(slot->fence));
+    slot->fence = 0;
+
+    // make the texels visible to rendering and copies. only now, such that
+    // rendering never waits for a generation that is in flight
+    GL_CHECK(glMemoryBarrier(
+        GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT |
+        GL_TEXTURE_UPDATE_BARRIER_BIT));
+
+    hm->render_index = hm->write_index;
+    hm->write_index  = (hm->write_index + 1) % HEIGHTMAP_SLOT_COUNT;
+
+    update_bounds(hm, slot);
+
+    return true;
+}
+
+/// Pipelined mode: copies the regions that the last generation wrote into the
+/// rendered texture, which the texture that is generated next lacks.
+static void copy_regions(heightmap* hm)
+{
+    heightmap_slot* src = &hm->slots[hm->render_index];
+    heightmap_slot* dst = &hm->slots[hm->write_index];
+
+    // both textures use the same toroidal addressing
+    for (uint32_t i = 0; i < src->region_count; i++) {
+        const update_info* region = &src->regions[i];
+        GL_CHECK(glCopyImageSubData(
+            src->texture.id,
+            GL_TEXTURE_2D_ARRAY,
+            0,
+            region->tex.x,
+            region->tex.y,
+            region->level,
+            dst->texture.id,
+            GL_TEXTURE_2D_ARRAY,
+            0,
+            region->tex.x,
+            region->tex.y,
+            region->level,
+            region->size.x,
+            region->size.y,
+            1));
+    }
+
+    // the textures are the same until the next generation
+    src->region_count = 0;
+}
+
+/// Returns the number of texels that the squares of a_size^2 texels at a and of
+/// b_size^2 texels at b have in common.
+static uint32_t get_overlap_texel_count(nm::ivec2 a, int32_t a_size, nm::ivec2 b, int32_t b_size)
+{
+    int32_t x = nm::min(a.x + a_size, b.x + b_size) - nm::max(a.x, b.x);
+    int32_t y = nm::min(a.y + a_size, b.y + b_size) - nm::max(a.y, b.y);
+
+    return x > 0 && y > 0 ? uint32_t(x) * uint32_t(y) : 0u;
+}
+
+/// Returns the number of texels that the rendered texels of a level moved onto
+/// which the guard band of the old level already held.
+static uint32_t get_avoided_texel_count(
+    const heightmap* hm, const level_info* old_info, const level_info* info)
+{
+    if (old_info->cleared || info->cleared) return 0;
+
+    const int32_t size = int32_t(CLIPMAP_LEVEL_SIZE);
+    nm::ivec2 render_start(info->render_x, info->render_y);
+    nm::ivec2 old_render_start(old_info->render_x, old_info->render_y);
+    nm::ivec2 old_start(old_info->x, old_info->y);
+
+    return get_overlap_texel_count(render_start, size, old_start, hm->texture_size) -
+           get_overlap_texel_count(render_start, size, old_render_start, size);
+}
+
+/// Returns the number of texels of the region that count against the texel
+/// budget. Cached texels are only copied.
+static uint32_t get_budget_texel_count(const heightmap* hm, const update_info* info)
+{
+    return hm->is_caching ? get_uncached_texel_count(hm, info) : info->size.x * info->size.y;
+}
+
+/// Returns true if the world texel rectangles [a_min, a_max) and
+/// [b_min, b_max) overlap. An empty rectangle overlaps nothing.
+static bool is_overlapping(nm::ivec2 a_min, nm::ivec2 a_max, nm::ivec2 b_min, nm::ivec2 b_max)
+{
+    return nm::max(a_min.x, b_min.x) < nm::min(a_max.x, b_max.x) &&
+           nm::max(a_min.y, b_min.y) < nm::min(a_max.y, b_max.y);
+}
+
+/// Replaces the regions [first, *info_count) of a level with their parts that
+/// the prefetch texture does not hold, and appends the parts that it holds to
+/// copies. A region is kept whole if its parts do not fit in a plan.
+static void take_prefetched(
+    heightmap* hm,
+    uint32_t level,
+    update_info* infos,
+    uint32_t first,
+    uint32_t* info_count,
+    update_info* copies,
+    uint32_t* copy_count)
+{
+    const prefetch_info* prefetch = &hm->prefetch_infos[level];
+    if (!prefetch->is_valid) return;
+
+    const int32_t size   = hm->texture_size;
+    nm::ivec2 window_max = prefetch->start + nm::ivec2(size, size);
+
+    update_info generated[PLANNER_MAX_REGION_COUNT];
+    uint32_t generated_count = 0;
+    for (uint32_t i = first; i < *info_count; i++) {
+        update_info inside;
+        update_info outside[PLANNER_MAX_SPLIT_COUNT];
+        uint32_t outside_count = 0;
+        bool is_split          = split_update_region(
+            &infos[i], prefetch->start, window_max, &inside, outside, &outside_count);
+
+        // each of the remaining regions needs room as well
+        uint32_t count  = generated_count + outside_count + (*info_count - i - 1);
+        bool is_fitting = count <= PLANNER_MAX_REGION_COUNT;
+        bool is_held    = is_split && !is_overlapping(
+                                       inside.start,
+                                       inside.start + inside.size,
+                                       prefetch->excluded_min,
+                                       prefetch->excluded_max);
+        if (!is_held || !is_fitting) {
+            generated[generated_count++] = infos[i];
+            continue;
+        }
+
+        copies[(*copy_count)++] = inside;
+        for (uint32_t j = 0; j < outside_count; j++) {
+            generated[generated_count++] = outside[j];
+        }
+    }
+
+    memcpy(infos + first, generated, sizeof(update_info) * generated_count);
+    *info_count = first + generated_count;
+}
+
+/// Copies the regions from the prefetch texture into the texture that is
+/// generated, both use the same toroidal addressing.
+static void copy_prefetched(heightmap* hm, const update_info* copies, uint32_t copy_count)
+{
+    if (copy_count == 0) return;
+
+    // the texels were stored by the compute shader of an earlier update
+    GL_CHECK(glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT));
+
+    heightmap_slot* dst = &hm->slots[hm->write_index];
+    for (uint32_t i = 0; i < copy_count; i++) {
+        const update_info* region = &copies[i];
+        GL_CHECK(glCopyImageSubData(
+            hm->prefetch_texture.id,
+            GL_TEXTURE_2D_ARRAY,
+            0,
+            region->tex.x,
+            region->tex.y,
+            region->level,
+            dst->texture.id,
+            GL_TEXTURE_2D_ARRAY,
+            0,
+            region->tex.x,
+            region->tex.y,
+            region->level,
+            region->size.x,
+            region->size.y,
+            1));
+    }
+}
+
+/// Weight of the movement of the last update in the smoothed velocity.
+#define HEIGHTMAP_VELOCITY_WEIGHT .25f
+
+/// Returns the number of texels to prefetch ahead of a level that is predicted
+/// to move the given distance in texels, rounded up to the steps of two texels
+/// that the levels move in.
+static int32_t get_lead(float distance)
+{
+    // less than half a step is not worth predicting
+    if (fabsf(distance) < 1.f) return 0;
+
+    int32_t lead = nm::min(2 * int32_t(ceilf(.5f * fabsf(distance))), HEIGHTMAP_PREFETCH_MAX_LEAD);
+    return distance < 0.f ? -lead : lead;
 }
 
-void unuse_texture(heightmap* hm) { hm->texture.unuse(GL_TEXTURE0); }
\ No newline at end of file
+/// Returns the number of texels that a level is predicted to move in the next
+/// prefetch_frame_count updates.
+static nm::ivec2 get_prefetch_lead(const heightmap* hm, uint32_t level)
+{
+    float frame_count = float(hm->prefetch_frame_count) / float(1u << level);
+    return nm::ivec2(
+        get_lead(hm->velocity.x * frame_count), get_lead(hm->velocity.y * frame_count));
+}
+
+/// Moves the prefetched window of each level to where the level is predicted
+/// to be, and appends the regions that it lacks. Finer levels go first, as they
+/// scroll in the most texels. Levels whose regions do not fit in
+/// max_texel_count keep their prefetched window.
+static void plan_prefetch(
+    heightmap* hm, uint32_t max_texel_count, update_info* infos, uint32_t* info_count)
+{
+    const int32_t size   = hm->texture_size;
+    uint32_t texel_count = 0;
+    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
+        const level_info* level = &hm->level_infos[i];
+        prefetch_info* prefetch = &hm->prefetch_infos[i];
+        nm::ivec2 lead          = get_prefetch_lead(hm, i);
+        if (level->cleared || (lead.x == 0 && lead.y == 0)) continue;
+
+        // start over from the window of the level if the prefetched window is
+        // behind it or too far ahead, the window of the level is not generated
+        nm::ivec2 start(level->x, level->y);
+        nm::ivec2 ahead = prefetch->start - start;
+        if (!prefetch->is_valid || ahead.x * lead.x < 0 || ahead.y * lead.y < 0 ||
+            abs(ahead.x) > HEIGHTMAP_PREFETCH_MAX_LEAD ||
+            abs(ahead.y) > HEIGHTMAP_PREFETCH_MAX_LEAD) {
+            prefetch->is_valid     = true;
+            prefetch->start        = start;
+            prefetch->excluded_min = start;
+            prefetch->excluded_max = start + nm::ivec2(size, size);
+        }
+
+        nm::ivec2 target = start + lead;
+        if (target == prefetch->start) continue;
+
+        uint32_t first = *info_count;
+        plan_update_regions(prefetch->start, true, target, size, i, infos, info_count);
+
+        uint32_t level_texel_count = 0;
+        for (uint32_t j = first; j < *info_count; j++) {
+            level_texel_count += get_budget_texel_count(hm, &infos[j]);
+        }
+        if (texel_count + level_texel_count > max_texel_count) {
+            *info_count = first;
+            continue;
+        }
+        texel_count += level_texel_count;
+
+        // the texels of the target window that the old window does not have
+        // are generated, the excluded texels that remain stay excluded
+        prefetch->excluded_min = nm::ivec2(
+            nm::max(prefetch->excluded_min.x, target.x),
+            nm::max(prefetch->excluded_min.y, target.y));
+        prefetch->excluded_max = nm::ivec2(
+            nm::min(prefetch->excluded_max.x, target.x + size),
+            nm::min(prefetch->excluded_max.y, target.y + size));
+        prefetch->start = target;
+    }
+
+    for (uint32_t i = 0; i < *info_count; i++) {
+        infos[i].octaves = hm->stats.level_octaves[infos[i].level];
+    }
+}
+
+/// Generates the regions into the prefetch texture. The stats of the last
+/// update describe the regions of the update, the prefetched regions only
+/// count as prefetched_texels. Their dispatches are not timed, to not take the
+/// timer queries of the updates.
+static void generate_prefetched(heightmap* hm, const update_info* infos, uint32_t info_count)
+{
+    const heightmap_stats stats = hm->stats;
+
+    // the prefetch texture has no coarser levels to copy texels from
+    bool is_reusing         = hm->is_reusing_levels;
+    hm->is_reusing_levels   = false;
+    hm->stats.reused_texels = 0;
+    if (hm->backend == HEIGHTMAP_BACKEND_CPU) {
+        update_cpu(hm, &hm->prefetch_texture, infos, info_count);
+    } else {
+        update_gpu(hm, &hm->prefetch_texture, infos, info_count, false, false);
+    }
+    hm->is_reusing_levels = is_reusing;
+
+    // the cache sums since start up include the prefetched regions
+    hm->stats.region_count         = stats.region_count;
+    hm->stats.tile_count           = stats.tile_count;
+    hm->stats.launched_invocations = stats.launched_invocations;
+    hm->stats.useful_invocations   = stats.useful_invocations;
+    hm->stats.reused_texels        = stats.reused_texels;
+    hm->stats.cache_hits           = stats.cache_hits;
+    hm->stats.cache_misses         = stats.cache_misses;
+    hm->stats.pack_tiles           = stats.pack_tiles;
+}
+
+void update(
+    heightmap* hm, nm::ivec2 level_offsets[CLIPMAP_LEVEL_COUNT], nm::fvec2 camera_velocity)
+{
+    collect_frame_timers(hm);
+
+    // a jump by more than a level is not a movement to predict
+    nm::fvec2 velocity = camera_velocity / CLIPMAP_SCALE;
+    if (fabsf(velocity.x) > float(CLIPMAP_LEVEL_SIZE) ||
+        fabsf(velocity.y) > float(CLIPMAP_LEVEL_SIZE)) {
+        velocity = nm::fvec2(0.f, 0.f);
+    }
+    hm->velocity = (1.f - HEIGHTMAP_VELOCITY_WEIGHT) * hm->velocity +
+                   HEIGHTMAP_VELOCITY_WEIGHT * velocity;
+
+    // keep rendering the older texels until the generation is done, without
+    // queueing more work
+    if (hm->is_pipelined && !promote_slot(hm)) return;
+
+    // all levels are generated from scratch
+    bool is_regeneration = true;
+    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
+        is_regeneration = is_regeneration && hm->level_infos[i].cleared;
+    }
+
+    uint32_t budget           = hm->is_regenerate_pending ? 0u : hm->texel_budget;
+    hm->is_regenerate_pending = false;
+
+    // find out what needs to be updated for each level, from coarse to fine
+    // such that deferred levels can fall back to the coarser ones
+    level_info old_infos[CLIPMAP_LEVEL_COUNT];
+    memcpy(old_infos, hm->level_infos, sizeof(old_infos));
+    update_info infos[MAX_UPDATE_COUNT];
+    update_info copies[MAX_UPDATE_COUNT];
+    uint32_t update_region_count   = 0;
+    uint32_t copy_count            = 0;
+    uint32_t budget_texel_count    = 0;
+    uint32_t first_complete_level  = 0;
+    hm->stats.deferred_level_count = 0;
+    for (uint32_t i = CLIPMAP_LEVEL_COUNT; i-- > 0;) {
+        uint32_t first      = update_region_count;
+        uint32_t first_copy = copy_count;
+        update_level(hm, level_offsets[i], i, infos, &update_region_count);
+
+        // prefetched texels are only copied, like cached texels they do not
+        // count against the budget
+        take_prefetched(hm, i, infos, first, &update_region_count, copies, &copy_count);
+        uint32_t texel_count = 0;
+        for (uint32_t j = first; j < update_region_count; j++) {
+            texel_count += get_budget_texel_count(hm, &infos[j]);
+        }
+        if (texel_count == 0) continue;
+
+        bool is_over_budget = budget > 0 && budget_texel_count > 0 &&
+                              budget_texel_count + texel_count > budget;
+        if (hm->stats.deferred_level_count == 0 && !is_over_budget) {
+            budget_texel_count += texel_count;
+            continue;
+        }
+
+        // keep the old texels and update from them later
+        hm->level_infos[i]  = old_infos[i];
+        update_region_count = first;
+        copy_count          = first_copy;
+        if (hm->stats.deferred_level_count == 0) first_complete_level = i + 1;
+        hm->stats.deferred_level_count++;
+    }
+    is_regeneration = is_regeneration && hm->stats.deferred_level_count == 0;
+    uint32_t texel_count    = 0;
+    hm->stats.reused_texels = 0;
+    for (uint32_t i = 0; i < update_region_count; i++) {
+        infos[i].octaves = hm->stats.level_octaves[infos[i].level];
+        texel_count += infos[i].size.x * infos[i].size.y;
+        hm->stats.reused_texels += get_reused_texel_count(hm, &infos[i]);
+    }
+    hm->stats.reused_texel_sum += hm->stats.reused_texels;
+    hm->stats.updated_texel_sum += texel_count;
+
+    // deferred levels are restored, they did not move
+    hm->stats.avoided_texels = 0;
+    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
+        const level_info* info = &hm->level_infos[i];
+        hm->stats.avoided_texels += get_avoided_texel_count(hm, &old_infos[i], info);
+    }
+    hm->stats.avoided_texel_sum += hm->stats.avoided_texels;
+
+    hm->stats.prefetch_copied_texels = 0;
+    for (uint32_t i = 0; i < copy_count; i++) {
+        hm->stats.prefetch_copied_texels += copies[i].size.x * copies[i].size.y;
+    }
+    hm->stats.prefetch_copied_texel_sum += hm->stats.prefetch_copied_texels;
+
+    // spend what is left of the budget on the texels of the next updates,
+    // unless levels are still catching up
+    update_info prefetch_regions[MAX_UPDATE_COUNT];
+    uint32_t prefetch_region_count = 0;
+    if (hm->prefetch_frame_count > 0 && hm->stats.deferred_level_count == 0) {
+        uint32_t spare_texel_count = UINT32_MAX;
+        if (budget > 0) spare_texel_count = budget - nm::min(budget, budget_texel_count);
+        plan_prefetch(hm, spare_texel_count, prefetch_regions, &prefetch_region_count);
+    }
+    hm->stats.prefetched_texels = 0;
+    for (uint32_t i = 0; i < prefetch_region_count; i++) {
+        hm->stats.prefetched_texels += prefetch_regions[i].size.x * prefetch_regions[i].size.y;
+    }
+    hm->stats.prefetched_texel_sum += hm->stats.prefetched_texels;
+
+    bool is_generating = update_region_count > 0 || copy_count > 0 ||
+                         prefetch_region_count > 0 ||
+                         (hm->is_pipelined && get_render_slot(hm)->region_count > 0);
+    if (is_generating) record_timestamp(hm, 0);
+    if (hm->is_pipelined) copy_regions(hm);
+
+    // the copies read the prefetch texture before it moves on
+    copy_prefetched(hm, copies, copy_count);
+    if (prefetch_region_count > 0) {
+        generate_prefetched(hm, prefetch_regions, prefetch_region_count);
+    }
+
+    if (hm->backend == HEIGHTMAP_BACKEND_CPU) {
+        hm->stats.region_count         = update_region_count;
+        hm->stats.tile_count           = 0;
+        hm->stats.launched_invocations = 0;
+        hm->stats.useful_invocations   = texel_count - hm->stats.reused_texels;
+
+        nm::tex* texture = &hm->slots[hm->write_index].texture;
+        update_cpu(hm, texture, infos, update_region_count);
+        if (hm->stats.reused_texels > 0 && upload_regions(hm, infos, update_region_count)) {
+            reuse_texels(hm, texture, infos, update_region_count);
+        }
+    } else {
+        update_gpu(
+            hm,
+            &hm->slots[hm->write_index].texture,
+            infos,
+            update_region_count,
+            is_regeneration,
+            true);
+    }
+    if (is_generating) record_timestamp(hm, 1);
+
+    // the copied regions are written as well
+    heightmap_slot* slot = &hm->slots[hm->write_index];
+    memcpy(slot->regions, infos, sizeof(update_info) * update_region_count);
+    memcpy(slot->regions + update_region_count, copies, sizeof(update_info) * copy_count);
+    slot->region_count = update_region_count + copy_count;
+    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
+        slot->level_offsets[i] = level_offsets[i];
+    }
+    slot->first_complete_level = first_complete_level;
+
+    if (!hm->is_pipelined) {
+        update_bounds(hm, slot);
+        return;
+    }
+
+    if (slot->region_count == 0) return;
+
+    slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    GL_CHECK_ERRORS();
+
+    // there is nothing to render yet
+    if (get_render_slot(hm)->first_complete_level == CLIPMAP_LEVEL_COUNT) promote_slot(hm);
+}
+
+void set_octave_truncation(heightmap* hm, bool is_truncating)
+{
+    hm->is_truncating_octaves = is_truncating;
+    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
+        hm->stats.level_octaves[i]     = is_truncating ? hm->nyquist_octaves[i] : NOISE_OCTAVES;
+        hm->level_infos[i].cleared     = true;
+        hm->prefetch_infos[i].is_valid = false;
+    }
+
+    nm::log(nm::LOG_INFO, "octave truncation %s\n", is_truncating ? "enabled" : "disabled");
+}
+
+void regenerate(heightmap* hm)
+{
+    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
+        hm->level_infos[i].cleared     = true;
+        hm->prefetch_infos[i].is_valid = false;
+    }
+    hm->is_regenerate_pending = true;
+}
+
+void use_texture(heightmap* hm)
+{
+    // make sure sync happens and that the compute shader is done, pipelining
+    // does so when the texture becomes the rendered one
+    if (!hm->is_pipelined) GL_CHECK(glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT));
+
+    hm->slots[hm->render_index].texture.use(GL_TEXTURE0);
+}
+
+void unuse_texture(heightmap* hm) { hm->slots[hm->render_index].texture.unuse(GL_TEXTURE0); }
+
+void begin_render(heightmap* hm) { record_timestamp(hm, 2); }
+
+void end_render(heightmap* hm) { record_timestamp(hm, 3); }
\ No newline at end of file
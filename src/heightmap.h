@@ -1,9 +1,17 @@
 #ifndef TERRAIN3_HEIGHTMAP_H
 #define TERRAIN3_HEIGHTMAP_H
 
+#include "dem.h"
+#include "height_bounds.h"
 #include "nmutil/gl.h"
 #include "nmutil/vector.h"
+#include "noise_batch.h"
 #include "terrain_defs.h"
+#include "tile_cache.h"
+#include "tile_pack.h"
+#include "ubo_ring.h"
+#include "update_planner.h"
+#include "worker_pool.h"
 
 /// This file and its implementation encapsulate the heightmap, which is the
 /// texture that represents the heights and the gradients of the terrain.
@@ -20,55 +28,457 @@ struct level_info {
     /// if cleared is true.
     int32_t x;
     int32_t y;
+    /// (-x,-y)-most world texel coordinate of the rendered CLIPMAP_LEVEL_SIZE^2
+    /// texels, which lie within the loaded texture.
+    int32_t render_x;
+    int32_t render_y;
     bool cleared;
 };
 
-/// Maintains information about a texture region that should be recomputed as
-/// the part of the world that it represents has changed. As well as information
-/// on where to update it in the texture.
-struct update_info {
-    /// Local texel coordinate of (-x/-y)-most point of region.
-    nm::ivec2 tex;
-    // todo should this not be unsigned?
-    /// Size in texels of the region.
-    nm::ivec2 size;
-    /// World texel coordinate of (-x/-y)-most point of region.
+/// Default number of texels that the texture holds beyond the rendered texels
+/// on each side, see get_resident_start.
+#define HEIGHTMAP_GUARD_BAND 4u
+
+/// Upper bound on the guard band, such that the texels of each level still lie
+/// within the rendered texels of the next coarser level.
+#define HEIGHTMAP_MAX_GUARD_BAND 16u
+
+/// Size of the heightmap texture with the largest guard band.
+#define HEIGHTMAP_MAX_TEXTURE_SIZE (CLIPMAP_LEVEL_SIZE + 2u * HEIGHTMAP_MAX_GUARD_BAND)
+
+/// Each level generates at most the regions of a single plan.
+#define MAX_UPDATE_COUNT (CLIPMAP_LEVEL_COUNT * PLANNER_MAX_REGION_COUNT)
+
+/// Each update writes the generated regions and at most as many regions that
+/// are copied from the prefetch texture.
+#define MAX_WRITTEN_COUNT (2u * MAX_UPDATE_COUNT)
+
+/// Texels of a level that were generated ahead of time into the prefetch
+/// texture, which uses the same toroidal addressing as the heightmap. Holds
+/// the texels of the window at start, except those in
+/// [excluded_min, excluded_max), which were never generated.
+struct prefetch_info {
+    bool is_valid;
     nm::ivec2 start;
-    /// Level of the texture.
-    uint32_t level;
-    float padding0;
+    nm::ivec2 excluded_min;
+    nm::ivec2 excluded_max;
 };
 
-struct heightmap {
+/// The compute shader works on square tiles of this many texels, must match
+/// the local size in lod.comp.
+#define HEIGHTMAP_TILE_SIZE 16u
+
+/// Number of tiles needed to cover a complete level in one dimension.
+#define HEIGHTMAP_TILE_COUNT_LEVEL                                                                 \
+    ((HEIGHTMAP_MAX_TEXTURE_SIZE + HEIGHTMAP_TILE_SIZE - 1u) / HEIGHTMAP_TILE_SIZE)
+
+/// Regions that reuse texels of a coarser level are split into tiles of this
+/// many texels instead, which start at an even world texel coordinate. Each
+/// tile is 9x9 quads of 2x2 texels and the three generated texels of each quad
+/// are spread over 243 of the invocations of lod.comp.
+#define HEIGHTMAP_REUSE_TILE_SIZE 18u
+
+/// lod_reuse.comp copies the reused texel of 16x16 quads per workgroup, its
+/// tiles are this many texels in each dimension.
+#define HEIGHTMAP_GATHER_TILE_SIZE 32u
+
+/// Each region covers at most a complete level.
+#define MAX_TILE_COUNT (MAX_UPDATE_COUNT * HEIGHTMAP_TILE_COUNT_LEVEL * HEIGHTMAP_TILE_COUNT_LEVEL)
+
+/// Statistics of the last heightmap update.
+struct heightmap_stats {
+    /// Number of regions that were recomputed.
+    uint32_t region_count;
+    /// Number of tiles, each tile is computed by a single workgroup.
+    uint32_t tile_count;
+    /// Number of compute shader invocations that were launched.
+    uint32_t launched_invocations;
+    /// Number of compute shader invocations that wrote a texel.
+    uint32_t useful_invocations;
+    /// Number of octaves that are evaluated for each level.
+    uint32_t level_octaves[CLIPMAP_LEVEL_COUNT];
+    /// Number of levels with work that were deferred by the texel budget.
+    uint32_t deferred_level_count;
+    /// Number of texels that were copied from a coarser level instead of
+    /// generated. Also accumulated since start up, together with the number of
+    /// texels that were updated in total.
+    uint32_t reused_texels;
+    uint64_t reused_texel_sum;
+    uint64_t updated_texel_sum;
+    /// Tile cache: number of tiles of the last update that were read from the
+    /// cache and that were generated, the same since start up, and the number
+    /// of tiles in the cache out of its capacity.
+    uint32_t cache_hits;
+    uint32_t cache_misses;
+    uint64_t cache_hit_sum;
+    uint64_t cache_miss_sum;
+    uint32_t cache_tile_count;
+    uint32_t cache_tile_capacity;
+    /// Number of tiles of the last update that were missing from the cache and
+    /// were decoded from the tile pack instead of generated, and the same
+    /// since start up.
+    uint32_t pack_tiles;
+    uint64_t pack_tile_sum;
+    /// Number of texels that were generated ahead of time into the prefetch
+    /// texture and that were copied from it instead of generated, the same
+    /// since start up.
+    uint32_t prefetched_texels;
+    uint32_t prefetch_copied_texels;
+    uint64_t prefetched_texel_sum;
+    uint64_t prefetch_copied_texel_sum;
+    /// Number of texels that the rendered texels moved onto and that were not
+    /// generated, as the guard band already held them. The same since start
+    /// up.
+    uint32_t avoided_texels;
+    uint64_t avoided_texel_sum;
+    /// Measured generation time in seconds and the number of texels generated
+    /// in that time, accumulated since start up. Index 0 is with all octaves
+    /// and index 1 is with truncated octaves. GPU times arrive a few frames
+    /// late.
+    double generate_seconds[2];
+    uint64_t generate_texels[2];
+    /// Measured generation time in seconds of the dispatches that regenerated
+    /// all levels from scratch, and the number of such dispatches. Indexed
+    /// the same as generate_seconds.
+    double regenerate_seconds[2];
+    uint32_t regenerate_count[2];
+    /// GPU time in seconds spent on generating, on rendering, and from the start
+    /// of the generation to the end of the rendering, accumulated over the
+    /// measured frames. From the timestamps of heightmap_frame_timer. The
+    /// timestamps wait for all earlier commands, so they cannot show overlap
+    /// within a frame. What pipelining saves shows as a lower frame time than
+    /// without it.
+    double frame_generate_seconds;
+    double frame_render_seconds;
+    double frame_seconds;
+    uint32_t frame_count;
+};
+
+/// Timer query around a single dispatch of the compute shader, which is read
+/// back a few frames later to not stall.
+struct heightmap_timer {
+    GLuint query;
+    bool is_pending;
+    bool is_truncated;
+    /// Whether the dispatch regenerated all levels.
+    bool is_regeneration;
+    uint32_t texel_count;
+};
+
+/// Number of timer queries in flight.
+#define HEIGHTMAP_TIMER_COUNT 4u
+
+/// Timestamps of a single frame, recorded in order: the start and the end of
+/// the generation, and the start and the end of the rendering. Read back a few
+/// frames later to not stall.
+struct heightmap_frame_timer {
+    GLuint queries[4];
+    /// Bit for each timestamp that has been recorded.
+    uint32_t recorded_mask;
+    bool is_pending;
+};
+
+/// Number of frame timers in flight.
+#define HEIGHTMAP_FRAME_TIMER_COUNT 4u
+
+/// Copy of the GPU height bounds that is read back once its fence signals, to
+/// not stall on the reduction.
+struct heightmap_readback {
+    GLuint buffer;
+    /// Zero if the slot is free.
+    GLsync fence;
+    /// Levels, origins and margins of the bounds at the time of the copy.
+    bool is_valid[CLIPMAP_LEVEL_COUNT];
+    nm::ivec2 origins[CLIPMAP_LEVEL_COUNT];
+    float margins[CLIPMAP_LEVEL_COUNT];
+};
+
+/// Number of height bounds read backs in flight.
+#define HEIGHTMAP_READBACK_COUNT 3u
+
+/// Determines where the heightmap is generated.
+enum heightmap_backend {
+    /// Generated by the lod.comp compute shader.
+    HEIGHTMAP_BACKEND_GPU,
+    /// Generated by worker threads and uploaded through a ring of pixel buffer
+    /// objects. Evaluates the same terrain_noise as the compute shader, results
+    /// only differ by floating point rounding, within TERRAIN_HEIGHT_TOLERANCE
+    /// and TERRAIN_SLOPE_TOLERANCE (see check_texels).
+    HEIGHTMAP_BACKEND_CPU
+};
+
+/// Determines where the heights of the terrain come from.
+enum heightmap_source {
+    /// The procedural terrain_noise, which both backends evaluate.
+    HEIGHTMAP_SOURCE_NOISE,
+    /// Survey data of a digital elevation model, which the worker threads of
+    /// the CPU backend resample into the levels.
+    HEIGHTMAP_SOURCE_DEM
+};
+
+/// A heightmap texture together with the state of its texels.
+struct heightmap_slot {
     /// Texture containing the heightmap and normal.
     nm::tex texture;
-    GLuint uniform_buffer;
+    /// Pipelined mode: signals when the last generation into the texture is
+    /// done, zero if there is none in flight.
+    GLsync fence;
+    /// Level offsets that the texels belong to, and the finest level from
+    /// which on all levels hold the texels of their offset. The finer levels
+    /// are rendered with the texels of this level.
+    nm::ivec2 level_offsets[CLIPMAP_LEVEL_COUNT];
+    uint32_t first_complete_level;
+    /// Regions written by the last generation, which the other texture lacks.
+    update_info regions[MAX_WRITTEN_COUNT];
+    uint32_t region_count;
+};
+
+/// Number of heightmap textures in pipelined mode.
+#define HEIGHTMAP_SLOT_COUNT 2u
+
+/// Options that are fixed for the lifetime of the heightmap.
+struct heightmap_config {
+    heightmap_backend backend;
+    /// HEIGHTMAP_SOURCE_DEM implies the CPU backend, the file is described by
+    /// dem.
+    heightmap_source source;
+    dem_config dem;
+    /// Lattice of the noise, used by both backends and get_height.
+    noise_lattice lattice;
+    /// GPU backend with the table lattice: if true, the four corners of a
+    /// lattice cell are read with a single textureGather instead of four
+    /// texelFetch calls.
+    bool is_gathering_noise;
+    /// Maximum number of texels that a single update generates, zero for no
+    /// limit. The coarsest level with work is always generated, to make
+    /// progress.
+    uint32_t texel_budget;
+    /// Number of texels that the texture holds beyond the rendered texels on
+    /// each side, at most HEIGHTMAP_MAX_GUARD_BAND.
+    uint32_t guard_band;
+    /// If true, each frame renders from the texture that the previous
+    /// generation completed, while the next generation fills the other one.
+    bool is_pipelined;
+    /// If true, texels that lie on a texel of a coarser level which evaluates
+    /// the same octaves are copied from that level instead of generated.
+    bool is_reusing_levels;
+    /// CPU backend: if not null, the generated texels are stored in a tile
+    /// cache in this file, of at most cache_size bytes, and read back from it
+    /// when they are needed again.
+    const char* cache_path;
+    size_t cache_size;
+    /// Tile cache: if not null, tiles that are missing from the cache are read
+    /// from the tile pack in this file, if it has them, instead of generated.
+    const char* pack_path;
+    /// If not zero, the texels that the levels are predicted to scroll in
+    /// within this many updates are generated ahead of time with the texel
+    /// budget that is left over, and copied once the levels get there.
+    uint32_t prefetch_frame_count;
+};
+
+/// Default texel budget, enough for two complete levels. Moving around only
+/// regenerates thin strips of each level, which stays well below the budget.
+#define HEIGHTMAP_TEXEL_BUDGET (2u * CLIPMAP_LEVEL_SIZE * CLIPMAP_LEVEL_SIZE)
+
+/// Default number of updates to prefetch ahead of the camera.
+#define HEIGHTMAP_PREFETCH_FRAME_COUNT 8u
+
+/// Maximum number of texels that a prefetched window is ahead of its level in
+/// each dimension. Must be even, as the levels move in steps of two texels.
+#define HEIGHTMAP_PREFETCH_MAX_LEAD 64
+
+/// Number of pixel buffer objects used to upload CPU generated texels.
+#define HEIGHTMAP_PBO_COUNT 3u
+
+/// Number of texels a single pixel buffer object holds, enough for a complete
+/// rewrite of the heightmap.
+#define HEIGHTMAP_PBO_TEXEL_COUNT                                                                  \
+    (HEIGHTMAP_MAX_TEXTURE_SIZE * HEIGHTMAP_MAX_TEXTURE_SIZE * CLIPMAP_LEVEL_COUNT)
+
+struct heightmap {
+    heightmap_backend backend;
+    heightmap_source source;
+    noise_lattice lattice;
+    /// Only mapped with HEIGHTMAP_SOURCE_DEM.
+    dem elevation;
+
+    /// The textures hold texture_size^2 texels of each level, the rendered
+    /// texels and a guard band of guard_band texels around them.
+    int32_t guard_band;
+    int32_t texture_size;
+
+    /// Without pipelining, only the first slot is used for both generating and
+    /// rendering. With pipelining, a slot becomes the one that is rendered
+    /// once its generation completes, and the other one is generated next.
+    bool is_pipelined;
+    heightmap_slot slots[HEIGHTMAP_SLOT_COUNT];
+    uint32_t write_index;
+    uint32_t render_index;
+
+    /// The update infos of lod.comp and lod_reuse.comp are allocated from
+    /// the ring each time that they are uploaded, the last upload starts at
+    /// uniform_offset.
+    ubo_ring* ring;
+    size_t uniform_offset;
     size_t uniform_buffer_size;
 
     nm::tex noise_tex;
+    /// RGBA8 texture with the four corners of each lattice cell, for the
+    /// packed lattice.
+    nm::tex noise_corners_tex;
+
+    /// SSBO with the compacted list of tiles to compute. Each tile is encoded
+    /// as (source level << 24 | region index << 16 | tile y << 8 | tile x),
+    /// where the source level is the coarsest level that texels of the region
+    /// are copied from, or the level of the region itself if none.
+    GLuint tile_buffer;
+    size_t tile_buffer_size;
+    /// SSBO with the tiles of lod_reuse.comp, encoded the same way.
+    GLuint reuse_tile_buffer;
+
+    bool is_reusing_levels;
+
+    /// Workers that evaluate the noise, for the CPU backend and for queries.
+    worker_pool pool;
+    /// CPU backend: ring of buffers to upload texels from, each buffer is
+    /// guarded by a fence that signals when the upload from it is done.
+    GLuint pbos[HEIGHTMAP_PBO_COUNT];
+    GLsync pbo_fences[HEIGHTMAP_PBO_COUNT];
+    uint32_t pbo_index;
+    /// CPU backend: if true, regions are assembled from cached tiles, and the
+    /// tiles that are missing are generated into the cache first.
+    bool is_caching;
+    tile_cache cache;
+    /// Tile cache: if true, tiles that are missing from the cache are decoded
+    /// from the pack if it has them. Their keys carry pack_id, which is never
+    /// zero.
+    bool is_packed;
+    tile_pack pack;
+    uint32_t pack_id;
+
+    /// Ring of timer queries, GPU backend only.
+    heightmap_timer timers[HEIGHTMAP_TIMER_COUNT];
+    uint32_t timer_index;
+    heightmap_frame_timer frame_timers[HEIGHTMAP_FRAME_TIMER_COUNT];
+    uint32_t frame_timer_index;
+
+    /// SSBO with the cells of height_bounds, written by lod_bounds.comp for
+    /// each level that changed.
+    GLuint bounds_buffer;
+    /// Bit for each level whose bounds have not been reduced yet.
+    uint32_t bounds_dirty_mask;
+    /// Levels, origins and margins of the bounds in bounds_buffer.
+    bool bounds_valid[CLIPMAP_LEVEL_COUNT];
+    nm::ivec2 bounds_origins[CLIPMAP_LEVEL_COUNT];
+    float bounds_margins[CLIPMAP_LEVEL_COUNT];
+    heightmap_readback readbacks[HEIGHTMAP_READBACK_COUNT];
+    uint32_t readback_index;
+    /// Latest bounds that arrived on the CPU, a few frames behind the
+    /// heightmap.
+    height_bounds bounds;
+    /// Incremented whenever the bounds of the level change, a read back that
+    /// finds the same bounds changes none.
+    uint32_t bounds_versions[CLIPMAP_LEVEL_COUNT];
+
+    /// If true, each level only evaluates the octaves that its texel spacing
+    /// can represent.
+    bool is_truncating_octaves;
+    /// Octave count of each level at the Nyquist limit of its texel spacing.
+    uint32_t nyquist_octaves[CLIPMAP_LEVEL_COUNT];
 
     /// One level info for each level.
     level_info level_infos[CLIPMAP_LEVEL_COUNT];
-    /// Each level can at most generate 4 for x-dimension and 4 for y-dimension.
-#define MAX_UPDATE_COUNT (CLIPMAP_LEVEL_COUNT * 8u)
 
-    /// Has to be a power of two. This is used to generate the terrain.
-#define NOISE_SIZE 256
+    /// Zero if not prefetching, see heightmap_config.
+    uint32_t prefetch_frame_count;
+    /// Texture with the texels that were generated ahead of the levels, only
+    /// created when prefetching.
+    nm::tex prefetch_texture;
+    prefetch_info prefetch_infos[CLIPMAP_LEVEL_COUNT];
+    /// Smoothed movement of the camera in grid units per update.
+    nm::fvec2 velocity;
+
+    /// Levels are updated from coarse to fine. Once a level does not fit in
+    /// the texel budget, it and all finer levels are deferred to a later
+    /// update and keep their old texels.
+    uint32_t texel_budget;
+    /// If true, the next update ignores the texel budget.
+    bool is_regenerate_pending;
+
+    /// NOISE_SIZE^2 table followed by the packed corner table, see
+    /// create_noise_table.
     uint8_t* noise;
+
+    /// Instruction set used for evaluating noise on the CPU.
+    noise_isa isa;
+
+    heightmap_stats stats;
 };
 
-nm_ret init(heightmap* hm);
+/// The per-frame uniform data is allocated from ring.
+nm_ret init(heightmap* hm, const heightmap_config* config, ubo_ring* ring);
 
 void cleanup(heightmap* hm);
 
-void update(heightmap* hm, nm::ivec2 level_offsets[CLIPMAP_LEVEL_COUNT]);
+/// Generates the texels that each level lacks at its new offset, within the
+/// texel budget. camera_velocity is the distance in meters that the camera
+/// moved since the last update, which predicts the texels to prefetch.
+void update(
+    heightmap* hm, nm::ivec2 level_offsets[CLIPMAP_LEVEL_COUNT], nm::fvec2 camera_velocity);
+
+/// Enables or disables per-level octave truncation, which causes all levels to
+/// be regenerated.
+void set_octave_truncation(heightmap* hm, bool is_truncating);
 
-/// Returns a height in [0,1] of a world-space position.
+/// Regenerates all levels from scratch in the next update, regardless of the
+/// texel budget. The GPU time of such an update is logged and accumulated in
+/// the stats.
+void regenerate(heightmap* hm);
+
+/// Returns the height and the gradient of the terrain at a world-space
+/// position, with all octaves of the noise or from the elevation model.
 nm::fvec3 get_height(heightmap* hm, nm::fvec2 pos);
 
+/// Number of positions of a query that are evaluated by a single worker.
+#define HEIGHTMAP_QUERY_CHUNK_SIZE 256u
+
+/// Writes the height and the gradient of the terrain at positions[i] to
+/// results[i] for all i in [0, count), spread over the worker threads.
+/// lod_hint is the size in meters of the smallest terrain feature that has to
+/// be resolved, octaves with a smaller lattice spacing are skipped. Pass zero
+/// for the full quality of get_height. The elevation model ignores it.
+/// Only reads the heightmap, so it can be called from multiple threads at the
+/// same time and concurrently with update.
+void query_heights(
+    heightmap* hm,
+    const nm::fvec2* positions,
+    nm::fvec3* results,
+    uint32_t count,
+    float lod_hint);
+
+/// Compares the rendered texels of the complete levels with the noise that the
+/// CPU backend evaluates, which tells if the backends agree. Returns the number
+/// of texels whose height or gradient differs by more than
+/// TERRAIN_HEIGHT_TOLERANCE or TERRAIN_SLOPE_TOLERANCE, and sets the largest
+/// differences. Waits for the GPU. Only for the noise.
+uint32_t check_texels(heightmap* hm, float* height_error, float* slope_error);
+
+/// Returns the slot whose texture is rendered. Its level offsets lag a frame
+/// behind in pipelined mode.
+inline const heightmap_slot* get_render_slot(const heightmap* hm)
+{
+    return &hm->slots[hm->render_index];
+}
+
 /// Encapsulation for applying the heightmap texture.
 void use_texture(heightmap* hm);
 
 void unuse_texture(heightmap* hm);
 
+/// Surround all rendering of a frame, to measure the GPU time of the rendering
+/// and of the whole frame. GPU backend only.
+void begin_render(heightmap* hm);
+
+void end_render(heightmap* hm);
+
 #endif //TERRAIN3_HEIGHTMAP_H
\ No newline at end of file
@@ -1,3 +1,3 @@
 #include "app.h"
 
-int main() { return run(); }
\ No newline at end of file
+int main(int argc, char* argv[]) { return run(argc, argv); }
\ No newline at end of file
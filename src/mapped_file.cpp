@@ -0,0 +1,83 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+nm_ret init(mapped_file* file, const char* path, bool is_random)
+{
+#ifdef _WIN32
+    DWORD flags = FILE_ATTRIBUTE_NORMAL | (is_random ? FILE_FLAG_RANDOM_ACCESS : 0);
+    HANDLE handle =
+        CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, flags, NULL);
+    if (handle == INVALID_HANDLE_VALUE) return NM_FAIL;
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(handle, &file_size) || file_size.QuadPart == 0) {
+        CloseHandle(handle);
+        return NM_FAIL;
+    }
+
+    HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping) {
+        CloseHandle(handle);
+        return NM_FAIL;
+    }
+
+    void* base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!base) {
+        CloseHandle(mapping);
+        CloseHandle(handle);
+        return NM_FAIL;
+    }
+
+    file->file    = intptr_t(handle);
+    file->mapping = intptr_t(mapping);
+    file->size    = size_t(file_size.QuadPart);
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NM_FAIL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NM_FAIL;
+    }
+
+    void* base = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return NM_FAIL;
+    }
+
+    // read ahead would load pages that are never accessed
+    if (is_random) madvise(base, size_t(st.st_size), MADV_RANDOM);
+
+    file->file    = intptr_t(fd);
+    file->mapping = 0;
+    file->size    = size_t(st.st_size);
+#endif
+
+    file->base = (const uint8_t*)base;
+
+    return NM_SUCCESS;
+}
+
+void cleanup(mapped_file* file)
+{
+#ifdef _WIN32
+    UnmapViewOfFile(file->base);
+    CloseHandle(HANDLE(file->mapping));
+    CloseHandle(HANDLE(file->file));
+#else
+    munmap((void*)file->base, file->size);
+    close(int(file->file));
+#endif
+}
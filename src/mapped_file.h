@@ -0,0 +1,28 @@
+#ifndef TERRAIN3_MAPPED_FILE_H
+#define TERRAIN3_MAPPED_FILE_H
+
+#include "nmutil/defs.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/// This file and its implementation encapsulate a file that is memory-mapped
+/// read-only in its entirety. Only the pages that are accessed are read, such
+/// that files larger than the memory can be mapped.
+
+struct mapped_file {
+    /// Platform handles of the file and its mapping.
+    intptr_t file;
+    intptr_t mapping;
+    const uint8_t* base;
+    size_t size;
+};
+
+/// Maps the file at path, which must not be empty. If is_random is true, the
+/// pages are expected to be accessed in no particular order and are not read
+/// ahead.
+nm_ret init(mapped_file* file, const char* path, bool is_random);
+
+void cleanup(mapped_file* file);
+
+#endif // TERRAIN3_MAPPED_FILE_H
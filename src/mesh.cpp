@@ -426,6 +426,7 @@ void setup_mesh(mesh* mesh)
 
 // Already defined in the shader.
 #define LOCATION_VERTEX 0
+#define LOCATION_INSTANCE 1
 
 static void setup_vertex_array(mesh* mesh)
 {
@@ -438,6 +439,19 @@ static void setup_vertex_array(mesh* mesh)
     GL_CHECK(glVertexAttribIPointer(LOCATION_VERTEX, 2, GL_UNSIGNED_BYTE, 0, 0));
     GL_CHECK(glEnableVertexAttribArray(LOCATION_VERTEX));
 
+    // gl_InstanceID does not include the first instance of a draw, the
+    // attribute does
+    uint32_t instances[MESH_MAX_INSTANCE_COUNT];
+    for (uint32_t i = 0; i < MESH_MAX_INSTANCE_COUNT; i++) {
+        instances[i] = i;
+    }
+    GL_CHECK(glGenBuffers(1, &mesh->instance_buffer));
+    GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, mesh->instance_buffer));
+    GL_CHECK(glBufferData(GL_ARRAY_BUFFER, sizeof(instances), instances, GL_STATIC_DRAW));
+    GL_CHECK(glVertexAttribIPointer(LOCATION_INSTANCE, 1, GL_UNSIGNED_INT, 0, 0));
+    GL_CHECK(glVertexAttribDivisor(LOCATION_INSTANCE, 1));
+    GL_CHECK(glEnableVertexAttribArray(LOCATION_INSTANCE));
+
     GL_CHECK(glBindVertexArray(0));
     GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, 0));
     // Element array buffer state is part of the vertex array object, have to
@@ -459,6 +473,7 @@ void cleanup_mesh(mesh* mesh)
 {
     GL_CHECK(glDeleteBuffers(1, &mesh->vertex_buffer));
     GL_CHECK(glDeleteBuffers(1, &mesh->index_buffer));
+    GL_CHECK(glDeleteBuffers(1, &mesh->instance_buffer));
     GL_CHECK(glDeleteVertexArrays(1, &mesh->vertex_array));
 }
 
@@ -474,4 +489,14 @@ void render_mesh(mesh* mesh, draw_info di)
         di.instance_count));
 
     GL_CHECK(glBindVertexArray(0));
-}
\ No newline at end of file
+}
+
+void render_mesh_indirect(mesh* mesh, uint32_t count)
+{
+    GL_CHECK(glBindVertexArray(mesh->vertex_array));
+
+    GL_CHECK(glMultiDrawElementsIndirect(
+        GL_TRIANGLE_STRIP, GL_UNSIGNED_SHORT, nullptr, GLsizei(count), sizeof(draw_command)));
+
+    GL_CHECK(glBindVertexArray(0));
+}
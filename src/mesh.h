@@ -24,6 +24,10 @@ struct instance_data {
     /// Do not use array, these have different rules altogether.
 };
 
+/// Number of instances that the vertex shaders can index, must match the size
+/// of their instance array.
+#define MESH_MAX_INSTANCE_COUNT 256u
+
 struct draw_info {
     /// Amount of indices this mesh consists of.
     uint32_t index_count;
@@ -34,6 +38,19 @@ struct draw_info {
     /// The offset of this mesh instances of the instance buffer.
     /// Aligned as a multiple of GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT.
     size_t uniform_buffer_offset;
+    /// Range in grid cells covered by the mesh, see block::range.
+    nm::uvec2 range;
+};
+
+/// Arguments of a single draw of glMultiDrawElementsIndirect, laid out as
+/// DrawElementsIndirectCommand.
+struct draw_command {
+    uint32_t index_count;
+    uint32_t instance_count;
+    uint32_t first_index;
+    int32_t base_vertex;
+    /// Index of the first instance in the instance buffer.
+    uint32_t base_instance;
 };
 
 struct block {
@@ -84,6 +101,9 @@ struct mesh {
 
     GLuint vertex_buffer;
     GLuint index_buffer;
+    /// Index of each instance, as an instanced attribute. The first instance
+    /// of a draw is the index of its instances in the instance buffer.
+    GLuint instance_buffer;
     uint32_t index_count;
     GLuint vertex_array;
 };
@@ -95,4 +115,8 @@ void cleanup_mesh(mesh* mesh);
 
 void render_mesh(mesh* mesh, draw_info di);
 
+/// Draws each of the count commands of the bound GL_DRAW_INDIRECT_BUFFER with
+/// a single call.
+void render_mesh_indirect(mesh* mesh, uint32_t count);
+
 #endif //TERRAIN3_MESH_H
@@ -5,35 +5,215 @@
 #include "nmutil/matrix.h"
 #include "nmutil/vector.h"
 
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+/// Estimated upper bound on the magnitude of the gradient of terrain_noise
+/// with all octaves, for both lattices. This is not proven: bounding every
+/// octave by the largest derivatives of its interpolant gives a bound an order
+/// of magnitude larger, which would shorten every step of the raycasts as
+/// much. The largest magnitude measured over 8M random points is 20.1, which
+/// terrain3_bench checks.
+#define NOISE_GRADIENT_BOUND 24.f
+
+/// Dimension of the noise table. Has to be a power of two.
+#define NOISE_SIZE 256
+
+/// Number of octaves of the full quality terrain.
+#define NOISE_OCTAVES 12u
+
+/// Maximum number of octaves for which the transforms are tabulated.
+#define NOISE_MAX_OCTAVES 16u
+
+/// Interpolation between the lattice values.
+enum noise_interp {
+    /// C2 continuous, the second derivative is used for the terrain gradient.
+    NOISE_INTERP_QUINTIC,
+    /// Cheaper, but only C1 continuous.
+    NOISE_INTERP_CUBIC
+};
+
+/// Source of the values at the integer lattice points.
+enum noise_lattice {
+    /// Bytes from a random table of noise_dim^2 entries, which wraps around.
+    NOISE_LATTICE_TABLE,
+    /// Integer hash of the lattice coordinate, computed in registers. Does not
+    /// repeat and does not touch memory.
+    NOISE_LATTICE_HASH,
+    /// Same values as NOISE_LATTICE_TABLE, but the four corners of a lattice
+    /// cell are read with a single 32-bit load from the packed corner table.
+    NOISE_LATTICE_PACKED
+};
+
+/// Width and height in cells of a tile of the packed corner table. A tile of
+/// 32-bit words is a single 64-byte cache line.
+#define NOISE_CORNER_TILE_SIZE 4u
+
+/// Alignment in bytes of the allocation of create_noise_table, a cache line.
+#define NOISE_TABLE_ALIGNMENT 64u
+
+/// Byte offset of the packed corner table, which follows the noise_dim^2 byte
+/// table in the same allocation (see create_noise_table). Aligned to a cache
+/// line, as the allocation is.
+inline size_t get_noise_corners_offset(uint32_t noise_dim)
+{
+    const size_t mask = NOISE_TABLE_ALIGNMENT - 1u;
+    return (size_t(noise_dim) * size_t(noise_dim) + mask) & ~mask;
+}
+
+/// Returns the packed corner table of noise_dim^2 words. The word of cell (x,y)
+/// holds the bytes of (x,y), (x+1,y), (x,y+1), and (x+1,y+1), from least to
+/// most significant.
+inline const uint32_t* get_noise_corners(const uint8_t* noise, uint32_t noise_dim)
+{
+    return reinterpret_cast<const uint32_t*>(noise + get_noise_corners_offset(noise_dim));
+}
+
+/// Index of cell (x,y) in [0, noise_dim)^2 in the packed corner table. The
+/// table is stored as row-major tiles of NOISE_CORNER_TILE_SIZE^2 cells, each
+/// tile is row-major as well.
+inline uint32_t noise_corner_index(uint32_t x, uint32_t y, uint32_t noise_dim)
+{
+    const uint32_t t = NOISE_CORNER_TILE_SIZE;
+    return (y & ~(t - 1u)) * noise_dim + ((x & ~(t - 1u)) + (y & (t - 1u))) * t + (x & (t - 1u));
+}
+
+/// Multipliers that combine the lattice coordinates before hashing.
+#define NOISE_HASH_X 0x8da6b343u
+#define NOISE_HASH_Y 0xd8163841u
+
+/// Finalizer of MurmurHash3. Only uses fixed shifts, such that it maps to SIMD
+/// and GLSL without per-lane shifts.
+inline uint32_t noise_hash_mix(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+/// Maps a hash to [0,1) using its upper 24 bits, which are exact as float.
+inline float noise_hash_value(uint32_t h) { return float(h >> 8) * (1.f / 16777216.f); }
+
+/// Row-major 2x2 matrix that can be evaluated at compile time.
+struct noise_mat2 {
+    float m[4];
+};
+
+/// Same order of operations as nm::mat2::operator*.
+constexpr noise_mat2 mul(const noise_mat2& a, const noise_mat2& b)
+{
+    return {
+        {a.m[0] * b.m[0] + a.m[1] * b.m[2],
+         a.m[0] * b.m[1] + a.m[1] * b.m[3],
+         a.m[2] * b.m[0] + a.m[3] * b.m[2],
+         a.m[2] * b.m[1] + a.m[3] * b.m[3]}};
+}
+
+constexpr noise_mat2 mul(float f, const noise_mat2& a)
+{
+    return {{f * a.m[0], f * a.m[1], f * a.m[2], f * a.m[3]}};
+}
+
+inline nm::fvec2 mul(const noise_mat2& a, nm::fvec2 v)
+{
+    return nm::fvec2(a.m[0] * v.x + a.m[1] * v.y, a.m[2] * v.x + a.m[3] * v.y);
+}
+
+/// Lacunarity, every octave the frequency is multiplied by this.
+constexpr float NOISE_LACUNARITY = 1.9f;
+/// Gain, every octave the amplitude is multiplied by this.
+constexpr float NOISE_GAIN = .55f;
+/// Rotation matrix, applied every octave to decorrelate the octaves.
+constexpr noise_mat2 NOISE_ROTATION = {{.8f, -.6f, .6f, .8f}};
+/// And its transpose.
+constexpr noise_mat2 NOISE_ROTATION_T = {{.8f, .6f, -.6f, .8f}};
+
+/// Per-octave values that do not depend on the position.
+struct noise_octave_table {
+    /// Inverse of the running derivative transform, (f * m2t)^i.
+    noise_mat2 m[NOISE_MAX_OCTAVES];
+    /// Height multiplier, s^i.
+    float b[NOISE_MAX_OCTAVES];
+};
+
+/// Accumulates the same way as the loop in terrain_noise used to, such that
+/// the tabulated values are identical to the iterated ones.
+constexpr noise_octave_table make_noise_octave_table()
+{
+    noise_octave_table table = {};
+    noise_mat2 m             = {{1.f, 0.f, 0.f, 1.f}};
+    float b                  = 1.f;
+    for (uint32_t i = 0; i < NOISE_MAX_OCTAVES; i++) {
+        table.m[i] = m;
+        table.b[i] = b;
+        m          = mul(mul(NOISE_LACUNARITY, NOISE_ROTATION_T), m);
+        b *= NOISE_GAIN;
+    }
+    return table;
+}
+
+constexpr noise_octave_table NOISE_OCTAVE_TABLE = make_noise_octave_table();
+
+/// Transform of the input point from one octave to the next, f * m2.
+constexpr noise_mat2 NOISE_OCTAVE_STEP = mul(NOISE_LACUNARITY, NOISE_ROTATION);
+
 /// return value noise (in x) in [0,1] and its derivatives (in yz)
 /// based on https://www.shadertoy.com/view/4dXBRH
-inline nm::fvec3 noised_value(nm::fvec2 p, uint8_t* noise, uint32_t noise_dim, nm::fvec4* dd)
+/// noise is not accessed for NOISE_LATTICE_HASH.
+template <noise_interp Interp = NOISE_INTERP_QUINTIC, noise_lattice Lattice = NOISE_LATTICE_TABLE>
+inline nm::fvec3 noised_value(
+    nm::fvec2 p, const uint8_t* noise, uint32_t noise_dim, nm::fvec4* dd)
 {
     nm::ivec2 i = nm::ivec2(floorf(p));
     nm::fvec2 f = nm::fractf(p);
 
-#if 1
-    // quintic interpolation
-    nm::fvec2 u   = f * f * f * (f * (f * 6.f - 15.f) + 10.f);
-    nm::fvec2 du  = 30.f * f * f * (f * (f - 2.f) + 1.f);
-    nm::fvec2 ddu = 60.f * f * (f * (2.f * f - 3.f) + 1.f);
-#else
-    // cubic interpolation
-    nm::fvec2 u  = f * f * (3.f - 2.f * f);
-    nm::fvec2 du = 6.f * f * (1.f - f);
-#endif
+    nm::fvec2 u, du, ddu;
+    if constexpr (Interp == NOISE_INTERP_QUINTIC) {
+        u   = f * f * f * (f * (f * 6.f - 15.f) + 10.f);
+        du  = 30.f * f * f * (f * (f - 2.f) + 1.f);
+        ddu = 60.f * f * (f * (2.f * f - 3.f) + 1.f);
+    } else {
+        u   = f * f * (3.f - 2.f * f);
+        du  = 6.f * f * (1.f - f);
+        ddu = 6.f - 12.f * f;
+    }
 
     // samples in [0, 1)
-    // AND is valid since noise_dim is power of two
-    int32_t s       = int32_t(noise_dim) - 1;
-    nm::ivec2 idx_a = (i + nm::ivec2(0, 0)) & s;
-    float va        = (float)noise[idx_a.y * noise_dim + idx_a.x] / (float)UINT8_MAX;
-    nm::ivec2 idx_b = (i + nm::ivec2(1, 0)) & s;
-    float vb        = (float)noise[idx_b.y * noise_dim + idx_b.x] / (float)UINT8_MAX;
-    nm::ivec2 idx_c = (i + nm::ivec2(0, 1)) & s;
-    float vc        = (float)noise[idx_c.y * noise_dim + idx_c.x] / (float)UINT8_MAX;
-    nm::ivec2 idx_d = (i + nm::ivec2(1, 1)) & s;
-    float vd        = (float)noise[idx_d.y * noise_dim + idx_d.x] / (float)UINT8_MAX;
+    float va, vb, vc, vd;
+    if constexpr (Lattice == NOISE_LATTICE_TABLE) {
+        // AND is valid since noise_dim is power of two
+        int32_t s       = int32_t(noise_dim) - 1;
+        nm::ivec2 idx_a = (i + nm::ivec2(0, 0)) & s;
+        va              = (float)noise[idx_a.y * noise_dim + idx_a.x] / (float)UINT8_MAX;
+        nm::ivec2 idx_b = (i + nm::ivec2(1, 0)) & s;
+        vb              = (float)noise[idx_b.y * noise_dim + idx_b.x] / (float)UINT8_MAX;
+        nm::ivec2 idx_c = (i + nm::ivec2(0, 1)) & s;
+        vc              = (float)noise[idx_c.y * noise_dim + idx_c.x] / (float)UINT8_MAX;
+        nm::ivec2 idx_d = (i + nm::ivec2(1, 1)) & s;
+        vd              = (float)noise[idx_d.y * noise_dim + idx_d.x] / (float)UINT8_MAX;
+    } else if constexpr (Lattice == NOISE_LATTICE_PACKED) {
+        uint32_t s = noise_dim - 1u;
+        uint32_t w = get_noise_corners(noise, noise_dim)[noise_corner_index(
+            uint32_t(i.x) & s, uint32_t(i.y) & s, noise_dim)];
+        va         = (float)(w & 0xffu) / (float)UINT8_MAX;
+        vb         = (float)((w >> 8) & 0xffu) / (float)UINT8_MAX;
+        vc         = (float)((w >> 16) & 0xffu) / (float)UINT8_MAX;
+        vd         = (float)(w >> 24) / (float)UINT8_MAX;
+    } else {
+        // (i + 1) * C equals i * C + C in wrapping arithmetic
+        uint32_t hx0 = uint32_t(i.x) * NOISE_HASH_X;
+        uint32_t hx1 = hx0 + NOISE_HASH_X;
+        uint32_t hy0 = uint32_t(i.y) * NOISE_HASH_Y;
+        uint32_t hy1 = hy0 + NOISE_HASH_Y;
+        va           = noise_hash_value(noise_hash_mix(hx0 + hy0));
+        vb           = noise_hash_value(noise_hash_mix(hx1 + hy0));
+        vc           = noise_hash_value(noise_hash_mix(hx0 + hy1));
+        vd           = noise_hash_value(noise_hash_mix(hx1 + hy1));
+    }
 
     float k0 = va;
     float k1 = vb - va;
@@ -58,70 +238,147 @@ inline nm::fvec3 noised_value(nm::fvec2 p, uint8_t* noise, uint32_t noise_dim, n
     return nm::fvec3(value, derivatives.x, derivatives.y);
 }
 
-/// Note: not normalized, ranges from [0, <2].
-inline nm::fvec3 terrain_noise(nm::fvec2 p, uint8_t* noise, uint32_t noise_dim)
+/// Values accumulated over the octaves of terrain_noise.
+struct terrain_noise_state {
+    nm::fvec2 p; // transformed input point
+    float a; // accumulated height
+    nm::fvec2 e; // accumulated helper value to scale the noise with
+    nm::fvec2 d; // accumulated derivative
+    nm::fvec2 t; // accumulated (modified) partial derivative
+    nm::fvec4 r; // accumulated (modified) 2nd partial derivative
+};
+
+/// A single octave of terrain_noise.
+template <noise_interp Interp, noise_lattice Lattice, size_t I>
+inline void terrain_noise_octave(terrain_noise_state* st, const uint8_t* noise, uint32_t noise_dim)
 {
-    float f = 1.9f; // lacunarity
-    float s = .55f; // gain
+    static_assert(I < NOISE_MAX_OCTAVES, "octave transforms are not tabulated");
 
-    const nm::mat2 m2  = nm::mat2(.8f, -.6f, .6f, .8f); // rotation matrix
-    const nm::mat2 m2t = nm::mat2(.8f, .6f, -.6f, .8f); // and its transpose
+    // inverse of running derivative transform
+    constexpr noise_mat2 m = NOISE_OCTAVE_TABLE.m[I];
+    // current height multiplier
+    constexpr float b = NOISE_OCTAVE_TABLE.b[I];
 
-    float a     = 0.f; // accumulated height
-    float b     = 1.f; // current height multiplier
-    nm::fvec2 e = nm::fvec2(0.f); // accumulated helper value to scale the noise with
-    nm::fvec2 d = nm::fvec2(0.f); // accumulated derivative
+    // second order derivative
+    nm::fvec4 dd;
+    // get value for p' = m * p and derivative
+    nm::fvec3 n = noised_value<Interp, Lattice>(st->p, noise, noise_dim, &dd);
+    // the noise derivative for p' (transform by m is part of chain rule)
+    // this is actually a row vector, hence m involves the transpose of m2
+    nm::fvec2 duxy = mul(m, nm::fvec2(n.y, n.z));
+    // accumulate the derivative for p' (without transform by m)
+    st->t += nm::fvec2(n.y, n.z);
+    // accumulate the second derivative for p' (without transform by m)
+    // since it is the second derivative, it still has to be transformed
+    // once (would be twice if we did cancel out one transform, also due
+    // to the chain rule)
+    const nm::fvec2 xy = mul(m, nm::fvec2(dd.x, dd.y));
+    const nm::fvec2 zw = mul(m, nm::fvec2(dd.z, dd.w));
+    st->r += nm::fvec4(xy.x, xy.y, zw.x, zw.y);
+    // this is the accumulated factor, which is the
+    // derivative for p', but with the transform by m cancelled out
+    st->e += nm::fvec2(n.y, n.z);
+    // the term to scale the noise value by
+    float term = 1.f + dot(st->e, st->e);
+    // accumulate values
+    st->a += b * n.x / term;
+    // factors to calculate the derivative of (b * n.x / term)
+    // this involves the quotient rule
+    float x = 2.f * (st->t.x * st->r.x + st->t.y * st->r.z);
+    float y = 2.f * (st->t.x * st->r.y + st->t.y * st->r.w);
+    // accumulate derivative of (b * n.x / term)
+    st->d += b * (term * duxy - n.x * nm::fvec2(x, y)) / (term * term);
+    // accumulated transform of input point p
+    // used to sample a different noise value each octave
+    st->p = mul(NOISE_OCTAVE_STEP, st->p);
+}
 
-    // inverse of running derivative transform
-    nm::mat2 m = nm::mat2::identity();
-    // accumulated (modified) partial derivative
-    nm::fvec2 t = nm::fvec2(0.f);
-    // accumulated (modified) 2nd partial derivative
-    nm::fvec4 r = nm::fvec4(0.f);
+template <noise_interp Interp, noise_lattice Lattice, size_t... I>
+inline nm::fvec3 terrain_noise_unrolled(
+    nm::fvec2 p, const uint8_t* noise, uint32_t noise_dim, std::index_sequence<I...>)
+{
+    terrain_noise_state st;
+    st.p = p;
+    st.a = 0.f;
+    st.e = nm::fvec2(0.f);
+    st.d = nm::fvec2(0.f);
+    st.t = nm::fvec2(0.f);
+    st.r = nm::fvec4(0.f);
 
-    // every iteration, the original position is multiplied by f
+    // every octave, the original position is multiplied by f
     // let p' be (f * m2)^i * p
-    for (uint32_t i = 0u; i < 12; i++) {
-        // second order derivative
-        nm::fvec4 dd;
-        // get value for p' = m * p and derivative
-        nm::fvec3 n = noised_value(p, noise, noise_dim, &dd);
-        // the noise derivative for p' (transform by m is part of chain rule)
-        // this is actually a row vector, hence m involves the transpose of m2
-        nm::fvec2 duxy = m * nm::fvec2(n.y, n.z);
-        // accumulate the derivative for p' (without transform by m)
-        t += nm::fvec2(n.y, n.z);
-        // accumulate the second derivative for p' (without transform by m)
-        // since it is the second derivative, it still has to be transformed
-        // once (would be twice if we did cancel out one transform, also due
-        // to the chain rule)
-        const nm::fvec2 xy = m * nm::fvec2(dd.x, dd.y);
-        const nm::fvec2 zw = m * nm::fvec2(dd.z, dd.w);
-        r += nm::fvec4(xy.x, xy.y, zw.x, zw.y);
-        // this is the accumulated factor, which is the
-        // derivative for p', but with the transform by m cancelled out
-        e += nm::fvec2(n.y, n.z);
-        // the term to scale the noise value by
-        float term = 1.f + dot(e, e);
-        // accumulate values
-        a += b * n.x / term;
-        // factors to calculate the derivative of (b * n.x / term)
-        // this involves the quotient rule
-        float x = 2.f * (t.x * r.x + t.y * r.z);
-        float y = 2.f * (t.x * r.y + t.y * r.w);
-        // accumulate derivative of (b * n.x / term)
-        d += b * (term * duxy - n.x * nm::fvec2(x, y)) / (term * term);
-        // scaling factor for next iteration
-        b *= s;
-        // accumulated transform of input point p
-        // used to sample a different noise value each octave
-        p = f * m2 * p;
-        // derivative of p. we use the transpose of m as the matrix m is
-        // applied to a row vector
-        m = f * m2t * m;
+    (terrain_noise_octave<Interp, Lattice, I>(&st, noise, noise_dim), ...);
+
+    return nm::fvec3(st.a, st.d.x, st.d.y);
+}
+
+/// Note: not normalized, ranges from [0, <2].
+/// The octaves are fully unrolled, such that cheap variants with fewer octaves
+/// can be instantiated for coarse queries.
+template <
+    uint32_t Octaves      = NOISE_OCTAVES,
+    noise_interp Interp   = NOISE_INTERP_QUINTIC,
+    noise_lattice Lattice = NOISE_LATTICE_TABLE>
+inline nm::fvec3 terrain_noise(nm::fvec2 p, const uint8_t* noise, uint32_t noise_dim)
+{
+    return terrain_noise_unrolled<Interp, Lattice>(
+        p, noise, noise_dim, std::make_index_sequence<Octaves>());
+}
+
+/// An instantiation of terrain_noise.
+typedef nm::fvec3 (*terrain_noise_fn)(nm::fvec2 p, const uint8_t* noise, uint32_t noise_dim);
+
+template <noise_lattice Lattice, size_t... I>
+inline terrain_noise_fn get_terrain_noise_fn(uint32_t octaves, std::index_sequence<I...>)
+{
+    static constexpr terrain_noise_fn fns[] = {
+        terrain_noise<uint32_t(I + 1), NOISE_INTERP_QUINTIC, Lattice>...};
+    return fns[octaves - 1];
+}
+
+/// Selects the quintic terrain_noise with a runtime octave count in
+/// [1, NOISE_OCTAVES] and lattice, for when these are not known at compile time.
+inline terrain_noise_fn get_terrain_noise_fn(uint32_t octaves, noise_lattice lattice)
+{
+    if (lattice == NOISE_LATTICE_HASH) {
+        return get_terrain_noise_fn<NOISE_LATTICE_HASH>(
+            octaves, std::make_index_sequence<NOISE_OCTAVES>());
     }
+    if (lattice == NOISE_LATTICE_PACKED) {
+        return get_terrain_noise_fn<NOISE_LATTICE_PACKED>(
+            octaves, std::make_index_sequence<NOISE_OCTAVES>());
+    }
+    return get_terrain_noise_fn<NOISE_LATTICE_TABLE>(
+        octaves, std::make_index_sequence<NOISE_OCTAVES>());
+}
+
+/// Upper bound on how much the first octaves of terrain_noise differ from all
+/// NOISE_OCTAVES octaves. Octave i adds b_i * n / term, where n is in [0,1]
+/// and term is at least one.
+inline float get_truncation_bound(uint32_t octaves)
+{
+    float bound = 0.f;
+    for (uint32_t i = octaves; i < NOISE_OCTAVES; i++) {
+        bound += NOISE_OCTAVE_TABLE.b[i];
+    }
+    return bound;
+}
 
-    return nm::fvec3(a, d.x, d.y);
+/// Returns the number of octaves in [1, NOISE_OCTAVES] that can be represented
+/// when sampling with the given spacing in noise space. Octave i has a lattice
+/// spacing of NOISE_LACUNARITY^-i and value noise contains frequencies up to
+/// half a cycle per lattice cell, so by the Nyquist limit the octave is only
+/// kept if the spacing is at most the lattice spacing. Higher octaves would only
+/// add aliasing.
+inline uint32_t get_nyquist_octaves(float spacing)
+{
+    uint32_t octaves = 1;
+    float lattice    = 1.f / NOISE_LACUNARITY;
+    while (octaves < NOISE_OCTAVES && spacing <= lattice) {
+        octaves++;
+        lattice /= NOISE_LACUNARITY;
+    }
+    return octaves;
 }
 
 #endif // TERRAIN3_NOISE_H
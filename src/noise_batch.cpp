@@ -0,0 +1,245 @@
+#include "noise_batch.h"
+
+#include <cstdlib>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define NOISE_BATCH_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#ifdef NOISE_BATCH_X86
+
+// defined in the instruction set specific translation units
+
+void terrain_noise_batch_sse4(
+    noise_lattice lattice,
+    uint32_t octaves,
+    const float* xs,
+    const float* ys,
+    size_t n,
+    const uint8_t* noise,
+    uint32_t noise_dim,
+    float* out_h,
+    float* out_dx,
+    float* out_dz);
+
+void terrain_noise_batch_avx2(
+    noise_lattice lattice,
+    uint32_t octaves,
+    const float* xs,
+    const float* ys,
+    size_t n,
+    const uint8_t* noise,
+    uint32_t noise_dim,
+    float* out_h,
+    float* out_dx,
+    float* out_dz);
+
+void terrain_noise_batch_avx512(
+    noise_lattice lattice,
+    uint32_t octaves,
+    const float* xs,
+    const float* ys,
+    size_t n,
+    const uint8_t* noise,
+    uint32_t noise_dim,
+    float* out_h,
+    float* out_dx,
+    float* out_dz);
+
+static void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4])
+{
+#ifdef _MSC_VER
+    __cpuidex((int*)regs, int(leaf), int(subleaf));
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+/// Returns which register states the operating system saves.
+static uint64_t xgetbv()
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    uint32_t eax, edx;
+    __asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return uint64_t(edx) << 32 | eax;
+#endif
+}
+
+#endif // NOISE_BATCH_X86
+
+noise_isa detect_noise_isa()
+{
+#ifdef NOISE_BATCH_X86
+    uint32_t regs[4];
+    cpuid(0, 0, regs);
+    uint32_t max_leaf = regs[0];
+
+    cpuid(1, 0, regs);
+    bool has_sse4    = (regs[2] >> 19) & 1u;
+    bool has_osxsave = (regs[2] >> 27) & 1u;
+    bool has_avx     = (regs[2] >> 28) & 1u;
+
+    bool has_avx2   = false;
+    bool has_avx512 = false;
+    if (max_leaf >= 7) {
+        cpuid(7, 0, regs);
+        has_avx2   = (regs[1] >> 5) & 1u;
+        has_avx512 = (regs[1] >> 16) & 1u;
+    }
+
+    // the os must save the ymm registers for avx, and additionally the opmask
+    // and zmm registers for avx-512
+    uint64_t xcr0 = has_osxsave ? xgetbv() : 0;
+    bool os_avx    = (xcr0 & 0x06) == 0x06;
+    bool os_avx512 = (xcr0 & 0xe6) == 0xe6;
+
+    if (has_avx512 && os_avx512) return NOISE_ISA_AVX512;
+    if (has_avx && has_avx2 && os_avx) return NOISE_ISA_AVX2;
+    if (has_sse4) return NOISE_ISA_SSE4;
+#endif
+
+    return NOISE_ISA_SCALAR;
+}
+
+const char* get_noise_isa_name(noise_isa isa)
+{
+    switch (isa) {
+    case NOISE_ISA_SCALAR:
+        return "scalar";
+    case NOISE_ISA_SSE4:
+        return "sse4";
+    case NOISE_ISA_AVX2:
+        return "avx2";
+    case NOISE_ISA_AVX512:
+        return "avx512";
+    default:
+        return "unknown";
+    }
+}
+
+const char* get_noise_lattice_name(noise_lattice lattice)
+{
+    switch (lattice) {
+    case NOISE_LATTICE_TABLE:
+        return "table";
+    case NOISE_LATTICE_HASH:
+        return "hash";
+    case NOISE_LATTICE_PACKED:
+        return "packed";
+    default:
+        return "unknown";
+    }
+}
+
+uint8_t* create_noise_table(uint32_t noise_dim)
+{
+    srand(2);
+    uint32_t noise_count  = noise_dim * noise_dim;
+    size_t corners_offset = get_noise_corners_offset(noise_dim);
+
+    // the size is a multiple of the alignment, as aligned_alloc requires
+    size_t size = corners_offset + sizeof(uint32_t) * noise_count;
+#ifdef _WIN32
+    uint8_t* noise = (uint8_t*)_aligned_malloc(size, NOISE_TABLE_ALIGNMENT);
+#else
+    uint8_t* noise = (uint8_t*)aligned_alloc(NOISE_TABLE_ALIGNMENT, size);
+#endif
+    if (!noise) return nullptr;
+
+    for (uint32_t i = 0u; i < noise_count; i++) {
+        noise[i] = uint8_t(float(rand()) / float(RAND_MAX) * UINT8_MAX);
+    }
+    for (size_t i = noise_count; i < corners_offset; i++) {
+        noise[i] = 0;
+    }
+
+    // pack the corners of every cell, wrapping around like the table lookups
+    uint32_t s        = noise_dim - 1u;
+    uint32_t* corners = reinterpret_cast<uint32_t*>(noise + corners_offset);
+    for (uint32_t y = 0u; y < noise_dim; y++) {
+        for (uint32_t x = 0u; x < noise_dim; x++) {
+            uint32_t x1 = (x + 1u) & s;
+            uint32_t y1 = (y + 1u) & s;
+            uint32_t a  = noise[y * noise_dim + x];
+            uint32_t b  = noise[y * noise_dim + x1];
+            uint32_t c  = noise[y1 * noise_dim + x];
+            uint32_t d  = noise[y1 * noise_dim + x1];
+
+            corners[noise_corner_index(x, y, noise_dim)] = a | b << 8 | c << 16 | d << 24;
+        }
+    }
+
+    return noise;
+}
+
+void destroy_noise_table(uint8_t* noise)
+{
+#ifdef _WIN32
+    _aligned_free(noise);
+#else
+    free(noise);
+#endif
+}
+
+uint64_t get_noise_seed(const uint8_t* noise, uint32_t noise_dim, noise_lattice lattice)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (uint32_t i = 0; i < noise_dim * noise_dim; i++) {
+        h = (h ^ noise[i]) * 0x100000001b3ull;
+    }
+    h = (h ^ (lattice == NOISE_LATTICE_HASH ? 1u : 0u)) * 0x100000001b3ull;
+
+    return h;
+}
+
+void terrain_noise_batch(
+    noise_isa isa,
+    noise_lattice lattice,
+    uint32_t octaves,
+    const float* xs,
+    const float* ys,
+    size_t n,
+    const uint8_t* noise,
+    uint32_t noise_dim,
+    float* out_h,
+    float* out_dx,
+    float* out_dz)
+{
+    switch (isa) {
+#ifdef NOISE_BATCH_X86
+    case NOISE_ISA_AVX512:
+        terrain_noise_batch_avx512(
+            lattice, octaves, xs, ys, n, noise, noise_dim, out_h, out_dx, out_dz);
+        return;
+    case NOISE_ISA_AVX2:
+        terrain_noise_batch_avx2(
+            lattice, octaves, xs, ys, n, noise, noise_dim, out_h, out_dx, out_dz);
+        return;
+    case NOISE_ISA_SSE4:
+        terrain_noise_batch_sse4(
+            lattice, octaves, xs, ys, n, noise, noise_dim, out_h, out_dx, out_dz);
+        return;
+#endif
+    default:
+        break;
+    }
+
+    // scalar fallback
+    terrain_noise_fn fn = get_terrain_noise_fn(octaves, lattice);
+    for (size_t i = 0; i < n; i++) {
+        nm::fvec3 t = fn(nm::fvec2(xs[i], ys[i]), noise, noise_dim);
+        out_h[i]    = t.x;
+        out_dx[i]   = t.y;
+        out_dz[i]   = t.z;
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef TERRAIN3_NOISE_BATCH_H
+#define TERRAIN3_NOISE_BATCH_H
+
+#include "noise.h"
+
+#include <cstddef>
+#include <cstdint>
+
+/// This file and its implementation encapsulate the evaluation of terrain_noise
+/// for many points at once, using the widest instruction set the CPU supports.
+
+/// The vectorized kernels gather four bytes at a time from the noise table, so
+/// the table must be followed by this many readable bytes.
+#define NOISE_BATCH_PADDING 3u
+
+/// Instruction sets for which a batch kernel exists.
+enum noise_isa {
+    NOISE_ISA_SCALAR,
+    /// 4 points per iteration.
+    NOISE_ISA_SSE4,
+    /// 8 points per iteration.
+    NOISE_ISA_AVX2,
+    /// 16 points per iteration.
+    NOISE_ISA_AVX512
+};
+
+/// Returns the widest instruction set that is supported by both the CPU and
+/// the operating system.
+noise_isa detect_noise_isa();
+
+const char* get_noise_isa_name(noise_isa isa);
+
+const char* get_noise_lattice_name(noise_lattice lattice);
+
+/// Allocates a noise_dim^2 table of random bytes, followed by the packed corner
+/// table (see get_noise_corners) which also serves as NOISE_BATCH_PADDING. The
+/// allocation is aligned to NOISE_TABLE_ALIGNMENT, such that every tile of the
+/// corner table is a single cache line. noise_dim must be at least
+/// NOISE_CORNER_TILE_SIZE. To be released with destroy_noise_table. The table
+/// is the same on every call.
+uint8_t* create_noise_table(uint32_t noise_dim);
+
+void destroy_noise_table(uint8_t* noise);
+
+/// Identifies the terrain that the noise table and the lattice generate, with a
+/// hash (FNV-1a) of the table and whether the lattice is hashed instead, which
+/// is another terrain. Stored with texels on disk, to reject texels of another
+/// terrain.
+uint64_t get_noise_seed(const uint8_t* noise, uint32_t noise_dim, noise_lattice lattice);
+
+/// Evaluates terrain_noise(nm::fvec2(xs[i], ys[i]), noise, noise_dim) for all
+/// i in [0,n) with the given lattice and number of octaves in
+/// [1, NOISE_OCTAVES], and writes the value and derivatives to the output
+/// arrays. Results match the scalar function up to floating point rounding.
+void terrain_noise_batch(
+    noise_isa isa,
+    noise_lattice lattice,
+    uint32_t octaves,
+    const float* xs,
+    const float* ys,
+    size_t n,
+    const uint8_t* noise,
+    uint32_t noise_dim,
+    float* out_h,
+    float* out_dx,
+    float* out_dz);
+
+#endif // TERRAIN3_NOISE_BATCH_H
@@ -0,0 +1,120 @@
+#include "noise_batch.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+
+#include "noise_batch_kernel.h"
+
+#include <immintrin.h>
+
+/// AVX-512 kernel, sixteen points per iteration.
+
+namespace {
+
+struct avx512 {
+    static constexpr size_t width = 16;
+
+    struct vi {
+        __m512i v;
+
+        vi() = default;
+
+        explicit vi(__m512i v) : v(v) {}
+
+        explicit vi(int32_t s) : v(_mm512_set1_epi32(s)) {}
+
+        friend vi operator+(vi a, vi b) { return vi(_mm512_add_epi32(a.v, b.v)); }
+
+        friend vi operator*(vi a, vi b) { return vi(_mm512_mullo_epi32(a.v, b.v)); }
+
+        friend vi operator&(vi a, vi b) { return vi(_mm512_and_si512(a.v, b.v)); }
+
+        friend vi operator^(vi a, vi b) { return vi(_mm512_xor_si512(a.v, b.v)); }
+    };
+
+    struct vf {
+        __m512 v;
+
+        vf() = default;
+
+        explicit vf(__m512 v) : v(v) {}
+
+        explicit vf(float s) : v(_mm512_set1_ps(s)) {}
+
+        friend vf operator+(vf a, vf b) { return vf(_mm512_add_ps(a.v, b.v)); }
+
+        friend vf operator-(vf a, vf b) { return vf(_mm512_sub_ps(a.v, b.v)); }
+
+        friend vf operator*(vf a, vf b) { return vf(_mm512_mul_ps(a.v, b.v)); }
+
+        friend vf operator/(vf a, vf b) { return vf(_mm512_div_ps(a.v, b.v)); }
+
+        friend vf operator+(vf a, float b) { return a + vf(b); }
+
+        friend vf operator+(float a, vf b) { return vf(a) + b; }
+
+        friend vf operator-(vf a, float b) { return a - vf(b); }
+
+        friend vf operator*(vf a, float b) { return a * vf(b); }
+
+        friend vf operator*(float a, vf b) { return vf(a) * b; }
+    };
+
+    static vf load(const float* p) { return vf(_mm512_loadu_ps(p)); }
+
+    static void store(float* p, vf a) { _mm512_storeu_ps(p, a.v); }
+
+    static vf floor(vf a)
+    {
+        return vf(_mm512_roundscale_ps(a.v, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC));
+    }
+
+    /// Logical shift, the lanes are treated as unsigned.
+    static vi shift_right(vi a, int n) { return vi(_mm512_srli_epi32(a.v, n)); }
+
+    static vf to_float(vi a) { return vf(_mm512_cvtepi32_ps(a.v)); }
+
+    static vi to_int(vf a) { return vi(_mm512_cvttps_epi32(a.v)); }
+
+    /// Loads noise[idx] for every lane and maps it to [0,1].
+    static vf gather_noise(const uint8_t* noise, vi idx)
+    {
+        // gathers four bytes starting at each index, keep the first one
+        __m512i words = _mm512_i32gather_epi32(idx.v, (const void*)noise, 1);
+        __m512i bytes = _mm512_and_si512(words, _mm512_set1_epi32(0xff));
+        return vf(_mm512_cvtepi32_ps(bytes)) / vf(float(UINT8_MAX));
+    }
+
+    /// Loads corners[idx] for every lane.
+    static vi gather_corners(const uint32_t* corners, vi idx)
+    {
+        return vi(_mm512_i32gather_epi32(idx.v, (const void*)corners, 4));
+    }
+};
+
+} // namespace
+
+void terrain_noise_batch_avx512(
+    noise_lattice lattice,
+    uint32_t octaves,
+    const float* xs,
+    const float* ys,
+    size_t n,
+    const uint8_t* noise,
+    uint32_t noise_dim,
+    float* out_h,
+    float* out_dx,
+    float* out_dz)
+{
+    if (lattice == NOISE_LATTICE_HASH) {
+        terrain_noise_kernel<avx512, NOISE_LATTICE_HASH>(
+            octaves, xs, ys, n, noise, noise_dim, out_h, out_dx, out_dz);
+    } else if (lattice == NOISE_LATTICE_PACKED) {
+        terrain_noise_kernel<avx512, NOISE_LATTICE_PACKED>(
+            octaves, xs, ys, n, noise, noise_dim, out_h, out_dx, out_dz);
+    } else {
+        terrain_noise_kernel<avx512, NOISE_LATTICE_TABLE>(
+            octaves, xs, ys, n, noise, noise_dim, out_h, out_dx, out_dz);
+    }
+}
+
+#endif
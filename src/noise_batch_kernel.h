@@ -0,0 +1,205 @@
+#ifndef TERRAIN3_NOISE_BATCH_KERNEL_H
+#define TERRAIN3_NOISE_BATCH_KERNEL_H
+
+#include "noise.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/// Vectorized version of terrain_noise in noise.h, in structure-of-arrays
+/// layout. Only included by the instruction set specific translation units,
+/// which are compiled with the matching compiler flags. S is a traits type
+/// that provides:
+///  - S::width, the number of lanes.
+///  - S::vf and S::vi, float and int vectors with arithmetic operators.
+///  - S::load, S::store, S::floor, S::to_int, S::to_float, S::shift_right,
+///    S::gather_noise and S::gather_corners.
+/// The order of operations follows noise.h, such that the results only differ
+/// by rounding.
+
+/// Vectorized noise_hash_value(noise_hash_mix(h)).
+template <typename S>
+inline typename S::vf noise_hash_lanes(typename S::vi h)
+{
+    typedef typename S::vi vi;
+
+    h = h ^ S::shift_right(h, 16);
+    h = h * vi(int32_t(0x85ebca6bu));
+    h = h ^ S::shift_right(h, 13);
+    h = h * vi(int32_t(0xc2b2ae35u));
+    h = h ^ S::shift_right(h, 16);
+    return S::to_float(S::shift_right(h, 8)) * (1.f / 16777216.f);
+}
+
+template <typename S, noise_lattice Lattice>
+inline void terrain_noise_lanes(
+    uint32_t octaves,
+    const float* xs,
+    const float* ys,
+    const uint8_t* noise,
+    uint32_t noise_dim,
+    float* out_h,
+    float* out_dx,
+    float* out_dz)
+{
+    typedef typename S::vf vf;
+    typedef typename S::vi vi;
+
+    const vi mask = vi(int32_t(noise_dim) - 1);
+    const vi dim  = vi(int32_t(noise_dim));
+
+    const uint32_t* corners = get_noise_corners(noise, noise_dim);
+
+    vf px = S::load(xs);
+    vf py = S::load(ys);
+
+    vf a  = vf(0.f); // accumulated height
+    vf ex = vf(0.f), ey = vf(0.f); // accumulated helper value
+    vf dx = vf(0.f), dy = vf(0.f); // accumulated derivative
+    vf tx = vf(0.f), ty = vf(0.f); // accumulated partial derivative
+    vf rx = vf(0.f), ry = vf(0.f), rz = vf(0.f), rw = vf(0.f); // accumulated 2nd derivative
+
+    for (uint32_t i = 0u; i < octaves; i++) {
+        // the height multiplier and the derivative transform do not depend on
+        // the position, so they are the same for all lanes
+        const float* m = NOISE_OCTAVE_TABLE.m[i].m;
+        const float b  = NOISE_OCTAVE_TABLE.b[i];
+
+        // noised_value ------------------------------------------------------
+
+        vf flx = S::floor(px);
+        vf fly = S::floor(py);
+        vi ix  = S::to_int(flx);
+        vi iy  = S::to_int(fly);
+        vf fx  = px - flx;
+        vf fy  = py - fly;
+
+        // quintic interpolation
+        vf ux   = fx * fx * fx * (fx * (fx * 6.f - 15.f) + 10.f);
+        vf uy   = fy * fy * fy * (fy * (fy * 6.f - 15.f) + 10.f);
+        vf dux  = 30.f * fx * fx * (fx * (fx - 2.f) + 1.f);
+        vf duy  = 30.f * fy * fy * (fy * (fy - 2.f) + 1.f);
+        vf ddux = 60.f * fx * (fx * (2.f * fx - 3.f) + 1.f);
+        vf dduy = 60.f * fy * (fy * (2.f * fy - 3.f) + 1.f);
+
+        // samples in [0, 1)
+        vf va, vb, vc, vd;
+        if constexpr (Lattice == NOISE_LATTICE_TABLE) {
+            vi ix0  = ix & mask;
+            vi ix1  = (ix + vi(1)) & mask;
+            vi row0 = (iy & mask) * dim;
+            vi row1 = ((iy + vi(1)) & mask) * dim;
+            va      = S::gather_noise(noise, row0 + ix0);
+            vb      = S::gather_noise(noise, row0 + ix1);
+            vc      = S::gather_noise(noise, row1 + ix0);
+            vd      = S::gather_noise(noise, row1 + ix1);
+        } else if constexpr (Lattice == NOISE_LATTICE_PACKED) {
+            // same as noise_corner_index
+            const vi tile_mask = vi(int32_t(NOISE_CORNER_TILE_SIZE - 1u));
+            const vi tile_base = vi(~int32_t(NOISE_CORNER_TILE_SIZE - 1u));
+            const vi byte      = vi(int32_t(0xffu));
+            vi x               = ix & mask;
+            vi y               = iy & mask;
+            vi idx             = (y & tile_base) * dim +
+                     ((x & tile_base) + (y & tile_mask)) * vi(int32_t(NOISE_CORNER_TILE_SIZE)) +
+                     (x & tile_mask);
+            vi w = S::gather_corners(corners, idx);
+            va   = S::to_float(w & byte) / vf(float(UINT8_MAX));
+            vb   = S::to_float(S::shift_right(w, 8) & byte) / vf(float(UINT8_MAX));
+            vc   = S::to_float(S::shift_right(w, 16) & byte) / vf(float(UINT8_MAX));
+            vd   = S::to_float(S::shift_right(w, 24)) / vf(float(UINT8_MAX));
+        } else {
+            vi hx0 = ix * vi(int32_t(NOISE_HASH_X));
+            vi hx1 = hx0 + vi(int32_t(NOISE_HASH_X));
+            vi hy0 = iy * vi(int32_t(NOISE_HASH_Y));
+            vi hy1 = hy0 + vi(int32_t(NOISE_HASH_Y));
+            va     = noise_hash_lanes<S>(hx0 + hy0);
+            vb     = noise_hash_lanes<S>(hx1 + hy0);
+            vc     = noise_hash_lanes<S>(hx0 + hy1);
+            vd     = noise_hash_lanes<S>(hx1 + hy1);
+        }
+
+        vf k0 = va;
+        vf k1 = vb - va;
+        vf k2 = vc - va;
+        vf k4 = va - vb - vc + vd;
+
+        vf nx = k0 + k1 * ux + k2 * uy + k4 * ux * uy;
+        vf ny = dux * (uy * k4 + k1);
+        vf nz = duy * (ux * k4 + k2);
+
+        vf ddx = ddux * uy * k4 + ddux * k1;
+        vf ddy = duy * k4 * dux;
+        vf ddz = duy * k4 * dux;
+        vf ddw = dduy * ux * k4 + dduy * k2;
+
+        // terrain_noise ------------------------------------------------------
+
+        vf duxy_x = m[0] * ny + m[1] * nz;
+        vf duxy_y = m[2] * ny + m[3] * nz;
+        tx        = tx + ny;
+        ty        = ty + nz;
+        rx        = rx + (m[0] * ddx + m[1] * ddy);
+        ry        = ry + (m[2] * ddx + m[3] * ddy);
+        rz        = rz + (m[0] * ddz + m[1] * ddw);
+        rw        = rw + (m[2] * ddz + m[3] * ddw);
+        ex        = ex + ny;
+        ey        = ey + nz;
+        vf term   = 1.f + (ex * ex + ey * ey);
+        a         = a + b * nx / term;
+        vf x      = 2.f * (tx * rx + ty * rz);
+        vf y      = 2.f * (tx * ry + ty * rw);
+        vf term2  = term * term;
+        dx        = dx + b * (term * duxy_x - nx * x) / term2;
+        dy        = dy + b * (term * duxy_y - nx * y) / term2;
+
+        // p = f * m2 * p
+        const float* step = NOISE_OCTAVE_STEP.m;
+        vf px_next        = step[0] * px + step[1] * py;
+        vf py_next        = step[2] * px + step[3] * py;
+        px                = px_next;
+        py                = py_next;
+    }
+
+    S::store(out_h, a);
+    S::store(out_dx, dx);
+    S::store(out_dz, dy);
+}
+
+template <typename S, noise_lattice Lattice>
+inline void terrain_noise_kernel(
+    uint32_t octaves,
+    const float* xs,
+    const float* ys,
+    size_t n,
+    const uint8_t* noise,
+    uint32_t noise_dim,
+    float* out_h,
+    float* out_dx,
+    float* out_dz)
+{
+    size_t i = 0;
+    for (; i + S::width <= n; i += S::width) {
+        terrain_noise_lanes<S, Lattice>(
+            octaves, xs + i, ys + i, noise, noise_dim, out_h + i, out_dx + i, out_dz + i);
+    }
+
+    // remainder, padded to a full vector
+    if (i < n) {
+        size_t rest = n - i;
+        float x[S::width]  = {};
+        float y[S::width]  = {};
+        float h[S::width]  = {};
+        float dx[S::width] = {};
+        float dz[S::width] = {};
+        memcpy(x, xs + i, sizeof(float) * rest);
+        memcpy(y, ys + i, sizeof(float) * rest);
+        terrain_noise_lanes<S, Lattice>(octaves, x, y, noise, noise_dim, h, dx, dz);
+        memcpy(out_h + i, h, sizeof(float) * rest);
+        memcpy(out_dx + i, dx, sizeof(float) * rest);
+        memcpy(out_dz + i, dz, sizeof(float) * rest);
+    }
+}
+
+#endif // TERRAIN3_NOISE_BATCH_KERNEL_H
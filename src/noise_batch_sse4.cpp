@@ -0,0 +1,124 @@
+#include "noise_batch.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+
+#include "noise_batch_kernel.h"
+
+#include <immintrin.h>
+
+/// SSE4.1 kernel, four points per iteration. There is no gather instruction, so
+/// the table lookups are done per lane.
+
+namespace {
+
+struct sse4 {
+    static constexpr size_t width = 4;
+
+    struct vi {
+        __m128i v;
+
+        vi() = default;
+
+        explicit vi(__m128i v) : v(v) {}
+
+        explicit vi(int32_t s) : v(_mm_set1_epi32(s)) {}
+
+        friend vi operator+(vi a, vi b) { return vi(_mm_add_epi32(a.v, b.v)); }
+
+        friend vi operator*(vi a, vi b) { return vi(_mm_mullo_epi32(a.v, b.v)); }
+
+        friend vi operator&(vi a, vi b) { return vi(_mm_and_si128(a.v, b.v)); }
+
+        friend vi operator^(vi a, vi b) { return vi(_mm_xor_si128(a.v, b.v)); }
+    };
+
+    struct vf {
+        __m128 v;
+
+        vf() = default;
+
+        explicit vf(__m128 v) : v(v) {}
+
+        explicit vf(float s) : v(_mm_set1_ps(s)) {}
+
+        friend vf operator+(vf a, vf b) { return vf(_mm_add_ps(a.v, b.v)); }
+
+        friend vf operator-(vf a, vf b) { return vf(_mm_sub_ps(a.v, b.v)); }
+
+        friend vf operator*(vf a, vf b) { return vf(_mm_mul_ps(a.v, b.v)); }
+
+        friend vf operator/(vf a, vf b) { return vf(_mm_div_ps(a.v, b.v)); }
+
+        friend vf operator+(vf a, float b) { return a + vf(b); }
+
+        friend vf operator+(float a, vf b) { return vf(a) + b; }
+
+        friend vf operator-(vf a, float b) { return a - vf(b); }
+
+        friend vf operator*(vf a, float b) { return a * vf(b); }
+
+        friend vf operator*(float a, vf b) { return vf(a) * b; }
+    };
+
+    static vf load(const float* p) { return vf(_mm_loadu_ps(p)); }
+
+    static void store(float* p, vf a) { _mm_storeu_ps(p, a.v); }
+
+    static vf floor(vf a) { return vf(_mm_floor_ps(a.v)); }
+
+    /// Logical shift, the lanes are treated as unsigned.
+    static vi shift_right(vi a, int n) { return vi(_mm_srli_epi32(a.v, n)); }
+
+    static vf to_float(vi a) { return vf(_mm_cvtepi32_ps(a.v)); }
+
+    static vi to_int(vf a) { return vi(_mm_cvttps_epi32(a.v)); }
+
+    /// Loads noise[idx] for every lane and maps it to [0,1].
+    static vf gather_noise(const uint8_t* noise, vi idx)
+    {
+        __m128i bytes = _mm_setr_epi32(
+            noise[_mm_extract_epi32(idx.v, 0)],
+            noise[_mm_extract_epi32(idx.v, 1)],
+            noise[_mm_extract_epi32(idx.v, 2)],
+            noise[_mm_extract_epi32(idx.v, 3)]);
+        return vf(_mm_cvtepi32_ps(bytes)) / vf(float(UINT8_MAX));
+    }
+
+    /// Loads corners[idx] for every lane.
+    static vi gather_corners(const uint32_t* corners, vi idx)
+    {
+        return vi(_mm_setr_epi32(
+            int32_t(corners[_mm_extract_epi32(idx.v, 0)]),
+            int32_t(corners[_mm_extract_epi32(idx.v, 1)]),
+            int32_t(corners[_mm_extract_epi32(idx.v, 2)]),
+            int32_t(corners[_mm_extract_epi32(idx.v, 3)])));
+    }
+};
+
+} // namespace
+
+void terrain_noise_batch_sse4(
+    noise_lattice lattice,
+    uint32_t octaves,
+    const float* xs,
+    const float* ys,
+    size_t n,
+    const uint8_t* noise,
+    uint32_t noise_dim,
+    float* out_h,
+    float* out_dx,
+    float* out_dz)
+{
+    if (lattice == NOISE_LATTICE_HASH) {
+        terrain_noise_kernel<sse4, NOISE_LATTICE_HASH>(
+            octaves, xs, ys, n, noise, noise_dim, out_h, out_dx, out_dz);
+    } else if (lattice == NOISE_LATTICE_PACKED) {
+        terrain_noise_kernel<sse4, NOISE_LATTICE_PACKED>(
+            octaves, xs, ys, n, noise, noise_dim, out_h, out_dx, out_dz);
+    } else {
+        terrain_noise_kernel<sse4, NOISE_LATTICE_TABLE>(
+            octaves, xs, ys, n, noise, noise_dim, out_h, out_dx, out_dz);
+    }
+}
+
+#endif
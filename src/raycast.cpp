@@ -0,0 +1,163 @@
+#include "raycast.h"
+
+#include "nmutil/math.h"
+
+#include <cfloat>
+
+/// The terrain is in [0, RAYCAST_MAX_HEIGHT), since terrain_noise is in [0,2).
+#define RAYCAST_MAX_HEIGHT (2.f * TERRAIN_AMP)
+
+/// Returns the distance along the ray at which it leaves the rectangle in the
+/// xz-plane that it is currently in.
+static float get_cell_exit(const raycast_ray* ray, nm::fvec2 cell_min, nm::fvec2 cell_max)
+{
+    float tx = FLT_MAX;
+    if (ray->dir.x > 0.f) {
+        tx = (cell_max.x - ray->origin.x) / ray->dir.x;
+    } else if (ray->dir.x < 0.f) {
+        tx = (cell_min.x - ray->origin.x) / ray->dir.x;
+    }
+
+    float tz = FLT_MAX;
+    if (ray->dir.z > 0.f) {
+        tz = (cell_max.y - ray->origin.z) / ray->dir.z;
+    } else if (ray->dir.z < 0.f) {
+        tz = (cell_min.y - ray->origin.z) / ray->dir.z;
+    }
+
+    return nm::min(tx, tz);
+}
+
+/// Returns the distance up to which the height bounds guarantee that the ray
+/// stays above the terrain, starting from distance t. Descends from the
+/// coarsest cell that contains the current position to finer cells, as long
+/// as the ray is within the range of the cell. Within the first cell whose
+/// range the ray is above, the ray is safe until it either leaves the cell or
+/// descends to the maximum height of the cell. Returns t if no cell gives such
+/// a guarantee. level is the level the previous call ended at, and is set to
+/// the level this call ended at.
+static float skip_cells(
+    const height_bounds* bounds, const raycast_ray* ray, float t, uint32_t* level)
+{
+    nm::fvec3 pos = ray->origin + t * ray->dir;
+    nm::fvec2 pos_xz(pos.x, pos.z);
+
+    // after a skip, the next cell of the coarser level may be skipped as well
+    uint32_t i = nm::min(*level + 1u, CLIPMAP_LEVEL_COUNT - 1u);
+    nm::fvec2 cell_min, cell_max, range;
+    while (!get_cell_bounds(bounds, i, pos_xz, &cell_min, &cell_max, &range)) {
+        if (++i == CLIPMAP_LEVEL_COUNT) {
+            *level = CLIPMAP_LEVEL_COUNT - 1u;
+            return t;
+        }
+    }
+
+    // the finer cells are only visited once the ray is within the range of
+    // the cell
+    while (pos.y <= range.y) {
+        if (i == 0 || !get_cell_bounds(bounds, i - 1u, pos_xz, &cell_min, &cell_max, &range)) {
+            *level = i;
+            return t;
+        }
+        i--;
+    }
+    *level = i;
+
+    float t_safe = get_cell_exit(ray, cell_min, cell_max);
+    if (ray->dir.y < 0.f) t_safe = nm::min(t_safe, t + (pos.y - range.y) / -ray->dir.y);
+
+    // step just past the border, to end up in the next cell
+    return t_safe * (1.f + 1e-6f) + 1e-4f;
+}
+
+bool raycast(const raycast_terrain* terrain, const raycast_ray* ray, raycast_hit* hit)
+{
+    hit->is_hit     = false;
+    hit->step_count = 0;
+
+    // maximum rate at which the ray can approach the terrain, per meter along
+    // the ray
+    float dir_xz = sqrtf(ray->dir.x * ray->dir.x + ray->dir.z * ray->dir.z);
+    float rate   = HEIGHT_BOUNDS_SLOPE * dir_xz - ray->dir.y;
+
+    // start at the top of the terrain
+    float t = 0.f;
+    if (ray->origin.y > RAYCAST_MAX_HEIGHT) {
+        if (ray->dir.y >= 0.f) return false;
+        t = (ray->origin.y - RAYCAST_MAX_HEIGHT) / -ray->dir.y;
+    }
+
+    terrain_noise_fn fn = get_terrain_noise_fn(NOISE_OCTAVES, terrain->lattice);
+
+    // the traversal of the height bounds starts at the coarsest level
+    uint32_t level = CLIPMAP_LEVEL_COUNT - 1u;
+    while (t <= ray->max_t && hit->step_count < RAYCAST_MAX_STEPS) {
+        hit->step_count++;
+
+        if (terrain->bounds) {
+            float t_skip = skip_cells(terrain->bounds, ray, t, &level);
+            if (t_skip > t) {
+                t = t_skip;
+                continue;
+            }
+        }
+
+        nm::fvec3 pos = ray->origin + t * ray->dir;
+        if (pos.y >= RAYCAST_MAX_HEIGHT && ray->dir.y >= 0.f) return false;
+
+        // same scaling as get_height
+        nm::fvec3 n = fn(TERRAIN_SCA * nm::fvec2(pos.x, pos.z), terrain->noise, NOISE_SIZE);
+        float above = pos.y - TERRAIN_AMP * n.x;
+        if (above <= RAYCAST_EPSILON) {
+            nm::fvec2 grad = TERRAIN_AMP * TERRAIN_SCA * nm::fvec2(n.y, n.z);
+            hit->is_hit    = true;
+            hit->t         = t;
+            hit->pos       = pos;
+            hit->normal    = nm::normalize(nm::fvec3(-grad.x, 1.f, -grad.y));
+            return true;
+        }
+
+        // the ray cannot get closer to the terrain than it is now
+        if (rate <= 0.f) return false;
+
+        // no part of the terrain can be hit before this distance
+        t += above / rate;
+    }
+
+    return false;
+}
+
+struct raycast_work {
+    const raycast_terrain* terrain;
+    const raycast_ray* rays;
+    raycast_hit* hits;
+    uint32_t count;
+};
+
+static void raycast_chunk(void* user, uint32_t index)
+{
+    const raycast_work* work = (const raycast_work*)user;
+
+    uint32_t first = index * RAYCAST_CHUNK_SIZE;
+    uint32_t last  = nm::min(first + RAYCAST_CHUNK_SIZE, work->count);
+    for (uint32_t i = first; i < last; i++) {
+        raycast(work->terrain, &work->rays[i], &work->hits[i]);
+    }
+}
+
+void raycast_batch(
+    const raycast_terrain* terrain,
+    worker_pool* pool,
+    const raycast_ray* rays,
+    raycast_hit* hits,
+    uint32_t count)
+{
+    raycast_work work;
+    work.terrain = terrain;
+    work.rays    = rays;
+    work.hits    = hits;
+    work.count   = count;
+
+    uint32_t chunk_count = (count + RAYCAST_CHUNK_SIZE - 1u) / RAYCAST_CHUNK_SIZE;
+    parallel_for(pool, chunk_count, raycast_chunk, &work);
+}
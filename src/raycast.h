@@ -0,0 +1,69 @@
+#ifndef TERRAIN3_RAYCAST_H
+#define TERRAIN3_RAYCAST_H
+
+#include "height_bounds.h"
+#include "noise.h"
+#include "worker_pool.h"
+
+#include "nmutil/vector.h"
+
+/// This file and its implementation encapsulate intersecting rays with the
+/// terrain. Rays are sphere traced against the analytic terrain_noise, with
+/// the slope of the terrain bounded by NOISE_GRADIENT_BOUND. Where the height
+/// bounds of the resident clipmap levels are available, rays descend from the
+/// coarsest cell that contains them to finer cells, and skip the parts of the
+/// first cell that lie above its maximum height.
+
+/// Maximum number of steps, a ray that has not hit by then is reported as a
+/// miss.
+#define RAYCAST_MAX_STEPS 512u
+
+/// A ray is considered to hit when it is this close above the terrain, in
+/// meters.
+#define RAYCAST_EPSILON .01f
+
+/// The terrain that rays are intersected with.
+struct raycast_terrain {
+    /// Noise table with NOISE_SIZE^2 entries, as in heightmap.
+    const uint8_t* noise;
+    noise_lattice lattice;
+    /// Optional, speeds up rays that pass over resident levels.
+    const height_bounds* bounds;
+};
+
+struct raycast_ray {
+    nm::fvec3 origin;
+    /// Must be normalized.
+    nm::fvec3 dir;
+    /// Distance after which the ray misses.
+    float max_t;
+};
+
+struct raycast_hit {
+    bool is_hit;
+    /// Distance along the ray.
+    float t;
+    nm::fvec3 pos;
+    nm::fvec3 normal;
+    /// Number of terrain evaluations and cell skips.
+    uint32_t step_count;
+};
+
+/// Intersects a ray with the terrain. A ray that starts below the terrain hits
+/// at its origin. Returns hit->is_hit.
+bool raycast(const raycast_terrain* terrain, const raycast_ray* ray, raycast_hit* hit);
+
+/// Number of rays of a batch that are traced by a single worker.
+#define RAYCAST_CHUNK_SIZE 64u
+
+/// Intersects rays[i] for all i in [0, count) and writes the results to
+/// hits[i], spread over the worker threads. Can be called from multiple
+/// threads at the same time, as long as the bounds are not modified.
+void raycast_batch(
+    const raycast_terrain* terrain,
+    worker_pool* pool,
+    const raycast_ray* rays,
+    raycast_hit* hits,
+    uint32_t count);
+
+#endif // TERRAIN3_RAYCAST_H
@@ -5,11 +5,15 @@
 #include "stb_wrapper.h"
 #include <filesystem>
 
-nm_ret init(terrain* t)
+nm_ret init(terrain* t, const heightmap_config* config, ubo_ring* ring)
 {
-    init(&t->geometry);
+    if (init(&t->geometry, ring) != NM_SUCCESS) return NM_FAIL;
 
-    if (init(&t->heightmap) != NM_SUCCESS) return NM_FAIL;
+    if (init(&t->heightmap, config, ring) != NM_SUCCESS) return NM_FAIL;
+
+    // the blocks are culled with the height bounds of the heightmap
+    t->geometry.bounds        = &t->heightmap.bounds;
+    t->geometry.level_octaves = t->heightmap.stats.level_octaves;
 
     nm_ret ret;
 
@@ -180,7 +184,8 @@ nm_ret init(terrain* t)
         prog->set_uint("DEF_CLIPMAP_LEVEL_SIZE", CLIPMAP_LEVEL_SIZE);
         prog->set_uint("DEF_CLIPMAP_LEVEL_COUNT", CLIPMAP_LEVEL_COUNT);
         prog->set_float("DEF_CLIPMAP_SCALE", CLIPMAP_SCALE);
-        prog->set_float("DEF_TEXTURE_SCALE", TEXTURE_SCALE);
+        // the texture holds the guard band of the levels as well
+        prog->set_float("DEF_TEXTURE_SCALE", 1.f / float(t->heightmap.texture_size));
         prog->set_float("DEF_TERRAIN_AMP", TERRAIN_AMP);
         prog->set_float("DEF_TERRAIN_SCA", TERRAIN_SCA);
         prog->set_float("DEF_TERRAIN_WATER_LVL", TERRAIN_WATER_LVL);
@@ -230,7 +235,7 @@ nm_ret init(terrain* t)
     return NM_SUCCESS;
 }
 
-void update(terrain* t, nm::fvec3 target)
+void update(terrain* t, nm::fvec3 target, nm::fvec3 velocity)
 {
     nm::fvec2 camera_pos = nm::fvec2(target.x, target.z);
 
@@ -239,7 +244,17 @@ void update(terrain* t, nm::fvec3 target)
 
     // as we move around, the heightmap textures are updated incrementally,
     // allowing for an "endless" terrain.
-    update(&t->heightmap, t->geometry.level_offsets);
+    update(&t->heightmap, t->geometry.level_offsets, nm::fvec2(velocity.x, velocity.z));
+
+    // the geometry is rendered where the rendered texels are, which lags a
+    // frame behind when pipelining. levels that did not fit in the texel budget
+    // are rendered with the texels of a coarser level
+    const heightmap_slot* slot = get_render_slot(&t->heightmap);
+    for (uint32_t i = 0; i < CLIPMAP_LEVEL_COUNT; i++) {
+        t->geometry.level_offsets[i]   = slot->level_offsets[i];
+        t->geometry.bounds_versions[i] = t->heightmap.bounds_versions[i];
+    }
+    t->geometry.first_complete_level = slot->first_complete_level;
 }
 
 void render(terrain* t, nm::shader_program* prog, nm::mat4 vp, nm::fvec3 target)
@@ -252,6 +267,7 @@ void render(terrain* t, nm::shader_program* prog, nm::mat4 vp, nm::fvec3 target)
 
     // set level offsets
     prog->set_ivec2_array("uni_lvl_off", &t->geometry.level_offsets[0], CLIPMAP_LEVEL_COUNT);
+    prog->set_uint("uni_first_lvl", t->geometry.first_complete_level);
 
     use_texture(&t->heightmap);
     t->grass_diff.use(GL_TEXTURE1);
@@ -284,6 +300,8 @@ void render(terrain* t, nm::mat4 vp, nm::fvec3 target, operation_draw draw_op, b
         GL_CHECK(glPolygonMode(GL_FRONT_AND_BACK, GL_FILL));
     }
 
+    begin_render(&t->heightmap);
+
     switch (draw_op) {
     case DEFAULT:
         render(t, &t->default_program, vp, target);
@@ -300,6 +318,8 @@ void render(terrain* t, nm::mat4 vp, nm::fvec3 target, operation_draw draw_op, b
     default:
         break;
     }
+
+    end_render(&t->heightmap);
 }
 
 void cleanup(terrain* t)
@@ -26,9 +26,11 @@ struct terrain {
     nm::tex cliff_norm;
 };
 
-nm_ret init(terrain* t);
+/// The per-frame uniform data of the terrain is allocated from ring.
+nm_ret init(terrain* t, const heightmap_config* config, ubo_ring* ring);
 
-void update(terrain* t, nm::fvec3 target);
+/// velocity is the distance that the target moved since the last update.
+void update(terrain* t, nm::fvec3 target, nm::fvec3 velocity);
 
 /// Render the mesh and heightmap one time with a specified program.
 void render(terrain* t, nm::shader_program* prog, nm::mat4 vp, nm::fvec3 target);
@@ -24,10 +24,6 @@ static_assert(CLIPMAP_LEVEL_COUNT <= 10u, "");
 /// Distance between vertices.
 #define CLIPMAP_SCALE .1f
 
-/// Scale factor to convert local offsets (vertex coordinates) into
-/// texture coordinates.
-#define TEXTURE_SCALE (1.f / CLIPMAP_LEVEL_SIZE)
-
 // terrain parameters ----------------------------------------------------------
 
 /// Terrain amplitude.
@@ -39,4 +35,11 @@ static_assert(CLIPMAP_LEVEL_COUNT <= 10u, "");
 /// Water level, before scaling. World height is roughly in [0,2].
 #define TERRAIN_WATER_LVL .6f
 
+/// Largest difference between the texels that the CPU and the GPU backend
+/// generate, in meters for the height and as slope for the gradient. Both
+/// evaluate the same terrain_noise, and only differ by floating point rounding
+/// (operation order and fused multiply-adds).
+#define TERRAIN_HEIGHT_TOLERANCE 1e-3f
+#define TERRAIN_SLOPE_TOLERANCE 1e-4f
+
 #endif //TERRAIN3_TERRAIN_DEFS_H
@@ -0,0 +1,262 @@
+#include "tile_cache.h"
+
+#include "nmutil/log.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/// "T3TC" in little endian.
+#define TILE_CACHE_MAGIC 0x43543354u
+
+/// The header, the index, and the texels each start at a page boundary.
+#define TILE_CACHE_PAGE_SIZE 4096u
+
+static size_t round_to_page(size_t size)
+{
+    return (size + TILE_CACHE_PAGE_SIZE - 1u) & ~size_t(TILE_CACHE_PAGE_SIZE - 1u);
+}
+
+static size_t get_index_offset() { return round_to_page(sizeof(tile_cache_header)); }
+
+static size_t get_texels_offset(uint32_t tile_count)
+{
+    return get_index_offset() + round_to_page(sizeof(tile_cache_entry) * tile_count);
+}
+
+/// Opens the file and maps size bytes of it, growing or shrinking it first.
+static nm_ret map_file(tile_cache* cache, const char* path, size_t size)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(
+        path,
+        GENERIC_READ | GENERIC_WRITE,
+        0,
+        NULL,
+        OPEN_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL,
+        NULL);
+    if (file == INVALID_HANDLE_VALUE) return NM_FAIL;
+
+    LARGE_INTEGER file_size;
+    file_size.QuadPart = LONGLONG(size);
+    if (!SetFilePointerEx(file, file_size, NULL, FILE_BEGIN) || !SetEndOfFile(file)) {
+        CloseHandle(file);
+        return NM_FAIL;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, 0, 0, NULL);
+    if (!mapping) {
+        CloseHandle(file);
+        return NM_FAIL;
+    }
+
+    void* base = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (!base) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return NM_FAIL;
+    }
+
+    cache->file    = intptr_t(file);
+    cache->mapping = intptr_t(mapping);
+#else
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return NM_FAIL;
+
+    // grows sparsely, untouched tiles take no space on disk
+    if (ftruncate(fd, off_t(size)) != 0) {
+        close(fd);
+        return NM_FAIL;
+    }
+
+    void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        close(fd);
+        return NM_FAIL;
+    }
+
+    cache->file    = intptr_t(fd);
+    cache->mapping = 0;
+#endif
+
+    cache->base = (uint8_t*)base;
+    cache->size = size;
+
+    return NM_SUCCESS;
+}
+
+static void unmap_file(tile_cache* cache)
+{
+#ifdef _WIN32
+    FlushViewOfFile(cache->base, 0);
+    UnmapViewOfFile(cache->base);
+    CloseHandle(HANDLE(cache->mapping));
+    CloseHandle(HANDLE(cache->file));
+#else
+    msync(cache->base, cache->size, MS_SYNC);
+    munmap(cache->base, cache->size);
+    close(int(cache->file));
+#endif
+}
+
+static void unlink_slot(tile_cache* cache, uint32_t slot)
+{
+    uint32_t prev = cache->prev[slot];
+    uint32_t next = cache->next[slot];
+    if (prev != TILE_CACHE_NO_SLOT) cache->next[prev] = next;
+    if (next != TILE_CACHE_NO_SLOT) cache->prev[next] = prev;
+    if (cache->head == slot) cache->head = next;
+    if (cache->tail == slot) cache->tail = prev;
+}
+
+static void push_front(tile_cache* cache, uint32_t slot)
+{
+    cache->prev[slot] = TILE_CACHE_NO_SLOT;
+    cache->next[slot] = cache->head;
+    if (cache->head != TILE_CACHE_NO_SLOT) cache->prev[cache->head] = slot;
+    cache->head = slot;
+    if (cache->tail == TILE_CACHE_NO_SLOT) cache->tail = slot;
+}
+
+nm_ret init(tile_cache* cache, const char* path, size_t max_size, uint64_t seed)
+{
+    size_t tile_bytes   = TILE_CACHE_TILE_BYTES + sizeof(tile_cache_entry);
+    size_t header_bytes = get_index_offset() + TILE_CACHE_PAGE_SIZE;
+    uint32_t tile_count = max_size > header_bytes ? uint32_t((max_size - header_bytes) / tile_bytes)
+                                                  : 0u;
+    tile_count          = std::max(tile_count, TILE_CACHE_MIN_TILE_COUNT);
+
+    size_t size = get_texels_offset(tile_count) + size_t(tile_count) * TILE_CACHE_TILE_BYTES;
+    if (map_file(cache, path, size) != NM_SUCCESS) {
+        nm::log(nm::LOG_ERROR, "failed to map tile cache %s\n", path);
+        return NM_FAIL;
+    }
+
+    cache->header  = (tile_cache_header*)cache->base;
+    cache->entries = (tile_cache_entry*)(cache->base + get_index_offset());
+    cache->texels  = (nm::fvec4*)(cache->base + get_texels_offset(tile_count));
+
+    // tiles of another noise, generator, or layout cannot be used
+    tile_cache_header* header = cache->header;
+    bool is_compatible        = header->magic == TILE_CACHE_MAGIC &&
+                         header->format_version == TILE_CACHE_FORMAT_VERSION &&
+                         header->generator_version == TILE_CACHE_GENERATOR_VERSION &&
+                         header->tile_count == tile_count && header->seed == seed;
+    if (!is_compatible) {
+        memset(cache->base, 0, get_texels_offset(tile_count));
+        header->magic             = TILE_CACHE_MAGIC;
+        header->format_version    = TILE_CACHE_FORMAT_VERSION;
+        header->generator_version = TILE_CACHE_GENERATOR_VERSION;
+        header->tile_count        = tile_count;
+        header->seed              = seed;
+        header->tick              = 0;
+    }
+
+    cache->prev.assign(tile_count, TILE_CACHE_NO_SLOT);
+    cache->next.assign(tile_count, TILE_CACHE_NO_SLOT);
+    cache->head = TILE_CACHE_NO_SLOT;
+    cache->tail = TILE_CACHE_NO_SLOT;
+    cache->slots.clear();
+    cache->free_slots.clear();
+    cache->hit_count  = 0;
+    cache->miss_count = 0;
+
+    // rebuild the order of use from the index, oldest first
+    std::vector<uint32_t> used;
+    for (uint32_t i = tile_count; i-- > 0;) {
+        if (cache->entries[i].is_valid) {
+            used.push_back(i);
+        } else {
+            cache->free_slots.push_back(i);
+        }
+    }
+    std::sort(used.begin(), used.end(), [cache](uint32_t a, uint32_t b) {
+        return cache->entries[a].last_used < cache->entries[b].last_used;
+    });
+    for (uint32_t slot : used) {
+        cache->slots[cache->entries[slot].key] = slot;
+        push_front(cache, slot);
+    }
+
+    nm::log(
+        nm::LOG_INFO,
+        "opened tile cache %s with %u of %u tiles\n",
+        path,
+        uint32_t(used.size()),
+        tile_count);
+
+    return NM_SUCCESS;
+}
+
+void cleanup(tile_cache* cache)
+{
+    nm::log(
+        nm::LOG_INFO,
+        "tile cache: %llu hits, %llu misses\n",
+        (unsigned long long)cache->hit_count,
+        (unsigned long long)cache->miss_count);
+
+    unmap_file(cache);
+    cache->slots.clear();
+}
+
+uint32_t find_tile(tile_cache* cache, const tile_cache_key* key)
+{
+    auto it = cache->slots.find(*key);
+    if (it == cache->slots.end()) {
+        cache->miss_count++;
+        return TILE_CACHE_NO_SLOT;
+    }
+
+    uint32_t slot = it->second;
+    if (cache->entries[slot].is_valid) cache->hit_count++;
+
+    cache->entries[slot].last_used = ++cache->header->tick;
+    unlink_slot(cache, slot);
+    push_front(cache, slot);
+
+    return slot;
+}
+
+uint32_t peek_tile(const tile_cache* cache, const tile_cache_key* key)
+{
+    auto it = cache->slots.find(*key);
+    return it == cache->slots.end() ? TILE_CACHE_NO_SLOT : it->second;
+}
+
+uint32_t insert_tile(tile_cache* cache, const tile_cache_key* key)
+{
+    uint32_t slot;
+    if (!cache->free_slots.empty()) {
+        slot = cache->free_slots.back();
+        cache->free_slots.pop_back();
+    } else {
+        slot = cache->tail;
+        cache->slots.erase(cache->entries[slot].key);
+        unlink_slot(cache, slot);
+    }
+
+    // invalid until the texels are written, in case the application stops
+    tile_cache_entry* entry = &cache->entries[slot];
+    entry->is_valid         = 0;
+    entry->key              = *key;
+    entry->last_used        = ++cache->header->tick;
+
+    cache->slots[*key] = slot;
+    push_front(cache, slot);
+
+    return slot;
+}
+
+void set_tile_valid(tile_cache* cache, uint32_t slot) { cache->entries[slot].is_valid = 1; }
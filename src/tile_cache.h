@@ -0,0 +1,162 @@
+#ifndef TERRAIN3_TILE_CACHE_H
+#define TERRAIN3_TILE_CACHE_H
+
+#include "nmutil/defs.h"
+#include "nmutil/vector.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/// This file and its implementation encapsulate a persistent cache of
+/// generated heightmap texels, such that revisiting a part of the world reads
+/// the texels from disk instead of evaluating the noise again. The texels are
+/// stored in square tiles that start at a world texel coordinate that is a
+/// multiple of the tile size, in a memory-mapped file. Generated tiles are
+/// written to the mapping as they are created. Once the file is full, the
+/// least recently used tile is replaced.
+
+/// Size of a tile in texels of its level, in each dimension.
+#define TILE_CACHE_TILE_SIZE 16u
+
+/// A tile of height and gradient texels is exactly one page.
+#define TILE_CACHE_TILE_BYTES (TILE_CACHE_TILE_SIZE * TILE_CACHE_TILE_SIZE * sizeof(nm::fvec4))
+
+/// Layout of the file, a file with a different layout is cleared.
+#define TILE_CACHE_FORMAT_VERSION 2u
+
+/// Must be incremented whenever the generated texels change for the same
+/// inputs, such that outdated files are cleared.
+#define TILE_CACHE_GENERATOR_VERSION 1u
+
+/// Default size cap of the file in bytes.
+#define TILE_CACHE_DEFAULT_SIZE (size_t(256u) << 20)
+
+/// Lower bound on the number of tiles, enough for all tiles that a complete
+/// regeneration touches. A single update never evicts its own tiles.
+#define TILE_CACHE_MIN_TILE_COUNT 4096u
+
+/// Returned when a tile is not in the cache.
+#define TILE_CACHE_NO_SLOT UINT32_MAX
+
+/// Identifies a tile. The tile covers world texel coordinates [x, x + size) and
+/// [y, y + size) of the level, divided by the tile size.
+struct tile_cache_key {
+    int32_t x;
+    int32_t y;
+    uint32_t level;
+    /// The texels of different octave counts differ.
+    uint32_t octaves;
+    /// Zero for texels evaluated from the noise, otherwise identifies the tile
+    /// pack whose quantized texels the tile holds, such that a run without the
+    /// pack does not take them for exact ones.
+    uint32_t pack;
+};
+
+inline bool operator==(const tile_cache_key& a, const tile_cache_key& b)
+{
+    return a.x == b.x && a.y == b.y && a.level == b.level && a.octaves == b.octaves &&
+           a.pack == b.pack;
+}
+
+struct tile_cache_key_hash {
+    size_t operator()(const tile_cache_key& k) const
+    {
+        uint64_t h = uint64_t(uint32_t(k.x)) * 0x9e3779b97f4a7c15ull;
+        h ^= uint64_t(uint32_t(k.y)) * 0xc2b2ae3d27d4eb4full;
+        h ^= uint64_t(k.level << 8 | k.octaves) * 0x165667b19e3779f9ull;
+        h ^= uint64_t(k.pack) * 0xd6e8feb86659fd93ull;
+        return size_t(h ^ (h >> 32));
+    }
+};
+
+/// First page of the file.
+struct tile_cache_header {
+    uint32_t magic;
+    uint32_t format_version;
+    uint32_t generator_version;
+    uint32_t tile_count;
+    /// Identifies the noise, tiles of a different noise are discarded.
+    uint64_t seed;
+    /// Incremented on every access, to order the tiles by their last use.
+    uint64_t tick;
+};
+
+/// Entry of the index that follows the header, one for each tile slot.
+struct tile_cache_entry {
+    tile_cache_key key;
+    uint64_t last_used;
+    /// Set once the texels of the slot have been written completely.
+    uint32_t is_valid;
+    uint32_t padding;
+};
+
+struct tile_cache {
+    /// Platform handles of the file and its mapping.
+    intptr_t file;
+    intptr_t mapping;
+    uint8_t* base;
+    size_t size;
+
+    tile_cache_header* header;
+    tile_cache_entry* entries;
+    /// TILE_CACHE_TILE_SIZE^2 texels per slot, row-major.
+    nm::fvec4* texels;
+
+    std::unordered_map<tile_cache_key, uint32_t, tile_cache_key_hash> slots;
+    /// Doubly linked list of the slots in use, from most to least recently
+    /// used. Unused slots are taken before any tile is replaced.
+    std::vector<uint32_t> prev;
+    std::vector<uint32_t> next;
+    uint32_t head;
+    uint32_t tail;
+    std::vector<uint32_t> free_slots;
+
+    /// Number of lookups that found their tile, and that did not, since the
+    /// cache was opened.
+    uint64_t hit_count;
+    uint64_t miss_count;
+};
+
+/// Opens or creates the file at path with room for as many tiles as fit in
+/// max_size bytes. Valid tiles of an earlier run with the same seed and layout
+/// are kept, otherwise the file is cleared.
+nm_ret init(tile_cache* cache, const char* path, size_t max_size, uint64_t seed);
+
+/// Writes the mapping back to the file and closes it.
+void cleanup(tile_cache* cache);
+
+/// Returns the slot of the tile and marks it as most recently used, or
+/// TILE_CACHE_NO_SLOT if it is not cached. A slot that was inserted but is not
+/// valid yet is returned as well.
+uint32_t find_tile(tile_cache* cache, const tile_cache_key* key);
+
+/// Returns the slot of the tile like find_tile, without counting as an access.
+uint32_t peek_tile(const tile_cache* cache, const tile_cache_key* key);
+
+/// Returns a slot for a tile that is not cached, replacing the least recently
+/// used tile if the file is full. Its texels must be written before calling
+/// set_tile_valid.
+uint32_t insert_tile(tile_cache* cache, const tile_cache_key* key);
+
+/// Marks the texels of an inserted slot as complete, such that they are kept
+/// for later runs.
+void set_tile_valid(tile_cache* cache, uint32_t slot);
+
+/// Returns the TILE_CACHE_TILE_SIZE^2 texels of a slot.
+inline nm::fvec4* get_tile_texels(tile_cache* cache, uint32_t slot)
+{
+    return cache->texels + size_t(slot) * TILE_CACHE_TILE_SIZE * TILE_CACHE_TILE_SIZE;
+}
+
+/// Number of tile slots in the file.
+inline uint32_t get_tile_capacity(const tile_cache* cache) { return cache->header->tile_count; }
+
+/// Number of tile slots in use.
+inline uint32_t get_cached_tile_count(const tile_cache* cache)
+{
+    return get_tile_capacity(cache) - uint32_t(cache->free_slots.size());
+}
+
+#endif // TERRAIN3_TILE_CACHE_H
@@ -0,0 +1,392 @@
+#include "tile_pack.h"
+
+#include "nmutil/log.h"
+
+#include <cmath>
+#include <cstring>
+
+/// "T3TP" in little endian.
+#define TILE_PACK_MAGIC 0x50543354u
+
+static uint32_t zigzag(uint32_t r) { return (r << 1) ^ uint32_t(int32_t(r) >> 31); }
+
+static uint32_t unzigzag(uint32_t z) { return (z >> 1) ^ (0u - (z & 1u)); }
+
+/// Returns the quantized value, the arithmetic on quantized values wraps
+/// around such that every residual fits in 32 bits.
+static uint32_t quantize(float value, float inv_step)
+{
+    float q = nearbyintf(value * inv_step);
+    q       = fminf(fmaxf(q, -2147483648.f), 2147483520.f);
+    return uint32_t(int32_t(q));
+}
+
+/// Returns the number of bits needed for the value.
+static uint32_t get_bit_width(uint32_t value)
+{
+    uint32_t width = 0;
+    while (width < 32u && (value >> width) != 0) width++;
+    return width;
+}
+
+/// Set in the width byte of a row that is predicted with the second order.
+#define TILE_PACK_SECOND_ORDER_BIT 0x80u
+
+/// Returns the prediction of a value from the value before it, a, and the one
+/// before that, b. The first order repeats a, the second order extrapolates.
+static uint32_t predict(uint32_t a, uint32_t b, bool is_second_order)
+{
+    return is_second_order ? 2u * a - b : a;
+}
+
+uint32_t encode_tile(
+    const nm::fvec4* texels, float height_step, float gradient_step, uint8_t* data)
+{
+    const uint32_t n = TILE_PACK_TILE_SIZE;
+    float inv_steps[TILE_PACK_CHANNEL_COUNT] = {
+        1.f / height_step, 1.f / gradient_step, 1.f / gradient_step};
+
+    uint8_t* out = data;
+    for (uint32_t c = 0; c < TILE_PACK_CHANNEL_COUNT; c++) {
+        uint32_t q[TILE_PACK_TILE_TEXEL_COUNT];
+        for (uint32_t i = 0; i < TILE_PACK_TILE_TEXEL_COUNT; i++) {
+            // the components of a texel are contiguous
+            q[i] = quantize((&texels[i].x)[c], inv_steps[c]);
+        }
+
+        // the first texel is stored as is
+        memcpy(out, &q[0], sizeof(uint32_t));
+        out += sizeof(uint32_t);
+
+        uint8_t* widths = out;
+        out += n;
+        for (uint32_t y = 0; y < n; y++) {
+            // zig-zag encoded residuals of both orders, where the values
+            // before the first ones repeat them
+            uint32_t residuals[2][TILE_PACK_TILE_SIZE];
+            uint32_t bits[2] = {0, 0};
+            for (uint32_t x = 0; x < n; x++) {
+                uint32_t a, b;
+                if (y == 0) {
+                    a = q[x > 0 ? x - 1 : 0];
+                    b = q[x > 1 ? x - 2 : 0];
+                } else {
+                    a = q[(y - 1) * n + x];
+                    b = q[(y > 1 ? y - 2 : y - 1) * n + x];
+                }
+                for (uint32_t order = 0; order < 2; order++) {
+                    residuals[order][x] = zigzag(q[y * n + x] - predict(a, b, order == 1));
+                    bits[order] |= residuals[order][x];
+                }
+            }
+
+            // the order with the narrower residuals
+            uint32_t order = get_bit_width(bits[1]) < get_bit_width(bits[0]) ? 1u : 0u;
+            uint32_t width = get_bit_width(bits[order]);
+            widths[y]      = uint8_t(width | (order == 1 ? TILE_PACK_SECOND_ORDER_BIT : 0u));
+
+            // a row of n values with the same width ends on a byte boundary
+            uint64_t acc   = 0;
+            uint32_t count = 0;
+            for (uint32_t x = 0; x < n; x++) {
+                acc |= uint64_t(residuals[order][x]) << count;
+                count += width;
+                while (count >= 8u) {
+                    *out++ = uint8_t(acc);
+                    acc >>= 8;
+                    count -= 8u;
+                }
+            }
+        }
+    }
+
+    return uint32_t(out - data);
+}
+
+nm_ret decode_tile(
+    const uint8_t* data, uint32_t size, float height_step, float gradient_step, nm::fvec4* texels)
+{
+    const uint32_t n                     = TILE_PACK_TILE_SIZE;
+    float steps[TILE_PACK_CHANNEL_COUNT] = {height_step, gradient_step, gradient_step};
+
+    const uint8_t* in  = data;
+    const uint8_t* end = data + size;
+    for (uint32_t c = 0; c < TILE_PACK_CHANNEL_COUNT; c++) {
+        if (end - in < ptrdiff_t(sizeof(uint32_t) + n)) return NM_FAIL;
+
+        uint32_t q[TILE_PACK_TILE_TEXEL_COUNT];
+        uint32_t first;
+        memcpy(&first, in, sizeof(uint32_t));
+        in += sizeof(uint32_t);
+        const uint8_t* widths = in;
+        in += n;
+
+        for (uint32_t y = 0; y < n; y++) {
+            bool is_second_order = (widths[y] & TILE_PACK_SECOND_ORDER_BIT) != 0;
+            uint32_t width       = widths[y] & ~TILE_PACK_SECOND_ORDER_BIT;
+            if (width > 32u || end - in < ptrdiff_t(2u * width)) return NM_FAIL;
+
+            // unpack the residuals of the row, each with a single unaligned
+            // load from a copy with room to load past the end of the row
+            uint8_t packed[2u * 32u + sizeof(uint64_t)] = {};
+            memcpy(packed, in, 2u * width);
+            in += 2u * width;
+
+            uint32_t residuals[TILE_PACK_TILE_SIZE];
+            uint64_t mask = (uint64_t(1) << width) - 1u;
+            for (uint32_t x = 0; x < n; x++) {
+                uint32_t bit = x * width;
+                uint64_t bits;
+                memcpy(&bits, packed + (bit >> 3), sizeof(bits));
+                residuals[x] = unzigzag(uint32_t((bits >> (bit & 7u)) & mask));
+            }
+
+            // the rows after the first are independent for every texel
+            uint32_t* row = &q[y * n];
+            if (y > 0) {
+                const uint32_t* above  = row - n;
+                const uint32_t* above2 = y > 1 ? row - 2 * n : above;
+                if (is_second_order) {
+                    for (uint32_t x = 0; x < n; x++) {
+                        row[x] = residuals[x] + 2u * above[x] - above2[x];
+                    }
+                } else {
+                    for (uint32_t x = 0; x < n; x++) row[x] = residuals[x] + above[x];
+                }
+            } else {
+                row[0] = first;
+                for (uint32_t x = 1; x < n; x++) {
+                    uint32_t b = row[x > 1 ? x - 2 : 0];
+                    row[x]     = residuals[x] + predict(row[x - 1], b, is_second_order);
+                }
+            }
+        }
+
+        for (uint32_t i = 0; i < TILE_PACK_TILE_TEXEL_COUNT; i++) {
+            (&texels[i].x)[c] = float(int32_t(q[i])) * steps[c];
+        }
+    }
+    if (in != end) return NM_FAIL;
+
+    for (uint32_t i = 0; i < TILE_PACK_TILE_TEXEL_COUNT; i++) {
+        texels[i].w = 0.f;
+    }
+
+    return NM_SUCCESS;
+}
+
+uint32_t get_checksum(const uint8_t* data, size_t size, uint32_t checksum)
+{
+    // reflected polynomial of CRC-32, one table lookup per byte
+    static const struct crc_table {
+        uint32_t values[256];
+        crc_table()
+        {
+            for (uint32_t i = 0; i < 256u; i++) {
+                uint32_t c = i;
+                for (uint32_t k = 0; k < 8u; k++) c = (c >> 1) ^ (0xedb88320u & (0u - (c & 1u)));
+                values[i] = c;
+            }
+        }
+    } table;
+
+    uint32_t crc = ~checksum;
+    for (size_t i = 0; i < size; i++) crc = (crc >> 8) ^ table.values[(crc ^ data[i]) & 0xffu];
+
+    return ~crc;
+}
+
+/// Returns the checksum of the level table followed by the index.
+static uint32_t get_index_checksum(
+    const tile_pack_level* levels,
+    uint32_t level_count,
+    const tile_pack_entry* entries,
+    uint32_t entry_count)
+{
+    uint32_t checksum = get_checksum((const uint8_t*)levels, sizeof(*levels) * level_count, 0);
+    return get_checksum((const uint8_t*)entries, sizeof(*entries) * entry_count, checksum);
+}
+
+/// Returns the offset in the file of the first tile.
+static uint64_t get_payload_offset(uint32_t level_count, uint32_t entry_count)
+{
+    return sizeof(tile_pack_header) + sizeof(tile_pack_level) * uint64_t(level_count) +
+           sizeof(tile_pack_entry) * uint64_t(entry_count);
+}
+
+nm_ret init(
+    tile_pack_writer* writer,
+    const char* path,
+    const tile_pack_level* levels,
+    uint32_t level_count,
+    uint64_t seed)
+{
+    if (level_count > TILE_PACK_MAX_LEVEL_COUNT) return NM_FAIL;
+
+    writer->levels.assign(levels, levels + level_count);
+    uint32_t entry_count = 0;
+    for (tile_pack_level& level : writer->levels) {
+        level.first_entry = entry_count;
+        level.padding     = 0;
+        entry_count += level.width * level.height;
+    }
+
+    tile_pack_entry missing = {0, 0, 0};
+    writer->entries.assign(entry_count, missing);
+
+    tile_pack_header* header = &writer->header;
+    memset(header, 0, sizeof(*header));
+    header->magic          = TILE_PACK_MAGIC;
+    header->format_version = TILE_PACK_FORMAT_VERSION;
+    header->tile_size      = TILE_PACK_TILE_SIZE;
+    header->level_count    = level_count;
+    header->seed           = seed;
+    header->entry_count    = entry_count;
+
+    writer->file = fopen(path, "wb");
+    if (!writer->file) {
+        nm::log(nm::LOG_ERROR, "failed to create tile pack %s\n", path);
+        return NM_FAIL;
+    }
+
+    // the header and the index are written once they are complete
+    writer->offset = get_payload_offset(level_count, entry_count);
+    if (fseek(writer->file, long(writer->offset), SEEK_SET) != 0) {
+        fclose(writer->file);
+        return NM_FAIL;
+    }
+
+    return NM_SUCCESS;
+}
+
+nm_ret write_tile(
+    tile_pack_writer* writer,
+    uint32_t level_index,
+    int32_t x,
+    int32_t y,
+    const uint8_t* data,
+    uint32_t size)
+{
+    const tile_pack_level* level = &writer->levels[level_index];
+    int32_t tx                   = x - level->x;
+    int32_t ty                   = y - level->y;
+    if (tx < 0 || ty < 0 || tx >= int32_t(level->width) || ty >= int32_t(level->height)) {
+        return NM_FAIL;
+    }
+
+    tile_pack_entry* entry = &writer->entries[level->first_entry + ty * level->width + tx];
+    if (entry->size > 0 || size == 0) return NM_FAIL;
+    if (fwrite(data, 1, size, writer->file) != size) return NM_FAIL;
+
+    entry->offset   = writer->offset;
+    entry->size     = size;
+    entry->checksum = get_checksum(data, size, 0);
+    writer->offset += size;
+
+    return NM_SUCCESS;
+}
+
+nm_ret finish(tile_pack_writer* writer)
+{
+    tile_pack_header* header = &writer->header;
+    header->index_checksum   = get_index_checksum(
+        writer->levels.data(),
+        header->level_count,
+        writer->entries.data(),
+        header->entry_count);
+
+    bool is_written = fseek(writer->file, 0, SEEK_SET) == 0 &&
+                      fwrite(header, sizeof(*header), 1, writer->file) == 1 &&
+                      fwrite(
+                          writer->levels.data(),
+                          sizeof(tile_pack_level),
+                          writer->levels.size(),
+                          writer->file) == writer->levels.size() &&
+                      fwrite(
+                          writer->entries.data(),
+                          sizeof(tile_pack_entry),
+                          writer->entries.size(),
+                          writer->file) == writer->entries.size();
+    is_written      = fclose(writer->file) == 0 && is_written;
+
+    writer->levels.clear();
+    writer->entries.clear();
+
+    return is_written ? NM_SUCCESS : NM_FAIL;
+}
+
+nm_ret init(tile_pack* pack, const char* path)
+{
+    if (init(&pack->file, path, true) != NM_SUCCESS) {
+        nm::log(nm::LOG_ERROR, "failed to map tile pack %s\n", path);
+        return NM_FAIL;
+    }
+
+    // the header, the level table, and the index must be complete and intact
+    const tile_pack_header* header = (const tile_pack_header*)pack->file.base;
+    bool is_valid = pack->file.size >= sizeof(tile_pack_header) &&
+                    header->magic == TILE_PACK_MAGIC &&
+                    header->format_version == TILE_PACK_FORMAT_VERSION &&
+                    header->tile_size == TILE_PACK_TILE_SIZE &&
+                    header->level_count <= TILE_PACK_MAX_LEVEL_COUNT &&
+                    pack->file.size >= get_payload_offset(header->level_count, header->entry_count);
+    if (is_valid) {
+        pack->header  = header;
+        pack->levels  = (const tile_pack_level*)(pack->file.base + sizeof(tile_pack_header));
+        pack->entries = (const tile_pack_entry*)(pack->levels + header->level_count);
+        is_valid      = header->index_checksum == get_index_checksum(
+                                                      pack->levels,
+                                                      header->level_count,
+                                                      pack->entries,
+                                                      header->entry_count);
+    }
+    if (!is_valid) {
+        nm::log(nm::LOG_ERROR, "tile pack %s is not valid\n", path);
+        cleanup(&pack->file);
+        return NM_FAIL;
+    }
+
+    nm::log(
+        nm::LOG_INFO,
+        "opened tile pack %s with %u levels and %u tiles\n",
+        path,
+        header->level_count,
+        header->entry_count);
+
+    return NM_SUCCESS;
+}
+
+void cleanup(tile_pack* pack) { cleanup(&pack->file); }
+
+bool find_tile(const tile_pack* pack, uint32_t level, int32_t x, int32_t y, tile_pack_tile* tile)
+{
+    for (uint32_t i = 0; i < pack->header->level_count; i++) {
+        const tile_pack_level* l = &pack->levels[i];
+        if (l->level != level) continue;
+
+        int32_t tx = x - l->x;
+        int32_t ty = y - l->y;
+        if (tx < 0 || ty < 0 || tx >= int32_t(l->width) || ty >= int32_t(l->height)) continue;
+
+        const tile_pack_entry* entry = &pack->entries[l->first_entry + ty * l->width + tx];
+        if (entry->size == 0) continue;
+
+        tile->level = l;
+        tile->entry = entry;
+        return true;
+    }
+
+    return false;
+}
+
+nm_ret read_tile(const tile_pack* pack, const tile_pack_tile* tile, nm::fvec4* texels)
+{
+    const tile_pack_entry* entry = tile->entry;
+    if (entry->offset + entry->size > pack->file.size) return NM_FAIL;
+
+    const uint8_t* data = pack->file.base + entry->offset;
+    if (get_checksum(data, entry->size, 0) != entry->checksum) return NM_FAIL;
+
+    const tile_pack_level* level = tile->level;
+    return decode_tile(data, entry->size, level->height_step, level->gradient_step, texels);
+}
@@ -0,0 +1,175 @@
+#ifndef TERRAIN3_TILE_PACK_H
+#define TERRAIN3_TILE_PACK_H
+
+#include "mapped_file.h"
+#include "nmutil/defs.h"
+#include "nmutil/vector.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+/// This file and its implementation encapsulate a compressed container of
+/// heightmap texels, for datasets that are generated offline. The texels are
+/// stored in square tiles that start at a world texel coordinate that is a
+/// multiple of the tile size, like the tiles of the tile cache. Each level
+/// covers a rectangle of tiles, whose entries in the index are found without a
+/// search.
+///
+/// A tile stores the height and the gradient of its texels, quantized to
+/// integer steps. Each channel is predicted from the texels before it: the
+/// first row from the texels to its left, the other rows from the texels
+/// above, which are independent for all texels of a row. Each row uses either
+/// the first or the second order prediction, whichever has the smaller
+/// residuals. The zig-zag encoded residuals of each row are bit-packed with
+/// the fewest bits that hold all of them, which acts as the entropy stage.
+/// Decoding a row unpacks TILE_PACK_TILE_SIZE residuals of a single width and
+/// adds them to the prediction lane by lane.
+///
+/// Layout of the file: the header, the level table, the index, and the
+/// payload of the tiles in the order they were written.
+
+/// Size of a tile in texels of its level, in each dimension. Equal to the tile
+/// size of the tile cache, such that tiles line up.
+#define TILE_PACK_TILE_SIZE 16u
+
+/// Number of texels of a tile.
+#define TILE_PACK_TILE_TEXEL_COUNT (TILE_PACK_TILE_SIZE * TILE_PACK_TILE_SIZE)
+
+/// Height, gradient x, and gradient y. The fourth component is zero.
+#define TILE_PACK_CHANNEL_COUNT 3u
+
+/// Upper bound on the size of an encoded tile: the first value and the row
+/// widths of each channel, and all residuals with 32 bits.
+#define TILE_PACK_MAX_TILE_BYTES                                                                   \
+    (TILE_PACK_CHANNEL_COUNT * (4u + TILE_PACK_TILE_SIZE + 4u * TILE_PACK_TILE_TEXEL_COUNT))
+
+/// Layout of the file, a file with a different layout is rejected.
+#define TILE_PACK_FORMAT_VERSION 1u
+
+/// Quantization step of the heights in meters, the error is at most half a
+/// step. The step is the same for all levels, such that coarse levels are not
+/// less accurate than fine ones: their larger differences between neighboring
+/// texels only widen their residuals.
+#define TILE_PACK_HEIGHT_STEP (1.f / 128.f)
+
+/// Quantization step of the gradients, the same for all levels as well.
+#define TILE_PACK_GRADIENT_STEP (1.f / 2048.f)
+
+/// Maximum number of levels in a file.
+#define TILE_PACK_MAX_LEVEL_COUNT 16u
+
+/// First bytes of the file.
+struct tile_pack_header {
+    uint32_t magic;
+    uint32_t format_version;
+    uint32_t tile_size;
+    uint32_t level_count;
+    /// Identifies the generator of the texels, such as the noise seed.
+    uint64_t seed;
+    /// Number of entries of the index, and the checksum of the level table and
+    /// the index.
+    uint32_t entry_count;
+    uint32_t index_checksum;
+};
+
+/// Rectangle of tiles of a single level, in tile coordinates: world texel
+/// coordinates of the level divided by the tile size.
+struct tile_pack_level {
+    uint32_t level;
+    /// Number of octaves that the texels evaluated.
+    uint32_t octaves;
+    int32_t x;
+    int32_t y;
+    uint32_t width;
+    uint32_t height;
+    /// Quantization steps of the heights and the gradients.
+    float height_step;
+    float gradient_step;
+    /// Index of the entry of tile (x, y), the entries are row-major.
+    uint32_t first_entry;
+    uint32_t padding;
+};
+
+/// Entry of the index for each tile, a size of zero if the tile is missing.
+struct tile_pack_entry {
+    uint64_t offset;
+    uint32_t size;
+    uint32_t checksum;
+};
+
+/// Writes a file. Tiles can be written in any order, the index is written once
+/// all tiles are.
+struct tile_pack_writer {
+    FILE* file;
+    tile_pack_header header;
+    std::vector<tile_pack_level> levels;
+    std::vector<tile_pack_entry> entries;
+    /// Offset in the file of the next tile.
+    uint64_t offset;
+};
+
+/// Reads a file, which is memory-mapped. Can be read from multiple threads at
+/// the same time.
+struct tile_pack {
+    mapped_file file;
+    const tile_pack_header* header;
+    const tile_pack_level* levels;
+    const tile_pack_entry* entries;
+};
+
+/// Tile of a file that was found by find_tile.
+struct tile_pack_tile {
+    const tile_pack_level* level;
+    const tile_pack_entry* entry;
+};
+
+/// Encodes the TILE_PACK_TILE_TEXEL_COUNT row-major texels of a tile into at
+/// most TILE_PACK_MAX_TILE_BYTES bytes of data. Returns the number of bytes.
+uint32_t encode_tile(
+    const nm::fvec4* texels, float height_step, float gradient_step, uint8_t* data);
+
+/// Decodes the texels of a tile. Returns NM_FAIL if the data is malformed.
+nm_ret decode_tile(
+    const uint8_t* data, uint32_t size, float height_step, float gradient_step, nm::fvec4* texels);
+
+/// Returns the CRC-32 of the bytes, continuing the checksum of the bytes before
+/// them. Pass zero for the first bytes.
+uint32_t get_checksum(const uint8_t* data, size_t size, uint32_t checksum);
+
+/// Creates the file at path for the levels. The entries of the levels are
+/// assigned in order.
+nm_ret init(
+    tile_pack_writer* writer,
+    const char* path,
+    const tile_pack_level* levels,
+    uint32_t level_count,
+    uint64_t seed);
+
+/// Appends the encoded data of the tile at tile coordinate (x, y) of the i-th
+/// level, which must not have been written before.
+nm_ret write_tile(
+    tile_pack_writer* writer,
+    uint32_t level_index,
+    int32_t x,
+    int32_t y,
+    const uint8_t* data,
+    uint32_t size);
+
+/// Writes the index and closes the file. Returns NM_FAIL if any write failed.
+nm_ret finish(tile_pack_writer* writer);
+
+/// Opens the file at path and checks its header and its index.
+nm_ret init(tile_pack* pack, const char* path);
+
+void cleanup(tile_pack* pack);
+
+/// Finds the tile at tile coordinate (x, y) of the level. Returns false if the
+/// file does not have it.
+bool find_tile(const tile_pack* pack, uint32_t level, int32_t x, int32_t y, tile_pack_tile* tile);
+
+/// Decodes a tile that was found. Returns NM_FAIL if its checksum does not
+/// match.
+nm_ret read_tile(const tile_pack* pack, const tile_pack_tile* tile, nm::fvec4* texels);
+
+#endif // TERRAIN3_TILE_PACK_H
@@ -0,0 +1,154 @@
+#include "ubo_ring.h"
+#include "nmutil/log.h"
+#include "nmutil/util.h"
+
+#include <cassert>
+
+nm_ret init(ubo_ring* ring)
+{
+    GLint alignment;
+    GL_CHECK(glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment));
+    ring->alignment = size_t(alignment);
+
+    GL_CHECK(glGenBuffers(1, &ring->buffer));
+    GL_CHECK(glBindBuffer(GL_UNIFORM_BUFFER, ring->buffer));
+    GL_CHECK(glBufferData(
+        GL_UNIFORM_BUFFER,
+        UBO_RING_SEGMENT_COUNT * UBO_RING_SEGMENT_SIZE,
+        NULL,
+        GL_DYNAMIC_DRAW));
+    GL_CHECK(glBindBuffer(GL_UNIFORM_BUFFER, 0));
+
+    // the first frame moves on to the first segment
+    ring->segment         = UBO_RING_SEGMENT_COUNT - 1u;
+    ring->offset          = 0;
+    ring->is_mapped       = false;
+    ring->is_synchronized = false;
+    ring->mapped_start    = 0;
+    ring->data            = nullptr;
+    for (uint32_t i = 0; i < UBO_RING_SEGMENT_COUNT; i++) {
+        ring->fences[i] = 0;
+    }
+
+    ring->stats.allocated_size = 0;
+    ring->stats.stall_count    = 0;
+    ring->stats.overflow_count = 0;
+
+    return NM_SUCCESS;
+}
+
+void cleanup(ubo_ring* ring)
+{
+    for (uint32_t i = 0; i < UBO_RING_SEGMENT_COUNT; i++) {
+        if (ring->fences[i]) GL_CHECK(glDeleteSync(ring->fences[i]));
+    }
+    GL_CHECK(glDeleteBuffers(1, &ring->buffer));
+}
+
+/// Maps the segment of the frame from start on. No other frame reads it, the
+/// fence of the segment ensures that the GPU is done with it, unless waiting
+/// for the fence failed. Returns false if it cannot be mapped.
+static bool map_segment(ubo_ring* ring, size_t start)
+{
+    assert(!ring->is_mapped);
+
+    GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_FLUSH_EXPLICIT_BIT;
+    if (!ring->is_synchronized) access |= GL_MAP_UNSYNCHRONIZED_BIT;
+
+    GL_CHECK(glBindBuffer(GL_UNIFORM_BUFFER, ring->buffer));
+    void* data = glMapBufferRange(
+        GL_UNIFORM_BUFFER,
+        GLintptr(size_t(ring->segment) * UBO_RING_SEGMENT_SIZE + start),
+        GLsizeiptr(UBO_RING_SEGMENT_SIZE - start),
+        access);
+    GL_CHECK_ERRORS();
+    GL_CHECK(glBindBuffer(GL_UNIFORM_BUFFER, 0));
+
+    if (!data) {
+        nm::log(nm::LOG_ERROR, "failed to map uniform ring\n");
+        return false;
+    }
+
+    ring->is_mapped    = true;
+    ring->mapped_start = start;
+    ring->data         = static_cast<uint8_t*>(data);
+    return true;
+}
+
+void begin_frame(ubo_ring* ring)
+{
+    assert(!ring->is_mapped);
+    ring->segment = (ring->segment + 1u) % UBO_RING_SEGMENT_COUNT;
+    ring->offset  = 0;
+
+    ring->stats.allocated_size = 0;
+
+    // wait until the frame that used this segment, UBO_RING_SEGMENT_COUNT
+    // frames ago, is done
+    GLsync fence          = ring->fences[ring->segment];
+    ring->is_synchronized = false;
+    if (fence) {
+        GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+        GL_CHECK_ERRORS();
+        if (status == GL_TIMEOUT_EXPIRED) {
+            ring->stats.stall_count++;
+            status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+            GL_CHECK_ERRORS();
+        }
+
+        // without the fence, the driver has to synchronize the map instead
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+            nm::log(nm::LOG_ERROR, "failed to wait for uniform ring\n");
+            ring->stats.stall_count++;
+            ring->is_synchronized = true;
+        }
+
+        GL_CHECK(glDeleteSync(fence));
+        ring->fences[ring->segment] = 0;
+    }
+
+    // if this fails, the first allocation tries again
+    map_segment(ring, 0);
+}
+
+void end_frame(ubo_ring* ring)
+{
+    if (ring->is_mapped) unmap_ranges(ring);
+    assert(!ring->fences[ring->segment]);
+    ring->fences[ring->segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void* map_range(ubo_ring* ring, size_t size, size_t* offset)
+{
+    size_t start = realign_offset(ring->offset, ring->alignment);
+    if (start + size > UBO_RING_SEGMENT_SIZE) {
+        if (ring->stats.overflow_count++ == 0) {
+            nm::log(
+                nm::LOG_ERROR, "uniform data of frame exceeds %u bytes\n", UBO_RING_SEGMENT_SIZE);
+        }
+        return nullptr;
+    }
+    if (!ring->is_mapped && !map_segment(ring, start)) return nullptr;
+
+    ring->offset               = start + size;
+    ring->stats.allocated_size = ring->offset;
+
+    *offset = size_t(ring->segment) * UBO_RING_SEGMENT_SIZE + start;
+    return ring->data + (start - ring->mapped_start);
+}
+
+void unmap_ranges(ubo_ring* ring)
+{
+    assert(ring->is_mapped);
+    GL_CHECK(glBindBuffer(GL_UNIFORM_BUFFER, ring->buffer));
+    // relative to the start of the mapping
+    if (ring->offset > ring->mapped_start) {
+        GL_CHECK(glFlushMappedBufferRange(
+            GL_UNIFORM_BUFFER, 0, GLsizeiptr(ring->offset - ring->mapped_start)));
+    }
+    GL_CHECK(glUnmapBuffer(GL_UNIFORM_BUFFER));
+    GL_CHECK(glBindBuffer(GL_UNIFORM_BUFFER, 0));
+
+    ring->is_mapped = false;
+    ring->data      = nullptr;
+}
@@ -0,0 +1,82 @@
+#ifndef TERRAIN3_UBO_RING_H
+#define TERRAIN3_UBO_RING_H
+
+#include "nmutil/defs.h"
+#include <nmutil/gl.h>
+
+#include <cstddef>
+#include <cstdint>
+
+/// This file and its implementation encapsulate a uniform buffer that the
+/// per-frame uniform data of all subsystems is allocated from. The buffer is
+/// split into a segment per frame in flight. Each frame allocates linearly
+/// from its own segment, which is mapped once at the start of the frame,
+/// unsynchronized as the GPU only reads the other segments. Without persistent
+/// mapping in OpenGL 4.3, the buffer cannot be read while it is mapped, so the
+/// allocations are unmapped before the GPU reads them and the rest of the
+/// segment is mapped again by the next allocation. A fence per segment guards
+/// that the GPU is done with a segment before a later frame writes to it again.
+
+/// Number of frames whose uniform data can be in flight.
+#define UBO_RING_SEGMENT_COUNT 3u
+
+/// Size in bytes of the uniform data of a single frame.
+#define UBO_RING_SEGMENT_SIZE (1u << 16u)
+
+struct ubo_ring_stats {
+    /// Number of bytes allocated in the current frame.
+    size_t allocated_size;
+    /// Number of frames that had to wait for the GPU to release their segment,
+    /// or failed to, and allocations that did not fit in their segment, since
+    /// init.
+    uint32_t stall_count;
+    uint32_t overflow_count;
+};
+
+struct ubo_ring {
+    GLuint buffer;
+    /// Every allocation starts at a multiple of GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT.
+    size_t alignment;
+
+    /// Segment of the current frame and the offset of its next allocation,
+    /// relative to the start of the segment.
+    uint32_t segment;
+    size_t offset;
+    /// Signals once the GPU is done with the frame that used the segment.
+    GLsync fences[UBO_RING_SEGMENT_COUNT];
+    /// Whether the segment is mapped synchronized, as waiting for its fence
+    /// failed in this frame.
+    bool is_synchronized;
+    /// Whether the segment is mapped from mapped_start on, relative to the
+    /// start of the segment, at data.
+    bool is_mapped;
+    size_t mapped_start;
+    uint8_t* data;
+
+    ubo_ring_stats stats;
+};
+
+nm_ret init(ubo_ring* ring);
+
+void cleanup(ubo_ring* ring);
+
+/// Moves on to the segment of the next frame, waits if the GPU still uses it,
+/// and maps it. Must be called before the first allocation of each frame.
+void begin_frame(ubo_ring* ring);
+
+/// Unmaps the segment if needed and fences it, once all commands that read
+/// its uniform data are issued.
+void end_frame(ubo_ring* ring);
+
+/// Allocates size bytes from the segment of the frame, maps the rest of the
+/// segment if it is not mapped, and returns the start of the range for
+/// writing. offset is set to the start of the range in the buffer. Returns
+/// null if the segment is full. The range is valid until the end of the frame.
+void* map_range(ubo_ring* ring, size_t size, size_t* offset);
+
+/// Flushes the ranges allocated since the segment was last mapped and unmaps
+/// it. Must be called before the GPU reads any of them, callers that allocate
+/// multiple ranges before reading them only unmap once.
+void unmap_ranges(ubo_ring* ring);
+
+#endif // TERRAIN3_UBO_RING_H
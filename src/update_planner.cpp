@@ -0,0 +1,217 @@
+#include "update_planner.h"
+
+#include "nmutil/math.h"
+
+#include <vector>
+
+/// Returns the local texel coordinate of a world texel coordinate in a texture
+/// of the given size.
+static int32_t get_local(int32_t world, int32_t texture_size)
+{
+    return world - nm::idiv(world, texture_size) * texture_size;
+}
+
+/// Appends the regions of a rectangle of world texels that is at most a
+/// complete window in each dimension, split where it wraps around the texture.
+static void add_rect(
+    nm::ivec2 start,
+    nm::ivec2 size,
+    int32_t texture_size,
+    uint32_t level,
+    update_info* infos,
+    uint32_t* info_count)
+{
+    if (size.x <= 0 || size.y <= 0) return;
+
+    // the part before the seam and the part after it, which may be empty
+    nm::ivec2 tex(get_local(start.x, texture_size), get_local(start.y, texture_size));
+    nm::ivec2 first(
+        nm::min(size.x, texture_size - tex.x), nm::min(size.y, texture_size - tex.y));
+
+    for (int32_t j = 0; j < 2; j++) {
+        int32_t size_y = j == 0 ? first.y : size.y - first.y;
+        if (size_y == 0) continue;
+
+        for (int32_t i = 0; i < 2; i++) {
+            int32_t size_x = i == 0 ? first.x : size.x - first.x;
+            if (size_x == 0) continue;
+
+            update_info info;
+            info.tex     = nm::ivec2(i == 0 ? tex.x : 0, j == 0 ? tex.y : 0);
+            info.size    = nm::ivec2(size_x, size_y);
+            info.start   = nm::ivec2(start.x + i * first.x, start.y + j * first.y);
+            info.level   = level;
+            info.octaves = 0;
+
+            infos[(*info_count)++] = info;
+        }
+    }
+}
+
+nm::ivec2 get_resident_start(
+    nm::ivec2 old_start, bool is_old_valid, nm::ivec2 render_start, int32_t guard_band)
+{
+    if (!is_old_valid) return render_start - nm::ivec2(guard_band, guard_band);
+
+    // the rendered window may lie anywhere within the window
+    return nm::ivec2(
+        nm::min(nm::max(old_start.x, render_start.x - 2 * guard_band), render_start.x),
+        nm::min(nm::max(old_start.y, render_start.y - 2 * guard_band), render_start.y));
+}
+
+void plan_update_regions(
+    nm::ivec2 old_start,
+    bool is_old_valid,
+    nm::ivec2 start,
+    int32_t size,
+    uint32_t level,
+    update_info* infos,
+    uint32_t* info_count)
+{
+    // overlap of the old and the new window
+    nm::ivec2 keep_min(nm::max(start.x, old_start.x), nm::max(start.y, old_start.y));
+    nm::ivec2 keep_max(
+        nm::min(start.x + size, old_start.x + size), nm::min(start.y + size, old_start.y + size));
+    if (!is_old_valid || keep_min.x >= keep_max.x || keep_min.y >= keep_max.y) {
+        add_rect(start, nm::ivec2(size, size), size, level, infos, info_count);
+        return;
+    }
+
+    // the windows have the same size, so the new columns are on a single side
+    // and span the complete height
+    if (keep_min.x > start.x) {
+        add_rect(start, nm::ivec2(keep_min.x - start.x, size), size, level, infos, info_count);
+    } else if (keep_max.x < start.x + size) {
+        add_rect(
+            nm::ivec2(keep_max.x, start.y),
+            nm::ivec2(start.x + size - keep_max.x, size),
+            size,
+            level,
+            infos,
+            info_count);
+    }
+
+    // the new rows, only within the kept columns
+    int32_t width = keep_max.x - keep_min.x;
+    if (keep_min.y > start.y) {
+        add_rect(
+            nm::ivec2(keep_min.x, start.y),
+            nm::ivec2(width, keep_min.y - start.y),
+            size,
+            level,
+            infos,
+            info_count);
+    } else if (keep_max.y < start.y + size) {
+        add_rect(
+            nm::ivec2(keep_min.x, keep_max.y),
+            nm::ivec2(width, start.y + size - keep_max.y),
+            size,
+            level,
+            infos,
+            info_count);
+    }
+}
+
+/// Appends the part of a region that covers the world texel rectangle
+/// [min, max), which must lie within the region.
+static void add_part(
+    const update_info* region,
+    nm::ivec2 min,
+    nm::ivec2 max,
+    update_info* parts,
+    uint32_t* part_count)
+{
+    if (min.x >= max.x || min.y >= max.y) return;
+
+    // the region does not wrap around, neither do its parts
+    update_info part = *region;
+    part.tex         = region->tex + (min - region->start);
+    part.size        = max - min;
+    part.start       = min;
+
+    parts[(*part_count)++] = part;
+}
+
+bool split_update_region(
+    const update_info* region,
+    nm::ivec2 rect_min,
+    nm::ivec2 rect_max,
+    update_info* inside,
+    update_info* outside,
+    uint32_t* outside_count)
+{
+    nm::ivec2 region_min = region->start;
+    nm::ivec2 region_max = region->start + region->size;
+
+    // overlap of the region and the rectangle
+    nm::ivec2 overlap_min(nm::max(region_min.x, rect_min.x), nm::max(region_min.y, rect_min.y));
+    nm::ivec2 overlap_max(nm::min(region_max.x, rect_max.x), nm::min(region_max.y, rect_max.y));
+    if (overlap_min.x >= overlap_max.x || overlap_min.y >= overlap_max.y) return false;
+
+    uint32_t inside_count = 0;
+    add_part(region, overlap_min, overlap_max, inside, &inside_count);
+
+    // complete rows below and above the overlap, the columns to its sides
+    // only span its rows
+    add_part(region, region_min, nm::ivec2(region_max.x, overlap_min.y), outside, outside_count);
+    add_part(region, nm::ivec2(region_min.x, overlap_max.y), region_max, outside, outside_count);
+    add_part(
+        region,
+        nm::ivec2(region_min.x, overlap_min.y),
+        nm::ivec2(overlap_min.x, overlap_max.y),
+        outside,
+        outside_count);
+    add_part(
+        region,
+        nm::ivec2(overlap_max.x, overlap_min.y),
+        nm::ivec2(region_max.x, overlap_max.y),
+        outside,
+        outside_count);
+
+    return true;
+}
+
+bool check_update_regions(
+    nm::ivec2 old_start,
+    bool is_old_valid,
+    nm::ivec2 start,
+    int32_t size,
+    const update_info* infos,
+    uint32_t info_count)
+{
+    // number of times each local texel is covered
+    std::vector<uint8_t> covered(size_t(size) * size_t(size), 0);
+    for (uint32_t i = 0; i < info_count; i++) {
+        const update_info* info = &infos[i];
+        if (info->size.x <= 0 || info->size.y <= 0) return false;
+        if (info->tex.x != get_local(info->start.x, size) ||
+            info->tex.y != get_local(info->start.y, size)) {
+            return false;
+        }
+        if (info->tex.x + info->size.x > size || info->tex.y + info->size.y > size) return false;
+        if (info->start.x < start.x || info->start.x + info->size.x > start.x + size ||
+            info->start.y < start.y || info->start.y + info->size.y > start.y + size) {
+            return false;
+        }
+
+        for (int32_t y = 0; y < info->size.y; y++) {
+            for (int32_t x = 0; x < info->size.x; x++) {
+                uint8_t* count = &covered[(info->tex.y + y) * size + info->tex.x + x];
+                if (++*count > 1) return false;
+            }
+        }
+    }
+
+    // every texel of the new window must be generated unless the old window
+    // has it
+    for (int32_t y = start.y; y < start.y + size; y++) {
+        for (int32_t x = start.x; x < start.x + size; x++) {
+            bool is_kept = is_old_valid && x >= old_start.x && x < old_start.x + size &&
+                           y >= old_start.y && y < old_start.y + size;
+            bool is_covered = covered[get_local(y, size) * size + get_local(x, size)] == 1;
+            if (is_kept == is_covered) return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,89 @@
+#ifndef TERRAIN3_UPDATE_PLANNER_H
+#define TERRAIN3_UPDATE_PLANNER_H
+
+#include "nmutil/vector.h"
+
+#include <cstdint>
+
+/// This file and its implementation encapsulate finding the texels of a
+/// clipmap level that must be generated when the level moves. A level holds
+/// the size^2 world texels of its window, and world texel (x, y) is stored at
+/// local texel (x mod size, y mod size) of the toroidally addressed texture,
+/// where size is the size of the texture.
+
+/// Maintains information about a texture region that should be recomputed as
+/// the part of the world that it represents has changed. As well as information
+/// on where to update it in the texture.
+struct update_info {
+    /// Local texel coordinate of (-x/-y)-most point of region.
+    nm::ivec2 tex;
+    // todo should this not be unsigned?
+    /// Size in texels of the region.
+    nm::ivec2 size;
+    /// World texel coordinate of (-x/-y)-most point of region.
+    nm::ivec2 start;
+    /// Level of the texture.
+    uint32_t level;
+    /// Number of octaves to evaluate.
+    uint32_t octaves;
+};
+
+/// The texels that a moved window lacks form at most two rectangles, one that
+/// spans the complete height of the window and one for the remaining columns.
+/// Each of them is split into at most four regions where it wraps around the
+/// texture.
+#define PLANNER_MAX_REGION_COUNT 8u
+
+/// Returns the start of the window of a level that keeps a guard band of
+/// guard_band texels around the window that is rendered at render_start. The
+/// window only moves once the rendered window would leave it, such that the
+/// rendered window can move back and forth by up to twice the guard band
+/// without a texel being generated. A window that is not valid is centered on
+/// the rendered window.
+nm::ivec2 get_resident_start(
+    nm::ivec2 old_start, bool is_old_valid, nm::ivec2 render_start, int32_t guard_band);
+
+/// Appends the regions of a level whose window of size^2 texels moves from
+/// old_start to start, both the (-x,-y)-most world texel coordinate. If
+/// is_old_valid is false, nothing is kept and the complete window is planned.
+/// The regions do not overlap and cover exactly the texels of the new window
+/// that the old window does not have. The octaves of the regions are not set.
+void plan_update_regions(
+    nm::ivec2 old_start,
+    bool is_old_valid,
+    nm::ivec2 start,
+    int32_t size,
+    uint32_t level,
+    update_info* infos,
+    uint32_t* info_count);
+
+/// A region split by split_update_region has at most one part on each side of
+/// the rectangle.
+#define PLANNER_MAX_SPLIT_COUNT 4u
+
+/// Splits a region into the part inside the world texel rectangle
+/// [rect_min, rect_max) and the parts outside of it, which are appended to
+/// outside. Returns false if the region does not overlap the rectangle, in
+/// which case nothing is written. The parts keep the level and the octaves of
+/// the region.
+bool split_update_region(
+    const update_info* region,
+    nm::ivec2 rect_min,
+    nm::ivec2 rect_max,
+    update_info* inside,
+    update_info* outside,
+    uint32_t* outside_count);
+
+/// Brute-force check of plan_update_regions, which compares every texel of the
+/// level against the regions. Returns false if a texel is covered more than
+/// once, a texel that must be generated is not covered, a kept texel is
+/// covered, or a region does not map to its local texel coordinates.
+bool check_update_regions(
+    nm::ivec2 old_start,
+    bool is_old_valid,
+    nm::ivec2 start,
+    int32_t size,
+    const update_info* infos,
+    uint32_t info_count);
+
+#endif // TERRAIN3_UPDATE_PLANNER_H
@@ -281,6 +281,8 @@ bool was_f4_pressed(window* w) { return w->state.key_states[GLFW_KEY_F4].was_pre
 
 bool was_f5_pressed(window* w) { return w->state.key_states[GLFW_KEY_F5].was_pressed; }
 
+bool was_f6_pressed(window* w) { return w->state.key_states[GLFW_KEY_F6].was_pressed; }
+
 bool was_enter_pressed(window* w) { return w->state.key_states[GLFW_KEY_ENTER].was_pressed; }
 
 bool was_prtsc_pressed(window* w) { return w->state.key_states[GLFW_KEY_PRINT_SCREEN].was_pressed; }
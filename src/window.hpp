@@ -47,6 +47,8 @@ bool was_f4_pressed(window* w);
 
 bool was_f5_pressed(window* w);
 
+bool was_f6_pressed(window* w);
+
 bool was_enter_pressed(window* w);
 
 bool was_prtsc_pressed(window* w);
@@ -0,0 +1,108 @@
+#include "worker_pool.h"
+
+#include "nmutil/log.h"
+
+/// Claims and performs indices of the batch until none are left.
+static void run_batch(worker_batch* batch)
+{
+    uint32_t i;
+    while ((i = batch->next.fetch_add(1, std::memory_order_relaxed)) < batch->count) {
+        batch->fn(batch->user, i);
+    }
+}
+
+static void worker_main(worker_pool* pool)
+{
+    while (true) {
+        worker_batch* batch;
+        {
+            std::unique_lock<std::mutex> lock(pool->mutex);
+            pool->cond.wait(lock, [pool] { return pool->is_stopping || !pool->jobs.empty(); });
+            if (pool->is_stopping) return;
+
+            batch = pool->jobs.front();
+            pool->jobs.pop_front();
+        }
+
+        run_batch(batch);
+
+        // the batch may only be destroyed by the caller once no worker
+        // refers to it, so notify while holding the lock
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        if (--batch->active == 0) batch->done.notify_all();
+    }
+}
+
+nm_ret init(worker_pool* pool, uint32_t thread_count)
+{
+    if (thread_count == 0) {
+        uint32_t hardware_count = std::thread::hardware_concurrency();
+        thread_count            = hardware_count > 1 ? hardware_count - 1 : 1;
+    }
+
+    pool->is_stopping = false;
+    for (uint32_t i = 0; i < thread_count; i++) {
+        pool->threads.emplace_back(worker_main, pool);
+    }
+
+    nm::log(nm::LOG_INFO, "started %u worker threads\n", thread_count);
+
+    return NM_SUCCESS;
+}
+
+void cleanup(worker_pool* pool)
+{
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->is_stopping = true;
+    }
+    pool->cond.notify_all();
+
+    for (size_t i = 0; i < pool->threads.size(); i++) {
+        pool->threads[i].join();
+    }
+    pool->threads.clear();
+}
+
+void parallel_for(worker_pool* pool, uint32_t count, worker_fn fn, void* user)
+{
+    if (count == 0) return;
+
+    worker_batch batch;
+    batch.fn    = fn;
+    batch.user  = user;
+    batch.count = count;
+    batch.next.store(0, std::memory_order_relaxed);
+
+    // invite at most one worker per remaining index
+    uint32_t invite_count = uint32_t(pool->threads.size());
+    if (invite_count > count - 1) invite_count = count - 1;
+
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        batch.active = invite_count;
+        for (uint32_t i = 0; i < invite_count; i++) {
+            pool->jobs.push_back(&batch);
+        }
+    }
+    if (invite_count == 1) {
+        pool->cond.notify_one();
+    } else if (invite_count > 1) {
+        pool->cond.notify_all();
+    }
+
+    run_batch(&batch);
+
+    // withdraw invitations that were not picked up, and wait for the workers
+    // that did pick one up
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    for (auto it = pool->jobs.begin(); it != pool->jobs.end();) {
+        if (*it == &batch) {
+            it = pool->jobs.erase(it);
+            batch.active--;
+        } else {
+            ++it;
+        }
+    }
+    batch.done.wait(lock, [&batch] { return batch.active == 0; });
+}
@@ -0,0 +1,53 @@
+#ifndef TERRAIN3_WORKER_POOL_H
+#define TERRAIN3_WORKER_POOL_H
+
+#include "nmutil/defs.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// This file and its implementation encapsulate a pool of worker threads that
+/// is used to spread CPU work over the available cores.
+
+/// Performs the work for a single index of a parallel loop.
+typedef void (*worker_fn)(void* user, uint32_t index);
+
+/// Shared state of a single parallel loop. Lives on the stack of the caller.
+struct worker_batch {
+    worker_fn fn;
+    void* user;
+    uint32_t count;
+    /// Next index that has not been claimed yet.
+    std::atomic<uint32_t> next;
+    /// Number of workers that hold a reference to this batch, protected by
+    /// the pool mutex.
+    uint32_t active;
+    std::condition_variable done;
+};
+
+struct worker_pool {
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable cond;
+    /// Each entry invites one worker to help out with a batch.
+    std::deque<worker_batch*> jobs;
+    bool is_stopping;
+};
+
+/// If thread count is zero, one less than the number of hardware threads is
+/// used since the calling thread also performs work.
+nm_ret init(worker_pool* pool, uint32_t thread_count);
+
+void cleanup(worker_pool* pool);
+
+/// Calls fn(user, i) for every i in [0, count) and returns when all calls are
+/// done. The calling thread participates. Can be called from multiple threads
+/// at the same time.
+void parallel_for(worker_pool* pool, uint32_t count, worker_fn fn, void* user);
+
+#endif // TERRAIN3_WORKER_POOL_H